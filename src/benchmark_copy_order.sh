@@ -0,0 +1,91 @@
+#!/bin/bash
+#
+# Copyright © 2022 Solus Project <copyright@getsol.us>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Compares copy throughput reading the source in directory order and in
+# on-disk order (installer_copy_engine_set_sequential()), from a slow
+# source device. Needs root:
+#
+#     benchmark_copy_order.sh COPY_BENCHMARK [SOURCE_TREE]
+#
+# SOURCE_TREE (default /usr/share) is written to an ext4 loop device in a
+# fixed shuffled order, so that where files sit on disk has nothing to do
+# with directory order, as on a live image that has seen updates. The
+# device is then put behind dm-delay, which holds every request for
+# BENCH_DELAY_MS (default 8), like a USB 2 stick or an optical disc. The
+# copy goes to tmpfs so the target is never the bottleneck, and each
+# order is run BENCH_RUNS times (default 3) with cold caches.
+
+set -euo pipefail
+
+bench="$1"
+source_tree="${2:-/usr/share}"
+delay_ms="${BENCH_DELAY_MS:-8}"
+runs="${BENCH_RUNS:-3}"
+dm_name="installer-copy-bench-$$"
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "benchmark_copy_order.sh needs root for loop devices and dm-delay" >&2
+    exit 77
+fi
+
+work="$(mktemp -d)"
+loop=""
+
+cleanup() {
+    umount "$work/target" 2>/dev/null || true
+    umount "$work/source" 2>/dev/null || true
+    dmsetup remove "$dm_name" 2>/dev/null || true
+    if [ -n "$loop" ]; then
+        losetup -d "$loop" || true
+    fi
+    rm -rf "$work"
+}
+trap cleanup EXIT
+
+mkdir "$work/source" "$work/target"
+
+# Room for the tree plus ext4 overhead
+size_kb="$(du -sk "$source_tree" | cut -f1)"
+truncate -s "$((size_kb * 5 / 4 + 65536))K" "$work/image"
+mkfs.ext4 -q "$work/image"
+loop="$(losetup --find --show "$work/image")"
+
+# Write files in a shuffled but fixed order, so every run sees the same
+# layout
+mount "$loop" "$work/source"
+(cd "$source_tree" && find . -type d) | (cd "$work/source" && xargs -d '\n' mkdir -p)
+(cd "$source_tree" && find . -type f -o -type l) |
+    shuf --random-source=<(yes) |
+    (cd "$source_tree" && xargs -d '\n' cp -a --parents -t "$work/source")
+umount "$work/source"
+
+sectors="$(blockdev --getsz "$loop")"
+dmsetup create "$dm_name" --table "0 $sectors delay $loop 0 $delay_ms"
+mount -o ro "/dev/mapper/$dm_name" "$work/source"
+
+echo "Copying $source_tree with ${delay_ms} ms per request, $runs runs each"
+
+for run in $(seq "$runs"); do
+    for order in "" --sequential; do
+        mount -t tmpfs tmpfs "$work/target"
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+        echo -n "run $run: "
+        "$bench" $order "$work/source" "$work/target"
+        umount "$work/target"
+    done
+done
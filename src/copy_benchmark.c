@@ -0,0 +1,83 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "lib/installer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _CopyBenchmark {
+    GMainLoop *loop;
+    GError *err;
+} CopyBenchmark;
+
+static void on_copied(GObject *source, GAsyncResult *result, gpointer user_data) {
+    CopyBenchmark *bench = user_data;
+
+    installer_copy_engine_copy_finish(INSTALLER_COPY_ENGINE(source), result, &bench->err);
+    g_main_loop_quit(bench->loop);
+}
+
+/**
+ * Times one copy of a tree with the copy engine, for comparing the
+ * order files are read in. Run by benchmark_copy_order.sh, which sets up
+ * a slow source device:
+ *
+ *     solus-installer-copy-benchmark [--sequential] SOURCE TARGET
+ */
+int main(int argc, char *argv[]) {
+    g_autoptr(InstallerCopyEngine) engine = NULL;
+    g_autoptr(GMainLoop) loop = NULL;
+    g_autofree gchar *size = NULL;
+    InstallerCopyProgress progress;
+    CopyBenchmark bench = {0};
+    gboolean sequential = FALSE;
+    gint64 start = 0;
+    gdouble seconds = 0;
+
+    if (argc == 4 && strcmp(argv[1], "--sequential") == 0) {
+        sequential = TRUE;
+        argv++;
+    } else if (argc != 3) {
+        g_printerr("Usage: %s [--sequential] SOURCE TARGET\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    engine = installer_copy_engine_new(argv[1], argv[2]);
+    installer_copy_engine_set_sequential(engine, sequential);
+
+    loop = g_main_loop_new(NULL, FALSE);
+    bench.loop = loop;
+
+    start = g_get_monotonic_time();
+    installer_copy_engine_copy_async(engine, NULL, on_copied, &bench);
+    g_main_loop_run(loop);
+    seconds = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+
+    if (bench.err) {
+        g_printerr("Error copying: %s\n", bench.err->message);
+        g_error_free(bench.err);
+        return EXIT_FAILURE;
+    }
+
+    installer_copy_engine_get_progress(engine, &progress);
+    size = g_format_size(progress.bytes_done);
+    g_print("%s order: %" G_GUINT64_FORMAT " files, %s in %.2f s, %.2f MB/s\n",
+            sequential ? "on-disk" : "directory", progress.files_done, size, seconds,
+            progress.bytes_done / seconds / 1e6);
+
+    return EXIT_SUCCESS;
+}
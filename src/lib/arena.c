@@ -0,0 +1,163 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "arena.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Big enough for every string and record of a typical disk */
+#define ARENA_CHUNK_SIZE 16384
+#define ARENA_ALIGNMENT (sizeof(max_align_t))
+
+typedef struct _ArenaChunk {
+    struct _ArenaChunk *next;
+    gsize size;
+    gsize used;
+    max_align_t data[];
+} ArenaChunk;
+
+struct _InstallerArena {
+    ArenaChunk *chunks;
+    GHashTable *interned;
+    InstallerArenaStats stats;
+};
+
+InstallerArena *installer_arena_new(void) {
+    InstallerArena *self = g_atomic_rc_box_new0(InstallerArena);
+
+    self->interned = g_hash_table_new(g_str_hash, g_str_equal);
+
+    return self;
+}
+
+InstallerArena *installer_arena_ref(InstallerArena *self) {
+    g_return_val_if_fail(self != NULL, NULL);
+
+    return g_atomic_rc_box_acquire(self);
+}
+
+static void installer_arena_clear(InstallerArena *self) {
+    ArenaChunk *chunk = self->chunks;
+
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        g_free(chunk);
+        chunk = next;
+    }
+
+    g_hash_table_destroy(self->interned);
+}
+
+void installer_arena_unref(InstallerArena *self) {
+    g_return_if_fail(self != NULL);
+
+    g_atomic_rc_box_release_full(self, (GDestroyNotify) installer_arena_clear);
+}
+
+static ArenaChunk *add_chunk(InstallerArena *self, gsize min_size) {
+    gsize size = MAX(ARENA_CHUNK_SIZE, min_size);
+    ArenaChunk *chunk = g_malloc0(sizeof(ArenaChunk) + size);
+
+    chunk->size = size;
+
+    // Oversized allocations get a chunk of their own behind the current
+    // one, so the space left in the current chunk is not wasted.
+    if (self->chunks && min_size > ARENA_CHUNK_SIZE) {
+        chunk->next = self->chunks->next;
+        self->chunks->next = chunk;
+    } else {
+        chunk->next = self->chunks;
+        self->chunks = chunk;
+    }
+
+    self->stats.n_chunks++;
+    self->stats.bytes_reserved += size;
+
+    return chunk;
+}
+
+gpointer installer_arena_alloc(InstallerArena *self, gsize size) {
+    ArenaChunk *chunk = NULL;
+    gsize aligned = 0;
+
+    g_return_val_if_fail(self != NULL, NULL);
+
+    aligned = (MAX(size, 1) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    chunk = self->chunks;
+    if (!chunk || chunk->size - chunk->used < aligned) {
+        chunk = add_chunk(self, aligned);
+    }
+
+    gpointer mem = (guint8 *) chunk->data + chunk->used;
+    chunk->used += aligned;
+
+    self->stats.n_allocations++;
+    self->stats.bytes_used += aligned;
+
+    return mem;
+}
+
+const gchar *installer_arena_strndup(InstallerArena *self, const gchar *str,
+                                     gsize n) {
+    gchar *copy = NULL;
+    gsize len = 0;
+
+    g_return_val_if_fail(self != NULL, NULL);
+
+    if (!str) {
+        return NULL;
+    }
+
+    len = strnlen(str, n);
+    copy = installer_arena_alloc(self, len + 1);
+    memcpy(copy, str, len);
+
+    return copy;
+}
+
+const gchar *installer_arena_strdup(InstallerArena *self, const gchar *str) {
+    return installer_arena_strndup(self, str, G_MAXSIZE);
+}
+
+const gchar *installer_arena_intern(InstallerArena *self, const gchar *str) {
+    const gchar *copy = NULL;
+
+    g_return_val_if_fail(self != NULL, NULL);
+
+    if (!str) {
+        return NULL;
+    }
+
+    copy = g_hash_table_lookup(self->interned, str);
+    if (copy) {
+        self->stats.n_interned++;
+        return copy;
+    }
+
+    copy = installer_arena_strdup(self, str);
+    g_hash_table_add(self->interned, (gpointer) copy);
+
+    return copy;
+}
+
+void installer_arena_get_stats(InstallerArena *self, InstallerArenaStats *stats) {
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(stats != NULL);
+
+    *stats = self->stats;
+}
@@ -0,0 +1,146 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_ARENA_H
+#define INSTALLER_ARENA_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * InstallerArena:
+ *
+ * A refcounted bump allocator that owns every string and record made
+ * during one disk scan. Nothing allocated from an arena is freed on its
+ * own; everything goes at once when the last reference is dropped.
+ *
+ * Allocating is not thread-safe, so an arena must only be filled from
+ * one thread at a time. Once filled, its contents may be read from any
+ * thread for as long as a reference is held.
+ */
+typedef struct _InstallerArena InstallerArena;
+
+/**
+ * InstallerArenaStats:
+ * @n_allocations: Allocations served by the arena
+ * @n_chunks: Backing chunks requested from the system allocator
+ * @n_interned: Strings that were deduplicated by interning
+ * @bytes_used: Bytes handed out, including alignment padding
+ * @bytes_reserved: Bytes held in backing chunks
+ *
+ * Counters describing how an arena has been used.
+ */
+typedef struct _InstallerArenaStats {
+    guint n_allocations;
+    guint n_chunks;
+    guint n_interned;
+    gsize bytes_used;
+    gsize bytes_reserved;
+} InstallerArenaStats;
+
+/**
+ * installer_arena_new:
+ *
+ * Returns: (transfer full): A new, empty #InstallerArena
+ */
+InstallerArena *installer_arena_new(void);
+
+/**
+ * installer_arena_ref:
+ * @self: The arena
+ *
+ * Returns: (transfer full): @self
+ */
+InstallerArena *installer_arena_ref(InstallerArena *self);
+
+/**
+ * installer_arena_unref:
+ * @self: The arena
+ *
+ * Drops a reference, freeing everything allocated from the arena when
+ * the last one is gone.
+ */
+void installer_arena_unref(InstallerArena *self);
+
+/**
+ * installer_arena_alloc:
+ * @self: The arena
+ * @size: The number of bytes to allocate
+ *
+ * Returns: (transfer none): Zero-filled memory suitably aligned for any
+ *          type, owned by @self
+ */
+gpointer installer_arena_alloc(InstallerArena *self, gsize size);
+
+/**
+ * installer_arena_new0:
+ * @arena: The arena
+ * @type: The type to allocate
+ *
+ * Allocates a zero-filled @type from @arena.
+ */
+#define installer_arena_new0(arena, type) \
+    ((type *) installer_arena_alloc((arena), sizeof(type)))
+
+/**
+ * installer_arena_strdup:
+ * @self: The arena
+ * @str: (nullable): The string to copy
+ *
+ * Returns: (transfer none) (nullable): A copy of @str owned by @self
+ */
+const gchar *installer_arena_strdup(InstallerArena *self, const gchar *str);
+
+/**
+ * installer_arena_strndup:
+ * @self: The arena
+ * @str: (nullable): The string to copy
+ * @n: The maximum number of bytes to copy
+ *
+ * Returns: (transfer none) (nullable): A copy of at most @n bytes of
+ *          @str owned by @self
+ */
+const gchar *installer_arena_strndup(InstallerArena *self, const gchar *str,
+                                     gsize n);
+
+/**
+ * installer_arena_intern:
+ * @self: The arena
+ * @str: (nullable): The string to intern
+ *
+ * Like installer_arena_strdup(), but equal strings are only stored
+ * once. Use this for values that repeat across a scan, such as OS types
+ * and icon names.
+ *
+ * Returns: (transfer none) (nullable): The canonical copy of @str
+ */
+const gchar *installer_arena_intern(InstallerArena *self, const gchar *str);
+
+/**
+ * installer_arena_get_stats:
+ * @self: The arena
+ * @stats: (out): Place to store the counters
+ *
+ * Gets the usage counters of an arena.
+ */
+void installer_arena_get_stats(InstallerArena *self, InstallerArenaStats *stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(InstallerArena, installer_arena_unref)
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,470 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "btrfs.h"
+
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+#include <sys/ioctl.h>
+
+/**
+ * SubvolumeRef:
+ * @parent_id: The tree the subvolume is linked into
+ * @dirid: The inode of the directory in @parent_id holding the link
+ * @name: The name of the link
+ *
+ * The contents of a ROOT_BACKREF item, used to build subvolume paths.
+ */
+typedef struct _SubvolumeRef {
+    guint64 parent_id;
+    guint64 dirid;
+    gchar *name;
+} SubvolumeRef;
+
+static void subvolume_ref_free(SubvolumeRef *ref) {
+    if (!ref) {
+        return;
+    }
+
+    g_free(ref->name);
+    g_free(ref);
+}
+
+void installer_btrfs_subvolume_free(InstallerBtrfsSubvolume *self) {
+    if (!self) {
+        return;
+    }
+
+    g_free(self->path);
+    g_free(self);
+}
+
+static gboolean uuid_is_null(const guint8 *uuid) {
+    for (gint i = 0; i < INSTALLER_BTRFS_UUID_SIZE; i++) {
+        if (uuid[i] != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean installer_btrfs_subvolume_is_snapshot(InstallerBtrfsSubvolume *self) {
+    g_return_val_if_fail(self != NULL, FALSE);
+
+    return !uuid_is_null(self->parent_uuid);
+}
+
+static void parse_root_item(GHashTable *subvolumes,
+                            struct btrfs_ioctl_search_header *hdr,
+                            const gchar *data) {
+    struct btrfs_root_item item;
+    InstallerBtrfsSubvolume *subvol = NULL;
+
+    memset(&item, 0, sizeof(item));
+    memcpy(&item, data, MIN(hdr->len, sizeof(item)));
+
+    // Subvolumes that have been deleted but not yet cleaned up
+    // have no references left.
+    if (GUINT32_FROM_LE(item.refs) == 0) {
+        return;
+    }
+
+    subvol = g_new0(InstallerBtrfsSubvolume, 1);
+    subvol->id = hdr->objectid;
+    subvol->generation = GUINT64_FROM_LE(item.generation);
+    subvol->read_only = (GUINT64_FROM_LE(item.flags) & BTRFS_ROOT_SUBVOL_RDONLY) != 0;
+
+    // Root items written by kernels older than 3.6 stop before the
+    // UUID fields, and those which were since touched by such a
+    // kernel have a stale generation_v2.
+    if (hdr->len >= G_STRUCT_OFFSET(struct btrfs_root_item, received_uuid) &&
+        item.generation_v2 == item.generation) {
+        memcpy(subvol->uuid, item.uuid, INSTALLER_BTRFS_UUID_SIZE);
+        memcpy(subvol->parent_uuid, item.parent_uuid, INSTALLER_BTRFS_UUID_SIZE);
+    }
+
+    g_hash_table_replace(subvolumes, &subvol->id, subvol);
+}
+
+static void parse_root_backref(GHashTable *refs,
+                               struct btrfs_ioctl_search_header *hdr,
+                               const gchar *data) {
+    struct btrfs_root_ref ref;
+    SubvolumeRef *subvol_ref = NULL;
+    guint16 name_len;
+
+    if (hdr->len < sizeof(ref)) {
+        return;
+    }
+
+    memcpy(&ref, data, sizeof(ref));
+    name_len = GUINT16_FROM_LE(ref.name_len);
+    if (sizeof(ref) + name_len > hdr->len) {
+        return;
+    }
+
+    subvol_ref = g_new0(SubvolumeRef, 1);
+    subvol_ref->parent_id = hdr->offset;
+    subvol_ref->dirid = GUINT64_FROM_LE(ref.dirid);
+    subvol_ref->name = g_strndup(data + sizeof(ref), name_len);
+
+    g_hash_table_replace(refs, g_memdup2(&hdr->objectid, sizeof(guint64)),
+                         subvol_ref);
+}
+
+/**
+ * search_root_tree:
+ * @fd: A directory fd on the btrfs filesystem
+ * @subvolumes: Table to store #InstallerBtrfsSubvolume records in
+ * @refs: Table to store #SubvolumeRef records in
+ * @err: (out): Place to store an error (if any)
+ *
+ * Walks every ROOT_ITEM and ROOT_BACKREF item for subvolume trees in
+ * the root tree, resuming each ioctl where the previous batch ended.
+ *
+ * Returns: %TRUE on success
+ */
+static gboolean search_root_tree(gint fd, GHashTable *subvolumes,
+                                 GHashTable *refs, GError **err) {
+    struct btrfs_ioctl_search_args args;
+    struct btrfs_ioctl_search_key *key = &args.key;
+
+    memset(&args, 0, sizeof(args));
+    key->tree_id = BTRFS_ROOT_TREE_OBJECTID;
+    key->min_objectid = BTRFS_FIRST_FREE_OBJECTID;
+    key->max_objectid = BTRFS_LAST_FREE_OBJECTID;
+    key->min_type = BTRFS_ROOT_ITEM_KEY;
+    key->max_type = BTRFS_ROOT_BACKREF_KEY;
+    key->max_offset = G_MAXUINT64;
+    key->max_transid = G_MAXUINT64;
+
+    while (TRUE) {
+        struct btrfs_ioctl_search_header hdr;
+        gsize offset = 0;
+
+        memset(&hdr, 0, sizeof(hdr));
+
+        key->nr_items = G_MAXUINT32;
+        if (ioctl(fd, BTRFS_IOC_TREE_SEARCH, &args) < 0) {
+            gint saved = errno;
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                        "Error searching btrfs root tree: %s", g_strerror(saved));
+            return FALSE;
+        }
+
+        if (key->nr_items == 0) {
+            break;
+        }
+
+        for (guint32 i = 0; i < key->nr_items; i++) {
+            memcpy(&hdr, args.buf + offset, sizeof(hdr));
+            offset += sizeof(hdr);
+
+            // The key range is compared as a whole, so items of other
+            // types in between our objectids are returned too.
+            if (hdr.type == BTRFS_ROOT_ITEM_KEY) {
+                parse_root_item(subvolumes, &hdr, args.buf + offset);
+            } else if (hdr.type == BTRFS_ROOT_BACKREF_KEY) {
+                parse_root_backref(refs, &hdr, args.buf + offset);
+            }
+
+            offset += hdr.len;
+        }
+
+        // Continue from the key after the last one we saw
+        key->min_objectid = hdr.objectid;
+        key->min_type = hdr.type;
+        key->min_offset = hdr.offset;
+        if (key->min_offset < G_MAXUINT64) {
+            key->min_offset++;
+        } else if (key->min_type < 255) {
+            key->min_type++;
+            key->min_offset = 0;
+        } else if (key->min_objectid < key->max_objectid) {
+            key->min_objectid++;
+            key->min_type = 0;
+            key->min_offset = 0;
+        } else {
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * lookup_dir_path:
+ * @fd: A directory fd on the btrfs filesystem
+ * @tree_id: The subvolume tree containing @dirid
+ * @dirid: The inode number of a directory
+ *
+ * Resolves an inode to its path inside the subvolume @tree_id.
+ *
+ * Returns: (transfer full): The path with a trailing separator, an empty
+ *          string for the subvolume root, or %NULL on error
+ */
+static gchar *lookup_dir_path(gint fd, guint64 tree_id, guint64 dirid) {
+    struct btrfs_ioctl_ino_lookup_args args;
+
+    memset(&args, 0, sizeof(args));
+    args.treeid = tree_id;
+    args.objectid = dirid;
+
+    if (ioctl(fd, BTRFS_IOC_INO_LOOKUP, &args) < 0) {
+        g_debug("unable to look up inode %" G_GUINT64_FORMAT " in tree %" G_GUINT64_FORMAT ": %s",
+                dirid, tree_id, g_strerror(errno));
+        return NULL;
+    }
+
+    return g_strndup(args.name, sizeof(args.name));
+}
+
+static const gchar *resolve_path(gint fd, guint64 id, GHashTable *subvolumes,
+                                 GHashTable *refs, guint depth) {
+    InstallerBtrfsSubvolume *subvol = NULL;
+    SubvolumeRef *ref = NULL;
+    const gchar *parent_path = NULL;
+    g_autofree gchar *dir_path = NULL;
+
+    if (id == BTRFS_FS_TREE_OBJECTID) {
+        return "";
+    }
+
+    subvol = g_hash_table_lookup(subvolumes, &id);
+    if (!subvol) {
+        return NULL;
+    }
+
+    if (subvol->path) {
+        return subvol->path;
+    }
+
+    // A corrupt tree could link subvolumes in a loop
+    ref = g_hash_table_lookup(refs, &id);
+    if (!ref || depth > g_hash_table_size(subvolumes)) {
+        return NULL;
+    }
+
+    parent_path = resolve_path(fd, ref->parent_id, subvolumes, refs, depth + 1);
+    if (!parent_path) {
+        return NULL;
+    }
+
+    dir_path = lookup_dir_path(fd, ref->parent_id, ref->dirid);
+    if (!dir_path) {
+        return NULL;
+    }
+
+    subvol->parent_id = ref->parent_id;
+    if (*parent_path == '\0') {
+        subvol->path = g_strconcat(dir_path, ref->name, NULL);
+    } else {
+        subvol->path = g_strconcat(parent_path, G_DIR_SEPARATOR_S, dir_path,
+                                   ref->name, NULL);
+    }
+
+    return subvol->path;
+}
+
+static gint compare_subvolume_ids(InstallerBtrfsSubvolume **a,
+                                  InstallerBtrfsSubvolume **b) {
+    if ((*a)->id < (*b)->id) {
+        return -1;
+    }
+
+    return (*a)->id > (*b)->id;
+}
+
+GPtrArray *installer_btrfs_list_subvolumes(gint mount_fd, GError **err) {
+    g_autoptr(GHashTable) subvolumes = NULL;
+    g_autoptr(GHashTable) refs = NULL;
+    GHashTableIter iter;
+    InstallerBtrfsSubvolume *subvol = NULL;
+    struct btrfs_ioctl_ino_lookup_args lookup;
+    GPtrArray *ret = NULL;
+
+    g_return_val_if_fail(mount_fd >= 0, NULL);
+
+    // Paths are built from the top-level down, so they can only be
+    // opened relative to a mount of the top-level subvolume. A tree ID
+    // of zero looks up the tree that the fd itself is in.
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.objectid = BTRFS_FIRST_FREE_OBJECTID;
+    if (ioctl(mount_fd, BTRFS_IOC_INO_LOOKUP, &lookup) < 0) {
+        gint saved = errno;
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                    "Error looking up btrfs subvolume: %s", g_strerror(saved));
+        return NULL;
+    }
+
+    if (lookup.treeid != BTRFS_FS_TREE_OBJECTID) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Mount is subvolume %llu, not the top-level subvolume",
+                    (unsigned long long) lookup.treeid);
+        return NULL;
+    }
+
+    subvolumes = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                       (GDestroyNotify) installer_btrfs_subvolume_free);
+    refs = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                 (GDestroyNotify) subvolume_ref_free);
+
+    if (!search_root_tree(mount_fd, subvolumes, refs, err)) {
+        return NULL;
+    }
+
+    ret = g_ptr_array_new_with_free_func((GDestroyNotify) installer_btrfs_subvolume_free);
+
+    // Resolve every path first; resolution fills in parents on demand
+    g_hash_table_iter_init(&iter, subvolumes);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &subvol)) {
+        resolve_path(mount_fd, subvol->id, subvolumes, refs, 0);
+    }
+
+    g_hash_table_iter_init(&iter, subvolumes);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &subvol)) {
+        if (!subvol->path) {
+            g_debug("skipping unreachable btrfs subvolume %" G_GUINT64_FORMAT, subvol->id);
+            continue;
+        }
+
+        g_hash_table_iter_steal(&iter);
+        g_ptr_array_add(ret, subvol);
+    }
+
+    g_ptr_array_sort(ret, (GCompareFunc) compare_subvolume_ids);
+
+    return ret;
+}
+
+static gchar *uuid_to_key(const guint8 *uuid) {
+    GString *key = g_string_sized_new(INSTALLER_BTRFS_UUID_SIZE * 2);
+
+    for (gint i = 0; i < INSTALLER_BTRFS_UUID_SIZE; i++) {
+        g_string_append_printf(key, "%02x", uuid[i]);
+    }
+
+    return g_string_free(key, FALSE);
+}
+
+/**
+ * get_group_key:
+ * @subvol: The subvolume to find a group for
+ * @by_uuid: Table of every subvolume keyed by UUID
+ *
+ * Follows the snapshot chain of @subvol back as far as it is present on
+ * the filesystem. Snapshots whose origin has been deleted are grouped by
+ * the UUID of the missing origin.
+ *
+ * Returns: (transfer full): A key that is equal for all snapshots of
+ *          the same original subvolume
+ */
+static gchar *get_group_key(InstallerBtrfsSubvolume *subvol,
+                            GHashTable *by_uuid) {
+    InstallerBtrfsSubvolume *origin = subvol;
+    guint hops = 0;
+
+    if (uuid_is_null(subvol->uuid)) {
+        return g_strdup_printf("id:%" G_GUINT64_FORMAT, subvol->id);
+    }
+
+    while (installer_btrfs_subvolume_is_snapshot(origin) &&
+           hops++ < g_hash_table_size(by_uuid)) {
+        g_autofree gchar *parent_key = uuid_to_key(origin->parent_uuid);
+        InstallerBtrfsSubvolume *parent = g_hash_table_lookup(by_uuid, parent_key);
+        if (!parent) {
+            return g_steal_pointer(&parent_key);
+        }
+
+        origin = parent;
+    }
+
+    return uuid_to_key(origin->uuid);
+}
+
+static gboolean is_better_representative(InstallerBtrfsSubvolume *candidate,
+                                         InstallerBtrfsSubvolume *current) {
+    gboolean candidate_snap = installer_btrfs_subvolume_is_snapshot(candidate);
+    gboolean current_snap = installer_btrfs_subvolume_is_snapshot(current);
+
+    if (candidate_snap != current_snap) {
+        return !candidate_snap;
+    }
+
+    return candidate->generation > current->generation;
+}
+
+GPtrArray *installer_btrfs_collapse_snapshots(GPtrArray *subvolumes) {
+    g_autoptr(GHashTable) by_uuid = NULL;
+    g_autoptr(GHashTable) groups = NULL;
+    g_autoptr(GPtrArray) order = NULL;
+    GPtrArray *ret = NULL;
+
+    g_return_val_if_fail(subvolumes != NULL, NULL);
+
+    by_uuid = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    order = g_ptr_array_new();
+
+    for (guint i = 0; i < subvolumes->len; i++) {
+        InstallerBtrfsSubvolume *subvol = g_ptr_array_index(subvolumes, i);
+        if (!uuid_is_null(subvol->uuid)) {
+            g_hash_table_insert(by_uuid, uuid_to_key(subvol->uuid), subvol);
+        }
+    }
+
+    for (guint i = 0; i < subvolumes->len; i++) {
+        InstallerBtrfsSubvolume *subvol = g_ptr_array_index(subvolumes, i);
+        gchar *key = get_group_key(subvol, by_uuid);
+        InstallerBtrfsSubvolume *current = g_hash_table_lookup(groups, key);
+
+        if (!current) {
+            g_ptr_array_add(order, key);
+            g_hash_table_insert(groups, key, subvol);
+        } else {
+            if (is_better_representative(subvol, current)) {
+                g_hash_table_insert(groups, g_strdup(key), subvol);
+            }
+            g_free(key);
+        }
+    }
+
+    ret = g_ptr_array_sized_new(order->len);
+    for (guint i = 0; i < order->len; i++) {
+        g_ptr_array_add(ret, g_hash_table_lookup(groups, g_ptr_array_index(order, i)));
+    }
+
+    return ret;
+}
+
+gboolean installer_btrfs_resize_max(gint mount_fd, GError **err) {
+    struct btrfs_ioctl_vol_args args;
+
+    g_return_val_if_fail(mount_fd >= 0, FALSE);
+
+    // Without a "devid:" prefix, this is device 1, the only one
+    memset(&args, 0, sizeof(args));
+    g_strlcpy(args.name, "max", sizeof(args.name));
+    if (ioctl(mount_fd, BTRFS_IOC_RESIZE, &args) < 0) {
+        gint saved = errno;
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                    "Error resizing btrfs filesystem: %s", g_strerror(saved));
+        return FALSE;
+    }
+
+    return TRUE;
+}
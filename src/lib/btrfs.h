@@ -0,0 +1,108 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_BTRFS_H
+#define INSTALLER_BTRFS_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_BTRFS_UUID_SIZE 16
+
+/**
+ * InstallerBtrfsSubvolume:
+ * @id: The tree ID of the subvolume
+ * @parent_id: The tree ID of the subvolume containing this one
+ * @generation: The last transaction that changed this subvolume
+ * @path: The path of the subvolume relative to the top-level subvolume
+ * @uuid: The UUID of this subvolume
+ * @parent_uuid: The UUID of the subvolume this is a snapshot of, or all
+ *               zeroes if this is not a snapshot
+ * @read_only: Whether or not the subvolume is flagged read-only
+ *
+ * A single subvolume found in a btrfs root tree.
+ */
+typedef struct _InstallerBtrfsSubvolume {
+    guint64 id;
+    guint64 parent_id;
+    guint64 generation;
+    gchar *path;
+    guint8 uuid[INSTALLER_BTRFS_UUID_SIZE];
+    guint8 parent_uuid[INSTALLER_BTRFS_UUID_SIZE];
+    gboolean read_only;
+} InstallerBtrfsSubvolume;
+
+/**
+ * installer_btrfs_subvolume_free:
+ * @self: (nullable): The subvolume to free
+ *
+ * Frees resources used by a subvolume record.
+ */
+void installer_btrfs_subvolume_free(InstallerBtrfsSubvolume *self);
+
+/**
+ * installer_btrfs_subvolume_is_snapshot:
+ * @self: The subvolume to check
+ *
+ * Returns: %TRUE if @self was created as a snapshot of another subvolume
+ */
+gboolean installer_btrfs_subvolume_is_snapshot(InstallerBtrfsSubvolume *self);
+
+/**
+ * installer_btrfs_list_subvolumes:
+ * @mount_fd: A directory fd for the top-level subvolume (subvolid=5)
+ * @err: (out): Place to store an error (if any)
+ *
+ * Enumerates every subvolume on a mounted btrfs filesystem by walking
+ * the root tree with `BTRFS_IOC_TREE_SEARCH`. No subvolume needs to be
+ * mounted on its own; every returned path can be opened relative to
+ * @mount_fd.
+ *
+ * Returns: (transfer full): An array of #InstallerBtrfsSubvolume, or
+ *          %NULL in case of error (@err is set)
+ */
+GPtrArray *installer_btrfs_list_subvolumes(gint mount_fd, GError **err);
+
+/**
+ * installer_btrfs_collapse_snapshots:
+ * @subvolumes: An array of subvolumes from installer_btrfs_list_subvolumes()
+ *
+ * Groups subvolumes by the subvolume they were (transitively) snapshotted
+ * from, and picks one representative per group. The original subvolume is
+ * preferred; if it is gone, the most recently written snapshot is used.
+ *
+ * Returns: (transfer container): An array of representatives, borrowed
+ *          from @subvolumes
+ */
+GPtrArray *installer_btrfs_collapse_snapshots(GPtrArray *subvolumes);
+
+/**
+ * installer_btrfs_resize_max:
+ * @mount_fd: A directory fd anywhere on a mounted btrfs filesystem
+ * @err: (out): Place to store an error (if any)
+ *
+ * Grows a single-device btrfs filesystem to fill its device, with
+ * `BTRFS_IOC_RESIZE`.
+ *
+ * Returns: %TRUE if the filesystem was resized
+ */
+gboolean installer_btrfs_resize_max(gint mount_fd, GError **err);
+
+G_END_DECLS
+
+#endif
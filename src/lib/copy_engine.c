@@ -0,0 +1,2429 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define _GNU_SOURCE
+
+#include "copy_engine.h"
+#include "copy_ring.h"
+#include "durability.h"
+#include "executor.h"
+#include "journal.h"
+#include "manifest.h"
+#include "squashfs.h"
+#include "zero.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixmounts.h>
+#include <limits.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+/* Files are handed to workers in chunks of whichever limit comes first */
+#define COPY_CHUNK_FILES 64
+#define COPY_CHUNK_BYTES (32 * 1024 * 1024)
+
+/* Largest single copy_file_range() call */
+#define COPY_RANGE_MAX (1024 * 1024 * 1024)
+
+/* Buffer for filesystems copy_file_range() does not work across */
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+/* Files this big are scanned for zeroes to leave as holes, in blocks of this */
+#define COPY_SPARSE_MIN_SIZE (1024 * 1024)
+#define COPY_SPARSE_BLOCK 4096
+
+/* Files this big have their writeback started as they are written, in windows of this */
+#define COPY_WRITE_BEHIND_WINDOW (8 * 1024 * 1024)
+
+/* Done files are recorded in the journal in batches of whichever limit comes first */
+#define COPY_CHECKPOINT_FILES 16384
+#define COPY_CHECKPOINT_BYTES (512 * 1024 * 1024)
+
+#define XATTR_LIST_MAX_SIZE 65536
+
+/* Small file copies in flight on the target, split between the workers */
+#define COPY_QUEUE_DEPTH 64
+
+typedef enum {
+    COPY_PHASE_WALK,
+    COPY_PHASE_DATA,
+    COPY_PHASE_FINISH
+} CopyPhase;
+
+/**
+ * CopyEntry:
+ *
+ * A file or directory found while walking, with the metadata to give
+ * its copy. Paths are relative to both roots. When copying from a
+ * squashfs image, @inode and @xattr locate the entry in the image.
+ * For a sequential copy, @src_offset and @src_length are where a file's
+ * data is stored on the source.
+ */
+typedef struct _CopyEntry {
+    gchar *path;
+    gchar *link_to;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    guint64 size;
+    struct timespec times[2];
+    guint64 inode;
+    guint32 xattr;
+    guint64 src_offset;
+    guint64 src_length;
+} CopyEntry;
+
+typedef struct _CopyRun {
+    GTask *task;
+    GCancellable *cancellable;
+    GCancellable *outer;
+    gulong outer_id;
+
+    /* Either the squashfs image, or src_root and src_dev */
+    InstallerSquashfs *squashfs;
+    gint src_root;
+    gint dst_root;
+    dev_t src_dev;
+    InstallerDurability durability;
+    /* Filesystems mounted below dst_root, to sync along with it */
+    GArray *dst_mounts;
+    guint ring_depth;
+    gboolean sequential;
+    guint n_workers;
+    gboolean exact_totals;
+    InstallerManifest *manifest;
+    InstallerManifest *verify;
+    InstallerJournal *journal;
+    CopyPhase phase;
+
+    /* Jobs in flight, plus one while a phase is submitting */
+    gint pending;
+
+    /* Everything below is guarded by lock */
+    GMutex lock;
+    GError *error;
+    GPtrArray *files;
+    GPtrArray *dirs;
+    GPtrArray *links;
+    GHashTable *inodes;
+
+    /* The chunks of files, and the next to be claimed */
+    GArray *chunks;
+    gint next_chunk;
+
+    /* Done files not yet in the journal */
+    GArray *journal_pending;
+    guint64 journal_pending_files;
+    guint64 journal_pending_bytes;
+
+    /* Held while recording in the journal, so only one worker syncs */
+    GMutex checkpoint_lock;
+} CopyRun;
+
+struct _InstallerCopyEngine {
+    GObject parent_instance;
+
+    gchar *source;
+    InstallerSquashfs *squashfs;
+    gchar *target;
+    GHashTable *excludes;
+    guint queue_depth;
+    gboolean sequential;
+    InstallerManifest *manifest;
+    gboolean verify;
+    InstallerDurability durability;
+    InstallerJournal *journal;
+
+    gboolean running;
+    GMutex progress_lock;
+    InstallerCopyProgress progress;
+};
+
+G_DEFINE_TYPE(InstallerCopyEngine, installer_copy_engine, G_TYPE_OBJECT);
+
+static void installer_copy_engine_finalize(GObject *obj);
+
+static void installer_copy_engine_class_init(InstallerCopyEngineClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_copy_engine_finalize;
+}
+
+static void installer_copy_engine_init(InstallerCopyEngine *self) {
+    self->excludes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self->queue_depth = COPY_QUEUE_DEPTH;
+    self->durability = INSTALLER_DURABILITY_BATCHED;
+    g_mutex_init(&self->progress_lock);
+}
+
+static void installer_copy_engine_finalize(GObject *obj) {
+    InstallerCopyEngine *self = INSTALLER_COPY_ENGINE(obj);
+
+    g_free(self->source);
+    g_clear_object(&self->squashfs);
+    g_clear_object(&self->manifest);
+    g_clear_object(&self->journal);
+    g_free(self->target);
+    g_hash_table_destroy(self->excludes);
+    g_mutex_clear(&self->progress_lock);
+
+    G_OBJECT_CLASS(installer_copy_engine_parent_class)->finalize(obj);
+}
+
+InstallerCopyEngine *installer_copy_engine_new(const gchar *source,
+                                               const gchar *target) {
+    InstallerCopyEngine *self = NULL;
+
+    g_return_val_if_fail(source != NULL, NULL);
+    g_return_val_if_fail(target != NULL, NULL);
+
+    self = g_object_new(INSTALLER_TYPE_COPY_ENGINE, NULL);
+    self->source = g_strdup(source);
+    self->target = g_strdup(target);
+
+    return self;
+}
+
+InstallerCopyEngine *installer_copy_engine_new_from_squashfs(InstallerSquashfs *source,
+                                                             const gchar *target) {
+    InstallerCopyEngine *self = NULL;
+
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(source), NULL);
+    g_return_val_if_fail(target != NULL, NULL);
+
+    self = g_object_new(INSTALLER_TYPE_COPY_ENGINE, NULL);
+    self->squashfs = g_object_ref(source);
+    self->target = g_strdup(target);
+
+    return self;
+}
+
+void installer_copy_engine_exclude(InstallerCopyEngine *self, const gchar *path) {
+    g_autofree gchar *canonical = NULL;
+
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+    g_return_if_fail(path != NULL);
+
+    // Entries are looked up by their path relative to the root
+    canonical = g_canonicalize_filename(path, "/");
+    g_hash_table_add(self->excludes, g_strdup(canonical + 1));
+}
+
+void installer_copy_engine_set_queue_depth(InstallerCopyEngine *self, guint depth) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+
+    self->queue_depth = depth;
+}
+
+void installer_copy_engine_set_sequential(InstallerCopyEngine *self, gboolean sequential) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+
+    self->sequential = sequential;
+}
+
+void installer_copy_engine_set_manifest(InstallerCopyEngine *self,
+                                        InstallerManifest *manifest) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+    g_return_if_fail(manifest == NULL || INSTALLER_IS_MANIFEST(manifest));
+
+    g_set_object(&self->manifest, manifest);
+}
+
+void installer_copy_engine_set_verify(InstallerCopyEngine *self, gboolean verify) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+
+    self->verify = verify;
+}
+
+void installer_copy_engine_set_durability(InstallerCopyEngine *self,
+                                          InstallerDurability durability) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+
+    self->durability = durability;
+}
+
+void installer_copy_engine_set_journal(InstallerCopyEngine *self,
+                                       InstallerJournal *journal) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+    g_return_if_fail(journal == NULL || INSTALLER_IS_JOURNAL(journal));
+
+    g_set_object(&self->journal, journal);
+}
+
+void installer_copy_engine_get_progress(InstallerCopyEngine *self,
+                                        InstallerCopyProgress *progress) {
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+    g_return_if_fail(progress != NULL);
+
+    g_mutex_lock(&self->progress_lock);
+    *progress = self->progress;
+    g_mutex_unlock(&self->progress_lock);
+}
+
+static void copy_entry_free(CopyEntry *entry) {
+    g_free(entry->path);
+    g_free(entry->link_to);
+    g_free(entry);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(CopyEntry, copy_entry_free)
+
+static CopyEntry *copy_entry_new(const gchar *path, const struct statx *stx) {
+    CopyEntry *entry = g_new0(CopyEntry, 1);
+
+    entry->path = g_strdup(path);
+    entry->mode = stx->stx_mode;
+    entry->uid = stx->stx_uid;
+    entry->gid = stx->stx_gid;
+    entry->size = stx->stx_size;
+    entry->times[0].tv_sec = stx->stx_atime.tv_sec;
+    entry->times[0].tv_nsec = stx->stx_atime.tv_nsec;
+    entry->times[1].tv_sec = stx->stx_mtime.tv_sec;
+    entry->times[1].tv_nsec = stx->stx_mtime.tv_nsec;
+    entry->xattr = INSTALLER_SQUASHFS_NO_XATTRS;
+
+    return entry;
+}
+
+static CopyEntry *copy_entry_new_squashfs(const gchar *path,
+                                          const InstallerSquashfsInode *inode) {
+    CopyEntry *entry = g_new0(CopyEntry, 1);
+
+    entry->path = g_strdup(path);
+    entry->mode = inode->mode;
+    entry->uid = inode->uid;
+    entry->gid = inode->gid;
+    entry->size = inode->size;
+    entry->times[0].tv_sec = inode->mtime;
+    entry->times[1].tv_sec = inode->mtime;
+    entry->inode = inode->ref;
+    entry->xattr = inode->xattr;
+
+    return entry;
+}
+
+static InstallerCopyEngine *run_get_engine(CopyRun *run) {
+    return INSTALLER_COPY_ENGINE(g_task_get_source_object(run->task));
+}
+
+/**
+ * run_fail_error:
+ * @run: The copy
+ * @error: (transfer full): The error
+ *
+ * Records the first error of a copy and stops every other job.
+ */
+static void run_fail_error(CopyRun *run, GError *error) {
+    g_mutex_lock(&run->lock);
+    if (!run->error) {
+        run->error = g_steal_pointer(&error);
+    }
+    g_mutex_unlock(&run->lock);
+
+    g_clear_error(&error);
+    g_cancellable_cancel(run->cancellable);
+}
+
+/**
+ * set_copy_error:
+ * @errsv: The errno of the failure
+ * @what: What was being done, e.g. "copying"
+ * @path: The path relative to the roots
+ *
+ * Returns: %FALSE
+ */
+static gboolean set_copy_error(GError **err, gint errsv, const gchar *what,
+                               const gchar *path) {
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errsv), "Error %s '/%s': %s", what,
+                path, g_strerror(errsv));
+    return FALSE;
+}
+
+static void run_fail(CopyRun *run, gint errsv, const gchar *what, const gchar *path) {
+    GError *error = NULL;
+
+    set_copy_error(&error, errsv, what, path);
+    run_fail_error(run, error);
+}
+
+static gchar *child_path(const gchar *parent, const gchar *name) {
+    return *parent ? g_strconcat(parent, "/", name, NULL) : g_strdup(name);
+}
+
+/* Metadata */
+
+static gboolean copy_xattrs(gint src_fd, gint dst_fd) {
+    g_autofree gchar *names = g_malloc(XATTR_LIST_MAX_SIZE);
+    g_autofree gchar *value = NULL;
+    gssize names_len = 0;
+    gsize value_size = 0;
+
+    names_len = flistxattr(src_fd, names, XATTR_LIST_MAX_SIZE);
+    if (names_len < 0) {
+        // Not every source filesystem has them
+        return errno == ENOTSUP;
+    }
+
+    for (gchar *name = names; name < names + names_len; name += strlen(name) + 1) {
+        gssize len = fgetxattr(src_fd, name, NULL, 0);
+        if (len < 0) {
+            return FALSE;
+        }
+
+        if ((gsize) len > value_size) {
+            value_size = len;
+            value = g_realloc(value, value_size);
+        }
+
+        len = fgetxattr(src_fd, name, value, len);
+        if (len < 0 || fsetxattr(dst_fd, name, value, len, 0) != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * copy_xattrs_at:
+ *
+ * Like copy_xattrs(), for files copied by a ring, which leaves no file
+ * descriptors open.
+ */
+static gboolean copy_xattrs_at(CopyRun *run, const gchar *path) {
+    g_autofree gchar *src = g_strdup_printf("/proc/self/fd/%d/%s", run->src_root, path);
+    g_autofree gchar *dst = g_strdup_printf("/proc/self/fd/%d/%s", run->dst_root, path);
+    g_autofree gchar *names = g_malloc(XATTR_LIST_MAX_SIZE);
+    g_autofree gchar *value = NULL;
+    gssize names_len = 0;
+    gsize value_size = 0;
+
+    names_len = llistxattr(src, names, XATTR_LIST_MAX_SIZE);
+    if (names_len < 0) {
+        return errno == ENOTSUP;
+    }
+
+    for (gchar *name = names; name < names + names_len; name += strlen(name) + 1) {
+        gssize len = lgetxattr(src, name, NULL, 0);
+        if (len < 0) {
+            return FALSE;
+        }
+
+        if ((gsize) len > value_size) {
+            value_size = len;
+            value = g_realloc(value, value_size);
+        }
+
+        len = lgetxattr(src, name, value, len);
+        if (len < 0 || lsetxattr(dst, name, value, len, 0) != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * copy_squashfs_xattrs:
+ *
+ * Like copy_xattrs(), from the xattr table of the image. A corrupt
+ * table is logged, and reported as EIO like a failed read would be.
+ */
+static gboolean copy_squashfs_xattrs(CopyRun *run, gint dst_fd, CopyEntry *entry) {
+    g_autoptr(GPtrArray) xattrs = NULL;
+    g_autoptr(GError) err = NULL;
+
+    xattrs = installer_squashfs_read_xattrs(run->squashfs, entry->xattr, &err);
+    if (!xattrs) {
+        g_warning("Error reading xattrs of '/%s': %s", entry->path, err->message);
+        errno = EIO;
+        return FALSE;
+    }
+
+    for (guint i = 0; i < xattrs->len; i++) {
+        InstallerSquashfsXattr *xattr = g_ptr_array_index(xattrs, i);
+        gsize len = 0;
+        gconstpointer value = g_bytes_get_data(xattr->value, &len);
+
+        if (fsetxattr(dst_fd, xattr->name, value, len, 0) != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * apply_metadata:
+ * @src_fd: The source, or -1 when copying from a squashfs image
+ *
+ * Owner first, since chown() clears the setuid and setgid bits that the
+ * mode then puts back. Times last, since everything else touches them.
+ */
+static gboolean apply_metadata(CopyRun *run, gint src_fd, gint dst_fd, CopyEntry *entry) {
+    return fchown(dst_fd, entry->uid, entry->gid) == 0 &&
+           fchmod(dst_fd, entry->mode & 07777) == 0 &&
+           (run->squashfs ? copy_squashfs_xattrs(run, dst_fd, entry)
+                          : copy_xattrs(src_fd, dst_fd)) &&
+           futimens(dst_fd, entry->times) == 0;
+}
+
+static gboolean apply_metadata_at(CopyRun *run, CopyEntry *entry) {
+    return fchownat(run->dst_root, entry->path, entry->uid, entry->gid,
+                    AT_SYMLINK_NOFOLLOW) == 0 &&
+           fchmodat(run->dst_root, entry->path, entry->mode & 07777, 0) == 0 &&
+           copy_xattrs_at(run, entry->path) &&
+           utimensat(run->dst_root, entry->path, entry->times, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* Phase 1: walking */
+
+typedef struct _WalkJob {
+    CopyRun *run;
+    gchar *path;
+    guint64 inode;
+} WalkJob;
+
+static void run_job_done(CopyRun *run);
+static void walk_submit(CopyRun *run, const gchar *path, guint64 inode);
+
+static void walk_job_free(WalkJob *job) {
+    CopyRun *run = job->run;
+
+    g_free(job->path);
+    g_free(job);
+    run_job_done(run);
+}
+
+/**
+ * remove_partial:
+ *
+ * Removes what an interrupted copy may have left at @path, when resuming.
+ */
+static gboolean remove_partial(CopyRun *run, gint dir, const gchar *path) {
+    return !run->journal || unlinkat(dir, path, 0) == 0 || errno == ENOENT;
+}
+
+/**
+ * make_special:
+ * @target: (nullable): The target of a symlink
+ *
+ * Creates the things that have no data to copy: symlinks, device nodes
+ * and FIFOs. They are done while walking, since each is a single call.
+ */
+static gboolean make_special(CopyRun *run, gint dst_dir, const gchar *name,
+                             CopyEntry *entry, dev_t rdev, const gchar *target) {
+    if (!remove_partial(run, dst_dir, name)) {
+        return FALSE;
+    }
+
+    if (S_ISLNK(entry->mode)) {
+        if (symlinkat(target, dst_dir, name) != 0) {
+            return FALSE;
+        }
+    } else if (mknodat(dst_dir, name, entry->mode, rdev) != 0 ||
+               fchmodat(dst_dir, name, entry->mode & 07777, 0) != 0) {
+        return FALSE;
+    }
+
+    return fchownat(dst_dir, name, entry->uid, entry->gid, AT_SYMLINK_NOFOLLOW) == 0 &&
+           utimensat(dst_dir, name, entry->times, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+static gboolean copy_special(CopyRun *run, gint src_dir, gint dst_dir, const gchar *path,
+                             const gchar *name, const struct statx *stx) {
+    g_autoptr(CopyEntry) entry = copy_entry_new(path, stx);
+    gchar target[PATH_MAX + 1];
+
+    if (S_ISLNK(stx->stx_mode)) {
+        gssize len = readlinkat(src_dir, name, target, PATH_MAX);
+        if (len < 0) {
+            return FALSE;
+        }
+        target[len] = '\0';
+    }
+
+    return make_special(run, dst_dir, name, entry,
+                        makedev(stx->stx_rdev_major, stx->stx_rdev_minor), target);
+}
+
+/**
+ * add_file:
+ * @key: (nullable): Identifies the inode of a file with several links
+ *
+ * Only the first name of a hardlinked file is copied; the rest are
+ * linked to it once the data is there.
+ */
+static void add_file(CopyRun *run, CopyEntry *entry, gchar *key, GPtrArray *files,
+                     GPtrArray *links, guint64 *bytes) {
+    const gchar *first = NULL;
+
+    if (key) {
+        g_mutex_lock(&run->lock);
+        first = g_hash_table_lookup(run->inodes, key);
+        if (!first) {
+            g_hash_table_insert(run->inodes, key, g_strdup(entry->path));
+        } else {
+            g_free(key);
+        }
+        g_mutex_unlock(&run->lock);
+    }
+
+    if (first) {
+        entry->link_to = g_strdup(first);
+        g_ptr_array_add(links, entry);
+        return;
+    }
+
+    g_ptr_array_add(files, entry);
+    *bytes += entry->size;
+}
+
+static void add_dir(CopyRun *run, CopyEntry *entry) {
+    g_mutex_lock(&run->lock);
+    g_ptr_array_add(run->dirs, entry);
+    g_mutex_unlock(&run->lock);
+}
+
+/**
+ * source_offset:
+ *
+ * Finds where the first extent of a file is on the source device. Files
+ * that are empty, inline or on a filesystem without FIEMAP sort first.
+ */
+static guint64 source_offset(gint src_dir, const gchar *name) {
+    g_autofree struct fiemap *map = g_malloc0(sizeof(*map) + sizeof(struct fiemap_extent));
+    gint fd = openat(src_dir, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    guint64 offset = 0;
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0) {
+        offset = map->fm_extents[0].fe_physical;
+    }
+
+    close(fd);
+    return offset;
+}
+
+/**
+ * walk_entry:
+ *
+ * Handles one directory entry. Returns the errno of a failure, or 0.
+ */
+static gint walk_entry(CopyRun *run, gint src_dir, gint dst_dir, const gchar *path,
+                       const gchar *name, GPtrArray *files, GPtrArray *links,
+                       guint64 *bytes) {
+    struct statx stx;
+
+    if (statx(src_dir, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+              STATX_BASIC_STATS, &stx) != 0) {
+        return errno;
+    }
+
+    // Like cp -x, mount points are created but not descended into
+    if (S_ISDIR(stx.stx_mode)) {
+        if (mkdirat(dst_dir, name, 0700) != 0 && errno != EEXIST) {
+            return errno;
+        }
+
+        add_dir(run, copy_entry_new(path, &stx));
+
+        if (makedev(stx.stx_dev_major, stx.stx_dev_minor) == run->src_dev) {
+            walk_submit(run, path, 0);
+        }
+        return 0;
+    }
+
+    if (S_ISREG(stx.stx_mode)) {
+        CopyEntry *entry = copy_entry_new(path, &stx);
+        gchar *key = NULL;
+
+        if (stx.stx_nlink > 1) {
+            key = g_strdup_printf("%u:%u:%" G_GUINT64_FORMAT, stx.stx_dev_major,
+                                  stx.stx_dev_minor, (guint64) stx.stx_ino);
+        }
+
+        if (run->sequential && entry->size > 0) {
+            entry->src_offset = source_offset(src_dir, name);
+            entry->src_length = entry->size;
+        }
+
+        add_file(run, entry, key, files, links, bytes);
+        return 0;
+    }
+
+    if (S_ISLNK(stx.stx_mode) || S_ISCHR(stx.stx_mode) || S_ISBLK(stx.stx_mode) ||
+        S_ISFIFO(stx.stx_mode)) {
+        return copy_special(run, src_dir, dst_dir, path, name, &stx) ? 0 : errno;
+    }
+
+    // Sockets belong to running processes and mean nothing on disk
+    return 0;
+}
+
+/**
+ * walk_merge:
+ * @files: (transfer full): The files found in a directory
+ * @links: (transfer full): The extra links found in a directory
+ * @bytes: The size of @files
+ *
+ * Collected per directory, so the shared lists are locked once each.
+ */
+static void walk_merge(CopyRun *run, GPtrArray *files, GPtrArray *links, guint64 bytes) {
+    InstallerCopyEngine *engine = run_get_engine(run);
+
+    if (!run->exact_totals) {
+        g_mutex_lock(&engine->progress_lock);
+        engine->progress.files_total += files->len;
+        engine->progress.bytes_total += bytes;
+        g_mutex_unlock(&engine->progress_lock);
+    }
+
+    g_mutex_lock(&run->lock);
+    g_ptr_array_extend_and_steal(run->files, files);
+    g_ptr_array_extend_and_steal(run->links, links);
+    g_mutex_unlock(&run->lock);
+}
+
+static void walk_directory(WalkJob *job, GCancellable *cancellable) {
+    CopyRun *run = job->run;
+    InstallerCopyEngine *engine = run_get_engine(run);
+    const gchar *dir_path = *job->path ? job->path : ".";
+    g_autoptr(GPtrArray) files = g_ptr_array_new();
+    g_autoptr(GPtrArray) links = g_ptr_array_new();
+    guint64 bytes = 0;
+    gint src_dir = -1;
+    gint dst_dir = -1;
+    DIR *dir = NULL;
+    struct dirent *dent = NULL;
+
+    src_dir = openat(run->src_root, dir_path,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_dir < 0) {
+        run_fail(run, errno, "opening", job->path);
+        return;
+    }
+
+    dst_dir = openat(run->dst_root, dir_path,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dst_dir < 0) {
+        run_fail(run, errno, "opening the copy of", job->path);
+        close(src_dir);
+        return;
+    }
+
+    // The stream takes over src_dir, so walk a duplicate of it
+    dir = fdopendir(dup(src_dir));
+    if (!dir) {
+        run_fail(run, errno, "reading", job->path);
+        close(src_dir);
+        close(dst_dir);
+        return;
+    }
+
+    while ((dent = readdir(dir)) != NULL) {
+        g_autofree gchar *path = NULL;
+        gint errsv = 0;
+
+        if (g_cancellable_is_cancelled(cancellable)) {
+            break;
+        }
+
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+            continue;
+        }
+
+        path = child_path(job->path, dent->d_name);
+        if (g_hash_table_contains(engine->excludes, path)) {
+            continue;
+        }
+
+        errsv = walk_entry(run, src_dir, dst_dir, path, dent->d_name, files, links,
+                           &bytes);
+        if (errsv != 0) {
+            run_fail(run, errsv, "copying", path);
+            break;
+        }
+    }
+
+    closedir(dir);
+    close(src_dir);
+    close(dst_dir);
+
+    walk_merge(run, g_steal_pointer(&files), g_steal_pointer(&links), bytes);
+}
+
+/**
+ * walk_squashfs_entry:
+ *
+ * Like walk_entry(), for an entry of a squashfs image.
+ */
+static gboolean walk_squashfs_entry(CopyRun *run, gint dst_dir, const gchar *path,
+                                    const InstallerSquashfsDirent *dent,
+                                    GPtrArray *files, GPtrArray *links, guint64 *bytes,
+                                    GError **err) {
+    g_autoptr(CopyEntry) entry = NULL;
+    g_autofree gchar *target = NULL;
+    InstallerSquashfsInode inode;
+
+    if (!installer_squashfs_read_inode(run->squashfs, dent->ref, &inode, err)) {
+        return FALSE;
+    }
+
+    entry = copy_entry_new_squashfs(path, &inode);
+
+    if (S_ISDIR(inode.mode)) {
+        if (mkdirat(dst_dir, dent->name, 0700) != 0 && errno != EEXIST) {
+            return set_copy_error(err, errno, "creating", path);
+        }
+
+        add_dir(run, g_steal_pointer(&entry));
+        walk_submit(run, path, dent->ref);
+        return TRUE;
+    }
+
+    if (S_ISREG(inode.mode)) {
+        gchar *key = inode.nlink > 1 ? g_strdup_printf("%u", inode.number) : NULL;
+
+        if (run->sequential) {
+            installer_squashfs_get_extent(run->squashfs, &inode, &entry->src_offset,
+                                          &entry->src_length);
+        }
+
+        add_file(run, g_steal_pointer(&entry), key, files, links, bytes);
+        return TRUE;
+    }
+
+    if (S_ISSOCK(inode.mode)) {
+        return TRUE;
+    }
+
+    if (S_ISLNK(inode.mode)) {
+        target = installer_squashfs_read_link(run->squashfs, &inode, err);
+        if (!target) {
+            return FALSE;
+        }
+    }
+
+    if (!make_special(run, dst_dir, dent->name, entry, inode.rdev, target)) {
+        return set_copy_error(err, errno, "copying", path);
+    }
+
+    return TRUE;
+}
+
+/**
+ * walk_squashfs_directory:
+ *
+ * Like walk_directory(), listing a directory of a squashfs image from
+ * its directory table rather than from the kernel.
+ */
+static void walk_squashfs_directory(WalkJob *job, GCancellable *cancellable) {
+    CopyRun *run = job->run;
+    InstallerCopyEngine *engine = run_get_engine(run);
+    const gchar *dir_path = *job->path ? job->path : ".";
+    g_autoptr(GPtrArray) files = g_ptr_array_new();
+    g_autoptr(GPtrArray) links = g_ptr_array_new();
+    g_autoptr(GPtrArray) entries = NULL;
+    g_autoptr(GError) err = NULL;
+    InstallerSquashfsInode dir;
+    guint64 bytes = 0;
+    gint dst_dir = -1;
+
+    if (!installer_squashfs_read_inode(run->squashfs, job->inode, &dir, &err) ||
+        !(entries = installer_squashfs_read_dir(run->squashfs, &dir, &err))) {
+        run_fail_error(run, g_steal_pointer(&err));
+        return;
+    }
+
+    dst_dir = openat(run->dst_root, dir_path,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dst_dir < 0) {
+        run_fail(run, errno, "opening the copy of", job->path);
+        return;
+    }
+
+    for (guint i = 0; i < entries->len; i++) {
+        InstallerSquashfsDirent *dent = g_ptr_array_index(entries, i);
+        g_autofree gchar *path = NULL;
+
+        if (g_cancellable_is_cancelled(cancellable)) {
+            break;
+        }
+
+        path = child_path(job->path, dent->name);
+        if (g_hash_table_contains(engine->excludes, path)) {
+            continue;
+        }
+
+        if (!walk_squashfs_entry(run, dst_dir, path, dent, files, links, &bytes, &err)) {
+            run_fail_error(run, g_steal_pointer(&err));
+            break;
+        }
+    }
+
+    close(dst_dir);
+
+    walk_merge(run, g_steal_pointer(&files), g_steal_pointer(&links), bytes);
+}
+
+static void walk_submit(CopyRun *run, const gchar *path, guint64 inode) {
+    WalkJob *job = g_new0(WalkJob, 1);
+    InstallerExecutorFunc func = run->squashfs
+                                     ? (InstallerExecutorFunc) walk_squashfs_directory
+                                     : (InstallerExecutorFunc) walk_directory;
+
+    job->run = run;
+    job->path = g_strdup(path);
+    job->inode = inode;
+
+    // Submitted from a worker, so subtrees land on its own queue, where
+    // idle workers can steal them
+    g_atomic_int_inc(&run->pending);
+    installer_executor_submit_cpu(installer_executor_get_default(),
+                                  INSTALLER_EXECUTOR_PRIORITY_DEFAULT,
+                                  func, job, (GDestroyNotify) walk_job_free,
+                                  run->cancellable);
+}
+
+/* Phase 2: file data */
+
+/* A run of files copied together, claimed by one worker at a time */
+typedef struct _CopyChunk {
+    guint start;
+    guint end;
+} CopyChunk;
+
+typedef struct _DataJob {
+    CopyRun *run;
+} DataJob;
+
+static void data_job_free(DataJob *job) {
+    CopyRun *run = job->run;
+
+    g_free(job);
+    run_job_done(run);
+}
+
+/**
+ * WriteBehind:
+ *
+ * Where a large file's writeback has got to. Writeback of each window
+ * is started as soon as it is written, and waited for once the next is
+ * written, so a large file never leaves more than two windows dirty in
+ * the page cache and the disk writes while the source is still read.
+ */
+typedef struct _WriteBehind {
+    gint fd;
+    off_t started;
+    off_t waited;
+} WriteBehind;
+
+static void write_behind_update(WriteBehind *wb, off_t written) {
+    if (!wb || written - wb->started < COPY_WRITE_BEHIND_WINDOW) {
+        return;
+    }
+
+    installer_durability_write_behind(wb->fd, wb->started, written - wb->started, FALSE);
+    if (wb->started > wb->waited) {
+        installer_durability_write_behind(wb->fd, wb->waited, wb->started - wb->waited, TRUE);
+        wb->waited = wb->started;
+    }
+    wb->started = written;
+}
+
+/**
+ * write_behind_new:
+ *
+ * Returns: (nullable): Where to track writeback of @fd, or %NULL if it
+ *          is left to the kernel
+ */
+static WriteBehind *write_behind_new(CopyRun *run, gint fd, guint64 size) {
+    WriteBehind *wb = NULL;
+
+    if (run->durability == INSTALLER_DURABILITY_NONE || size < COPY_WRITE_BEHIND_WINDOW) {
+        return NULL;
+    }
+
+    wb = g_new0(WriteBehind, 1);
+    wb->fd = fd;
+    return wb;
+}
+
+/**
+ * write_behind_finish:
+ *
+ * Starts writeback of whatever is left of the file, without waiting.
+ * The sync at the end of the phase waits for it.
+ */
+static void write_behind_finish(WriteBehind *wb) {
+    if (!wb) {
+        return;
+    }
+
+    installer_durability_write_behind(wb->fd, wb->started, 0, FALSE);
+    g_free(wb);
+}
+
+/**
+ * copy_data:
+ *
+ * Copies with copy_file_range(), which lets the kernel move the data
+ * without it passing through userspace, and can reflink on filesystems
+ * that support it. Across filesystems where it is not supported, falls
+ * back to read() and write(). Writes are tracked in @wb, if there is
+ * one, so each call copies no more than a window.
+ *
+ * Returns: The number of bytes copied, or -1 with errno set
+ */
+static gint64 copy_data(gint src_fd, gint dst_fd, guint64 size, WriteBehind *wb) {
+    g_autofree guint8 *buffer = NULL;
+    guint64 max = wb ? COPY_WRITE_BEHIND_WINDOW : COPY_RANGE_MAX;
+    guint64 copied = 0;
+
+    while (copied < size) {
+        gssize n = copy_file_range(src_fd, NULL, dst_fd, NULL, MIN(size - copied, max), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (copied == 0 && (errno == EXDEV || errno == ENOSYS ||
+                                errno == EINVAL || errno == EOPNOTSUPP)) {
+                break;
+            }
+            return -1;
+        }
+
+        // The file shrank while we were copying it
+        if (n == 0) {
+            return copied;
+        }
+
+        copied += n;
+        write_behind_update(wb, copied);
+    }
+
+    if (copied == size) {
+        return copied;
+    }
+
+    buffer = g_malloc(COPY_BUFFER_SIZE);
+    while (TRUE) {
+        gssize n = read(src_fd, buffer, COPY_BUFFER_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (n == 0) {
+            return copied;
+        }
+
+        for (gssize written = 0; written < n;) {
+            gssize w = write(dst_fd, buffer + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            written += w;
+        }
+
+        copied += n;
+        write_behind_update(wb, copied);
+    }
+}
+
+/**
+ * write_nonzero:
+ * @offset: Where @buffer goes in the file
+ *
+ * Writes the blocks of @buffer that are not all zeroes, leaving holes
+ * where the rest would go. Runs of data blocks are written together.
+ */
+static gboolean write_nonzero(gint dst_fd, const guint8 *buffer, gsize len, off_t offset) {
+    gsize start = 0;
+
+    while (start < len) {
+        gsize end = 0;
+
+        while (start < len && installer_is_zero(buffer + start,
+                                                MIN(COPY_SPARSE_BLOCK, len - start))) {
+            start += COPY_SPARSE_BLOCK;
+        }
+        if (start >= len) {
+            break;
+        }
+
+        end = start;
+        while (end < len && !installer_is_zero(buffer + end,
+                                               MIN(COPY_SPARSE_BLOCK, len - end))) {
+            end += COPY_SPARSE_BLOCK;
+        }
+        end = MIN(end, len);
+
+        for (gsize done = start; done < end;) {
+            gssize w = pwrite(dst_fd, buffer + done, end - done, offset + done);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return FALSE;
+            }
+            done += w;
+        }
+
+        start = end;
+    }
+
+    return TRUE;
+}
+
+/**
+ * copy_sparse:
+ *
+ * Copies only the data of a file, so disk images and preallocated files
+ * do not become fully allocated on the target. Holes in the source are
+ * skipped with SEEK_DATA and SEEK_HOLE, and blocks of zeroes within the
+ * data are left as holes too. The target is new, so nothing needs to be
+ * punched; the size is set at the end. Writes are tracked in @wb, if
+ * there is one.
+ *
+ * Returns: The number of bytes copied, holes included, or -1 with errno
+ *          set
+ */
+static gint64 copy_sparse(gint src_fd, gint dst_fd, guint64 size, WriteBehind *wb) {
+    g_autofree guint8 *buffer = g_malloc(COPY_BUFFER_SIZE);
+    off_t offset = 0;
+
+    while ((guint64) offset < size) {
+        off_t data = lseek(src_fd, offset, SEEK_DATA);
+        off_t hole = 0;
+
+        if (data < 0) {
+            // Nothing but a hole is left
+            if (errno == ENXIO) {
+                offset = size;
+                break;
+            }
+            return -1;
+        }
+
+        hole = lseek(src_fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            return -1;
+        }
+        hole = MIN((guint64) hole, size);
+
+        for (offset = data; offset < hole;) {
+            gssize n = pread(src_fd, buffer, MIN(COPY_BUFFER_SIZE, hole - offset), offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+
+            // The file shrank while we were copying it
+            if (n == 0) {
+                size = offset;
+                break;
+            }
+
+            if (!write_nonzero(dst_fd, buffer, n, offset)) {
+                return -1;
+            }
+            offset += n;
+            write_behind_update(wb, offset);
+        }
+    }
+
+    if (ftruncate(dst_fd, size) != 0) {
+        return -1;
+    }
+
+    return size;
+}
+
+/**
+ * sync_file:
+ *
+ * Syncs a finished file or directory if the copy is strict.
+ *
+ * Returns: %FALSE with errno set if the sync failed
+ */
+static gboolean sync_file(CopyRun *run, gint fd, const gchar *path) {
+    if (run->durability != INSTALLER_DURABILITY_STRICT) {
+        return TRUE;
+    }
+
+    return installer_durability_fsync(fd, path, NULL);
+}
+
+static gint copy_file(CopyRun *run, CopyEntry *entry, guint64 *copied) {
+    WriteBehind *wb = NULL;
+    gint src_fd = -1;
+    gint dst_fd = -1;
+    gint64 n = 0;
+    gint errsv = 0;
+
+    src_fd = openat(run->src_root, entry->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_fd < 0) {
+        return errno;
+    }
+
+    if (!remove_partial(run, run->dst_root, entry->path)) {
+        errsv = errno;
+        close(src_fd);
+        return errsv;
+    }
+
+    dst_fd = openat(run->dst_root, entry->path,
+                    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (dst_fd < 0) {
+        errsv = errno;
+        close(src_fd);
+        return errsv;
+    }
+
+    wb = write_behind_new(run, dst_fd, entry->size);
+    if (entry->size >= COPY_SPARSE_MIN_SIZE) {
+        n = copy_sparse(src_fd, dst_fd, entry->size, wb);
+    } else {
+        n = copy_data(src_fd, dst_fd, entry->size, wb);
+    }
+    write_behind_finish(wb);
+
+    if (n < 0 || !apply_metadata(run, src_fd, dst_fd, entry) ||
+        !sync_file(run, dst_fd, entry->path)) {
+        errsv = errno;
+    } else {
+        *copied = n;
+    }
+
+    close(src_fd);
+    if (close(dst_fd) != 0 && errsv == 0) {
+        errsv = errno;
+    }
+
+    return errsv;
+}
+
+static void on_squashfs_write(guint64 written, gpointer user_data) {
+    write_behind_update(user_data, (off_t) written);
+}
+
+/**
+ * copy_squashfs_file:
+ *
+ * Like copy_file(), decompressing the file from the image. Sparse
+ * blocks are left as holes. Writeback is tracked as each block is
+ * written, the same as for a plain copy.
+ */
+static gboolean copy_squashfs_file(CopyRun *run, CopyEntry *entry, guint64 *copied,
+                                   GError **err) {
+    InstallerSquashfsInode inode;
+    WriteBehind *wb = NULL;
+    gint dst_fd = -1;
+    gboolean ret = FALSE;
+
+    if (!installer_squashfs_read_inode(run->squashfs, entry->inode, &inode, err)) {
+        return FALSE;
+    }
+
+    if (!remove_partial(run, run->dst_root, entry->path)) {
+        return set_copy_error(err, errno, "copying", entry->path);
+    }
+
+    dst_fd = openat(run->dst_root, entry->path,
+                    O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (dst_fd < 0) {
+        return set_copy_error(err, errno, "copying", entry->path);
+    }
+
+    wb = write_behind_new(run, dst_fd, inode.size);
+    ret = installer_squashfs_read_file(run->squashfs, &inode, dst_fd, on_squashfs_write,
+                                       wb, err);
+    write_behind_finish(wb);
+
+    if (!ret) {
+        close(dst_fd);
+        return FALSE;
+    }
+
+    ret = apply_metadata(run, -1, dst_fd, entry) && sync_file(run, dst_fd, entry->path);
+    if (close(dst_fd) != 0) {
+        ret = FALSE;
+    }
+
+    if (!ret) {
+        return set_copy_error(err, errno, "copying", entry->path);
+    }
+
+    *copied = inode.size;
+    return TRUE;
+}
+
+/* Rings are per worker thread, since only one thread may use each */
+static GPrivate thread_ring = G_PRIVATE_INIT((GDestroyNotify) installer_copy_ring_free);
+static gint ring_unavailable = FALSE;
+
+static InstallerCopyRing *get_thread_ring(void) {
+    InstallerCopyRing *ring = g_private_get(&thread_ring);
+    g_autoptr(GError) err = NULL;
+
+    if (ring || g_atomic_int_get(&ring_unavailable)) {
+        return ring;
+    }
+
+    ring = installer_copy_ring_new(&err);
+    if (!ring) {
+        g_debug("Copying small files with threads: %s", err->message);
+        g_atomic_int_set(&ring_unavailable, TRUE);
+        return NULL;
+    }
+
+    g_private_set(&thread_ring, ring);
+    return ring;
+}
+
+/**
+ * copy_small_files:
+ *
+ * Copies the data of the small files in a chunk with this thread's ring.
+ * Results are stored in @small, in the order the files are in the chunk.
+ *
+ * Returns: The number of files given to the ring, or 0 if it cannot be used
+ */
+static guint copy_small_files(CopyRun *run, const CopyChunk *chunk,
+                              InstallerCopyRingFile *small, GCancellable *cancellable) {
+    InstallerCopyRing *ring = NULL;
+    g_autoptr(GError) err = NULL;
+    guint n_small = 0;
+
+    if (run->ring_depth == 0 || !(ring = get_thread_ring())) {
+        return 0;
+    }
+
+    for (guint i = chunk->start; i < chunk->end; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+
+        if (entry->size <= INSTALLER_COPY_RING_MAX_FILE_SIZE) {
+            small[n_small].path = entry->path;
+            small[n_small].size = entry->size;
+            n_small++;
+        }
+    }
+
+    // Files the ring did not get to are copied the slow way
+    if (!installer_copy_ring_copy(ring, run->src_root, run->dst_root, small, n_small,
+                                  run->ring_depth, cancellable, &err) &&
+        !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_warning("Error copying with io_uring: %s", err->message);
+        g_private_replace(&thread_ring, NULL);
+    }
+
+    return n_small;
+}
+
+/**
+ * finish_small_file:
+ *
+ * Sets the metadata of a file copied by a ring. A file the ring failed
+ * on is copied again with copy_file(), which reports a better error if
+ * it fails again.
+ */
+static gint finish_small_file(CopyRun *run, CopyEntry *entry, gint result,
+                              guint64 *copied) {
+    if (result != 0) {
+        if (unlinkat(run->dst_root, entry->path, 0) != 0 && errno != ENOENT) {
+            return errno;
+        }
+        return copy_file(run, entry, copied);
+    }
+
+    if (!apply_metadata_at(run, entry)) {
+        return errno;
+    }
+
+    *copied = entry->size;
+    return 0;
+}
+
+/**
+ * readahead_chunk:
+ *
+ * Starts reading the source of a chunk that has not been claimed yet,
+ * so the reads queue on the device in order while the workers are busy
+ * decompressing or writing what came before. When a chunk is claimed,
+ * the chunks just before it are still being copied by the other
+ * workers, so the next to be claimed is a pool's width ahead.
+ */
+static void readahead_chunk(CopyRun *run, guint index) {
+    CopyChunk *chunk = NULL;
+    guint64 start = G_MAXUINT64;
+    guint64 end = 0;
+
+    if (index >= run->chunks->len) {
+        return;
+    }
+
+    chunk = &g_array_index(run->chunks, CopyChunk, index);
+    for (guint i = chunk->start; i < chunk->end; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+        gint fd = -1;
+
+        if (entry->src_length == 0) {
+            continue;
+        }
+
+        if (run->squashfs) {
+            start = MIN(start, entry->src_offset);
+            end = MAX(end, entry->src_offset + entry->src_length);
+            continue;
+        }
+
+        // The page cache is per file, so each file is read ahead on its own
+        fd = openat(run->src_root, entry->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+    }
+
+    if (run->squashfs && end > start) {
+        installer_squashfs_readahead(run->squashfs, start, end - start);
+    }
+}
+
+/**
+ * copy_files:
+ *
+ * Returns: %FALSE if the copy failed or was cancelled
+ */
+static gboolean copy_files(CopyRun *run, const CopyChunk *chunk,
+                           GCancellable *cancellable) {
+    InstallerCopyEngine *engine = run_get_engine(run);
+    g_autofree InstallerCopyRingFile *small = g_new0(InstallerCopyRingFile,
+                                                     chunk->end - chunk->start);
+    guint n_small = copy_small_files(run, chunk, small, cancellable);
+    guint next_small = 0;
+
+    for (guint i = chunk->start; i < chunk->end; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+        guint64 copied = 0;
+        gint errsv = 0;
+
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return FALSE;
+        }
+
+        if (run->squashfs) {
+            g_autoptr(GError) err = NULL;
+
+            if (!copy_squashfs_file(run, entry, &copied, &err)) {
+                run_fail_error(run, g_steal_pointer(&err));
+                return FALSE;
+            }
+        } else if (n_small > 0 && entry->size <= INSTALLER_COPY_RING_MAX_FILE_SIZE) {
+            errsv = finish_small_file(run, entry, small[next_small++].result, &copied);
+        } else {
+            errsv = copy_file(run, entry, &copied);
+        }
+
+        if (errsv != 0) {
+            run_fail(run, errsv, "copying", entry->path);
+            return FALSE;
+        }
+
+        g_mutex_lock(&engine->progress_lock);
+        engine->progress.files_done++;
+        engine->progress.bytes_done += copied;
+        g_mutex_unlock(&engine->progress_lock);
+    }
+
+    return TRUE;
+}
+
+/* Syncing and journaling */
+
+/**
+ * sync_filesystems:
+ *
+ * Syncs every filesystem of the target once, so their writeback is
+ * done in one pass each rather than file by file.
+ */
+static gboolean sync_filesystems(CopyRun *run, GError **err) {
+    InstallerCopyEngine *engine = run_get_engine(run);
+
+    if (!installer_durability_syncfs(run->dst_root, engine->target, err)) {
+        return FALSE;
+    }
+
+    for (guint i = 0; i < run->dst_mounts->len; i++) {
+        if (!installer_durability_syncfs(g_array_index(run->dst_mounts, gint, i),
+                                         engine->target, err)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * sync_target:
+ *
+ * Syncs the target at the end of a phase, unless that is left to the
+ * kernel.
+ */
+static gboolean sync_target(CopyRun *run) {
+    g_autoptr(GError) err = NULL;
+
+    if (run->durability == INSTALLER_DURABILITY_NONE) {
+        return TRUE;
+    }
+
+    if (!sync_filesystems(run, &err)) {
+        run_fail_error(run, g_steal_pointer(&err));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * journal_checkpoint:
+ * @force: %TRUE to record whatever is pending, however little
+ *
+ * Records the done files in the journal. They are only synced in
+ * batches, so the target is synced first; the journal must never say a
+ * file is done before it is on the disk.
+ */
+static gboolean journal_checkpoint(CopyRun *run, gboolean force) {
+    g_autoptr(GArray) ranges = NULL;
+    g_autoptr(GError) err = NULL;
+    gboolean ret = TRUE;
+
+    g_mutex_lock(&run->checkpoint_lock);
+
+    // Another worker may have recorded everything while this one waited
+    g_mutex_lock(&run->lock);
+    if (force || run->journal_pending_files >= COPY_CHECKPOINT_FILES ||
+        run->journal_pending_bytes >= COPY_CHECKPOINT_BYTES) {
+        ranges = g_steal_pointer(&run->journal_pending);
+        run->journal_pending = g_array_new(FALSE, FALSE, sizeof(InstallerJournalRange));
+        run->journal_pending_files = 0;
+        run->journal_pending_bytes = 0;
+    }
+    g_mutex_unlock(&run->lock);
+
+    if (ranges && ranges->len > 0) {
+        ret = sync_filesystems(run, &err) &&
+              installer_journal_add_files(run->journal, (InstallerJournalRange *) ranges->data,
+                                          ranges->len, &err);
+    }
+
+    g_mutex_unlock(&run->checkpoint_lock);
+
+    if (!ret) {
+        run_fail_error(run, g_steal_pointer(&err));
+    }
+    return ret;
+}
+
+static gint compare_index(gconstpointer a, gconstpointer b) {
+    gsize index_a = *(const gsize *) a;
+    gsize index_b = *(const gsize *) b;
+
+    if (index_a != index_b) {
+        return index_a < index_b ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * journal_record:
+ * @start: The first of the files that are done
+ * @end: The file after the last that is done
+ *
+ * Queues done files to be recorded in the journal, as ranges of their
+ * manifest entries, and records them once there are enough.
+ */
+static void journal_record(CopyRun *run, guint start, guint end) {
+    g_autoptr(GArray) indices = NULL;
+    guint64 bytes = 0;
+    gboolean full = FALSE;
+
+    if (!run->journal || start == end) {
+        return;
+    }
+
+    indices = g_array_sized_new(FALSE, FALSE, sizeof(gsize), end - start);
+    for (guint i = start; i < end; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+        gsize index = 0;
+
+        if (installer_manifest_find(run->manifest, entry->path, &index)) {
+            g_array_append_val(indices, index);
+            bytes += entry->size;
+        }
+    }
+    g_array_sort(indices, compare_index);
+
+    g_mutex_lock(&run->lock);
+    for (guint i = 0; i < indices->len; i++) {
+        gsize index = g_array_index(indices, gsize, i);
+        InstallerJournalRange *last = NULL;
+
+        if (run->journal_pending->len > 0) {
+            last = &g_array_index(run->journal_pending, InstallerJournalRange,
+                                  run->journal_pending->len - 1);
+        }
+
+        if (last && last->end == index) {
+            last->end++;
+        } else {
+            InstallerJournalRange range = {index, index + 1};
+            g_array_append_val(run->journal_pending, range);
+        }
+    }
+    run->journal_pending_files += indices->len;
+    run->journal_pending_bytes += bytes;
+    full = run->journal_pending_files >= COPY_CHECKPOINT_FILES ||
+           run->journal_pending_bytes >= COPY_CHECKPOINT_BYTES;
+    g_mutex_unlock(&run->lock);
+
+    if (full) {
+        journal_checkpoint(run, FALSE);
+    }
+}
+
+/* Verifying */
+
+typedef struct _VerifyJob {
+    CopyRun *run;
+    guint index;
+} VerifyJob;
+
+static void verify_job_free(VerifyJob *job) {
+    CopyRun *run = job->run;
+
+    g_free(job);
+    run_job_done(run);
+}
+
+/**
+ * open_uncached:
+ *
+ * Opens a copied file so reading it comes from the disk rather than the
+ * page cache, which still has what was written. O_DIRECT writes back
+ * and skips the cache; where it is not supported, the file is synced
+ * and its pages dropped instead.
+ */
+static gint open_uncached(CopyRun *run, const gchar *path, gboolean *direct) {
+    gint fd = openat(run->dst_root, path, O_RDONLY | O_DIRECT | O_NOFOLLOW | O_CLOEXEC);
+
+    *direct = fd >= 0;
+    if (fd >= 0 || errno != EINVAL) {
+        return fd;
+    }
+
+    fd = openat(run->dst_root, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0 && (fdatasync(fd) != 0 ||
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)) {
+        gint errsv = errno;
+        close(fd);
+        errno = errsv;
+        return -1;
+    }
+
+    return fd;
+}
+
+static gboolean verify_file(CopyRun *run, CopyEntry *entry, guint8 *buffer,
+                            GCancellable *cancellable, GError **err) {
+    InstallerManifestEntry expected;
+    guint8 hash[INSTALLER_MANIFEST_HASH_SIZE];
+    gboolean direct = FALSE;
+    gboolean ret = FALSE;
+    gint fd = -1;
+
+    if (!installer_manifest_lookup(run->verify, entry->path, &expected)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "'/%s' is not in the manifest", entry->path);
+        return FALSE;
+    }
+
+    fd = open_uncached(run, entry->path, &direct);
+    if (fd < 0) {
+        return set_copy_error(err, errno, "verifying", entry->path);
+    }
+
+    ret = installer_manifest_hash_fd(installer_manifest_get_hash_type(run->verify), fd,
+                                     buffer, COPY_BUFFER_SIZE, hash, cancellable, err);
+    if (!direct) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+
+    if (!ret) {
+        g_prefix_error(err, "Error verifying '/%s': ", entry->path);
+        return FALSE;
+    }
+
+    if (memcmp(hash, expected.hash, sizeof(hash)) != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "'/%s' does not match the manifest, so the install media may be "
+                    "damaged",
+                    entry->path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * verify_chunk:
+ *
+ * Hashes the copies of a chunk's files and checks them against the
+ * manifest.
+ */
+static void verify_chunk(VerifyJob *job, GCancellable *cancellable) {
+    CopyRun *run = job->run;
+    InstallerCopyEngine *engine = run_get_engine(run);
+    CopyChunk *chunk = &g_array_index(run->chunks, CopyChunk, job->index);
+    guint8 *buffer = NULL;
+    guint i = 0;
+
+    // Mapped, since direct I/O needs page-aligned buffers
+    buffer = mmap(NULL, COPY_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        run_fail(run, errno, "verifying", "");
+        return;
+    }
+
+    for (i = chunk->start; i < chunk->end; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+        g_autoptr(GError) err = NULL;
+
+        if (g_cancellable_is_cancelled(cancellable)) {
+            break;
+        }
+
+        if (!verify_file(run, entry, buffer, cancellable, &err)) {
+            run_fail_error(run, g_steal_pointer(&err));
+            break;
+        }
+
+        g_mutex_lock(&engine->progress_lock);
+        engine->progress.files_verified++;
+        g_mutex_unlock(&engine->progress_lock);
+    }
+
+    munmap(buffer, COPY_BUFFER_SIZE);
+
+    // Only what was verified counts as done, so the rest is copied again
+    journal_record(run, chunk->start, i);
+}
+
+/**
+ * verify_submit:
+ *
+ * Queues a copied chunk for verifying. Workers only take it once there
+ * are no chunks left to copy, so verifying overlaps the end of the copy
+ * rather than slowing down the rest of it.
+ */
+static void verify_submit(CopyRun *run, guint index) {
+    VerifyJob *job = g_new0(VerifyJob, 1);
+
+    job->run = run;
+    job->index = index;
+
+    g_atomic_int_inc(&run->pending);
+    installer_executor_submit_cpu(installer_executor_get_default(),
+                                  INSTALLER_EXECUTOR_PRIORITY_LOW,
+                                  (InstallerExecutorFunc) verify_chunk, job,
+                                  (GDestroyNotify) verify_job_free, run->cancellable);
+}
+
+/**
+ * copy_chunks:
+ *
+ * Claims chunks in order until there are none left. Claiming from a
+ * shared counter, rather than queueing a job per chunk, keeps the
+ * chunks in order: the executor hands out jobs submitted from a worker
+ * newest first.
+ */
+static void copy_chunks(DataJob *job, GCancellable *cancellable) {
+    CopyRun *run = job->run;
+    guint index = 0;
+
+    while ((index = (guint) g_atomic_int_add(&run->next_chunk, 1)) < run->chunks->len) {
+        if (run->sequential) {
+            readahead_chunk(run, index + run->n_workers);
+        }
+
+        if (!copy_files(run, &g_array_index(run->chunks, CopyChunk, index), cancellable)) {
+            return;
+        }
+
+        if (run->verify) {
+            verify_submit(run, index);
+        } else {
+            CopyChunk *chunk = &g_array_index(run->chunks, CopyChunk, index);
+            journal_record(run, chunk->start, chunk->end);
+        }
+    }
+}
+
+static gint compare_path(gconstpointer a, gconstpointer b) {
+    const CopyEntry *entry_a = *(CopyEntry *const *) a;
+    const CopyEntry *entry_b = *(CopyEntry *const *) b;
+
+    return strcmp(entry_a->path, entry_b->path);
+}
+
+/**
+ * skip_done_files:
+ *
+ * Drops the files the journal says an interrupted copy already did,
+ * counting them as done.
+ */
+static void skip_done_files(CopyRun *run) {
+    InstallerCopyEngine *engine = run_get_engine(run);
+    guint n_entries = 0;
+    gpointer *entries = g_ptr_array_steal(run->files, &n_entries);
+    guint64 files = 0;
+    guint64 bytes = 0;
+
+    for (guint i = 0; i < n_entries; i++) {
+        CopyEntry *entry = entries[i];
+        gsize index = 0;
+
+        if (installer_manifest_find(run->manifest, entry->path, &index) &&
+            installer_journal_is_file_done(run->journal, index)) {
+            files++;
+            bytes += entry->size;
+            copy_entry_free(entry);
+            continue;
+        }
+
+        g_ptr_array_add(run->files, entry);
+    }
+    g_free(entries);
+
+    g_debug("Resuming copy: %" G_GUINT64_FORMAT " files already done", files);
+
+    g_mutex_lock(&engine->progress_lock);
+    engine->progress.files_done += files;
+    engine->progress.bytes_done += bytes;
+    if (run->verify) {
+        engine->progress.files_verified += files;
+    }
+    g_mutex_unlock(&engine->progress_lock);
+}
+
+static gint compare_source_offset(gconstpointer a, gconstpointer b) {
+    const CopyEntry *entry_a = *(CopyEntry *const *) a;
+    const CopyEntry *entry_b = *(CopyEntry *const *) b;
+
+    if (entry_a->src_offset != entry_b->src_offset) {
+        return entry_a->src_offset < entry_b->src_offset ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * data_submit_all:
+ *
+ * Splits the files into chunks small enough to balance across the
+ * workers, but big enough that scheduling does not dominate for the
+ * many tiny files of a root filesystem.
+ *
+ * For a sequential copy the files are sorted by where they are on the
+ * source first, so the workers move through the source together. For
+ * a journaled copy they are otherwise sorted by path, as the manifest
+ * is, so each chunk is recorded as a single range.
+ */
+static void data_submit_all(CopyRun *run) {
+    guint64 bytes = 0;
+    CopyChunk chunk = {0, 0};
+
+    if (run->journal && installer_journal_is_resumed(run->journal)) {
+        skip_done_files(run);
+    }
+
+    if (run->sequential) {
+        g_ptr_array_sort(run->files, compare_source_offset);
+    } else if (run->journal) {
+        g_ptr_array_sort(run->files, compare_path);
+    }
+
+    // Every chunk is known before any is claimed, so each can read ahead
+    for (guint i = 0; i < run->files->len; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->files, i);
+
+        bytes += entry->size;
+        if (i + 1 - chunk.start < COPY_CHUNK_FILES && bytes < COPY_CHUNK_BYTES &&
+            i + 1 < run->files->len) {
+            continue;
+        }
+
+        chunk.end = i + 1;
+        g_array_append_val(run->chunks, chunk);
+
+        chunk.start = i + 1;
+        bytes = 0;
+    }
+
+    for (guint i = 0; i < MIN(run->n_workers, run->chunks->len); i++) {
+        DataJob *job = g_new0(DataJob, 1);
+
+        job->run = run;
+
+        g_atomic_int_inc(&run->pending);
+        installer_executor_submit_cpu(installer_executor_get_default(),
+                                      INSTALLER_EXECUTOR_PRIORITY_DEFAULT,
+                                      (InstallerExecutorFunc) copy_chunks, job,
+                                      (GDestroyNotify) data_job_free, run->cancellable);
+    }
+}
+
+/* Phase 3: links and directories */
+
+static gint finish_links(CopyRun *run, const gchar **failed) {
+    for (guint i = 0; i < run->links->len; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->links, i);
+
+        if (!remove_partial(run, run->dst_root, entry->path) ||
+            linkat(run->dst_root, entry->link_to, run->dst_root, entry->path, 0) != 0) {
+            *failed = entry->path;
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * finish_dirs:
+ *
+ * Directory metadata is set last, since creating anything inside a
+ * directory changes its times.
+ */
+static gint finish_dirs(CopyRun *run, const gchar **failed) {
+    for (guint i = 0; i < run->dirs->len; i++) {
+        CopyEntry *entry = g_ptr_array_index(run->dirs, i);
+        const gchar *path = *entry->path ? entry->path : ".";
+        gint src_fd = -1;
+        gint dst_fd = -1;
+        gint errsv = 0;
+
+        *failed = entry->path;
+
+        if (!run->squashfs) {
+            src_fd = openat(run->src_root, path,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (src_fd < 0) {
+                return errno;
+            }
+        }
+
+        dst_fd = openat(run->dst_root, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dst_fd < 0) {
+            errsv = errno;
+            if (src_fd >= 0) {
+                close(src_fd);
+            }
+            return errsv;
+        }
+
+        if (!apply_metadata(run, src_fd, dst_fd, entry) || !sync_file(run, dst_fd, path)) {
+            errsv = errno;
+        }
+
+        if (src_fd >= 0) {
+            close(src_fd);
+        }
+        close(dst_fd);
+
+        if (errsv != 0) {
+            return errsv;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * journal_complete:
+ *
+ * Records that the whole copy is done, once it is all on the disk.
+ */
+static void journal_complete(CopyRun *run) {
+    g_autoptr(GError) err = NULL;
+
+    if ((run->durability == INSTALLER_DURABILITY_NONE && !sync_filesystems(run, &err)) ||
+        !installer_journal_complete_phase(run->journal, INSTALLER_COPY_ENGINE_PHASE, &err)) {
+        run_fail_error(run, g_steal_pointer(&err));
+    }
+}
+
+/* Running */
+
+static void copy_run_free(CopyRun *run) {
+    if (run->outer) {
+        g_cancellable_disconnect(run->outer, run->outer_id);
+        g_object_unref(run->outer);
+    }
+    g_object_unref(run->cancellable);
+
+    if (run->src_root >= 0) {
+        close(run->src_root);
+    }
+    close(run->dst_root);
+    for (guint i = 0; i < run->dst_mounts->len; i++) {
+        close(g_array_index(run->dst_mounts, gint, i));
+    }
+    g_array_unref(run->dst_mounts);
+
+    g_mutex_clear(&run->lock);
+    g_clear_error(&run->error);
+    g_ptr_array_unref(run->files);
+    g_ptr_array_unref(run->dirs);
+    g_ptr_array_unref(run->links);
+    g_hash_table_destroy(run->inodes);
+    g_array_unref(run->chunks);
+    g_array_unref(run->journal_pending);
+    g_mutex_clear(&run->checkpoint_lock);
+
+    g_object_unref(run->task);
+    g_free(run);
+}
+
+static void run_return(CopyRun *run) {
+    InstallerCopyEngine *engine = run_get_engine(run);
+    GTask *task = g_object_ref(run->task);
+    InstallerDurabilityStats stats;
+
+    g_atomic_int_set(&engine->running, FALSE);
+
+    installer_durability_get_stats(&stats);
+    g_debug("Copy synced: %" G_GUINT64_FORMAT " fsyncs, %" G_GUINT64_FORMAT
+            " syncfs, %" G_GUINT64_FORMAT " write-behinds so far",
+            stats.n_fsyncs, stats.n_syncfs, stats.n_write_behinds);
+
+    if (run->error) {
+        g_task_return_error(task, g_steal_pointer(&run->error));
+    } else if (!g_task_return_error_if_cancelled(task)) {
+        g_task_return_boolean(task, TRUE);
+    }
+
+    copy_run_free(run);
+    g_object_unref(task);
+}
+
+/**
+ * run_advance:
+ *
+ * Moves the copy on to its next phase once every job of the current one
+ * is done.
+ */
+static void run_advance(CopyRun *run, __attribute((unused)) GCancellable *cancellable) {
+    const gchar *failed = NULL;
+    gint errsv = 0;
+
+    if (run->error || g_cancellable_is_cancelled(run->cancellable)) {
+        // Whatever was done is kept, for the next attempt to resume from
+        if (run->journal && run->phase == COPY_PHASE_DATA) {
+            journal_checkpoint(run, TRUE);
+        }
+        run_return(run);
+        return;
+    }
+
+    switch (run->phase) {
+        case COPY_PHASE_WALK: {
+            InstallerCopyEngine *engine = run_get_engine(run);
+
+            g_mutex_lock(&engine->progress_lock);
+            engine->progress.walking = FALSE;
+            g_mutex_unlock(&engine->progress_lock);
+
+            // Held while submitting, so early finishers cannot end the phase
+            run->phase = COPY_PHASE_DATA;
+            g_atomic_int_set(&run->pending, 1);
+            data_submit_all(run);
+            run_job_done(run);
+            break;
+        }
+
+        case COPY_PHASE_DATA:
+            run->phase = COPY_PHASE_FINISH;
+
+            // The data is on the disk before the metadata says the copy is done
+            if (!sync_target(run) || (run->journal && !journal_checkpoint(run, TRUE))) {
+                run_return(run);
+                break;
+            }
+
+            errsv = finish_links(run, &failed);
+            if (errsv == 0) {
+                errsv = finish_dirs(run, &failed);
+            }
+
+            if (errsv != 0) {
+                run_fail(run, errsv, "finishing", failed);
+            } else if (sync_target(run) && run->journal) {
+                journal_complete(run);
+            }
+
+            run_return(run);
+            break;
+
+        case COPY_PHASE_FINISH:
+        default:
+            g_assert_not_reached();
+    }
+}
+
+/**
+ * run_job_done:
+ *
+ * Called as every job is freed, whether or not it ran. Whoever drops
+ * the last pending job hands the next phase to a worker, as that may be
+ * the caller of installer_copy_engine_copy_async() when the walk ends
+ * before it returns, and sorting the files must not block its thread.
+ */
+static void run_job_done(CopyRun *run) {
+    if (!g_atomic_int_dec_and_test(&run->pending)) {
+        return;
+    }
+
+    // Not cancellable: a cancelled copy still has to return
+    installer_executor_submit_cpu(installer_executor_get_default(),
+                                  INSTALLER_EXECUTOR_PRIORITY_DEFAULT,
+                                  (InstallerExecutorFunc) run_advance, run, NULL, NULL);
+}
+
+static void on_outer_cancelled(__attribute((unused)) GCancellable *outer,
+                               CopyRun *run) {
+    g_cancellable_cancel(run->cancellable);
+}
+
+/**
+ * check_privileges:
+ *
+ * The copy keeps the owner of every file and recreates device nodes,
+ * which only root may do, so without it the copy would fail part way
+ * with the target half written.
+ */
+static gboolean check_privileges(GError **err) {
+    if (geteuid() != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "Copying the system needs root to keep file owners and device nodes");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint open_root(const gchar *path, GError **err) {
+    gint fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Error opening '%s': %s", path, g_strerror(errno));
+    }
+
+    return fd;
+}
+
+/**
+ * open_target_mounts:
+ *
+ * Opens every filesystem mounted below the target, e.g. a separate
+ * /boot or /home, since syncing the target root does not reach them.
+ */
+static GArray *open_target_mounts(const gchar *target) {
+    g_autofree gchar *root = g_canonicalize_filename(target, NULL);
+    g_autofree gchar *prefix = g_str_has_suffix(root, "/") ? g_strdup(root)
+                                                            : g_strconcat(root, "/", NULL);
+    GArray *fds = g_array_new(FALSE, FALSE, sizeof(gint));
+    GList *mounts = g_unix_mounts_get(NULL);
+
+    for (GList *item = mounts; item; item = item->next) {
+        const gchar *path = g_unix_mount_get_mount_path(item->data);
+        gint fd = -1;
+
+        if (!g_str_has_prefix(path, prefix)) {
+            continue;
+        }
+
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            g_array_append_val(fds, fd);
+        }
+    }
+
+    g_list_free_full(mounts, (GDestroyNotify) g_unix_mount_free);
+    return fds;
+}
+
+static guint n_cpu_workers(void) {
+    InstallerExecutorStats stats;
+
+    installer_executor_get_stats(installer_executor_get_default(), &stats);
+    return MAX(1, stats.cpu.n_threads);
+}
+
+/**
+ * ring_depth_per_worker:
+ *
+ * Every worker has a ring, so the queue depth is split between them.
+ */
+static guint ring_depth_per_worker(guint queue_depth) {
+    if (queue_depth == 0) {
+        return 0;
+    }
+
+    return MAX(1, queue_depth / n_cpu_workers());
+}
+
+static gboolean is_excluded(InstallerCopyEngine *self, const gchar *path) {
+    g_autofree gchar *prefix = g_strdup(path);
+    gchar *slash = NULL;
+
+    do {
+        if (g_hash_table_contains(self->excludes, prefix)) {
+            return TRUE;
+        }
+
+        slash = strrchr(prefix, '/');
+        if (slash) {
+            *slash = '\0';
+        }
+    } while (slash);
+
+    return FALSE;
+}
+
+/**
+ * manifest_totals:
+ *
+ * Counts the files the copy will find as the walk does: leaving out
+ * excluded paths, and counting a hardlinked file at its first name.
+ */
+static void manifest_totals(InstallerCopyEngine *self, guint64 *files, guint64 *bytes) {
+    g_autoptr(GHashTable) seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+    gsize n_entries = installer_manifest_get_n_entries(self->manifest);
+
+    *files = 0;
+    *bytes = 0;
+
+    for (gsize i = 0; i < n_entries; i++) {
+        InstallerManifestEntry entry;
+
+        installer_manifest_get_entry(self->manifest, i, &entry);
+        if (!S_ISREG(entry.mode) || is_excluded(self, entry.path)) {
+            continue;
+        }
+
+        if (entry.hardlink != 0) {
+            if (g_hash_table_contains(seen, GUINT_TO_POINTER(entry.hardlink))) {
+                continue;
+            }
+            g_hash_table_add(seen, GUINT_TO_POINTER(entry.hardlink));
+        }
+
+        (*files)++;
+        *bytes += entry.size;
+    }
+}
+
+void installer_copy_engine_copy_async(InstallerCopyEngine *self,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data) {
+    g_autoptr(GTask) task = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autoptr(CopyEntry) root = NULL;
+    InstallerSquashfsInode root_inode;
+    struct statx stx;
+    CopyRun *run = NULL;
+    gint src_root = -1;
+    gint dst_root = -1;
+
+    g_return_if_fail(INSTALLER_IS_COPY_ENGINE(self));
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, installer_copy_engine_copy_async);
+
+    if (!check_privileges(&err)) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    if (g_atomic_int_get(&self->running)) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_BUSY,
+                                "A copy is already running");
+        return;
+    }
+
+    if (self->verify && !self->manifest) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Verifying a copy needs a manifest");
+        return;
+    }
+
+    // Caught before anything is written rather than at the first file verified
+    if (self->verify && !installer_manifest_check_hash_type(self->manifest, &err)) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    if (self->journal && !self->manifest) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Journaling a copy needs a manifest");
+        return;
+    }
+
+    if (self->journal &&
+        installer_journal_is_phase_done(self->journal, INSTALLER_COPY_ENGINE_PHASE)) {
+        g_debug("Skipping copy: the journal says it is done");
+        g_task_return_boolean(task, TRUE);
+        return;
+    }
+
+    if (self->squashfs) {
+        if (!installer_squashfs_read_inode(self->squashfs,
+                                           installer_squashfs_get_root(self->squashfs),
+                                           &root_inode, &err)) {
+            g_task_return_error(task, g_steal_pointer(&err));
+            return;
+        }
+        root = copy_entry_new_squashfs("", &root_inode);
+    } else {
+        src_root = open_root(self->source, &err);
+        if (src_root < 0) {
+            g_task_return_error(task, g_steal_pointer(&err));
+            return;
+        }
+
+        if (statx(src_root, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &stx) != 0) {
+            g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(errno),
+                                    "Error reading '%s': %s", self->source,
+                                    g_strerror(errno));
+            close(src_root);
+            return;
+        }
+        root = copy_entry_new("", &stx);
+    }
+
+    dst_root = open_root(self->target, &err);
+    if (dst_root < 0) {
+        if (src_root >= 0) {
+            close(src_root);
+        }
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    run = g_new0(CopyRun, 1);
+    run->task = g_object_ref(task);
+    run->squashfs = self->squashfs;
+    run->src_root = src_root;
+    run->dst_root = dst_root;
+    run->durability = self->durability;
+    run->dst_mounts = self->durability != INSTALLER_DURABILITY_NONE || self->journal
+                          ? open_target_mounts(self->target)
+                          : g_array_new(FALSE, FALSE, sizeof(gint));
+    // io_uring only helps when there is a file to read from, and a strict
+    // copy syncs every file as it is finished, which needs its own fd
+    if (!self->squashfs) {
+        run->src_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        if (self->durability != INSTALLER_DURABILITY_STRICT) {
+            run->ring_depth = ring_depth_per_worker(self->queue_depth);
+        }
+    }
+    run->sequential = self->sequential;
+    run->manifest = self->manifest;
+    run->verify = self->verify ? self->manifest : NULL;
+    run->journal = self->journal;
+    run->n_workers = n_cpu_workers();
+    run->phase = COPY_PHASE_WALK;
+    g_mutex_init(&run->lock);
+    run->files = g_ptr_array_new_with_free_func((GDestroyNotify) copy_entry_free);
+    run->dirs = g_ptr_array_new_with_free_func((GDestroyNotify) copy_entry_free);
+    run->links = g_ptr_array_new_with_free_func((GDestroyNotify) copy_entry_free);
+    run->inodes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    run->chunks = g_array_new(FALSE, FALSE, sizeof(CopyChunk));
+    run->journal_pending = g_array_new(FALSE, FALSE, sizeof(InstallerJournalRange));
+    g_mutex_init(&run->checkpoint_lock);
+
+    // Errors cancel every job, without touching the caller's cancellable
+    run->cancellable = g_cancellable_new();
+    if (cancellable) {
+        run->outer = g_object_ref(cancellable);
+        run->outer_id = g_cancellable_connect(cancellable,
+                                              G_CALLBACK(on_outer_cancelled), run, NULL);
+    }
+
+    // The root itself only needs its metadata set
+    g_ptr_array_add(run->dirs, g_steal_pointer(&root));
+
+    g_mutex_lock(&self->progress_lock);
+    memset(&self->progress, 0, sizeof(self->progress));
+    self->progress.walking = TRUE;
+    if (self->manifest) {
+        manifest_totals(self, &self->progress.files_total, &self->progress.bytes_total);
+        run->exact_totals = TRUE;
+    }
+    g_mutex_unlock(&self->progress_lock);
+
+    g_atomic_int_set(&self->running, TRUE);
+
+    g_atomic_int_set(&run->pending, 1);
+    walk_submit(run, "", self->squashfs ? installer_squashfs_get_root(self->squashfs) : 0);
+    run_job_done(run);
+}
+
+gboolean installer_copy_engine_copy_finish(InstallerCopyEngine *self,
+                                           GAsyncResult *result, GError **err) {
+    g_return_val_if_fail(INSTALLER_IS_COPY_ENGINE(self), FALSE);
+    g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), err);
+}
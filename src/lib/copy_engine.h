@@ -0,0 +1,238 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_COPY_ENGINE_H
+#define INSTALLER_COPY_ENGINE_H
+
+#include "durability.h"
+#include "journal.h"
+#include "manifest.h"
+#include "squashfs.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The phase a journaled copy records once it is done */
+#define INSTALLER_COPY_ENGINE_PHASE "copy"
+
+#define INSTALLER_TYPE_COPY_ENGINE (installer_copy_engine_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerCopyEngine, installer_copy_engine, INSTALLER,
+                     COPY_ENGINE, GObject)
+
+/**
+ * InstallerCopyProgress:
+ * @walking: %TRUE while the source tree is still being walked, in which
+ *     case the totals are still growing unless they came from a manifest
+ * @files_total: Regular files found so far
+ * @files_done: Regular files copied
+ * @bytes_total: Size of the regular files found so far
+ * @bytes_done: Bytes copied
+ * @files_verified: Regular files checked against the manifest, if the
+ *     copy is verified
+ *
+ * How far a copy has got.
+ */
+typedef struct _InstallerCopyProgress {
+    gboolean walking;
+    guint64 files_total;
+    guint64 files_done;
+    guint64 bytes_total;
+    guint64 bytes_done;
+    guint64 files_verified;
+} InstallerCopyProgress;
+
+/**
+ * installer_copy_engine_new:
+ * @source: The root of the tree to copy, e.g. the live filesystem
+ * @target: An existing, empty directory to copy it into
+ *
+ * Returns: (transfer full): A new #InstallerCopyEngine
+ */
+InstallerCopyEngine *installer_copy_engine_new(const gchar *source,
+                                               const gchar *target);
+
+/**
+ * installer_copy_engine_new_from_squashfs:
+ * @source: The squashfs image to copy, e.g. the live root image
+ * @target: An existing, empty directory to copy it into
+ *
+ * Creates a copy engine that reads the image itself rather than a
+ * mount of it, so files are decompressed on every worker instead of
+ * one kernel thread. Sockets in the image are skipped, and io_uring is
+ * not used.
+ *
+ * Returns: (transfer full): A new #InstallerCopyEngine
+ */
+InstallerCopyEngine *installer_copy_engine_new_from_squashfs(InstallerSquashfs *source,
+                                                             const gchar *target);
+
+/**
+ * installer_copy_engine_exclude:
+ * @self: The copy engine
+ * @path: A path relative to the source root, e.g. "proc"
+ *
+ * Leaves @path and everything below it out of the copy. Mount points
+ * below the source root are never crossed, so this is only needed for
+ * paths on the source filesystem itself.
+ */
+void installer_copy_engine_exclude(InstallerCopyEngine *self, const gchar *path);
+
+/**
+ * installer_copy_engine_set_queue_depth:
+ * @self: The copy engine
+ * @depth: Small file copies to have in flight, or 0 to never use io_uring
+ *
+ * Sets how many small files may be copied with io_uring at once, split
+ * between the workers. The default suits an SSD; a spinning disk may
+ * do better with less. Where io_uring is not available, every file is
+ * copied with copy_file_range() instead.
+ */
+void installer_copy_engine_set_queue_depth(InstallerCopyEngine *self, guint depth);
+
+/**
+ * installer_copy_engine_set_sequential:
+ * @self: The copy engine
+ * @sequential: %TRUE to read the source in the order it is stored
+ *
+ * Makes the copy read files in the order their data is stored on the
+ * source, as found with FIEMAP or from the squashfs image, and read
+ * ahead of the workers. This is meant for media that seek slowly, like
+ * USB 2 sticks and optical discs, but costs an extra open of every file
+ * while walking a directory source. It is off by default. The
+ * `copy-order` benchmark compares both orders on such a device.
+ */
+void installer_copy_engine_set_sequential(InstallerCopyEngine *self,
+                                          gboolean sequential);
+
+/**
+ * installer_copy_engine_set_manifest:
+ * @self: The copy engine
+ * @manifest: (nullable): A manifest of the source tree
+ *
+ * Takes the progress totals from a manifest, so they are exact from the
+ * start of the copy rather than growing while the source is walked.
+ */
+void installer_copy_engine_set_manifest(InstallerCopyEngine *self,
+                                        InstallerManifest *manifest);
+
+/**
+ * installer_copy_engine_set_verify:
+ * @self: The copy engine
+ * @verify: %TRUE to check every copied file against the manifest
+ *
+ * Makes the copy read back every file it wrote, from the disk rather
+ * than the page cache, and compare its hash with the manifest set with
+ * installer_copy_engine_set_manifest(). This catches damaged install
+ * media, e.g. a flaky USB stick. Files are verified on the workers as
+ * they run out of files to copy, so most of the checking happens while
+ * the last files are still being copied. A file that does not match
+ * fails the copy with %G_IO_ERROR_INVALID_DATA. A manifest whose hash
+ * this build cannot make fails the copy before anything is written.
+ */
+void installer_copy_engine_set_verify(InstallerCopyEngine *self, gboolean verify);
+
+/**
+ * installer_copy_engine_set_durability:
+ * @self: The copy engine
+ * @durability: How hard to work to get the copy onto the disk
+ *
+ * The default, %INSTALLER_DURABILITY_BATCHED, starts writing large
+ * files out while they are copied and syncs each target filesystem,
+ * including any mounted below the target, once after the file data is
+ * copied and once at the end. %INSTALLER_DURABILITY_STRICT also syncs
+ * every file and directory as it is finished, and does not use
+ * io_uring. Files that must survive a power cut straight after they are
+ * written, like /etc/fstab and the bootloader config, should still go
+ * through installer_durability_barrier().
+ */
+void installer_copy_engine_set_durability(InstallerCopyEngine *self,
+                                          InstallerDurability durability);
+
+/**
+ * installer_copy_engine_set_journal:
+ * @self: The copy engine
+ * @journal: (nullable): The journal of the install
+ *
+ * Records the files that are done in a journal, so an interrupted copy
+ * can be resumed. Files are recorded in batches, after syncing the
+ * target, and only once verified if the copy is verified. A resumed
+ * copy walks the source again, recreating directories, symlinks and
+ * device nodes, but only copies the files the journal does not list.
+ * Once everything is copied, %INSTALLER_COPY_ENGINE_PHASE is recorded,
+ * and a later copy with the same journal does nothing. This needs a
+ * manifest, set with installer_copy_engine_set_manifest().
+ */
+void installer_copy_engine_set_journal(InstallerCopyEngine *self,
+                                       InstallerJournal *journal);
+
+/**
+ * installer_copy_engine_copy_async:
+ * @self: The copy engine
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Called once the copy is done
+ * @user_data: Data to pass to @callback
+ *
+ * Copies the source tree into the target directory, keeping ownership,
+ * permissions, timestamps, extended attributes, symlinks, hardlinks and
+ * device nodes. Holes in large files, and blocks of zeroes in them, are
+ * left as holes in the copy.
+ *
+ * The copy runs in three phases on the default executor's CPU pool:
+ * every directory is walked and created, with workers stealing
+ * subtrees from each other; then file data is copied in parallel with
+ * copy_file_range(), or io_uring for small files; and finally hardlinks
+ * are made and directory metadata is set. Moving between phases also
+ * happens on the pool, never on the caller's thread. Only one copy may
+ * run at a time.
+ *
+ * Keeping ownership and device nodes needs root, so an unprivileged
+ * copy fails with %G_IO_ERROR_PERMISSION_DENIED before anything is
+ * written.
+ */
+void installer_copy_engine_copy_async(InstallerCopyEngine *self,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data);
+
+/**
+ * installer_copy_engine_copy_finish:
+ * @self: The copy engine
+ * @result: The #GAsyncResult passed to the callback
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: %TRUE if everything was copied
+ */
+gboolean installer_copy_engine_copy_finish(InstallerCopyEngine *self,
+                                           GAsyncResult *result, GError **err);
+
+/**
+ * installer_copy_engine_get_progress:
+ * @self: The copy engine
+ * @progress: (out): Place to store the progress
+ *
+ * Gets the progress of the running copy. This may be called from any
+ * thread, e.g. from a timeout updating a progress bar.
+ */
+void installer_copy_engine_get_progress(InstallerCopyEngine *self,
+                                        InstallerCopyProgress *progress);
+
+G_END_DECLS
+
+#endif
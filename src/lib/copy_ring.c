@@ -0,0 +1,335 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "copy_ring.h"
+
+#ifdef HAVE_LIBURING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/mman.h>
+
+/* The operations of each file's chain, in order, then the extra closes
+ * of a chain that broke before closing its files */
+typedef enum {
+    RING_OP_OPEN_SRC,
+    RING_OP_OPEN_DST,
+    RING_OP_READ,
+    RING_OP_WRITE,
+    RING_OP_CLOSE_SRC,
+    RING_OP_CLOSE_DST,
+    RING_OP_CLEANUP,
+} RingOp;
+
+#define RING_CHAIN_LENGTH RING_OP_CLEANUP
+
+/* Room for every chain at once, plus the cleanup of every chain */
+#define RING_ENTRIES 256
+G_STATIC_ASSERT(RING_ENTRIES >= INSTALLER_COPY_RING_MAX_DEPTH * (RING_CHAIN_LENGTH + 2));
+
+#define RING_DATA(slot, op) (((guint64) (slot) << 3) | (op))
+#define RING_DATA_SLOT(data) ((guint) ((data) >> 3))
+#define RING_DATA_OP(data) ((RingOp) ((data) & 7))
+
+/* Each slot has a buffer and two fixed files: source, then copy */
+#define RING_SRC_FILE(slot) (2 * (slot))
+#define RING_DST_FILE(slot) (2 * (slot) + 1)
+
+typedef struct _RingSlot {
+    InstallerCopyRingFile *file;
+    guint pending;
+    gint error;
+    gboolean closed[2];
+} RingSlot;
+
+struct _InstallerCopyRing {
+    struct io_uring ring;
+    guint8 *buffers;
+    gsize buffers_size;
+    RingSlot slots[INSTALLER_COPY_RING_MAX_DEPTH];
+    guint n_active;
+    gboolean broken;
+};
+
+static void set_ring_error(GError **err, gint ret, const gchar *what) {
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(-ret), "Error %s: %s", what,
+                g_strerror(-ret));
+}
+
+InstallerCopyRing *installer_copy_ring_new(GError **err) {
+    g_autoptr(InstallerCopyRing) self = g_new0(InstallerCopyRing, 1);
+    struct io_uring_params params = {0};
+    struct iovec iov[INSTALLER_COPY_RING_MAX_DEPTH];
+    gint fds[RING_DST_FILE(INSTALLER_COPY_RING_MAX_DEPTH)];
+    gint ret = 0;
+
+    ret = io_uring_queue_init_params(RING_ENTRIES, &self->ring, &params);
+    if (ret < 0) {
+        // Nothing to tear down
+        set_ring_error(err, ret, "setting up io_uring");
+        g_free(g_steal_pointer(&self));
+        return NULL;
+    }
+
+    // Opening into fixed slots needs Linux 5.15, which has no feature
+    // flag of its own; this one arrived in 5.17
+    if (!(params.features & IORING_FEAT_CQE_SKIP)) {
+        g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                            "The kernel is too old to copy with io_uring");
+        return NULL;
+    }
+
+    self->buffers_size = (gsize) INSTALLER_COPY_RING_MAX_DEPTH *
+                         INSTALLER_COPY_RING_MAX_FILE_SIZE;
+    self->buffers = mmap(NULL, self->buffers_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->buffers == MAP_FAILED) {
+        self->buffers = NULL;
+        set_ring_error(err, -errno, "allocating io_uring buffers");
+        return NULL;
+    }
+
+    for (guint i = 0; i < INSTALLER_COPY_RING_MAX_DEPTH; i++) {
+        iov[i].iov_base = self->buffers + (gsize) i * INSTALLER_COPY_RING_MAX_FILE_SIZE;
+        iov[i].iov_len = INSTALLER_COPY_RING_MAX_FILE_SIZE;
+    }
+
+    // Registered once, so reads and writes do not pin the pages each time
+    ret = io_uring_register_buffers(&self->ring, iov, G_N_ELEMENTS(iov));
+    if (ret < 0) {
+        set_ring_error(err, ret, "registering io_uring buffers");
+        return NULL;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(fds); i++) {
+        fds[i] = -1;
+    }
+
+    ret = io_uring_register_files(&self->ring, fds, G_N_ELEMENTS(fds));
+    if (ret < 0) {
+        set_ring_error(err, ret, "registering io_uring files");
+        return NULL;
+    }
+
+    return g_steal_pointer(&self);
+}
+
+void installer_copy_ring_free(InstallerCopyRing *self) {
+    if (!self) {
+        return;
+    }
+
+    io_uring_queue_exit(&self->ring);
+    if (self->buffers) {
+        munmap(self->buffers, self->buffers_size);
+    }
+    g_free(self);
+}
+
+static void queue_file(InstallerCopyRing *self, guint index,
+                       InstallerCopyRingFile *file, gint src_root, gint dst_root) {
+    RingSlot *slot = &self->slots[index];
+    guint8 *buffer = self->buffers + (gsize) index * INSTALLER_COPY_RING_MAX_FILE_SIZE;
+    struct io_uring_sqe *sqe[RING_CHAIN_LENGTH];
+
+    // The ring is sized so there is always room for a whole chain
+    for (guint op = 0; op < RING_CHAIN_LENGTH; op++) {
+        sqe[op] = io_uring_get_sqe(&self->ring);
+    }
+
+    io_uring_prep_openat_direct(sqe[RING_OP_OPEN_SRC], src_root, file->path,
+                                O_RDONLY | O_NOFOLLOW, 0, RING_SRC_FILE(index));
+    io_uring_prep_openat_direct(sqe[RING_OP_OPEN_DST], dst_root, file->path,
+                                O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600,
+                                RING_DST_FILE(index));
+    io_uring_prep_read_fixed(sqe[RING_OP_READ], RING_SRC_FILE(index), buffer,
+                             file->size, 0, index);
+    io_uring_prep_write_fixed(sqe[RING_OP_WRITE], RING_DST_FILE(index), buffer,
+                              file->size, 0, index);
+    io_uring_prep_close_direct(sqe[RING_OP_CLOSE_SRC], RING_SRC_FILE(index));
+    io_uring_prep_close_direct(sqe[RING_OP_CLOSE_DST], RING_DST_FILE(index));
+
+    sqe[RING_OP_READ]->flags |= IOSQE_FIXED_FILE;
+    sqe[RING_OP_WRITE]->flags |= IOSQE_FIXED_FILE;
+
+    // A failure, including a short read or write, cancels the rest
+    for (guint op = 0; op < RING_CHAIN_LENGTH; op++) {
+        io_uring_sqe_set_data64(sqe[op], RING_DATA(index, op));
+        if (op + 1 < RING_CHAIN_LENGTH) {
+            sqe[op]->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    slot->file = file;
+    slot->pending = RING_CHAIN_LENGTH;
+    slot->error = 0;
+    slot->closed[0] = FALSE;
+    slot->closed[1] = FALSE;
+    self->n_active++;
+}
+
+static void complete_op(InstallerCopyRing *self, guint64 data, gint res) {
+    guint index = RING_DATA_SLOT(data);
+    RingOp op = RING_DATA_OP(data);
+    RingSlot *slot = &self->slots[index];
+
+    switch (op) {
+        case RING_OP_READ:
+        case RING_OP_WRITE:
+            if (res >= 0 && (gsize) res != slot->file->size) {
+                res = -EIO;
+            }
+            break;
+        case RING_OP_CLOSE_SRC:
+        case RING_OP_CLOSE_DST:
+            slot->closed[op - RING_OP_CLOSE_SRC] = res >= 0;
+            break;
+        case RING_OP_CLEANUP:
+            // The slot may never have been opened
+            res = 0;
+            break;
+        default:
+            break;
+    }
+
+    // Keep the error that broke the chain over the cancellations it caused
+    if (res < 0 && (slot->error == 0 || slot->error == ECANCELED)) {
+        slot->error = -res;
+    }
+
+    if (--slot->pending > 0) {
+        return;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(slot->closed); i++) {
+        struct io_uring_sqe *sqe = NULL;
+
+        if (slot->closed[i]) {
+            continue;
+        }
+
+        sqe = io_uring_get_sqe(&self->ring);
+        io_uring_prep_close_direct(sqe, i == 0 ? RING_SRC_FILE(index) : RING_DST_FILE(index));
+        io_uring_sqe_set_data64(sqe, RING_DATA(index, RING_OP_CLEANUP));
+        slot->closed[i] = TRUE;
+        slot->pending++;
+    }
+
+    if (slot->pending > 0) {
+        return;
+    }
+
+    slot->file->result = slot->error;
+    slot->file = NULL;
+    self->n_active--;
+}
+
+static guint find_free_slot(InstallerCopyRing *self) {
+    for (guint i = 0; i < INSTALLER_COPY_RING_MAX_DEPTH; i++) {
+        if (!self->slots[i].file) {
+            return i;
+        }
+    }
+
+    g_assert_not_reached();
+}
+
+gboolean installer_copy_ring_copy(InstallerCopyRing *self, gint src_root,
+                                  gint dst_root, InstallerCopyRingFile *files,
+                                  guint n_files, guint depth,
+                                  GCancellable *cancellable, GError **err) {
+    guint next = 0;
+
+    g_return_val_if_fail(self != NULL, FALSE);
+    g_return_val_if_fail(!self->broken, FALSE);
+    g_return_val_if_fail(files != NULL || n_files == 0, FALSE);
+
+    for (guint i = 0; i < n_files; i++) {
+        g_return_val_if_fail(files[i].size <= INSTALLER_COPY_RING_MAX_FILE_SIZE, FALSE);
+        files[i].result = ECANCELED;
+    }
+
+    depth = CLAMP(depth, 1, INSTALLER_COPY_RING_MAX_DEPTH);
+
+    while (next < n_files || self->n_active > 0) {
+        struct io_uring_cqe *cqe = NULL;
+        guint head = 0;
+        guint seen = 0;
+        gint ret = 0;
+
+        // Once cancelled, only the files in flight are finished
+        while (next < n_files && self->n_active < depth &&
+               !g_cancellable_is_cancelled(cancellable)) {
+            queue_file(self, find_free_slot(self), &files[next], src_root, dst_root);
+            next++;
+        }
+
+        if (self->n_active == 0) {
+            break;
+        }
+
+        ret = io_uring_submit_and_wait(&self->ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            self->broken = TRUE;
+            set_ring_error(err, ret, "submitting to io_uring");
+            return FALSE;
+        }
+
+        io_uring_for_each_cqe(&self->ring, head, cqe) {
+            complete_op(self, cqe->user_data, cqe->res);
+            seen++;
+        }
+        io_uring_cq_advance(&self->ring, seen);
+    }
+
+    if (next < n_files) {
+        g_cancellable_set_error_if_cancelled(cancellable, err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+#else
+
+struct _InstallerCopyRing {
+    gint unused;
+};
+
+InstallerCopyRing *installer_copy_ring_new(GError **err) {
+    g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "The installer was built without io_uring support");
+    return NULL;
+}
+
+void installer_copy_ring_free(InstallerCopyRing *self) {
+    g_free(self);
+}
+
+gboolean installer_copy_ring_copy(__attribute((unused)) InstallerCopyRing *self,
+                                  __attribute((unused)) gint src_root,
+                                  __attribute((unused)) gint dst_root,
+                                  __attribute((unused)) InstallerCopyRingFile *files,
+                                  __attribute((unused)) guint n_files,
+                                  __attribute((unused)) guint depth,
+                                  __attribute((unused)) GCancellable *cancellable,
+                                  __attribute((unused)) GError **err) {
+    g_return_val_if_reached(FALSE);
+}
+
+#endif
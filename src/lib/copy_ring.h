@@ -0,0 +1,113 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_COPY_RING_H
+#define INSTALLER_COPY_RING_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Files up to this size are copied with a single read and write */
+#define INSTALLER_COPY_RING_MAX_FILE_SIZE (128 * 1024)
+
+/* Most files a ring has in flight at once */
+#define INSTALLER_COPY_RING_MAX_DEPTH 32
+
+/**
+ * InstallerCopyRing:
+ *
+ * An io_uring used to copy small files. Each file is copied by one
+ * linked chain of operations: open both files into fixed file slots,
+ * read into a registered buffer, write it out, and close both, so the
+ * whole copy costs a share of one io_uring_enter() call rather than
+ * six syscalls.
+ *
+ * A ring may only be used by one thread at a time.
+ */
+typedef struct _InstallerCopyRing InstallerCopyRing;
+
+/**
+ * InstallerCopyRingFile:
+ * @path: The path of the file, relative to both roots
+ * @size: The size of the file, at most %INSTALLER_COPY_RING_MAX_FILE_SIZE
+ * @result: Set to 0 once the file is copied, or to the errno of the
+ *     failure
+ *
+ * A file to copy with an #InstallerCopyRing.
+ */
+typedef struct _InstallerCopyRingFile {
+    const gchar *path;
+    gsize size;
+    gint result;
+} InstallerCopyRingFile;
+
+/**
+ * installer_copy_ring_new:
+ * @err: (out): Place to store an error (if any)
+ *
+ * Sets up a ring, with its buffers and file slots registered.
+ *
+ * Fails with %G_IO_ERROR_NOT_SUPPORTED if the installer was built
+ * without liburing, or the kernel cannot open and close files into
+ * fixed slots (Linux 5.15).
+ *
+ * Returns: (transfer full) (nullable): The new ring, or %NULL
+ */
+InstallerCopyRing *installer_copy_ring_new(GError **err);
+
+/**
+ * installer_copy_ring_free:
+ * @self: The ring to free
+ *
+ * Tears down a ring. Anything still in flight is cancelled.
+ */
+void installer_copy_ring_free(InstallerCopyRing *self);
+
+/**
+ * installer_copy_ring_copy:
+ * @self: The ring
+ * @src_root: A directory fd the source paths are relative to
+ * @dst_root: A directory fd the copies are created relative to
+ * @files: (array length=n_files): The files to copy
+ * @n_files: The number of files
+ * @depth: The most files to have in flight at once
+ * @cancellable: (nullable): A #GCancellable
+ * @err: (out): Place to store an error (if any)
+ *
+ * Copies the data of each file into a new file, created with mode 0600.
+ * The copies get no other metadata. A file that fails gets the errno in
+ * its @result, and may leave a partial copy behind.
+ *
+ * If the ring itself fails, or @cancellable is cancelled, the files not
+ * yet copied are left with a non-zero @result and %FALSE is returned.
+ * A ring that fails with anything but %G_IO_ERROR_CANCELLED must be
+ * freed.
+ *
+ * Returns: %TRUE if every file was attempted
+ */
+gboolean installer_copy_ring_copy(InstallerCopyRing *self, gint src_root,
+                                  gint dst_root, InstallerCopyRingFile *files,
+                                  guint n_files, guint depth,
+                                  GCancellable *cancellable, GError **err);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(InstallerCopyRing, installer_copy_ring_free)
+
+G_END_DECLS
+
+#endif
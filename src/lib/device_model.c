@@ -0,0 +1,169 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "device_model.h"
+
+struct _InstallerDeviceModel {
+    GObject parent_instance;
+
+    GType item_type;
+    InstallerDeviceKeyFunc key_func;
+    GEqualFunc equal_func;
+
+    GPtrArray *items;
+};
+
+static void installer_device_model_list_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(InstallerDeviceModel, installer_device_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL,
+                                              installer_device_model_list_model_init));
+
+static void installer_device_model_finalize(GObject *obj);
+
+static void installer_device_model_class_init(InstallerDeviceModelClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_device_model_finalize;
+}
+
+static void installer_device_model_init(InstallerDeviceModel *self) {
+    self->items = g_ptr_array_new_with_free_func(g_object_unref);
+}
+
+static void installer_device_model_finalize(GObject *obj) {
+    InstallerDeviceModel *self = INSTALLER_DEVICE_MODEL(obj);
+
+    g_ptr_array_unref(self->items);
+
+    G_OBJECT_CLASS(installer_device_model_parent_class)->finalize(obj);
+}
+
+static GType installer_device_model_get_item_type(GListModel *model) {
+    return INSTALLER_DEVICE_MODEL(model)->item_type;
+}
+
+static guint installer_device_model_get_n_items(GListModel *model) {
+    return INSTALLER_DEVICE_MODEL(model)->items->len;
+}
+
+static gpointer installer_device_model_get_item(GListModel *model, guint position) {
+    InstallerDeviceModel *self = INSTALLER_DEVICE_MODEL(model);
+
+    if (position >= self->items->len) {
+        return NULL;
+    }
+
+    return g_object_ref(g_ptr_array_index(self->items, position));
+}
+
+static void installer_device_model_list_model_init(GListModelInterface *iface) {
+    iface->get_item_type = installer_device_model_get_item_type;
+    iface->get_n_items = installer_device_model_get_n_items;
+    iface->get_item = installer_device_model_get_item;
+}
+
+InstallerDeviceModel *installer_device_model_new(GType item_type,
+                                                 InstallerDeviceKeyFunc key_func,
+                                                 GEqualFunc equal_func) {
+    g_return_val_if_fail(g_type_is_a(item_type, G_TYPE_OBJECT), NULL);
+    g_return_val_if_fail(key_func != NULL, NULL);
+
+    InstallerDeviceModel *self = g_object_new(INSTALLER_TYPE_DEVICE_MODEL, NULL);
+
+    self->item_type = item_type;
+    self->key_func = key_func;
+    self->equal_func = equal_func ? equal_func : g_direct_equal;
+
+    return self;
+}
+
+static GHashTable *index_keys(InstallerDeviceModel *self, GPtrArray *items) {
+    // Copied, since old items may be freed while the keys are still in use
+    GHashTable *keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    for (guint i = 0; i < items->len; i++) {
+        g_hash_table_add(keys, g_strdup(self->key_func(g_ptr_array_index(items, i))));
+    }
+
+    return keys;
+}
+
+void installer_device_model_update(InstallerDeviceModel *self, GPtrArray *items) {
+    g_autoptr(GHashTable) old_keys = NULL;
+    g_autoptr(GHashTable) new_keys = NULL;
+    guint pos = 0;
+    guint next = 0;
+
+    g_return_if_fail(INSTALLER_IS_DEVICE_MODEL(self));
+    g_return_if_fail(items != NULL);
+
+    old_keys = index_keys(self, self->items);
+    new_keys = index_keys(self, items);
+
+    // Devices keep their relative order between scans, so one pass over
+    // both lists finds every change. If the order ever does change, the
+    // rows in between are replaced, which still ends in the right state.
+    while (pos < self->items->len || next < items->len) {
+        gpointer old_item = pos < self->items->len ? g_ptr_array_index(self->items, pos) : NULL;
+        gpointer new_item = next < items->len ? g_ptr_array_index(items, next) : NULL;
+
+        if (old_item && !g_hash_table_contains(new_keys, self->key_func(old_item))) {
+            g_ptr_array_remove_index(self->items, pos);
+            g_list_model_items_changed(G_LIST_MODEL(self), pos, 1, 0);
+            continue;
+        }
+
+        if (new_item && !g_hash_table_contains(old_keys, self->key_func(new_item))) {
+            g_ptr_array_insert(self->items, (gint) pos, g_object_ref(new_item));
+            g_list_model_items_changed(G_LIST_MODEL(self), pos, 0, 1);
+            pos++;
+            next++;
+            continue;
+        }
+
+        if (!old_item || !new_item) {
+            // Only reachable if @items held the same key twice
+            g_warn_if_reached();
+            break;
+        }
+
+        if (!self->equal_func(old_item, new_item)) {
+            g_ptr_array_index(self->items, pos) = g_object_ref(new_item);
+            g_object_unref(old_item);
+            g_list_model_items_changed(G_LIST_MODEL(self), pos, 1, 1);
+        }
+
+        pos++;
+        next++;
+    }
+}
+
+gboolean installer_device_model_find(InstallerDeviceModel *self, const gchar *key,
+                                     guint *position) {
+    g_return_val_if_fail(INSTALLER_IS_DEVICE_MODEL(self), FALSE);
+    g_return_val_if_fail(key != NULL, FALSE);
+
+    for (guint i = 0; i < self->items->len; i++) {
+        if (g_strcmp0(self->key_func(g_ptr_array_index(self->items, i)), key) == 0) {
+            if (position) {
+                *position = i;
+            }
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
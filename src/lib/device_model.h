@@ -0,0 +1,83 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_DEVICE_MODEL_H
+#define INSTALLER_DEVICE_MODEL_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_DEVICE_MODEL (installer_device_model_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerDeviceModel, installer_device_model, INSTALLER,
+                     DEVICE_MODEL, GObject)
+
+/**
+ * InstallerDeviceKeyFunc:
+ * @item: An item of the model
+ *
+ * Returns: (transfer none): A string that identifies the device @item
+ *          describes, such as its path, and that is unique in the model
+ */
+typedef const gchar *(*InstallerDeviceKeyFunc)(gpointer item);
+
+/**
+ * installer_device_model_new:
+ * @item_type: The #GType of the items
+ * @key_func: Gets the key of an item
+ * @equal_func: (nullable): Checks if two items with the same key can be
+ *              shown the same way, or %NULL to compare pointers
+ *
+ * Creates an empty #GListModel of devices that is updated by replacing
+ * its contents wholesale. Every update is turned into the exact inserts
+ * and removes that lead from the old contents to the new ones, so
+ * widgets bound to the model only redo the rows that changed.
+ *
+ * Returns: (transfer full): The new #InstallerDeviceModel
+ */
+InstallerDeviceModel *installer_device_model_new(GType item_type,
+                                                 InstallerDeviceKeyFunc key_func,
+                                                 GEqualFunc equal_func);
+
+/**
+ * installer_device_model_update:
+ * @self: The model
+ * @items: (element-type GObject): The new contents of the model, in order
+ *
+ * Replaces the contents of the model, emitting #GListModel::items-changed
+ * for every device that was removed, added or changed. Items that are
+ * equal to the ones already in the model are kept, and emit nothing.
+ *
+ * This must be called from the thread that owns the model.
+ */
+void installer_device_model_update(InstallerDeviceModel *self, GPtrArray *items);
+
+/**
+ * installer_device_model_find:
+ * @self: The model
+ * @key: The key of the device to look for
+ * @position: (out) (optional): Place to store the position of the device
+ *
+ * Returns: %TRUE if a device with @key is in the model
+ */
+gboolean installer_device_model_find(InstallerDeviceModel *self, const gchar *key,
+                                     guint *position);
+
+G_END_DECLS
+
+#endif
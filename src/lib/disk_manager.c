@@ -14,7 +14,41 @@
 // limitations under the License.
 //
 
+#define _GNU_SOURCE
+
 #include "disk_manager.h"
+#include "btrfs.h"
+#include "efi_fs_type_table.h"
+#include "journal.h"
+#include "os_icon_table.h"
+#include "part_class.h"
+#include "topology.h"
+#include "windows_bootloader_table.h"
+#include "windows_version_table.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gunixmounts.h>
+#include <glib-unix.h>
+#include <linux/magic.h>
+#include <linux/netlink.h>
+#include <linux/openat2.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+/* Largest os-release file we are willing to read */
+#define OS_RELEASE_MAX_SIZE 65536
+
+/* Largest uevent message the kernel sends */
+#define UEVENT_BUFFER_SIZE 8192
+/* How long to wait for a burst of uevents to settle before applying them */
+#define UEVENT_SETTLE_MS 250
+
+/* A disk spec, its partitions and the MBR type bytes, see disk_manager_read_disk() */
+#define DISK_LAYOUT_TYPE "((suttt)a(sssttttb)ay)"
 
 const gchar *os_release_paths[OS_RELEASE_PATHS_LENGTH] = {"etc/os-release",
                                                           "usr/lib/os-release"};
@@ -23,12 +57,14 @@ const gchar *lsb_release_paths[LSB_RELEASE_PATHS_LENGTH] = {
     "etc/lsb-release", "usr/lib/lsb-release",
     "usr/share/defaults/etc/lsb-release"};
 
-const gchar *os_icons[OS_ICONS_LENGTH] = {
-    "antergos", "archlinux", "crunchbang", "debian", "deepin",
-    "edubuntu", "elementary", "fedora", "frugalware", "gentoo",
-    "kubuntu", "linux-mint", "mageia", "mandriva", "manjaro",
-    "solus", "opensuse", "slackware", "steamos", "ubuntu-gnome",
-    "ubuntu-mate", "ubuntu"};
+enum {
+    SIGNAL_DEVICE_ADDED,
+    SIGNAL_DEVICE_REMOVED,
+    SIGNAL_DEVICE_CHANGED,
+    N_SIGNALS
+};
+
+static guint signals[N_SIGNALS] = {0};
 
 struct _DiskManager {
     GObject parent_instance;
@@ -37,25 +73,85 @@ struct _DiskManager {
     GRegex *re_mmcblk;
     GRegex *re_nvme;
     GRegex *re_raid;
+    GRegex *re_device_name;
+
+    GPtrArray *devices;
+    InstallerTopology *topology;
+    InstallerHelper *helper;
 
-    GSList *devices;
+    DiskScanSnapshot *snapshot;
+    gint snapshot_readers;
+    GMutex publish_lock;
 
-    GHashTable *win_prefixes;
-    GHashTable *win_bootloaders;
+    InstallerDeviceModel *drive_model;
+    InstallerDeviceModel *partition_model;
+    guint64 applied_generation;
+
+    gint uevent_fd;
+    guint uevent_source;
+    guint settle_source;
+    GHashTable *pending_disks;
 
     gboolean is_uefi;
     gint uefi_fw_size;
     gint host_size;
-    GSList *efi_types;
 };
 
 G_DEFINE_TYPE(DiskManager, disk_manager, G_TYPE_OBJECT);
 
 static void disk_manager_finalize(GObject *obj);
+static GPtrArray *blacklist_from_unix_mounts(void);
+static gboolean is_blacklisted(GPtrArray *blacklist, const gchar *path);
+static InstallerDrive *parse_disk(DiskManager *self, InstallerArena *arena,
+                                  InstallerTopology *topology, const gchar *device,
+                                  const gchar *disk, GVariant *known_layout,
+                                  GPtrArray *blacklist, GError **err);
+
+static const gchar *drive_key(gpointer item) {
+    return INSTALLER_DRIVE(item)->device;
+}
+
+static const gchar *part_item_key(gpointer item) {
+    return installer_part_item_get_path(item);
+}
 
 static void disk_manager_class_init(DiskManagerClass *klass) {
     GObjectClass *class = G_OBJECT_CLASS(klass);
     class->finalize = disk_manager_finalize;
+
+    /**
+     * DiskManager::device-added:
+     * @self: The #DiskManager
+     * @device: The path of the disk that appeared
+     *
+     * Emitted when the uevent monitor sees a new disk.
+     */
+    signals[SIGNAL_DEVICE_ADDED] =
+        g_signal_new("device-added", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST, 0,
+                     NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
+
+    /**
+     * DiskManager::device-removed:
+     * @self: The #DiskManager
+     * @device: The path of the disk that went away
+     *
+     * Emitted when the uevent monitor sees a disk being removed.
+     */
+    signals[SIGNAL_DEVICE_REMOVED] =
+        g_signal_new("device-removed", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+                     0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
+
+    /**
+     * DiskManager::device-changed:
+     * @self: The #DiskManager
+     * @device: The path of the disk that changed
+     *
+     * Emitted when the partitions on a known disk, or a stack built on
+     * top of them, changed. The disk should be parsed again.
+     */
+    signals[SIGNAL_DEVICE_CHANGED] =
+        g_signal_new("device-changed", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+                     0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
 /**
@@ -131,35 +227,21 @@ static void disk_manager_init(DiskManager *self) {
     self->re_raid = g_regex_new(
         "^[\t ]+[0-9]+[\t ]+[0-9]+[\t ]+[0-9]+[\t ]+(md[0-9]+)$", 0, 0, NULL);
 
-    /* Windows prefixes */
-
-    self->win_prefixes = g_hash_table_new(g_str_hash, g_str_equal);
-    g_hash_table_insert(self->win_prefixes, "10.", "Windows 10");
-    g_hash_table_insert(self->win_prefixes, "6.3", "Windows 8.1");
-    g_hash_table_insert(self->win_prefixes, "6.2", "Windows 8");
-    g_hash_table_insert(self->win_prefixes, "6.1", "Windows 7");
-    g_hash_table_insert(self->win_prefixes, "6.0", "Windows Vista");
-    g_hash_table_insert(self->win_prefixes, "5.2", "Windows XP");
-    g_hash_table_insert(self->win_prefixes, "5.1", "Windows XP");
-    g_hash_table_insert(self->win_prefixes, "5.0", "Windows 2000");
-    g_hash_table_insert(self->win_prefixes, "4.90", "Windows ME");
-    g_hash_table_insert(self->win_prefixes, "4.1", "Windows 98");
-    g_hash_table_insert(self->win_prefixes, "4.0.1381", "Windows NT");
-    g_hash_table_insert(self->win_prefixes, "4.0.950", "Windows 95");
-
-    /* Windows bootloaders */
-
-    self->win_bootloaders = g_hash_table_new(g_str_hash, g_str_equal);
-    g_hash_table_insert(self->win_bootloaders, "V.i.s.t.a",
-                        "Windows Vista bootloader");
-    g_hash_table_insert(self->win_bootloaders, "W.i.n.d.o.w.s. .7",
-                        "Windows 7 bootloader");
-    g_hash_table_insert(self->win_bootloaders,
-                        "W.i.n.d.o.w.s. .R.e.c.o.v.e.r.y. .E.n.v.i.r.o.n.m.e.n.t",
-                        "Windows recovery");
-    g_hash_table_insert(self->win_bootloaders,
-                        "W.i.n.d.o.w.s. .S.e.r.v.e.r. .2.0.0.8",
-                        "Windows Server 2008 bootloader");
+    /* The same set of names, for devices reported by uevents */
+
+    self->re_device_name = g_regex_new(
+        "^([^0-9]+|mmcblk[0-9]+|nvme[0-9]+n[0-9]+|md[0-9]+)$", 0, 0, NULL);
+
+    self->devices = g_ptr_array_new_with_free_func(g_free);
+    self->snapshot = disk_scan_snapshot_new(0, NULL);
+    g_mutex_init(&self->publish_lock);
+
+    self->drive_model = installer_device_model_new(INSTALLER_TYPE_DRIVE, drive_key, NULL);
+    self->partition_model = installer_device_model_new(
+        INSTALLER_TYPE_PART_ITEM, part_item_key, installer_part_item_equal);
+
+    self->uevent_fd = -1;
+    self->pending_disks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
     /* Set up UEFI knowledge */
 
@@ -188,14 +270,6 @@ static void disk_manager_init(DiskManager *self) {
         self->is_uefi = FALSE;
     }
 
-    /* Valid EFI types */
-
-    self->efi_types = g_slist_append(self->efi_types, "fat");
-    self->efi_types = g_slist_append(self->efi_types, "fat32");
-    self->efi_types = g_slist_append(self->efi_types, "fat16");
-    self->efi_types = g_slist_append(self->efi_types, "vfat");
-    self->efi_types = g_slist_append(self->efi_types, "fat12");
-
     /* Host size setup (64/32) */
 
     if (sizeof(void *) * 8 < 64) {
@@ -212,10 +286,16 @@ static void disk_manager_finalize(GObject *obj) {
     g_regex_unref(self->re_mmcblk);
     g_regex_unref(self->re_nvme);
     g_regex_unref(self->re_raid);
-    g_slist_free_full(g_steal_pointer(&self->devices), (GDestroyNotify) g_free);
-    g_hash_table_destroy(self->win_prefixes);
-    g_hash_table_destroy(self->win_bootloaders);
-    g_slist_free(g_steal_pointer(&self->efi_types));
+    g_regex_unref(self->re_device_name);
+    disk_manager_stop_monitor(self);
+    g_hash_table_destroy(self->pending_disks);
+    disk_scan_snapshot_unref(self->snapshot);
+    g_mutex_clear(&self->publish_lock);
+    g_object_unref(self->drive_model);
+    g_object_unref(self->partition_model);
+    g_ptr_array_unref(self->devices);
+    g_clear_object(&self->topology);
+    g_clear_object(&self->helper);
 
     G_OBJECT_CLASS(disk_manager_parent_class)->finalize(obj);
 }
@@ -224,8 +304,176 @@ DiskManager *disk_manager_new() {
     return g_object_new(INSTALLER_TYPE_DISK_MANAGER, NULL);
 }
 
-void disk_manager_scan_parts(DiskManager *self) {
+void disk_manager_set_helper(DiskManager *self, InstallerHelper *helper) {
     g_return_if_fail(DISK_IS_MANAGER(self));
+    g_return_if_fail(helper == NULL || INSTALLER_IS_HELPER(helper));
+
+    g_set_object(&self->helper, helper);
+}
+
+/**
+ * fill_signatures:
+ * @node: The node the signatures were read from
+ * @result: A READ_SIGNATURES result
+ */
+static void fill_signatures(InstallerTopologyNode *node, GVariant *result) {
+    g_autoptr(GVariantIter) children = NULL;
+    const gchar *member_of = NULL;
+    gchar *child = NULL;
+    guint32 member = 0;
+
+    if (!g_variant_is_of_type(result, G_VARIANT_TYPE("(usas)"))) {
+        g_debug("unexpected signatures of type %s", g_variant_get_type_string(result));
+        return;
+    }
+
+    g_variant_get(result, "(u&sas)", &member, &member_of, &children);
+    node->member = member;
+    node->member_of = *member_of ? g_strdup(member_of) : NULL;
+
+    while (g_variant_iter_next(children, "s", &child)) {
+        g_ptr_array_add(node->member_children, child);
+    }
+}
+
+typedef struct {
+    DiskManager *self;
+    const gchar *const *disks;
+    GHashTable *layouts;
+} ScanReads;
+
+/**
+ * read_with_helper:
+ * @nodes: (element-type InstallerTopologyNode): The leaf devices
+ * @sizes: (element-type guint64): Their sizes in bytes
+ * @user_data: The #ScanReads of the scan
+ *
+ * Has the root helper read the stacking signatures of every leaf device,
+ * as opening them takes privileges this process does not have. The
+ * layouts of the disks the scan will parse go in the same batch, so a
+ * whole scan costs one round trip.
+ */
+static void read_with_helper(GPtrArray *nodes, GArray *sizes, gpointer user_data) {
+    ScanReads *reads = user_data;
+    g_autoptr(InstallerHelperBatch) batch = NULL;
+    g_autoptr(GError) err = NULL;
+    guint n_disks = reads->disks ? g_strv_length((gchar **) reads->disks) : 0;
+
+    if (nodes->len == 0 && n_disks == 0) {
+        return;
+    }
+
+    batch = installer_helper_batch_new(INSTALLER_HELPER_BATCH_NONE);
+    for (guint i = 0; i < nodes->len; i++) {
+        InstallerTopologyNode *node = g_ptr_array_index(nodes, i);
+        installer_helper_batch_add(batch, INSTALLER_HELPER_OP_READ_SIGNATURES,
+                                   g_variant_new("(st)", node->path,
+                                                 g_array_index(sizes, guint64, i)));
+    }
+    for (guint i = 0; i < n_disks; i++) {
+        installer_helper_batch_add(batch, INSTALLER_HELPER_OP_READ_DISK,
+                                   g_variant_new("(s)", reads->disks[i]));
+    }
+
+    if (!installer_helper_run(reads->self->helper, batch, NULL, NULL, &err)) {
+        g_debug("unable to read signatures and disks: %s", err->message);
+        return;
+    }
+
+    for (guint i = 0; i < nodes->len; i++) {
+        InstallerTopologyNode *node = g_ptr_array_index(nodes, i);
+        GVariant *result = installer_helper_batch_get_result(batch, i, &err);
+
+        if (!result) {
+            g_debug("unable to read signatures of '%s': %s", node->path, err->message);
+            g_clear_error(&err);
+            continue;
+        }
+
+        fill_signatures(node, result);
+    }
+
+    // Disks that failed are left out, so parsing them reports the error
+    for (guint i = 0; i < n_disks; i++) {
+        GVariant *result = installer_helper_batch_get_result(batch, nodes->len + i, &err);
+
+        if (!result) {
+            g_clear_error(&err);
+            continue;
+        }
+
+        if (g_variant_is_of_type(result, G_VARIANT_TYPE(DISK_LAYOUT_TYPE))) {
+            g_hash_table_insert(reads->layouts, g_strdup(reads->disks[i]),
+                                g_variant_ref(result));
+        }
+    }
+}
+
+/**
+ * build_topology:
+ * @self: The current #DiskManager
+ * @disks: (nullable) (array zero-terminated=1): Disks whose layouts to
+ *     read along with the signatures
+ * @layouts: (nullable) (element-type utf8 GVariant): Where to store the
+ *     layouts of @disks
+ * @err: (out): Place to store an error (if any)
+ *
+ * Builds the device topology, reading signatures through the root
+ * helper if there is one. Without a helper @layouts is left empty.
+ *
+ * Returns: (transfer full) (nullable): The topology
+ */
+static InstallerTopology *build_topology(DiskManager *self, const gchar *const *disks,
+                                         GHashTable *layouts, GError **err) {
+    g_autoptr(GHashTable) unused = NULL;
+    ScanReads reads = {self, disks, layouts};
+
+    if (!self->helper) {
+        return installer_topology_new(err);
+    }
+
+    if (!reads.layouts) {
+        reads.disks = NULL;
+        unused = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify) g_variant_unref);
+        reads.layouts = unused;
+    }
+
+    return installer_topology_new_full(read_with_helper, &reads, err);
+}
+
+/**
+ * add_device:
+ * @devices: (element-type utf8): The device list to add to
+ * @device: The kernel name of a disk
+ */
+static void add_device(GPtrArray *devices, const gchar *device) {
+    g_autofree gchar *path =
+        g_build_path(G_DIR_SEPARATOR_S, "/dev/", device, NULL);
+
+    g_autoptr(GFile) file = g_file_new_for_path(path);
+    if (!g_file_query_exists(file, NULL)) {
+        g_warning("Trying to add non-existant device: %s", path);
+        return;
+    }
+
+    g_autofree gchar *canonical = g_canonicalize_filename(path, "/");
+    if (!g_ptr_array_find_with_equal_func(devices, canonical, g_str_equal, NULL)) {
+        g_ptr_array_add(devices, g_steal_pointer(&canonical));
+    }
+}
+
+/**
+ * list_devices:
+ * @self: The current #DiskManager
+ *
+ * Finds every whole disk in /proc/partitions. Only the regexes of @self
+ * are used, so this may run on a worker thread.
+ *
+ * Returns: (transfer full) (element-type utf8): The paths of the disks
+ */
+static GPtrArray *list_devices(DiskManager *self) {
+    GPtrArray *devices = g_ptr_array_new_with_free_func(g_free);
 
     // Open and read the system partitions file
     g_autoptr(GFile) partition_file = g_file_new_for_path("/proc/partitions");
@@ -234,7 +482,7 @@ void disk_manager_scan_parts(DiskManager *self) {
         g_file_read(partition_file, NULL, &err);
     if (!G_IS_FILE_INPUT_STREAM(input_stream)) {
         g_warning("Error reading partition file: %s", err->message);
-        return;
+        return devices;
     }
 
     g_autoptr(GDataInputStream) data_stream =
@@ -244,11 +492,6 @@ void disk_manager_scan_parts(DiskManager *self) {
     g_autofree gchar *line = NULL;
     while ((line = g_data_input_stream_read_line(data_stream, NULL, NULL,
                                                  &err)) != NULL) {
-        if (!line) {
-            g_warning("Error reading partition line: %s", err->message);
-            break;
-        }
-
         GRegex *groups[4] = {self->re_whole_disk, self->re_mmcblk, self->re_nvme,
                              self->re_raid};
 
@@ -262,209 +505,886 @@ void disk_manager_scan_parts(DiskManager *self) {
 
             // Found a match, append the device
             g_autofree gchar *device = g_match_info_fetch(match_info, 1);
-            disk_manager_append_device(self, device);
+            add_device(devices, device);
         }
 
         g_free(line);
     }
+
+    if (err) {
+        g_warning("Error reading partition line: %s", err->message);
+    }
+
+    return devices;
 }
 
-void disk_manager_append_device(DiskManager *self, gchar *device) {
-    g_return_if_fail(DISK_IS_MANAGER(self));
-    g_return_if_fail(device != NULL);
+void disk_manager_scan_parts(DiskManager *self) {
+    g_autoptr(GPtrArray) devices = NULL;
 
-    g_autofree gchar *path =
-        g_build_path(G_DIR_SEPARATOR_S, "/dev/", device, NULL);
+    g_return_if_fail(DISK_IS_MANAGER(self));
 
-    g_autoptr(GFile) file = g_file_new_for_path(path);
-    if (!g_file_query_exists(file, NULL)) {
-        g_warning("Trying to add non-existant device: %s", path);
-        return;
+    // Rebuild the topology so stacks created since the last scan are seen
+    g_autoptr(GError) topology_err = NULL;
+    g_clear_object(&self->topology);
+    self->topology = build_topology(self, NULL, NULL, &topology_err);
+    if (!self->topology) {
+        g_warning("Error building device topology: %s", topology_err->message);
     }
 
-    if (g_slist_find(self->devices, device) == NULL) {
-        self->devices =
-            g_slist_append(self->devices, g_canonicalize_filename(path, "/"));
+    devices = list_devices(self);
+    for (guint i = 0; i < devices->len; i++) {
+        const gchar *path = g_ptr_array_index(devices, i);
+        if (!g_ptr_array_find_with_equal_func(self->devices, path, g_str_equal, NULL)) {
+            g_ptr_array_add(self->devices, g_strdup(path));
+        }
     }
 }
 
-GSList *disk_manager_get_devices(DiskManager *self) {
+void disk_manager_append_device(DiskManager *self, gchar *device) {
+    g_return_if_fail(DISK_IS_MANAGER(self));
+    g_return_if_fail(device != NULL);
+
+    add_device(self->devices, device);
+}
+
+GPtrArray *disk_manager_get_devices(DiskManager *self) {
     return self->devices;
 }
 
-gboolean disk_manager_is_device_ssd(const gchar *path) {
-    g_return_val_if_fail(path != NULL, FALSE);
+/**
+ * queue_disk:
+ * @self: The current #DiskManager
+ * @name: The kernel name of a whole disk
+ *
+ * Marks a disk as needing to be looked at again once the current burst
+ * of uevents settles.
+ */
+static void queue_disk(DiskManager *self, const gchar *name) {
+    if (!g_regex_match(self->re_device_name, name, 0, NULL)) {
+        return;
+    }
 
-    g_autofree gchar *nodename = g_path_get_basename(path);
-    g_autofree gchar *fpath =
-        g_strdup_printf("/sys/block/%s/queue/rotational", nodename);
+    g_hash_table_add(self->pending_disks, g_strdup(name));
+}
 
-    g_autoptr(GFile) file = g_file_new_for_path(fpath);
-    if (!g_file_query_exists(file, NULL)) {
-        return FALSE;
-    }
+/**
+ * queue_disks_below:
+ * @self: The current #DiskManager
+ * @name: The kernel name of a stacked device, e.g. `dm-0`
+ *
+ * Queues every disk a stacked device is built from. The old topology is
+ * used for devices that have already gone away, and sysfs for new ones.
+ */
+static void queue_disks_below(DiskManager *self, const gchar *name) {
+    InstallerTopologyNode *node = NULL;
 
-    // Don't try using a SSD with eMMC
-    if (g_str_has_prefix(nodename, "mmcblk")) {
-        return FALSE;
+    if (self->topology) {
+        node = installer_topology_lookup(self->topology, name);
     }
 
-    // Open and read the device type file
-    g_autoptr(GError) err = NULL;
-    g_autoptr(GFileInputStream) input_stream = g_file_read(file, NULL, &err);
-    if (!G_IS_FILE_INPUT_STREAM(input_stream)) {
-        g_warning("Error reading device type file: %s", err->message);
-        return FALSE;
+    if (node) {
+        for (guint i = 0; i < node->slaves->len; i++) {
+            InstallerTopologyNode *slave = g_ptr_array_index(node->slaves, i);
+            queue_disks_below(self, slave->name);
+        }
+    } else {
+        g_autofree gchar *slaves_path = g_build_filename("/sys/block", name, "slaves", NULL);
+        g_autoptr(GDir) slaves = g_dir_open(slaves_path, 0, NULL);
+        const gchar *child = NULL;
+
+        while (slaves && (child = g_dir_read_name(slaves)) != NULL) {
+            queue_disks_below(self, child);
+        }
     }
 
-    g_autoptr(GDataInputStream) data_stream =
-        g_data_input_stream_new(G_INPUT_STREAM(input_stream));
+    // Walk up from partitions to the disk holding them
+    g_autofree gchar *class_path = g_build_filename("/sys/class/block", name, NULL);
+    g_autofree gchar *real = realpath(class_path, NULL);
+    g_autofree gchar *partition_attr =
+        real ? g_build_filename(real, "partition", NULL) : NULL;
 
-    g_autofree gchar *line =
-        g_data_input_stream_read_line(data_stream, NULL, NULL, &err);
-    if (g_strcmp0(line, "0") == 0) {
-        return TRUE;
+    if (partition_attr && g_file_test(partition_attr, G_FILE_TEST_EXISTS)) {
+        g_autofree gchar *parent = g_path_get_dirname(real);
+        g_autofree gchar *disk = g_path_get_basename(parent);
+        queue_disk(self, disk);
+    } else {
+        queue_disk(self, name);
     }
+}
 
-    return FALSE;
+/**
+ * RescanData:
+ * @devices: The disks to scan, or %NULL to find them all first
+ * @listed: %TRUE if @devices was found by the scan, and should replace
+ *     the device list once it is published
+ * @dirty: (nullable): The disks that have to be parsed again; the rest
+ *     are carried over from the last snapshot
+ * @added: Disks to emit #DiskManager::device-added for
+ * @removed: Disks to emit #DiskManager::device-removed for
+ * @changed: Disks to emit #DiskManager::device-changed for
+ */
+typedef struct _RescanData {
+    GStrv devices;
+    gboolean listed;
+    GHashTable *dirty;
+
+    GPtrArray *added;
+    GPtrArray *removed;
+    GPtrArray *changed;
+} RescanData;
+
+static void rescan_data_free(RescanData *data) {
+    g_strfreev(data->devices);
+    g_clear_pointer(&data->dirty, g_hash_table_destroy);
+    g_clear_pointer(&data->added, g_ptr_array_unref);
+    g_clear_pointer(&data->removed, g_ptr_array_unref);
+    g_clear_pointer(&data->changed, g_ptr_array_unref);
+    g_free(data);
 }
 
-gboolean disk_manager_is_install_supported(const gchar *path) {
-    g_return_val_if_fail(path != NULL, FALSE);
+/**
+ * rescan_data_new:
+ * @self: The current #DiskManager
+ *
+ * Copies the device list so that a rescan never reads it while the
+ * main thread applies uevents to it.
+ *
+ * Returns: (transfer full): The new #RescanData
+ */
+static RescanData *rescan_data_new(DiskManager *self) {
+    RescanData *data = g_new0(RescanData, 1);
 
-    g_autofree gchar *nodename = g_path_get_basename(path);
-    if (g_str_has_prefix(nodename, "md")) {
-        return FALSE;
+    data->devices = g_new0(gchar *, self->devices->len + 1);
+    for (guint i = 0; i < self->devices->len; i++) {
+        data->devices[i] = g_strdup(g_ptr_array_index(self->devices, i));
     }
-    return TRUE;
+
+    return data;
 }
 
-GHashTable *disk_manager_get_mount_points() {
-    GHashTable *ret = g_hash_table_new(g_str_hash, g_str_equal);
+/**
+ * publish_snapshot:
+ * @self: The current #DiskManager
+ * @snapshot: (transfer full): The snapshot to publish
+ *
+ * Swaps in a new snapshot. Readers never wait on this: they announce
+ * themselves in a counter before loading the pointer, so the old
+ * snapshot is only released once every reader that could have loaded
+ * it has taken its own reference.
+ */
+static void publish_snapshot(DiskManager *self, DiskScanSnapshot *snapshot) {
+    DiskScanSnapshot *old = NULL;
 
-    // Open and read the mounts file
-    g_autoptr(GFile) mounts_file = g_file_new_for_path("/proc/self/mounts");
+    do {
+        old = g_atomic_pointer_get(&self->snapshot);
+    } while (!g_atomic_pointer_compare_and_exchange(&self->snapshot, old, snapshot));
+
+    while (g_atomic_int_get(&self->snapshot_readers) > 0) {
+        g_thread_yield();
+    }
+
+    disk_scan_snapshot_unref(old);
+}
+
+static void rescan_thread(GTask *task, gpointer source, gpointer task_data,
+                          GCancellable *cancellable) {
+    DiskManager *self = DISK_MANAGER(source);
+    RescanData *data = task_data;
     g_autoptr(GError) err = NULL;
-    g_autoptr(GFileInputStream) input_stream =
-        g_file_read(mounts_file, NULL, &err);
-    if (!G_IS_FILE_INPUT_STREAM(input_stream)) {
-        g_warning("Error reading mounts file: %s", err->message);
-        return ret;
+    g_autoptr(InstallerTopology) topology = NULL;
+    g_autoptr(GPtrArray) blacklist = NULL;
+    g_autoptr(DiskScanSnapshot) base = NULL;
+    g_autoptr(DiskScanSnapshot) snapshot = NULL;
+    g_autoptr(InstallerArena) arena = installer_arena_new();
+    g_autoptr(GPtrArray) disks = g_ptr_array_new();
+    g_autoptr(GHashTable) layouts = NULL;
+
+    // A full rescan finds the disks itself, keeping /proc/partitions and
+    // the device probing of the topology off the main thread
+    if (!data->devices) {
+        GPtrArray *devices = list_devices(self);
+        g_ptr_array_add(devices, NULL);
+        data->devices = (GStrv) g_ptr_array_free(devices, FALSE);
+        data->listed = TRUE;
     }
 
-    g_autoptr(GDataInputStream) data_stream =
-        g_data_input_stream_new(G_INPUT_STREAM(input_stream));
+    blacklist = blacklist_from_unix_mounts();
 
-    // Read each line of the mounts file
-    g_autofree gchar *line = NULL;
-    while ((line = g_data_input_stream_read_line(data_stream, NULL, NULL,
-                                                 &err)) != NULL) {
-        if (strcmp(line, "") == 0) {
-            g_free(line);
-            continue;
+    // The layouts of the disks to parse are read with the signatures
+    for (gint i = 0; data->devices[i] != NULL; i++) {
+        const gchar *device = data->devices[i];
+        if ((!data->dirty || g_hash_table_contains(data->dirty, device)) &&
+            !is_blacklisted(blacklist, device)) {
+            g_ptr_array_add(disks, (gpointer) device);
         }
+    }
+    g_ptr_array_add(disks, NULL);
+
+    layouts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify) g_variant_unref);
+    topology = build_topology(self, (const gchar *const *) disks->pdata, layouts, &err);
+    if (!topology) {
+        g_warning("Error building device topology: %s", err->message);
+        g_clear_error(&err);
+    }
 
-        // Split the line into parts
-        g_autofree gchar **parts = g_strsplit(line, " ", -1);
+    // Only writers take this lock, so a slow probe never holds up a reader
+    g_mutex_lock(&self->publish_lock);
 
-        // Calculate the length of the parts vector
-        gsize len = (sizeof parts / sizeof(gchar) - 1);
-        if (len < 4) {
-            g_free(line);
-            continue;
+    base = disk_manager_get_snapshot(self);
+    snapshot = disk_scan_snapshot_new(base->generation + 1, topology);
+
+    for (gint i = 0; data->devices[i] != NULL; i++) {
+        const gchar *device = data->devices[i];
+        g_autoptr(InstallerDrive) drive = NULL;
+
+        if (g_cancellable_set_error_if_cancelled(cancellable, &err)) {
+            g_mutex_unlock(&self->publish_lock);
+            g_task_return_error(task, g_steal_pointer(&err));
+            return;
         }
 
-        gchar *dev = parts[0];
-        gchar *mount_point = parts[1];
+        // Drives that are not dirty are carried over untouched
+        if (data->dirty && !g_hash_table_contains(data->dirty, device)) {
+            InstallerDrive *existing = disk_scan_snapshot_lookup_drive(base, device);
+            if (existing) {
+                disk_scan_snapshot_add_drive(snapshot, existing);
+            }
+            continue;
+        }
 
-        // We only want block devices
-        if (g_str_has_prefix(dev, "/")) {
-            g_hash_table_insert(ret, dev, mount_point);
+        drive = parse_disk(self, arena, topology, device, device,
+                           g_hash_table_lookup(layouts, device), blacklist, &err);
+        if (!drive) {
+            if (err) {
+                g_warning("Error parsing system disk '%s': %s", device, err->message);
+                g_clear_error(&err);
+            }
+            continue;
         }
 
-        g_free(line);
+        disk_scan_snapshot_add_drive(snapshot, drive);
     }
 
-    return ret;
-}
+    // Kept with the snapshot so the startup benchmark can report them
+    installer_arena_get_stats(arena, &snapshot->arena_stats);
+    g_debug("scan arena: %u allocations (%u interned) in %u chunks, "
+            "%" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes used",
+            snapshot->arena_stats.n_allocations, snapshot->arena_stats.n_interned,
+            snapshot->arena_stats.n_chunks, snapshot->arena_stats.bytes_used,
+            snapshot->arena_stats.bytes_reserved);
+
+    publish_snapshot(self, disk_scan_snapshot_ref(snapshot));
+    g_mutex_unlock(&self->publish_lock);
 
-static gboolean has_prefix(gchar *key, __attribute((unused)) gchar *value,
-                           gchar *item) {
-    g_return_val_if_fail(key != NULL, FALSE);
-    g_return_val_if_fail(item != NULL, FALSE);
+    g_task_return_pointer(task, g_steal_pointer(&snapshot),
+                          (GDestroyNotify) disk_scan_snapshot_unref);
+}
 
-    return g_str_has_prefix(key, item);
+static void emit_each(DiskManager *self, GPtrArray *devices, guint signal) {
+    for (guint i = 0; i < devices->len; i++) {
+        g_signal_emit(self, signals[signal], 0, g_ptr_array_index(devices, i));
+    }
 }
 
 /**
- * get_windows_version:
- * @path: The path to possible Windows partition
+ * apply_snapshot:
  * @self: The current #DiskManager
+ * @snapshot: A snapshot that has been published
  *
- * Attempts to get the version of Windows installed on a partition.
- *
- * Returns: (transfer full): A string containing the Windows version,
- *          or %NULL
+ * Brings the state that belongs to the main thread, i.e. the topology
+ * and the list models, up to date with a published snapshot.
  */
-static gchar *get_windows_version(const gchar *path, DiskManager *self) {
-    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
-    g_return_val_if_fail(path != NULL, NULL);
+static void apply_snapshot(DiskManager *self, DiskScanSnapshot *snapshot) {
+    g_autoptr(GPtrArray) parts = NULL;
 
-    g_autofree gchar *fpath = g_build_path(G_DIR_SEPARATOR_S, path, "Windows",
-                                           "servicing", "Version", NULL);
-    g_autoptr(GFile) version_file = g_file_new_for_path(fpath);
+    // Scans may finish out of order, so never go back to an older one
+    if (snapshot->generation <= self->applied_generation) {
+        return;
+    }
+    self->applied_generation = snapshot->generation;
 
-    // Check if the version file exists. If it doesn't, look for System32
-    // to make sure the path really is a Windows path.
-    if (!g_file_query_exists(version_file, NULL)) {
-        g_free(fpath);
-        fpath = g_build_path(path, "Windows", "System32", NULL);
-        g_autoptr(GFile) system32 = g_file_new_for_path(fpath);
+    // The topology is only ever replaced here, on the main thread
+    if (snapshot->topology) {
+        g_clear_object(&self->topology);
+        self->topology = g_object_ref(snapshot->topology);
+    }
 
-        // Windows is installed, but we can't find out what version it is
-        if (g_file_query_exists(system32, NULL)) {
-            return "Windows (Unknown)";
-        }
+    installer_device_model_update(self->drive_model, snapshot->drives);
 
-        return NULL;
-    }
+    parts = g_ptr_array_new_with_free_func(g_object_unref);
+    for (guint i = 0; i < snapshot->drives->len; i++) {
+        InstallerDrive *drive = g_ptr_array_index(snapshot->drives, i);
 
-    // Open the Windows version directory
-    // TODO: Error handling
-    g_autoptr(GDir) version_dir = g_dir_open(fpath, 0, NULL);
-    if (!version_dir) {
-        return NULL;
+        for (guint j = 0; j < drive->partitions->len; j++) {
+            BDPartSpec *spec = g_ptr_array_index(drive->partitions, j);
+            if (spec->path) {
+                g_ptr_array_add(parts, installer_part_item_new(drive->device, spec));
+            }
+        }
     }
 
-    const gchar *child = NULL;
+    installer_device_model_update(self->partition_model, parts);
+}
 
-    // Iterate over the items in the directory to try to find a match
-    // in our Windows prefixes HashTable. If one is found, return the
-    // value in the table.
-    while ((child = g_dir_read_name(version_dir)) != NULL) {
-        gchar *item = g_hash_table_find(self->win_prefixes, (GHRFunc) has_prefix,
-                                        (gchar *) child);
-        if (item) {
-            return g_strdup(item);
+static void on_rescan_published(GObject *source, GAsyncResult *result,
+                                gpointer user_data) {
+    DiskManager *self = DISK_MANAGER(source);
+    g_autoptr(GTask) task = G_TASK(user_data);
+    RescanData *data = g_task_get_task_data(G_TASK(result));
+    g_autoptr(GError) err = NULL;
+    DiskScanSnapshot *snapshot = NULL;
+
+    snapshot = g_task_propagate_pointer(G_TASK(result), &err);
+    if (!snapshot) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    // The device list belongs to the main thread, so the disks the scan
+    // found are only taken on here
+    if (data->listed) {
+        g_ptr_array_set_size(self->devices, 0);
+        for (guint i = 0; data->devices[i] != NULL; i++) {
+            g_ptr_array_add(self->devices, g_strdup(data->devices[i]));
         }
     }
 
-    g_dir_close(version_dir);
-    return NULL;
+    apply_snapshot(self, snapshot);
+    g_task_return_pointer(task, snapshot, (GDestroyNotify) disk_scan_snapshot_unref);
+}
+
+static void on_incremental_rescan(GObject *source, GAsyncResult *result,
+                                  __attribute((unused)) gpointer user_data) {
+    DiskManager *self = DISK_MANAGER(source);
+    RescanData *data = g_task_get_task_data(G_TASK(result));
+    g_autoptr(GError) err = NULL;
+    g_autoptr(DiskScanSnapshot) snapshot = NULL;
+
+    snapshot = disk_manager_rescan_finish(self, result, &err);
+    if (!snapshot) {
+        g_warning("Error rescanning changed disks: %s", err->message);
+        return;
+    }
+
+    apply_snapshot(self, snapshot);
+
+    emit_each(self, data->removed, SIGNAL_DEVICE_REMOVED);
+    emit_each(self, data->added, SIGNAL_DEVICE_ADDED);
+    emit_each(self, data->changed, SIGNAL_DEVICE_CHANGED);
+}
+
+static gboolean apply_pending_disks(DiskManager *self) {
+    GHashTableIter iter;
+    const gchar *name = NULL;
+    RescanData *data = NULL;
+    g_autoptr(GTask) task = NULL;
+    g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GPtrArray) changed = g_ptr_array_new_with_free_func(g_free);
+    GHashTable *dirty = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    self->settle_source = 0;
+
+    g_hash_table_iter_init(&iter, self->pending_disks);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &name, NULL)) {
+        g_autofree gchar *path = g_build_filename("/dev", name, NULL);
+        g_autofree gchar *sysfs_path = g_build_filename("/sys/block", name, NULL);
+        guint index = 0;
+        gboolean known = g_ptr_array_find_with_equal_func(self->devices, path,
+                                                          g_str_equal, &index);
+        gboolean exists = g_file_test(sysfs_path, G_FILE_TEST_IS_DIR) &&
+                          g_file_test(path, G_FILE_TEST_EXISTS);
+
+        if (exists && !known) {
+            g_debug("uevent: disk '%s' added", path);
+            g_ptr_array_add(self->devices, g_strdup(path));
+            g_ptr_array_add(added, g_strdup(path));
+            g_hash_table_add(dirty, g_strdup(path));
+        } else if (!exists && known) {
+            g_debug("uevent: disk '%s' removed", path);
+            // Keep the remaining disks in the order they were found
+            g_ptr_array_remove_index(self->devices, index);
+            g_ptr_array_add(removed, g_strdup(path));
+        } else if (exists) {
+            g_debug("uevent: disk '%s' changed", path);
+            g_ptr_array_add(changed, g_strdup(path));
+            g_hash_table_add(dirty, g_strdup(path));
+        }
+    }
+
+    g_hash_table_remove_all(self->pending_disks);
+
+    // Only the affected disks are parsed again, off the main thread. The
+    // signals go out once the new snapshot has been published.
+    data = rescan_data_new(self);
+    data->dirty = dirty;
+    data->added = g_steal_pointer(&added);
+    data->removed = g_steal_pointer(&removed);
+    data->changed = g_steal_pointer(&changed);
+
+    task = g_task_new(self, NULL, on_incremental_rescan, NULL);
+    g_task_set_source_tag(task, disk_manager_rescan_async);
+    g_task_set_task_data(task, data, (GDestroyNotify) rescan_data_free);
+    installer_executor_run_task(installer_executor_get_default(), task, "",
+                                INSTALLER_EXECUTOR_PRIORITY_DEFAULT, rescan_thread);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * handle_uevent:
+ * @self: The current #DiskManager
+ * @buf: A uevent message
+ * @len: The length of @buf
+ *
+ * Parses a kernel uevent, a header followed by NUL-separated `KEY=value`
+ * pairs, and queues the disk it affects.
+ */
+static void handle_uevent(DiskManager *self, const gchar *buf, gsize len) {
+    const gchar *subsystem = NULL;
+    const gchar *devtype = NULL;
+    const gchar *devname = NULL;
+    const gchar *devpath = NULL;
+
+    // Skip the "action@devpath" header
+    gsize pos = strnlen(buf, len) + 1;
+
+    while (pos < len) {
+        const gchar *field = buf + pos;
+        gsize field_len = strnlen(field, len - pos);
+
+        if (g_str_has_prefix(field, "SUBSYSTEM=")) {
+            subsystem = field + strlen("SUBSYSTEM=");
+        } else if (g_str_has_prefix(field, "DEVTYPE=")) {
+            devtype = field + strlen("DEVTYPE=");
+        } else if (g_str_has_prefix(field, "DEVNAME=")) {
+            devname = field + strlen("DEVNAME=");
+        } else if (g_str_has_prefix(field, "DEVPATH=")) {
+            devpath = field + strlen("DEVPATH=");
+        }
+
+        pos += field_len + 1;
+    }
+
+    if (g_strcmp0(subsystem, "block") != 0 || !devname || !devpath) {
+        return;
+    }
+
+    if (g_strcmp0(devtype, "partition") == 0) {
+        // DEVPATH is .../block/<disk>/<partition>, even after removal
+        g_autofree gchar *parent = g_path_get_dirname(devpath);
+        g_autofree gchar *disk = g_path_get_basename(parent);
+        queue_disk(self, disk);
+    } else if (g_str_has_prefix(devname, "dm-") || g_str_has_prefix(devname, "md")) {
+        queue_disks_below(self, devname);
+    } else {
+        queue_disk(self, devname);
+    }
+}
+
+static gboolean on_uevent(gint fd, __attribute((unused)) GIOCondition condition,
+                          DiskManager *self) {
+    gchar buf[UEVENT_BUFFER_SIZE];
+
+    for (;;) {
+        struct sockaddr_nl addr = {0};
+        socklen_t addr_len = sizeof(addr);
+        gssize len = recvfrom(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT,
+                              (struct sockaddr *) &addr, &addr_len);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+                g_warning("Error reading uevent socket: %s", g_strerror(errno));
+            }
+            break;
+        }
+
+        // Only trust messages sent by the kernel itself
+        if (addr.nl_pid != 0) {
+            continue;
+        }
+
+        buf[len] = '\0';
+        handle_uevent(self, buf, (gsize) len);
+    }
+
+    if (g_hash_table_size(self->pending_disks) > 0 && self->settle_source == 0) {
+        self->settle_source =
+            g_timeout_add(UEVENT_SETTLE_MS, (GSourceFunc) apply_pending_disks, self);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean disk_manager_start_monitor(DiskManager *self, GError **err) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), FALSE);
+
+    struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1,
+    };
+
+    if (self->uevent_fd >= 0) {
+        return TRUE;
+    }
+
+    self->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                             NETLINK_KOBJECT_UEVENT);
+    if (self->uevent_fd < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Unable to open uevent socket: %s", g_strerror(errno));
+        return FALSE;
+    }
+
+    if (bind(self->uevent_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Unable to bind uevent socket: %s", g_strerror(errno));
+        close(self->uevent_fd);
+        self->uevent_fd = -1;
+        return FALSE;
+    }
+
+    self->uevent_source =
+        g_unix_fd_add(self->uevent_fd, G_IO_IN, (GUnixFDSourceFunc) on_uevent, self);
+
+    return TRUE;
+}
+
+void disk_manager_stop_monitor(DiskManager *self) {
+    g_return_if_fail(DISK_IS_MANAGER(self));
+
+    if (self->uevent_source) {
+        g_source_remove(self->uevent_source);
+        self->uevent_source = 0;
+    }
+
+    if (self->settle_source) {
+        g_source_remove(self->settle_source);
+        self->settle_source = 0;
+    }
+
+    if (self->uevent_fd >= 0) {
+        close(self->uevent_fd);
+        self->uevent_fd = -1;
+    }
+
+    g_hash_table_remove_all(self->pending_disks);
+}
+
+DiskScanSnapshot *disk_manager_get_snapshot(DiskManager *self) {
+    DiskScanSnapshot *snapshot = NULL;
+
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+
+    g_atomic_int_inc(&self->snapshot_readers);
+    snapshot = disk_scan_snapshot_ref(g_atomic_pointer_get(&self->snapshot));
+    g_atomic_int_add(&self->snapshot_readers, -1);
+
+    return snapshot;
+}
+
+void disk_manager_rescan_async(DiskManager *self, GCancellable *cancellable,
+                               GAsyncReadyCallback callback, gpointer user_data) {
+    GTask *task = NULL;
+    g_autoptr(GTask) scan = NULL;
+
+    g_return_if_fail(DISK_IS_MANAGER(self));
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, disk_manager_rescan_async);
+
+    // The scan runs as a task of its own, so the models can be updated on
+    // this thread before @callback sees the result
+    scan = g_task_new(self, cancellable, on_rescan_published, task);
+    g_task_set_source_tag(scan, disk_manager_rescan_async);
+    g_task_set_task_data(scan, g_new0(RescanData, 1), (GDestroyNotify) rescan_data_free);
+    installer_executor_run_task(installer_executor_get_default(), scan, "",
+                                INSTALLER_EXECUTOR_PRIORITY_HIGH, rescan_thread);
 }
 
-static gboolean contains_path(gchar *key, __attribute((unused)) gchar *value,
-                              gchar *item) {
-    g_return_val_if_fail(key != NULL, FALSE);
-    g_return_val_if_fail(item != NULL, FALSE);
+DiskScanSnapshot *disk_manager_rescan_finish(DiskManager *self,
+                                             GAsyncResult *result, GError **err) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+    g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), err);
+}
+
+static void install_image_thread(GTask *task, gpointer source, gpointer task_data,
+                                 GCancellable *cancellable) {
+    DiskManager *self = DISK_MANAGER(source);
+    g_autoptr(InstallerHelperBatch) batch = NULL;
+    g_autoptr(GError) err = NULL;
+    GVariant *result = NULL;
+    const gchar *uuid = NULL;
+
+    if (g_cancellable_set_error_if_cancelled(cancellable, &err)) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    // The arguments are not floating, so the batch takes a reference
+    batch = installer_helper_batch_new(INSTALLER_HELPER_BATCH_NONE);
+    installer_helper_batch_add(batch, INSTALLER_HELPER_OP_INSTALL_IMAGE, task_data);
+
+    if (installer_helper_run(self->helper, batch, NULL, NULL, &err)) {
+        result = installer_helper_batch_get_result(batch, 0, &err);
+    }
+
+    if (!result) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    if (!g_variant_is_of_type(result, G_VARIANT_TYPE("(s)"))) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                "Unexpected image install result of type %s",
+                                g_variant_get_type_string(result));
+        return;
+    }
+
+    g_variant_get(result, "(&s)", &uuid);
+    g_task_return_pointer(task, g_strdup(uuid), g_free);
+}
+
+void disk_manager_install_image_async(DiskManager *self, const gchar *image,
+                                      const gchar *disk, const gchar *partition,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback, gpointer user_data) {
+    g_autoptr(GTask) task = NULL;
+
+    g_return_if_fail(DISK_IS_MANAGER(self));
+    g_return_if_fail(image != NULL && disk != NULL && partition != NULL);
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, disk_manager_install_image_async);
+
+    if (!self->helper) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                                "Installing an image needs the root helper");
+        return;
+    }
+
+    g_task_set_task_data(task,
+                         g_variant_ref_sink(g_variant_new("(sss)", image, disk, partition)),
+                         (GDestroyNotify) g_variant_unref);
+
+    // The helper does the writing, so this only waits on it
+    installer_executor_run_task(installer_executor_get_default(), task, "",
+                                INSTALLER_EXECUTOR_PRIORITY_DEFAULT, install_image_thread);
+}
+
+gchar *disk_manager_install_image_finish(DiskManager *self, GAsyncResult *result,
+                                         GError **err) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+    g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), err);
+}
+
+GListModel *disk_manager_get_drives(DiskManager *self) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+
+    return G_LIST_MODEL(self->drive_model);
+}
+
+GListModel *disk_manager_get_partitions(DiskManager *self) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+
+    return G_LIST_MODEL(self->partition_model);
+}
+
+InstallerTopology *disk_manager_get_topology(DiskManager *self) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+
+    return self->topology;
+}
+
+gboolean disk_manager_is_device_ssd(const gchar *path) {
+    g_return_val_if_fail(path != NULL, FALSE);
 
-    if (g_strstr_len(item, -1, key)) {
+    g_autofree gchar *nodename = g_path_get_basename(path);
+    g_autofree gchar *fpath =
+        g_strdup_printf("/sys/block/%s/queue/rotational", nodename);
+
+    g_autoptr(GFile) file = g_file_new_for_path(fpath);
+    if (!g_file_query_exists(file, NULL)) {
+        return FALSE;
+    }
+
+    // Don't try using a SSD with eMMC
+    if (g_str_has_prefix(nodename, "mmcblk")) {
+        return FALSE;
+    }
+
+    // Open and read the device type file
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GFileInputStream) input_stream = g_file_read(file, NULL, &err);
+    if (!G_IS_FILE_INPUT_STREAM(input_stream)) {
+        g_warning("Error reading device type file: %s", err->message);
+        return FALSE;
+    }
+
+    g_autoptr(GDataInputStream) data_stream =
+        g_data_input_stream_new(G_INPUT_STREAM(input_stream));
+
+    g_autofree gchar *line =
+        g_data_input_stream_read_line(data_stream, NULL, NULL, &err);
+    if (g_strcmp0(line, "0") == 0) {
         return TRUE;
     }
 
     return FALSE;
 }
 
+gboolean disk_manager_is_install_supported(const gchar *path) {
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    g_autofree gchar *nodename = g_path_get_basename(path);
+    g_autofree gchar *holders_path =
+        g_build_filename("/sys/class/block", nodename, "holders", NULL);
+    g_autoptr(GDir) holders = NULL;
+
+    // Assembled md arrays are fine to install to, but anything that is
+    // currently part of a stack (an md member, LVM PV or opened LUKS
+    // container) would be destroyed underneath the stack.
+    holders = g_dir_open(holders_path, 0, NULL);
+    if (holders && g_dir_read_name(holders) != NULL) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+GHashTable *disk_manager_get_mount_points() {
+    GHashTable *ret = g_hash_table_new(g_str_hash, g_str_equal);
+
+    // Open and read the mounts file
+    g_autoptr(GFile) mounts_file = g_file_new_for_path("/proc/self/mounts");
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GFileInputStream) input_stream =
+        g_file_read(mounts_file, NULL, &err);
+    if (!G_IS_FILE_INPUT_STREAM(input_stream)) {
+        g_warning("Error reading mounts file: %s", err->message);
+        return ret;
+    }
+
+    g_autoptr(GDataInputStream) data_stream =
+        g_data_input_stream_new(G_INPUT_STREAM(input_stream));
+
+    // Read each line of the mounts file
+    g_autofree gchar *line = NULL;
+    while ((line = g_data_input_stream_read_line(data_stream, NULL, NULL,
+                                                 &err)) != NULL) {
+        if (strcmp(line, "") == 0) {
+            g_free(line);
+            continue;
+        }
+
+        // Split the line into parts
+        g_autofree gchar **parts = g_strsplit(line, " ", -1);
+
+        // Calculate the length of the parts vector
+        gsize len = (sizeof parts / sizeof(gchar) - 1);
+        if (len < 4) {
+            g_free(line);
+            continue;
+        }
+
+        gchar *dev = parts[0];
+        gchar *mount_point = parts[1];
+
+        // We only want block devices
+        if (g_str_has_prefix(dev, "/")) {
+            g_hash_table_insert(ret, dev, mount_point);
+        }
+
+        g_free(line);
+    }
+
+    return ret;
+}
+
+/**
+ * OSProbeResult:
+ * @name: The full name of the OS that was found
+ * @id: (nullable): The os-release `ID` of a Linux distribution
+ * @id_like: (nullable): The space-separated os-release `ID_LIKE` list
+ *
+ * What an OS probe found on a mounted partition.
+ */
+typedef struct _OSProbeResult {
+    gchar *name;
+    gchar *id;
+    gchar *id_like;
+} OSProbeResult;
+
+static void os_probe_result_clear(OSProbeResult *result) {
+    g_clear_pointer(&result->name, g_free);
+    g_clear_pointer(&result->id, g_free);
+    g_clear_pointer(&result->id_like, g_free);
+}
+
+/**
+ * get_windows_version:
+ * @path: The path to possible Windows partition
+ * @self: The current #DiskManager
+ *
+ * Attempts to get the version of Windows installed on a partition.
+ *
+ * Returns: (transfer full): A string containing the Windows version,
+ *          or %NULL
+ */
+static gchar *get_windows_version(const gchar *path, DiskManager *self) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+    g_return_val_if_fail(path != NULL, NULL);
+
+    g_autofree gchar *fpath = g_build_path(G_DIR_SEPARATOR_S, path, "Windows",
+                                           "servicing", "Version", NULL);
+    g_autoptr(GFile) version_file = g_file_new_for_path(fpath);
+
+    // Check if the version file exists. If it doesn't, look for System32
+    // to make sure the path really is a Windows path.
+    if (!g_file_query_exists(version_file, NULL)) {
+        g_free(fpath);
+        fpath = g_build_path(G_DIR_SEPARATOR_S, path, "Windows", "System32", NULL);
+        g_autoptr(GFile) system32 = g_file_new_for_path(fpath);
+
+        // Windows is installed, but we can't find out what version it is
+        if (g_file_query_exists(system32, NULL)) {
+            return g_strdup("Windows (Unknown)");
+        }
+
+        return NULL;
+    }
+
+    // Open the Windows version directory
+    // TODO: Error handling
+    g_autoptr(GDir) version_dir = g_dir_open(fpath, 0, NULL);
+    if (!version_dir) {
+        return NULL;
+    }
+
+    const gchar *child = NULL;
+
+    // Iterate over the items in the directory to try to find a match
+    // in our Windows prefixes table. The longest matching prefix wins,
+    // so e.g. "4.0.950" is not mistaken for a shorter entry.
+    while ((child = g_dir_read_name(version_dir)) != NULL) {
+        for (gsize len = strlen(child); len > 0; len--) {
+            const gchar *item = windows_version_lookup_n(child, len);
+            if (item) {
+                return g_strdup(item);
+            }
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * get_windows_bootloader:
  * @path: The path to a partition
@@ -485,19 +1405,24 @@ static gchar *get_windows_bootloader(const gchar *path, DiskManager *self) {
 
     g_autofree gchar *fpath =
         g_build_path(G_DIR_SEPARATOR_S, path, "Boot", "BCD", NULL);
-    g_autoptr(GFile) file = g_file_new_for_path(fpath);
+    g_autofree gchar *contents = NULL;
+    gsize len = 0;
 
-    if (!g_file_query_exists(file, NULL)) {
+    if (!g_file_test(fpath, G_FILE_TEST_IS_REGULAR)) {
         return NULL;
     }
 
-    gchar *item =
-        g_hash_table_find(self->win_bootloaders, (GHRFunc) contains_path, fpath);
-    if (item) {
-        return g_strdup(item);
+    // The BCD store is a registry hive, so its strings are UTF-16LE
+    if (g_file_get_contents(fpath, &contents, &len, NULL)) {
+        for (gsize i = 0; i < WINDOWS_BOOTLOADER_TABLE_LENGTH; i++) {
+            if (memmem(contents, len, windows_bootloader_table[i].key,
+                       windows_bootloader_table[i].key_len)) {
+                return g_strdup(windows_bootloader_table[i].value);
+            }
+        }
     }
 
-    return "Windows bootloader";
+    return g_strdup("Windows bootloader");
 }
 
 /**
@@ -662,84 +1587,344 @@ static gchar *search_for_key(const gchar *root, const gchar **paths,
             }
         }
 
-        // Still no name, try the next iteration
-        if (!name) {
-            continue;
-        }
+        // Stop at the first file that gave us a name
+        if (name) {
+            break;
+        }
+    }
+
+    return name;
+}
+
+/**
+ * open_in_root:
+ * @root_fd: A directory fd to treat as the root directory
+ * @path: The path to open, relative to @root_fd
+ * @flags: Flags to pass to open(2)
+ *
+ * Opens a path inside of another installation's root without letting
+ * absolute symlinks (e.g. etc/os-release -> /usr/lib/os-release) escape
+ * to the live system. Kernels without openat2(2) fall back to refusing
+ * to follow a symlink in the final component.
+ *
+ * Returns: A file descriptor, or -1 with errno set
+ */
+static gint open_in_root(gint root_fd, const gchar *path, gint flags) {
+#ifdef SYS_openat2
+    struct open_how how = {
+        .flags = (guint64) (flags | O_CLOEXEC),
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+
+    gint fd = (gint) syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) {
+        return fd;
+    }
+#endif
+
+    return openat(root_fd, path, flags | O_CLOEXEC | O_NOFOLLOW);
+}
+
+/**
+ * get_os_release_val_at:
+ * @root_fd: A directory fd for the root of an installation
+ * @path: The path to the release file, relative to @root_fd
+ * @find_key: The key in the release file to get the value of
+ *
+ * Like get_os_release_val(), but resolves @path relative to @root_fd
+ * so that the installation does not need to be mounted on its own.
+ *
+ * Returns: (transfer full): The value in the file corresponding
+ *           to %find_key, or %NULL
+ */
+static gchar *get_os_release_val_at(gint root_fd, const gchar *path,
+                                    const gchar *find_key) {
+    g_autofree gchar *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    gssize len = 0;
+    gint fd;
+
+    fd = open_in_root(root_fd, path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    contents = g_malloc(OS_RELEASE_MAX_SIZE + 1);
+    len = read(fd, contents, OS_RELEASE_MAX_SIZE);
+    close(fd);
+
+    if (len <= 0) {
+        return NULL;
+    }
+
+    contents[len] = '\0';
+    lines = g_strsplit(contents, "\n", -1);
+
+    for (gint i = 0; lines[i] != NULL; i++) {
+        g_strchomp(lines[i]);
+
+        if (!strchr(lines[i], '=')) {
+            continue;
+        }
+
+        gchar *val = match_os_release_line(lines[i], find_key);
+        if (val) {
+            return val;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * search_for_key_at:
+ * @root_fd: A directory fd for the root of an installation
+ * @paths: An array of paths to use
+ * @paths_len: The length of the %paths array
+ * @key: The key to search for
+ * @fallback_key: A secondary %key to use if the first one isn't found
+ *
+ * The fd-relative counterpart of search_for_key().
+ *
+ * Returns: (transfer full): The value of the %key, or %NULL
+ */
+static gchar *search_for_key_at(gint root_fd, const gchar **paths,
+                                gint paths_len, const gchar *key,
+                                const gchar *fallback_key) {
+    g_return_val_if_fail(root_fd >= 0, NULL);
+    g_return_val_if_fail(paths != NULL, NULL);
+    g_return_val_if_fail(key != NULL, NULL);
+
+    for (gint i = 0; i < paths_len; i++) {
+        gchar *name = get_os_release_val_at(root_fd, paths[i], key);
+
+        if (!name && fallback_key) {
+            name = get_os_release_val_at(root_fd, paths[i], fallback_key);
+        }
+
+        if (name) {
+            return name;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * get_btrfs_linux_version:
+ * @path: The path a btrfs top-level subvolume is mounted at
+ * @result: (out): Place to store what was found
+ *
+ * Looks for Linux installations inside the subvolumes of a btrfs
+ * filesystem, e.g. `@`, `@rootfs` or snapper snapshots. Subvolumes
+ * are listed from the root tree and probed relative to the one
+ * mount, so no subvolume has to be mounted on its own. Snapshots of
+ * the same installation are collapsed, and the first installation
+ * found is returned.
+ *
+ * Returns: %TRUE if a Linux distribution was found
+ */
+static gboolean get_btrfs_linux_version(const gchar *path, OSProbeResult *result) {
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GPtrArray) subvolumes = NULL;
+    g_autoptr(GPtrArray) installs = NULL;
+    gint mount_fd;
+
+    mount_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mount_fd < 0) {
+        return FALSE;
+    }
+
+    subvolumes = installer_btrfs_list_subvolumes(mount_fd, &err);
+    if (!subvolumes) {
+        g_debug("unable to list btrfs subvolumes at '%s': %s", path, err->message);
+        close(mount_fd);
+        return FALSE;
+    }
+
+    installs = installer_btrfs_collapse_snapshots(subvolumes);
+    g_debug("found %u btrfs subvolumes in %u groups at '%s'", subvolumes->len,
+            installs->len, path);
+
+    for (guint i = 0; i < installs->len && !result->name; i++) {
+        InstallerBtrfsSubvolume *subvol = g_ptr_array_index(installs, i);
+
+        gint subvol_fd = open_in_root(mount_fd, subvol->path, O_RDONLY | O_DIRECTORY);
+        if (subvol_fd < 0) {
+            continue;
+        }
+
+        result->name = search_for_key_at(subvol_fd, os_release_paths,
+                                         OS_RELEASE_PATHS_LENGTH, "PRETTY_NAME", "NAME");
+        if (result->name) {
+            result->id = search_for_key_at(subvol_fd, os_release_paths,
+                                           OS_RELEASE_PATHS_LENGTH, "ID", NULL);
+            result->id_like = search_for_key_at(subvol_fd, os_release_paths,
+                                                OS_RELEASE_PATHS_LENGTH, "ID_LIKE", NULL);
+        } else {
+            result->name = search_for_key_at(subvol_fd, lsb_release_paths,
+                                             LSB_RELEASE_PATHS_LENGTH,
+                                             "DISTRIB_DESCRIPTION", "DISTRIB_ID");
+            g_autofree gchar *distrib_id = search_for_key_at(
+                subvol_fd, lsb_release_paths, LSB_RELEASE_PATHS_LENGTH, "DISTRIB_ID", NULL);
+            result->id = distrib_id ? g_ascii_strdown(distrib_id, -1) : NULL;
+        }
+
+        if (result->name) {
+            g_debug("found '%s' in btrfs subvolume '%s'", result->name, subvol->path);
+        }
+
+        close(subvol_fd);
+    }
+
+    close(mount_fd);
+    return result->name != NULL;
+}
+
+/**
+ * is_btrfs:
+ * @path: A mounted path
+ *
+ * Returns: %TRUE if @path is on a btrfs filesystem
+ */
+static gboolean is_btrfs(const gchar *path) {
+    struct statfs buf;
+
+    if (statfs(path, &buf) != 0) {
+        return FALSE;
     }
 
-    return name;
+    return buf.f_type == BTRFS_SUPER_MAGIC;
 }
 
 /**
  * get_linux_version:
- * @path: The path to a partition to check
  * @self: The current #DiskManager
+ * @path: The path to a partition to check
+ * @result: (out): Place to store what was found
  *
  * Looks for a Linux installation on the given partition by searching
  * the os-release and lsb-release paths for Linux distro identifiers.
+ * Along with the name, the os-release `ID` and `ID_LIKE` fields are
+ * kept so that an icon can be picked for the distribution.
  *
- * Returns: (transfer full): The name or identifier of the installed
- *          Linux distrobution if one is installed, or %NULL
+ * Returns: %TRUE if a Linux distribution is installed
  */
-static gchar *get_linux_version(const gchar *path,
-                                __attribute((unused)) DiskManager *self) {
-    g_return_val_if_fail(path != NULL, NULL);
+static gboolean get_linux_version(__attribute((unused)) DiskManager *self,
+                                  const gchar *path, OSProbeResult *result) {
+    g_return_val_if_fail(path != NULL, FALSE);
 
     // Iterate os-release files and then fallback to lsb-release files,
     // respecting stateless heirarchy
-    gchar *name = search_for_key(path, os_release_paths, OS_RELEASE_PATHS_LENGTH,
-                                 "PRETTY_NAME", "NAME");
+    result->name = search_for_key(path, os_release_paths, OS_RELEASE_PATHS_LENGTH,
+                                  "PRETTY_NAME", "NAME");
+    if (result->name) {
+        result->id = search_for_key(path, os_release_paths, OS_RELEASE_PATHS_LENGTH,
+                                    "ID", NULL);
+        result->id_like = search_for_key(path, os_release_paths,
+                                         OS_RELEASE_PATHS_LENGTH, "ID_LIKE", NULL);
+        return TRUE;
+    }
+
+    // We don't have a name, so start looking at the lsb_release files.
+    // DISTRIB_ID is the closest thing they have to an os-release ID.
+    result->name = search_for_key(path, lsb_release_paths, LSB_RELEASE_PATHS_LENGTH,
+                                  "DISTRIB_DESCRIPTION", "DISTRIB_ID");
+    if (result->name) {
+        g_autofree gchar *distrib_id = search_for_key(
+            path, lsb_release_paths, LSB_RELEASE_PATHS_LENGTH, "DISTRIB_ID", NULL);
+        result->id = distrib_id ? g_ascii_strdown(distrib_id, -1) : NULL;
+        return TRUE;
+    }
 
-    // Check that we have a name. If we don't, start looking at the
-    // lsb_release files.
-    if (!name) {
-        name = search_for_key(path, lsb_release_paths, LSB_RELEASE_PATHS_LENGTH,
-                              "DISTRIB_DESCRIPTION", "DISTRIB_ID");
+    // Distributions on btrfs usually live in a subvolume rather than
+    // the top-level of the filesystem.
+    if (is_btrfs(path)) {
+        return get_btrfs_linux_version(path, result);
     }
 
-    return name;
+    return FALSE;
 }
 
+static gboolean probe_windows(DiskManager *self, const gchar *path,
+                              OSProbeResult *result) {
+    result->name = get_windows_version(path, self);
+    return result->name != NULL;
+}
+
+static gboolean probe_windows_boot(DiskManager *self, const gchar *path,
+                                   OSProbeResult *result) {
+    result->name = get_windows_bootloader(path, self);
+    return result->name != NULL;
+}
+
+static gboolean probe_partial_install(__attribute((unused)) DiskManager *self,
+                                      const gchar *path, OSProbeResult *result) {
+    if (!installer_journal_probe(path)) {
+        return FALSE;
+    }
+
+    result->name = g_strdup("Unfinished Solus installation");
+    return TRUE;
+}
+
+typedef gboolean (*OSProbeFunc)(DiskManager *self, const gchar *path,
+                                OSProbeResult *result);
+
+/*
+ * Probes in the order they are tried on a mounted partition. An
+ * unfinished install may already have its os-release copied, so it is
+ * looked for before anything else.
+ */
+static const struct {
+    InstallerOSType otype;
+    OSProbeFunc probe;
+} os_probes[] = {
+    {INSTALLER_OS_TYPE_PARTIAL_INSTALL, probe_partial_install},
+    {INSTALLER_OS_TYPE_WINDOWS, probe_windows},
+    {INSTALLER_OS_TYPE_WINDOWS_BOOT, probe_windows_boot},
+    {INSTALLER_OS_TYPE_LINUX, get_linux_version},
+};
+
 /**
  * get_os_icon:
- * @os: The #InstallerOS to get an icon for
+ * @otype: The type of OS that was found
+ * @result: What the probe for @otype found
  *
- * Attempts to get an icon to use for an Operating System.
+ * Picks an icon for an operating system. Linux distributions are looked
+ * up by their os-release `ID`, then by each entry of `ID_LIKE`, so that
+ * derivatives without an icon of their own get their parent's.
  *
- * Returns: (transfer full): The icon name to use for this %os,
- *          or %NULL
+ * Returns: The interned icon name to use
  */
-static gchar *get_os_icon(InstallerOS *os) {
-    g_return_val_if_fail(INSTALLER_IS_OS(os), "system-software-install");
-
-    g_autofree gchar *otype = installer_os_get_otype(os);
-
-    // Check the OS type to see if it's Windows or Linux
-    if (strcmp(otype, "windows") == 0 || strcmp(otype, "windows-boot") == 0) {
-        return "distributor-logo-windows";
-    } else if (strcmp(otype, "linux") != 0) {
-        return "system-software-install";
+static GQuark get_os_icon(InstallerOSType otype, const OSProbeResult *result) {
+    const gchar *icon = NULL;
+
+    switch (otype) {
+        case INSTALLER_OS_TYPE_WINDOWS:
+        case INSTALLER_OS_TYPE_WINDOWS_BOOT:
+            return g_quark_from_static_string("distributor-logo-windows");
+        case INSTALLER_OS_TYPE_LINUX:
+            break;
+        default:
+            return g_quark_from_static_string("system-software-install");
     }
 
-    // Convert the OS name to lowercase and remove leading/trailing spaces
-    g_autofree gchar *raw = installer_os_get_name(os);
-    raw = g_strstrip(raw);
-    g_autofree gchar *raw_lower = g_utf8_casefold(raw, -1);
-
-    // Turn spaces into hyphens
-    g_autoptr(GString) mangled = g_string_new(raw_lower);
-    g_string_replace(mangled, " ", "-", -1);
+    if (result->id) {
+        icon = os_icon_lookup(result->id);
+    }
 
-    // Look for a matching icon
-    gint i;
-    for (i = 0; i < OS_ICONS_LENGTH; i++) {
-        if (g_str_has_prefix(mangled->str, os_icons[i])) {
-            return g_strdup_printf("distributor-logo-%s", os_icons[i]);
+    if (!icon && result->id_like) {
+        g_auto(GStrv) like = g_strsplit(result->id_like, " ", -1);
+        for (gint i = 0; like[i] != NULL && !icon; i++) {
+            if (*like[i] != '\0') {
+                icon = os_icon_lookup(like[i]);
+            }
         }
     }
 
-    return "system-software-install";
+    // Icons come from a static table, so they never need to be copied
+    return g_quark_from_static_string(icon ? icon : "system-software-install");
 }
 
 gchar *disk_manager_get_disk_model(gchar *device, GError **err) {
@@ -774,54 +1959,96 @@ gchar *disk_manager_get_disk_vendor(gchar *device, GError **err) {
     return vendor;
 }
 
-typedef struct _BlacklistData {
-    GSList *blacklist;
+static gboolean is_blacklisted_mount_point(const gchar *mount_point) {
+    return g_strcmp0(mount_point, "/") == 0 ||
+           g_str_has_prefix(mount_point, "/run/initramfs");
+}
+
+/**
+ * blacklist_from_mounts:
+ * @mounts: (element-type GMount): Mounts from a #GVolumeMonitor
+ *
+ * Finds the devices backing the live system's own mounts.
+ *
+ * Returns: (transfer full) (element-type utf8): Device paths that must
+ *          not be touched
+ */
+static GPtrArray *blacklist_from_mounts(GPtrArray *mounts) {
+    GPtrArray *blacklist = g_ptr_array_new_with_free_func(g_free);
 
-    gchar *current_path;
-    gboolean should_skip;
-} BlacklistData;
+    for (guint i = 0; mounts && i < mounts->len; i++) {
+        g_autoptr(GFile) mount_root = g_mount_get_root(g_ptr_array_index(mounts, i));
+        g_autofree gchar *mount_point = g_file_get_path(mount_root);
+        GUnixMountEntry *entry = NULL;
 
-static void check_blacklist(gchar *path, BlacklistData *data) {
-    if (strcmp(path, data->current_path) == 0) {
-        data->should_skip = TRUE;
+        if (!is_blacklisted_mount_point(mount_point)) {
+            continue;
+        }
+
+        entry = g_unix_mount_at(mount_point, NULL);
+        if (entry) {
+            g_ptr_array_add(blacklist, g_strdup(g_unix_mount_get_device_path(entry)));
+            g_unix_mount_free(entry);
+        }
     }
-}
 
-static void maybe_blacklist(GMount *mount, BlacklistData *blacklist_data) {
-    g_autoptr(GFile) mount_root = g_mount_get_root(mount);
-    g_autofree gchar *mount_point = g_file_get_path(mount_root);
+    return blacklist;
+}
 
-    if (strcmp(mount_point, "/") == 0 ||
-        g_str_has_prefix(mount_point, "/run/initramfs")) {
-        blacklist_data->blacklist =
-            g_slist_append(blacklist_data->blacklist, mount);
+/**
+ * blacklist_from_unix_mounts:
+ *
+ * Like blacklist_from_mounts(), but reads the mount table directly.
+ * Unlike #GVolumeMonitor, this is safe to call from any thread.
+ *
+ * Returns: (transfer full) (element-type utf8): Device paths that must
+ *          not be touched
+ */
+static GPtrArray *blacklist_from_unix_mounts(void) {
+    GPtrArray *blacklist = g_ptr_array_new_with_free_func(g_free);
+    GList *mounts = g_unix_mounts_get(NULL);
+
+    for (GList *item = mounts; item != NULL; item = item->next) {
+        if (is_blacklisted_mount_point(g_unix_mount_get_mount_path(item->data))) {
+            g_ptr_array_add(blacklist,
+                            g_strdup(g_unix_mount_get_device_path(item->data)));
+        }
     }
+
+    g_list_free_full(mounts, (GDestroyNotify) g_unix_mount_free);
+    return blacklist;
 }
 
-typedef gpointer (*OSVersionFunc)(gpointer path, gpointer user_data);
+static gboolean is_blacklisted(GPtrArray *blacklist, const gchar *path) {
+    return g_ptr_array_find_with_equal_func(blacklist, path, g_str_equal, NULL);
+}
 
-InstallerOS *disk_manager_detect_os(DiskManager *self, BDPartSpec *device,
-                                    GError **err) {
-    g_debug("attempting to detect OS on '%s'", device->path);
+/**
+ * detect_os_at_path:
+ * @self: The current #DiskManager
+ * @arena: The arena to allocate the result in
+ * @path: The path to the block device to probe
+ * @err: (out): Place to store an error (if any)
+ *
+ * Mounts @path if it is not already mounted and looks for a known
+ * operating system on it.
+ *
+ * Returns: (transfer full) (nullable): The detected OS, or %NULL
+ */
+static InstallerOS *detect_os_at_path(DiskManager *self, InstallerArena *arena,
+                                      const gchar *path, GError **err) {
+    g_debug("attempting to detect OS on '%s'", path);
 
     gboolean mounted = FALSE;
     g_autofree gchar *mount_point = NULL;
+    g_autofree gchar *fstype = NULL;
+    const gchar *mount_options = "ro";
     g_autoptr(GFile) mount_dir = NULL;
-    g_autoptr(GHashTable) possibles = NULL;
-    GHashTableIter iter;
-    g_autofree gchar *os_name = NULL;
-    g_autofree gchar *os_icon_name = NULL;
     InstallerOS *ret = NULL;
 
-    // Ignore swap and Microsoft reserved partitions
-    if (device->flags & (BD_PART_FLAG_SWAP | BD_PART_FLAG_MSFT_RESERVED)) {
-        g_debug("detected swap or Microsoft reserved; skipping device");
-        return NULL;
-    }
-
     // Get or create a mount point for this OS
     // TODO: Error handling
-    mount_point = bd_fs_get_mountpoint(device->path, NULL);
+    mount_point = bd_fs_get_mountpoint(path, NULL);
     if (!mount_point) {
         g_debug("attempting to create a temp dir for mounting");
         mount_point = g_dir_make_tmp("us.getsol.Installer-XXXXXX", err);
@@ -829,8 +2056,16 @@ InstallerOS *disk_manager_detect_os(DiskManager *self, BDPartSpec *device,
             return NULL;
         }
 
+        // Always mount the top-level of btrfs filesystems so that every
+        // subvolume can be reached from the one mount, regardless of
+        // which subvolume is set as the default.
+        fstype = bd_fs_get_fstype(path, NULL);
+        if (g_strcmp0(fstype, "btrfs") == 0) {
+            mount_options = "ro,subvolid=5";
+        }
+
         g_debug("attempting to mount device at %s", mount_point);
-        if (!bd_fs_mount(device->path, mount_point, "auto", "ro", NULL, err)) {
+        if (!bd_fs_mount(path, mount_point, "auto", mount_options, NULL, err)) {
             mount_dir = g_file_new_for_path(mount_point);
             g_file_delete(mount_dir, NULL, err);
             return NULL;
@@ -839,37 +2074,24 @@ InstallerOS *disk_manager_detect_os(DiskManager *self, BDPartSpec *device,
         mounted = TRUE;
     }
 
-    // TODO: There has got to be a nicer way to do this...
-    possibles = g_hash_table_new(g_str_hash, g_str_equal);
-    g_hash_table_insert(possibles, "windows", get_windows_version);
-    g_hash_table_insert(possibles, "windows-boot", get_windows_bootloader);
-    g_hash_table_insert(possibles, "linux", get_linux_version);
-
-    g_hash_table_iter_init(&iter, possibles);
-    gchar *key = NULL;
-    OSVersionFunc *func = NULL;
-
     // Iterate over our possible OS types
-    while (g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &func)) {
-        g_debug("looking for %s", key);
+    for (gsize i = 0; i < G_N_ELEMENTS(os_probes) && !ret; i++) {
+        OSProbeResult result = {0};
+
+        g_debug("looking for %s", installer_os_type_to_string(os_probes[i].otype));
 
         // Try to get the OS version for this type
-        os_name = ((OSVersionFunc) func)(device->path, self);
-        if (!os_name) {
-            // None found, continue to the next possibility
-            continue;
+        if (os_probes[i].probe(self, mount_point, &result)) {
+            ret = installer_os_new(arena, os_probes[i].otype, result.name, path);
+            installer_os_set_icon(ret, get_os_icon(os_probes[i].otype, &result));
         }
 
-        // Create our OS info struct to return
-        ret = installer_os_new(key, os_name, device->path);
-        os_icon_name = get_os_icon(ret);
-        installer_os_set_icon_name(ret, os_icon_name);
-        break;
+        os_probe_result_clear(&result);
     }
 
     // Make sure we're not mounted
     if (mounted) {
-        g_debug("unmounting device '%s' at '%s'", device->path, mount_point);
+        g_debug("unmounting device '%s' at '%s'", path, mount_point);
         if (bd_fs_unmount(mount_point, TRUE, FALSE, NULL, err)) {
             g_debug("cleaning up mount point '%s'", mount_point);
             mount_dir = g_file_new_for_path(mount_point);
@@ -880,16 +2102,167 @@ InstallerOS *disk_manager_detect_os(DiskManager *self, BDPartSpec *device,
     return ret;
 }
 
-static gboolean is_efi_system_partition(DiskManager *self,
-                                        BDPartDiskSpec *disk_spec,
-                                        BDPartSpec *part_spec, GError **err) {
-    g_autofree gchar *basename = NULL;
-    g_autofree gchar *fstype = NULL;
-    g_autofree gchar *found_fstype = NULL;
+InstallerOS *disk_manager_detect_os(DiskManager *self, InstallerArena *arena,
+                                    BDPartSpec *device, GError **err) {
+    InstallerPartClass klass = installer_part_classify(device, NULL);
+
+    if (!installer_part_class_should_probe(klass)) {
+        g_debug("partition class is %s; skipping device",
+                installer_part_class_to_string(klass));
+        return NULL;
+    }
+
+    return detect_os_at_path(self, arena, device->path, err);
+}
+
+InstallerOS *disk_manager_detect_os_at_path(DiskManager *self, InstallerArena *arena,
+                                            const gchar *path, GError **err) {
+    g_return_val_if_fail(DISK_IS_MANAGER(self), NULL);
+    g_return_val_if_fail(arena != NULL, NULL);
+    g_return_val_if_fail(path != NULL, NULL);
+
+    return detect_os_at_path(self, arena, path, err);
+}
+
+/**
+ * detect_with_helper:
+ * @self: The current #DiskManager
+ * @arena: The arena to allocate results in
+ * @paths: (element-type utf8): The devices to probe
+ * @operating_systems: The table to add detected operating systems to
+ *
+ * Probes every device in one round trip to the root helper, which does
+ * the mounting this process is not allowed to do.
+ */
+static void detect_with_helper(DiskManager *self, InstallerArena *arena,
+                               GPtrArray *paths, GHashTable *operating_systems) {
+    g_autoptr(InstallerHelperBatch) batch = NULL;
+    g_autoptr(GError) err = NULL;
+
+    batch = installer_helper_batch_new(INSTALLER_HELPER_BATCH_NONE);
+    for (guint i = 0; i < paths->len; i++) {
+        installer_helper_batch_add(batch, INSTALLER_HELPER_OP_DETECT_OS,
+                                   g_variant_new("(s)", g_ptr_array_index(paths, i)));
+    }
+
+    if (!installer_helper_run(self->helper, batch, NULL, NULL, &err)) {
+        g_warning("Error probing devices through the helper: %s", err->message);
+        return;
+    }
+
+    for (guint i = 0; i < paths->len; i++) {
+        const gchar *path = g_ptr_array_index(paths, i);
+        g_autoptr(GError) detect_err = NULL;
+        GVariant *result = NULL;
+        guint32 otype = 0;
+        const gchar *name = NULL;
+        const gchar *device = NULL;
+        const gchar *icon = NULL;
+        InstallerOS *os = NULL;
+
+        result = installer_helper_batch_get_result(batch, i, &detect_err);
+        if (!result) {
+            g_warning("error detecting operating system on '%s': %s", path,
+                      detect_err->message);
+            continue;
+        }
+
+        if (!g_variant_is_of_type(result, G_VARIANT_TYPE("(usss)"))) {
+            g_debug("no operating system detected at '%s'", path);
+            continue;
+        }
+
+        g_variant_get(result, "(u&s&s&s)", &otype, &name, &device, &icon);
+        os = installer_os_new(arena, otype, *name ? name : NULL, device);
+        installer_os_set_icon(os, *icon ? g_quark_from_string(icon) : 0);
+
+        g_hash_table_insert(operating_systems, (gpointer) os->device_path, os);
+    }
+}
+
+/**
+ * detect_operating_systems:
+ * @self: The current #DiskManager
+ * @arena: The arena to allocate results in
+ * @paths: (element-type utf8): The devices to probe
+ * @operating_systems: The table to add detected operating systems to
+ *
+ * Probes a list of devices for operating systems, through the root
+ * helper if there is one.
+ */
+static void detect_operating_systems(DiskManager *self, InstallerArena *arena,
+                                     GPtrArray *paths,
+                                     GHashTable *operating_systems) {
+    if (paths->len == 0) {
+        return;
+    }
+
+    if (self->helper) {
+        detect_with_helper(self, arena, paths, operating_systems);
+        return;
+    }
+
+    for (guint i = 0; i < paths->len; i++) {
+        const gchar *path = g_ptr_array_index(paths, i);
+        g_autoptr(GError) err = NULL;
+        InstallerOS *os = NULL;
+
+        os = detect_os_at_path(self, arena, path, &err);
+        if (!os) {
+            if (err) {
+                g_warning("error detecting operating system on '%s': %s", path,
+                          err->message);
+            }
+            g_debug("no operating system detected at '%s'", path);
+            continue;
+        }
+
+        g_hash_table_insert(operating_systems, (gpointer) os->device_path, os);
+    }
+}
+
+/**
+ * collect_stack_tops:
+ * @topology: The topology @node belongs to
+ * @node: A physical member of a stack
+ * @probe_paths: (element-type utf8): The list of devices to probe
+ * @probed: Paths of stack tops that have already been queued
+ *
+ * Queues the devices at the top of every stack @node belongs to. A
+ * volume group spread over several partitions is only probed once.
+ */
+static void collect_stack_tops(InstallerTopology *topology, InstallerTopologyNode *node,
+                               GPtrArray *probe_paths, GHashTable *probed) {
+    g_autoptr(GPtrArray) tops = installer_topology_get_tops(topology, node);
+
+    for (guint i = 0; i < tops->len; i++) {
+        InstallerTopologyNode *top = g_ptr_array_index(tops, i);
+
+        // Inactive stacks have nothing on top that could be mounted
+        if (top == node || !g_hash_table_add(probed, g_strdup(top->path))) {
+            continue;
+        }
+
+        g_ptr_array_add(probe_paths, top->path);
+    }
+}
 
-    basename = g_path_get_basename(part_spec->path);
+/**
+ * is_efi_system_partition:
+ * @part_spec: The partition to check
+ * @klass: The class of @part_spec from installer_part_classify()
+ * @err: (out): Place to store an error (if any)
+ *
+ * Checks if a partition is usable as an EFI system partition. The
+ * partition table has to say so, and it has to contain a FAT filesystem.
+ *
+ * Returns: %TRUE if @part_spec is an ESP
+ */
+static gboolean is_efi_system_partition(BDPartSpec *part_spec, InstallerPartClass klass,
+                                        GError **err) {
+    g_autofree gchar *fstype = NULL;
 
-    if (disk_spec->table_type != BD_PART_TABLE_GPT) {
+    if (klass != INSTALLER_PART_CLASS_ESP) {
         return FALSE;
     }
 
@@ -899,112 +2272,363 @@ static gboolean is_efi_system_partition(DiskManager *self,
         return FALSE;
     }
 
-    found_fstype = (gchar *) g_slist_find(self->efi_types, fstype);
+    return efi_fs_type_lookup(fstype) != NULL;
+}
 
-    if (!found_fstype) {
-        return FALSE;
+static gint compare_part_start(gconstpointer a, gconstpointer b) {
+    const BDPartSpec *part_a = *(BDPartSpec *const *) a;
+    const BDPartSpec *part_b = *(BDPartSpec *const *) b;
+
+    return (part_a->start > part_b->start) - (part_a->start < part_b->start);
+}
+
+/**
+ * get_disk_parts:
+ * @disk: The path of the disk
+ * @err: (out): Place to store an error (if any)
+ *
+ * Gets the partitions on a disk, sorted by where they start so that
+ * walking them reads the disk front to back.
+ *
+ * Returns: (transfer full) (element-type BDPartSpec) (nullable): The
+ *          partitions, or %NULL on error
+ */
+static GPtrArray *get_disk_parts(const gchar *disk, GError **err) {
+    BDPartSpec **parts = bd_part_get_disk_parts(disk, err);
+    GPtrArray *ret = NULL;
+
+    if (!parts) {
+        return NULL;
     }
 
-    return part_spec->flags & BD_PART_FLAG_BOOT;
+    ret = g_ptr_array_new_with_free_func((GDestroyNotify) bd_part_spec_free);
+    for (gint i = 0; parts[i] != NULL; i++) {
+        g_ptr_array_add(ret, parts[i]);
+    }
+    g_free(parts);
+
+    g_ptr_array_sort(ret, compare_part_start);
+    return ret;
 }
 
-InstallerDrive *disk_manager_parse_system_disk(DiskManager *self, gchar *device,
-                                               gchar *disk, GList *mounts,
-                                               GError **err) {
-    GHashTable *operating_systems = NULL;
-    GSList *esps = NULL;
+GVariant *disk_manager_read_disk(const gchar *disk, GError **err) {
+    g_autoptr(GPtrArray) partitions = NULL;
+    g_autoptr(GByteArray) mbr_types = NULL;
+    BDPartDiskSpec *disk_spec = NULL;
+    GVariantBuilder parts_builder;
+    GVariantBuilder mbr_builder;
+    GVariant *ret = NULL;
+
+    disk_spec = bd_part_get_disk_spec(disk, err);
+    if (!disk_spec) {
+        return NULL;
+    }
+
+    g_debug("getting partitions on disk '%s'", disk_spec->path);
+
+    partitions = get_disk_parts(disk, err);
+    if (!partitions) {
+        bd_part_disk_spec_free(disk_spec);
+        return NULL;
+    }
+
+    // libblockdev only exposes GPT type GUIDs, so MBR type bytes are
+    // read from the disk once up front
+    if (disk_spec->table_type == BD_PART_TABLE_MSDOS) {
+        g_autoptr(GError) mbr_err = NULL;
+        mbr_types = installer_part_class_read_mbr_types(disk, disk_spec->sector_size,
+                                                        &mbr_err);
+        if (!mbr_types) {
+            g_debug("unable to read MBR type bytes: %s", mbr_err->message);
+        }
+    }
+
+    g_variant_builder_init(&parts_builder, G_VARIANT_TYPE("a(sssttttb)"));
+    for (guint i = 0; i < partitions->len; i++) {
+        BDPartSpec *partition = g_ptr_array_index(partitions, i);
+        g_autoptr(GError) esp_err = NULL;
+        gboolean is_esp = FALSE;
+
+        // Telling an ESP apart means reading its filesystem, so it is
+        // done here rather than by whoever unpacks the layout
+        if (!(partition->type & BD_PART_TYPE_FREESPACE)) {
+            is_esp = is_efi_system_partition(
+                partition, installer_part_classify(partition, mbr_types), &esp_err);
+            if (esp_err) {
+                g_debug("unable to check ESP '%s': %s", partition->path,
+                        esp_err->message);
+            }
+        }
+
+        g_variant_builder_add(&parts_builder, "(sssttttb)", partition->path,
+                              partition->name ? partition->name : "",
+                              partition->type_guid ? partition->type_guid : "",
+                              (guint64) partition->type, partition->start,
+                              partition->size, partition->flags, is_esp);
+    }
+
+    g_variant_builder_init(&mbr_builder, G_VARIANT_TYPE_BYTESTRING);
+    for (guint i = 0; mbr_types && i < mbr_types->len; i++) {
+        g_variant_builder_add(&mbr_builder, "y", mbr_types->data[i]);
+    }
+
+    ret = g_variant_new(DISK_LAYOUT_TYPE, disk_spec->path, (guint32) disk_spec->table_type,
+                        disk_spec->size, disk_spec->sector_size, disk_spec->flags,
+                        &parts_builder, &mbr_builder);
+
+    bd_part_disk_spec_free(disk_spec);
+    return ret;
+}
+
+/**
+ * read_disk_layout:
+ * @self: The current #DiskManager
+ * @disk: The path of the disk
+ * @err: (out): Place to store an error (if any)
+ *
+ * Reads the layout of @disk, through the root helper if there is one.
+ *
+ * Returns: (transfer full) (nullable): The layout
+ */
+static GVariant *read_disk_layout(DiskManager *self, const gchar *disk, GError **err) {
+    g_autoptr(InstallerHelperBatch) batch = NULL;
+    GVariant *result = NULL;
+
+    if (!self->helper) {
+        result = disk_manager_read_disk(disk, err);
+        return result ? g_variant_ref_sink(result) : NULL;
+    }
+
+    batch = installer_helper_batch_new(INSTALLER_HELPER_BATCH_NONE);
+    installer_helper_batch_add(batch, INSTALLER_HELPER_OP_READ_DISK,
+                               g_variant_new("(s)", disk));
+
+    if (!installer_helper_run(self->helper, batch, NULL, NULL, err)) {
+        return NULL;
+    }
+
+    result = installer_helper_batch_get_result(batch, 0, err);
+    if (!result) {
+        return NULL;
+    }
+
+    if (!g_variant_is_of_type(result, G_VARIANT_TYPE(DISK_LAYOUT_TYPE))) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Unexpected disk layout of type %s", g_variant_get_type_string(result));
+        return NULL;
+    }
+
+    return g_variant_ref(result);
+}
+
+/**
+ * unpack_disk_layout:
+ * @layout: A layout from disk_manager_read_disk()
+ * @partitions: (out) (element-type BDPartSpec): The partitions, in the
+ *     order they start on the disk
+ * @mbr_types: (out) (nullable): The MBR type bytes, if there are any
+ * @esps: (out): The set of partitions in @partitions that are ESPs
+ *
+ * Returns: (transfer full): The disk spec
+ */
+static BDPartDiskSpec *unpack_disk_layout(GVariant *layout, GPtrArray **partitions,
+                                          GByteArray **mbr_types, GHashTable **esps) {
+    BDPartDiskSpec *disk_spec = g_new0(BDPartDiskSpec, 1);
+    g_autoptr(GVariantIter) parts_iter = NULL;
+    g_autoptr(GVariant) mbr_variant = NULL;
+    const gchar *path = NULL;
+    const gchar *name = NULL;
+    const gchar *type_guid = NULL;
+    guint32 table_type = 0;
+    guint64 type = 0;
+    guint64 start = 0;
+    guint64 size = 0;
+    guint64 flags = 0;
+    gboolean is_esp = FALSE;
+    const guint8 *mbr_data = NULL;
+    gsize mbr_len = 0;
+
+    g_variant_get(layout, "((&suttt)a(sssttttb)@ay)", &path, &table_type, &disk_spec->size,
+                  &disk_spec->sector_size, &disk_spec->flags, &parts_iter, &mbr_variant);
+    disk_spec->path = g_strdup(path);
+    disk_spec->table_type = table_type;
+
+    *partitions = g_ptr_array_new_with_free_func((GDestroyNotify) bd_part_spec_free);
+    *esps = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    while (g_variant_iter_next(parts_iter, "(&s&s&sttttb)", &path, &name, &type_guid,
+                               &type, &start, &size, &flags, &is_esp)) {
+        BDPartSpec *partition = g_new0(BDPartSpec, 1);
+
+        partition->path = g_strdup(path);
+        partition->name = *name ? g_strdup(name) : NULL;
+        partition->type_guid = *type_guid ? g_strdup(type_guid) : NULL;
+        partition->type = type;
+        partition->start = start;
+        partition->size = size;
+        partition->flags = flags;
+
+        g_ptr_array_add(*partitions, partition);
+        if (is_esp) {
+            g_hash_table_add(*esps, partition);
+        }
+    }
+
+    mbr_data = g_variant_get_fixed_array(mbr_variant, &mbr_len, sizeof(guint8));
+    *mbr_types = NULL;
+    if (mbr_len > 0) {
+        *mbr_types = g_byte_array_append(g_byte_array_new(), mbr_data, (guint) mbr_len);
+    }
+
+    return disk_spec;
+}
+
+/**
+ * parse_disk:
+ * @self: The current #DiskManager
+ * @arena: The arena to allocate every string and record of the scan in
+ * @topology: (nullable): The topology to resolve stacks against
+ * @device: The path of the device
+ * @disk: The path of the disk
+ * @known_layout: (nullable): The layout of @disk if it has already been read
+ * @blacklist: (element-type utf8): Device paths that must not be probed
+ * @err: (out): Place to store an error (if any)
+ *
+ * Parses a disk without touching any mutable #DiskManager state, so this
+ * may run on a worker thread.
+ *
+ * Returns: (transfer full) (nullable): The parsed drive
+ */
+static InstallerDrive *parse_disk(DiskManager *self, InstallerArena *arena,
+                                  InstallerTopology *topology, const gchar *device,
+                                  const gchar *disk, GVariant *known_layout,
+                                  GPtrArray *blacklist, GError **err) {
+    g_autoptr(GHashTable) operating_systems = NULL;
+    g_autoptr(GHashTable) members = NULL;
+    g_autoptr(GHashTable) probed_tops = NULL;
+    g_autoptr(GPtrArray) probe_paths = NULL;
+    g_autoptr(GPtrArray) esps = NULL;
+    g_autoptr(GByteArray) mbr_types = NULL;
+    g_autoptr(GVariant) layout = NULL;
+    g_autoptr(GHashTable) disk_esps = NULL;
     BDPartDiskSpec *disk_spec = NULL;
-    BDPartSpec **partitions = NULL;
-    BlacklistData blacklist_data = {
-        .blacklist = NULL, .current_path = device, .should_skip = FALSE};
+    g_autoptr(GPtrArray) partitions = NULL;
 
     g_autofree gchar *vendor = NULL;
     g_autofree gchar *model = NULL;
 
     InstallerDrive *ret = NULL;
 
-    // Check if some mount points should be blacklisted
-    g_list_foreach(mounts, (GFunc) maybe_blacklist, &blacklist_data);
-
     // Check if the current device path is blacklisted, e.g. /dev/sda
-    g_slist_foreach(blacklist_data.blacklist, (GFunc) check_blacklist,
-                    &blacklist_data);
-
-    if (blacklist_data.should_skip) {
+    if (is_blacklisted(blacklist, device)) {
         g_debug("blacklist indicates we should skip");
         return NULL;
     }
 
+    if (!disk) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "'%s' has no disk", device);
+        return NULL;
+    }
+
+    // Keys and values are owned by the arena
     operating_systems = g_hash_table_new(g_str_hash, g_str_equal);
+    members = g_hash_table_new(g_str_hash, g_str_equal);
+    probed_tops = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
-    if (disk) {
-        disk_spec = bd_part_get_disk_spec(disk, err);
-        if (!disk_spec) {
-            return NULL;
-        }
+    // ESPs are borrowed from the partitions array, and the paths to probe
+    // from it or the topology
+    esps = g_ptr_array_new();
+    probe_paths = g_ptr_array_new();
 
-        g_debug("getting partitions on disk '%s'", disk_spec->path);
+    layout = known_layout ? g_variant_ref(known_layout) : read_disk_layout(self, disk, err);
+    if (!layout) {
+        return NULL;
+    }
 
-        partitions = bd_part_get_disk_parts(disk, err);
-        g_return_val_if_fail(partitions != NULL, NULL);
+    disk_spec = unpack_disk_layout(layout, &partitions, &mbr_types, &disk_esps);
 
-        int i = 0;
-        BDPartSpec *partition = NULL;
+    g_debug("iterating over partitions on disk");
+    for (guint i = 0; i < partitions->len; i++) {
+        BDPartSpec *partition = g_ptr_array_index(partitions, i);
+        InstallerTopologyNode *node = NULL;
+        InstallerPartClass klass;
 
-        g_debug("iterating over partitions on disk");
-        while ((partition = partitions[i++]) != NULL) {
-            InstallerOS *os = NULL;
-            g_autoptr(GError) detect_err = NULL;
+        if (is_blacklisted(blacklist, partition->path)) {
+            g_debug("partition '%s' blacklisted; skipping", partition->path);
+            continue;
+        }
 
-            blacklist_data.current_path = partition->path;
-            g_slist_foreach(blacklist_data.blacklist, (GFunc) check_blacklist,
-                            &blacklist_data);
+        if (partition->type & BD_PART_TYPE_FREESPACE) {
+            g_debug("partition is free space; skipping");
+            continue;
+        }
 
-            if (blacklist_data.should_skip) {
-                g_debug("partition '%s' blacklisted; skipping", partition->path);
-                continue;
-            }
+        klass = installer_part_classify(partition, mbr_types);
+        g_debug("partition '%s' has class %s", partition->path,
+                installer_part_class_to_string(klass));
 
-            if (partition->type & BD_PART_TYPE_FREESPACE) {
-                g_debug("partition is free space; skipping");
-                continue;
-            }
+        if (g_hash_table_contains(disk_esps, partition)) {
+            g_debug("detected this is a system partition");
+            g_ptr_array_add(esps, partition);
+        }
 
-            os = disk_manager_detect_os(self, partition, &detect_err);
-            if (!os) {
-                if (detect_err) {
-                    g_critical("error detecting operating system for partition '%s': %s",
-                               partition->path, detect_err->message);
-                }
-                g_debug("no operating system detected at '%s'", partition->path);
-                continue;
+        if (topology) {
+            node = installer_topology_lookup(topology, partition->path);
+        }
+
+        if (node && installer_topology_is_stack_member(node)) {
+            g_autofree gchar *description =
+                installer_topology_describe(topology, node);
+            if (description) {
+                g_debug("partition '%s' is a stack member: %s", partition->path,
+                        description);
+                g_hash_table_insert(members,
+                                    (gpointer) installer_arena_strdup(arena, partition->path),
+                                    (gpointer) installer_arena_strdup(arena, description));
             }
 
-            g_hash_table_insert(operating_systems, partition->path, os);
+            collect_stack_tops(topology, node, probe_paths, probed_tops);
+            continue;
+        }
 
-            if (is_efi_system_partition(self, disk_spec, partition, err)) {
-                g_debug("detected this is a system partition");
-                esps = g_slist_append(esps, partition);
-            }
+        if (!installer_part_class_should_probe(klass)) {
+            g_debug("partition class is not probed; skipping");
+            continue;
         }
 
-        g_free(disk_spec);
-        g_free(partitions);
+        g_ptr_array_add(probe_paths, partition->path);
     }
 
-    vendor = disk_manager_get_disk_vendor(device, err);
-    g_return_val_if_fail(vendor != NULL, NULL);
+    // Everything is probed at once, so a helper needs one round trip
+    detect_operating_systems(self, arena, probe_paths, operating_systems);
 
-    model = disk_manager_get_disk_model(device, err);
-    g_return_val_if_fail(model != NULL, NULL);
-
-    ret = installer_drive_new(g_strdup(device), g_strdup(disk), g_strdup(vendor),
-                              g_strdup(model), operating_systems, err);
+    vendor = disk_manager_get_disk_vendor((gchar *) device, err);
+    model = vendor ? disk_manager_get_disk_model((gchar *) device, err) : NULL;
+    if (!model) {
+        bd_part_disk_spec_free(disk_spec);
+        return NULL;
+    }
 
-    g_return_val_if_fail(ret != NULL, NULL);
+    ret = installer_drive_new(g_strdup(device), disk_spec, g_strdup(vendor),
+                              g_strdup(model), g_steal_pointer(&operating_systems));
 
-    ret->esps = esps;
-    ret->partitions = partitions;
+    ret->esps = g_steal_pointer(&esps);
+    ret->partitions = g_steal_pointer(&partitions);
+    ret->members = g_steal_pointer(&members);
+    ret->arena = installer_arena_ref(arena);
 
     return ret;
 }
+
+InstallerDrive *disk_manager_parse_system_disk(DiskManager *self, gchar *device,
+                                               gchar *disk, GPtrArray *mounts,
+                                               GError **err) {
+    g_autoptr(GPtrArray) blacklist = blacklist_from_mounts(mounts);
+    g_autoptr(InstallerArena) arena = installer_arena_new();
+
+    if (!self->topology) {
+        self->topology = build_topology(self, NULL, NULL, NULL);
+    }
+
+    return parse_disk(self, arena, self->topology, device, disk, NULL, blacklist, err);
+}
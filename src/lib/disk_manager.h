@@ -17,8 +17,14 @@
 #ifndef INSTALLER_DISK_MANAGER_H
 #define INSTALLER_DISK_MANAGER_H
 
+#include "device_model.h"
 #include "drive.h"
+#include "executor.h"
+#include "helper.h"
 #include "os.h"
+#include "part_item.h"
+#include "scan_snapshot.h"
+#include "topology.h"
 
 #include <blockdev/fs.h>
 #include <blockdev/part.h>
@@ -42,10 +48,6 @@ extern const gchar *os_release_paths[];
  */
 extern const gchar *lsb_release_paths[];
 
-#define OS_ICONS_LENGTH 22
-
-extern const gchar *os_icons[];
-
 #define INSTALLER_TYPE_DISK_MANAGER (disk_manager_get_type())
 
 G_DECLARE_FINAL_TYPE(DiskManager, disk_manager, DISK, MANAGER, GObject)
@@ -55,9 +57,19 @@ G_DECLARE_FINAL_TYPE(DiskManager, disk_manager, DISK, MANAGER, GObject)
  */
 DiskManager *disk_manager_new();
 
+/**
+ * Probe devices through a root helper instead of mounting them directly.
+ *
+ * Set this before the first scan when this process runs unprivileged.
+ */
+void disk_manager_set_helper(DiskManager *self, InstallerHelper *helper);
+
 /**
  * Scan all partitions on the device and populate the manager's
  * device list.
+ *
+ * This reads every device on the calling thread; a UI should use
+ * disk_manager_rescan_async() instead, which does the same on a worker.
  */
 void disk_manager_scan_parts(DiskManager *self);
 
@@ -74,11 +86,151 @@ void disk_manager_append_device(DiskManager *self, gchar *device);
  * @self: The #DiskManager
  *
  * Gets the current list of detected devices. The returned list
- * must not be freed.
+ * must not be freed, and may only be used from the main thread.
+ * Use disk_manager_get_snapshot() from anywhere else.
+ *
+ * Returns: (transfer none) (element-type utf8): The paths of the
+ *          devices on the system, in the order they were found
+ */
+GPtrArray *disk_manager_get_devices(DiskManager *self);
+
+/**
+ * disk_manager_get_snapshot:
+ * @self: The #DiskManager
+ *
+ * Gets the most recently published scan of every drive. This never
+ * takes a lock or waits for a running scan, so it is safe to call from
+ * the UI thread and from any other thread.
+ *
+ * Returns: (transfer full): The current #DiskScanSnapshot. Release it
+ *          with disk_scan_snapshot_unref().
+ */
+DiskScanSnapshot *disk_manager_get_snapshot(DiskManager *self);
+
+/**
+ * disk_manager_rescan_async:
+ * @self: The #DiskManager
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: The callback to call when the scan is published
+ * @user_data: Data to pass to @callback
+ *
+ * Finds every disk on the system and parses it on a worker thread, then
+ * atomically publishes the result as the new snapshot. The device list
+ * and the drive and partition models are brought up to date before
+ * @callback is called, so nothing here touches a device on the calling
+ * thread.
+ */
+void disk_manager_rescan_async(DiskManager *self, GCancellable *cancellable,
+                               GAsyncReadyCallback callback, gpointer user_data);
+
+/**
+ * disk_manager_rescan_finish:
+ * @self: The #DiskManager
+ * @result: The #GAsyncResult passed to the callback
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: (transfer full): The snapshot that was published, or %NULL
+ *          in case of error (@err is set)
+ */
+DiskScanSnapshot *disk_manager_rescan_finish(DiskManager *self,
+                                             GAsyncResult *result, GError **err);
+
+/**
+ * disk_manager_install_image_async:
+ * @self: The #DiskManager
+ * @image: The path to a prebuilt ext4 or btrfs root filesystem image,
+ *     which must be world-readable
+ * @disk: The path of the disk to install to
+ * @partition: The path of the partition on @disk to write the image to
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: The callback to call when the image is installed
+ * @user_data: Data to pass to @callback
+ *
+ * Installs a root filesystem image through the root helper, which
+ * checks the drive and writes the image with an #InstallerImageWriter.
+ * That needs root, so without a helper this fails with
+ * %G_IO_ERROR_PERMISSION_DENIED. @cancellable is only checked before
+ * the helper starts; once it has, the install runs to the end.
+ */
+void disk_manager_install_image_async(DiskManager *self, const gchar *image,
+                                      const gchar *disk, const gchar *partition,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback, gpointer user_data);
+
+/**
+ * disk_manager_install_image_finish:
+ * @self: The #DiskManager
+ * @result: The #GAsyncResult passed to the callback
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: (transfer full): The new UUID of the filesystem, or %NULL in
+ *          case of error (@err is set)
+ */
+gchar *disk_manager_install_image_finish(DiskManager *self, GAsyncResult *result,
+                                         GError **err);
+
+/**
+ * disk_manager_get_drives:
+ * @self: The #DiskManager
+ *
+ * Gets a live list of the drives in the most recent scan. Each scan or
+ * hotplug event emits #GListModel::items-changed only for the drives
+ * that were added, removed or parsed again, so a list box bound to the
+ * model keeps the rows of every other drive. This may only be used from
+ * the main thread.
  *
- * Returns: (transfer none): A #GSList of devices on the system
+ * Returns: (transfer none): A #GListModel of #InstallerDrive
  */
-GSList *disk_manager_get_devices(DiskManager *self);
+GListModel *disk_manager_get_drives(DiskManager *self);
+
+/**
+ * disk_manager_get_partitions:
+ * @self: The #DiskManager
+ *
+ * Like disk_manager_get_drives(), but lists the partitions of every
+ * drive, in disk order. A partition whose layout did not change keeps
+ * its item across scans. This may only be used from the main thread.
+ *
+ * Returns: (transfer none): A #GListModel of #InstallerPartItem
+ */
+GListModel *disk_manager_get_partitions(DiskManager *self);
+
+/**
+ * disk_manager_start_monitor:
+ * @self: The #DiskManager
+ * @err: (out): Place to store an error (if any)
+ *
+ * Starts listening for kernel uevents on a netlink socket, so disks
+ * that appear, disappear or change after the initial scan are picked
+ * up without a full rescan. Events are applied to the device list once
+ * a burst settles, and the #DiskManager::device-added,
+ * #DiskManager::device-removed and #DiskManager::device-changed signals
+ * are emitted for each affected disk.
+ *
+ * Returns: %TRUE if the monitor is running, or %FALSE in case of error
+ *          (@err is set)
+ */
+gboolean disk_manager_start_monitor(DiskManager *self, GError **err);
+
+/**
+ * disk_manager_stop_monitor:
+ * @self: The #DiskManager
+ *
+ * Stops listening for uevents. Pending events are dropped.
+ */
+void disk_manager_stop_monitor(DiskManager *self);
+
+/**
+ * disk_manager_get_topology:
+ * @self: The #DiskManager
+ *
+ * Gets the block device topology built by the last scan. This may only
+ * be used from the main thread; other threads should use the topology
+ * of a #DiskScanSnapshot.
+ *
+ * Returns: (transfer none) (nullable): The current #InstallerTopology
+ */
+InstallerTopology *disk_manager_get_topology(DiskManager *self);
 
 /**
  * Check if the given path is on a SSD.
@@ -88,7 +240,8 @@ gboolean disk_manager_is_device_ssd(const gchar *path);
 /**
  * Check if the rootfs install is supported on this device.
  *
- * Currently we only support rootfs installs on certain types.
+ * Devices that are currently held by another device, such as RAID
+ * members or LVM physical volumes, are not supported.
  */
 gboolean disk_manager_is_install_supported(const gchar *path);
 
@@ -101,11 +254,54 @@ gchar *disk_manager_get_disk_model(gchar *device, GError **err);
 
 gchar *disk_manager_get_disk_vendor(gchar *device, GError **err);
 
-InstallerOS *disk_manager_detect_os(DiskManager *self, BDPartSpec *device,
-                                    GError **err);
+/**
+ * disk_manager_detect_os:
+ * @self: The #DiskManager
+ * @arena: The arena to allocate the result in
+ * @device: The partition to probe
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: (transfer none) (nullable): The OS found on @device, owned
+ *          by @arena, or %NULL
+ */
+InstallerOS *disk_manager_detect_os(DiskManager *self, InstallerArena *arena,
+                                    BDPartSpec *device, GError **err);
+
+/**
+ * disk_manager_detect_os_at_path:
+ * @self: The #DiskManager
+ * @arena: The arena to allocate the result in
+ * @path: The device to probe
+ * @err: (out): Place to store an error (if any)
+ *
+ * Like disk_manager_detect_os(), but probes any device without checking
+ * its partition class first. This mounts @path if it is not mounted yet,
+ * so it needs root.
+ *
+ * Returns: (transfer none) (nullable): The OS found on @path, owned by
+ *          @arena, or %NULL
+ */
+InstallerOS *disk_manager_detect_os_at_path(DiskManager *self, InstallerArena *arena,
+                                            const gchar *path, GError **err);
+
+/**
+ * disk_manager_read_disk:
+ * @disk: The path of the disk
+ * @err: (out): Place to store an error (if any)
+ *
+ * Reads everything a scan needs from @disk itself: the disk spec, its
+ * partitions in the order they start, whether each is an EFI system
+ * partition, and the MBR type bytes. The result is packed as
+ * `((suttt)a(sssttttb)ay)` so the root helper can send it back to an
+ * unprivileged #DiskManager, which is not allowed to open the disk.
+ *
+ * Returns: (transfer floating) (nullable): The layout of @disk, or
+ *          %NULL in case of error (@err is set)
+ */
+GVariant *disk_manager_read_disk(const gchar *disk, GError **err);
 
 InstallerDrive *disk_manager_parse_system_disk(DiskManager *self, gchar *device,
-                                               gchar *disk, GList *mounts,
+                                               gchar *disk, GPtrArray *mounts,
                                                GError **err);
 
 G_END_DECLS
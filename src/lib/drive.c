@@ -15,6 +15,7 @@
 //
 
 #include "drive.h"
+#include "os.h"
 
 G_DEFINE_TYPE(InstallerDrive, installer_drive, G_TYPE_OBJECT);
 
@@ -37,14 +38,21 @@ static void installer_drive_finalize(GObject *obj) {
     g_free(self->model);
 
     g_hash_table_destroy(self->operating_systems);
+    g_clear_pointer(&self->members, g_hash_table_destroy);
 
-    g_slist_free_full(g_steal_pointer(&self->esps), (GDestroyNotify) g_free);
-    g_free(self->partitions);
+    // Keys and values of both tables live in the arena, so it goes last
+    g_clear_pointer(&self->arena, installer_arena_unref);
+
+    // ESPs are borrowed from the partitions array
+    g_clear_pointer(&self->esps, g_ptr_array_unref);
+    g_clear_pointer(&self->partitions, g_ptr_array_unref);
 
     G_OBJECT_CLASS(installer_drive_parent_class)->finalize(obj);
 }
 
-static gint sort_swap_partitions(BDPartSpec *a, BDPartSpec *b) {
+static gint sort_swap_partitions(gconstpointer pa, gconstpointer pb) {
+    const BDPartSpec *a = *(BDPartSpec *const *) pa;
+    const BDPartSpec *b = *(BDPartSpec *const *) pb;
     gint ret = 0;
 
     if (a->size > b->size) {
@@ -56,20 +64,13 @@ static gint sort_swap_partitions(BDPartSpec *a, BDPartSpec *b) {
     return ret;
 }
 
-InstallerDrive *installer_drive_new(gchar *device, gchar *disk, gchar *vendor,
-                                    gchar *model, GHashTable *ops,
-                                    GError **err) {
+InstallerDrive *installer_drive_new(gchar *device, BDPartDiskSpec *disk, gchar *vendor,
+                                    gchar *model, GHashTable *ops) {
     InstallerDrive *self = g_object_new(INSTALLER_TYPE_DRIVE, NULL);
 
     g_return_val_if_fail(INSTALLER_IS_DRIVE(self), NULL);
 
-    BDPartDiskSpec *disk_spec = bd_part_get_disk_spec(disk, err);
-    if (!disk_spec) {
-        g_object_unref(self);
-        return NULL;
-    }
-
-    self->disk = disk_spec;
+    self->disk = disk;
 
     self->device = device;
     self->vendor = vendor;
@@ -79,29 +80,21 @@ InstallerDrive *installer_drive_new(gchar *device, gchar *disk, gchar *vendor,
     return self;
 }
 
-GSList *installer_drive_get_swap_partitions(InstallerDrive *self,
-                                            GError **err) {
-    GSList *parts = NULL;
-    BDPartSpec **bd_parts = NULL;
-    BDPartSpec *part_spec = NULL;
-    int i = 0;
-
-    g_return_val_if_fail(self->disk != NULL, parts);
-
-    bd_parts = bd_part_get_disk_parts(self->device, err);
+GPtrArray *installer_drive_get_swap_partitions(InstallerDrive *self) {
+    GPtrArray *parts = NULL;
 
-    g_return_val_if_fail(bd_parts != NULL, parts);
+    g_return_val_if_fail(self->partitions != NULL, NULL);
 
-    while ((part_spec = bd_parts[i]) != NULL) {
-        if (part_spec->flags & BD_PART_FLAG_SWAP) {
-            parts = g_slist_insert_sorted(parts, bd_part_spec_copy(part_spec),
-                                          (GCompareFunc) sort_swap_partitions);
+    // Read with the rest of the layout, so this needs no access to the disk
+    parts = g_ptr_array_new_with_free_func((GDestroyNotify) bd_part_spec_free);
+    for (guint i = 0; i < self->partitions->len; i++) {
+        BDPartSpec *part = g_ptr_array_index(self->partitions, i);
+        if (part->flags & BD_PART_FLAG_SWAP) {
+            g_ptr_array_add(parts, bd_part_spec_copy(part));
         }
-
-        i++;
     }
 
-    g_free(bd_parts);
+    g_ptr_array_sort(parts, sort_swap_partitions);
     return parts;
 }
 
@@ -113,3 +106,32 @@ gchar *installer_drive_get_display_string(InstallerDrive *self) {
 const gchar *installer_drive_get_disk_type(InstallerDrive *self) {
     return bd_part_get_part_table_type_str(self->disk->table_type, NULL);
 }
+
+const gchar *installer_drive_get_member_description(InstallerDrive *self,
+                                                    const gchar *path) {
+    g_return_val_if_fail(INSTALLER_IS_DRIVE(self), NULL);
+
+    if (!self->members) {
+        return NULL;
+    }
+
+    return g_hash_table_lookup(self->members, path);
+}
+
+const gchar *installer_drive_get_partial_install(InstallerDrive *self) {
+    GHashTableIter iter;
+    gpointer value = NULL;
+
+    g_return_val_if_fail(INSTALLER_IS_DRIVE(self), NULL);
+
+    g_hash_table_iter_init(&iter, self->operating_systems);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        const InstallerOS *os = value;
+
+        if (installer_os_get_otype(os) == INSTALLER_OS_TYPE_PARTIAL_INSTALL) {
+            return installer_os_get_device_path(os);
+        }
+    }
+
+    return NULL;
+}
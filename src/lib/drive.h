@@ -17,6 +17,8 @@
 #ifndef INSTALLER_DRIVE_H
 #define INSTALLER_DRIVE_H
 
+#include "arena.h"
+
 #include <blockdev/part.h>
 #include <gio/gio.h>
 #include <glib.h>
@@ -37,38 +39,39 @@ struct _InstallerDrive {
     gchar *model;
     GHashTable *operating_systems;
 
-    GSList *esps;
-    BDPartSpec **partitions;
+    GPtrArray *esps;
+    GPtrArray *partitions;
+
+    GHashTable *members;
+
+    InstallerArena *arena;
 };
 
 /**
- * insaller_drive_new:
+ * installer_drive_new:
  * @device: The name of the device
- * @disk: The name of the disk
+ * @disk: (transfer full): The partition table of the disk
  * @vendor: The vendor of the device
  * @model: The model of the device
  * @ops: A mapping of partition to OSType
- * @err: (out): Place to store an error (if any)
  *
  * Creates a new #InstallerDrive.
  *
  * Returns: The new #InstallerDrive
  */
-InstallerDrive *installer_drive_new(gchar *device, gchar *disk, gchar *vendor,
-                                    gchar *model, GHashTable *ops,
-                                    GError **err);
+InstallerDrive *installer_drive_new(gchar *device, BDPartDiskSpec *disk, gchar *vendor,
+                                    gchar *model, GHashTable *ops);
 
 /**
  * installer_drive_get_swap_partitions:
  * @self: The drive to search in
- * @err: (out): Place to store an error (if any)
  *
  * Gets all of the swap partitions on this drive.
  *
- * Returns: (transfer full): A sorted singly-linked list of swap
- *          partitions on the @self or %NULL in case of error (@error is set)
+ * Returns: (transfer full) (element-type BDPartSpec): The swap partitions
+ *          on @self, largest first
  */
-GSList *installer_drive_get_swap_partitions(InstallerDrive *self, GError **err);
+GPtrArray *installer_drive_get_swap_partitions(InstallerDrive *self);
 
 /**
  * installer_drive_get_display_string:
@@ -92,6 +95,33 @@ gchar *installer_drive_get_display_string(InstallerDrive *self);
  */
 const gchar *installer_drive_get_disk_type(InstallerDrive *self);
 
+/**
+ * installer_drive_get_member_description:
+ * @self: The drive the partition is on
+ * @path: The path to a partition on this drive
+ *
+ * Gets a description of the LVM2, RAID or LUKS stack a partition is
+ * a physical member of, for annotating the partition in a UI.
+ *
+ * Returns: (transfer none) (nullable): The description, or %NULL if the
+ *          partition is not part of a stack
+ */
+const gchar *installer_drive_get_member_description(InstallerDrive *self,
+                                                    const gchar *path);
+
+/**
+ * installer_drive_get_partial_install:
+ * @self: The drive to search in
+ *
+ * Finds an install on this drive that was interrupted, e.g. by a power
+ * cut or the install media being pulled, so it can be offered to be
+ * resumed rather than started over.
+ *
+ * Returns: (transfer none) (nullable): The path of the partition holding
+ *          the unfinished install, or %NULL if there is none
+ */
+const gchar *installer_drive_get_partial_install(InstallerDrive *self);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,109 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define _GNU_SOURCE
+
+#include "durability.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static GMutex stats_lock;
+static InstallerDurabilityStats stats;
+
+static gboolean set_sync_error(GError **err, const gchar *what) {
+    gint errsv = errno;
+
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errsv), "Error syncing '%s': %s",
+                what, g_strerror(errsv));
+    errno = errsv;
+    return FALSE;
+}
+
+gboolean installer_durability_fsync(gint fd, const gchar *what, GError **err) {
+    g_mutex_lock(&stats_lock);
+    stats.n_fsyncs++;
+    g_mutex_unlock(&stats_lock);
+
+    if (fsync(fd) != 0) {
+        return set_sync_error(err, what);
+    }
+
+    return TRUE;
+}
+
+gboolean installer_durability_syncfs(gint fd, const gchar *what, GError **err) {
+    g_mutex_lock(&stats_lock);
+    stats.n_syncfs++;
+    g_mutex_unlock(&stats_lock);
+
+    if (syncfs(fd) != 0) {
+        return set_sync_error(err, what);
+    }
+
+    return TRUE;
+}
+
+void installer_durability_write_behind(gint fd, off_t offset, off_t len, gboolean wait) {
+    guint flags = SYNC_FILE_RANGE_WRITE;
+
+    if (wait) {
+        flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+    }
+
+    g_mutex_lock(&stats_lock);
+    stats.n_write_behinds++;
+    g_mutex_unlock(&stats_lock);
+
+    sync_file_range(fd, offset, len, flags);
+}
+
+static gboolean fsync_path(const gchar *path, gint flags, GError **err) {
+    gint fd = open(path, O_RDONLY | O_CLOEXEC | flags);
+    gboolean ret = FALSE;
+
+    if (fd < 0) {
+        return set_sync_error(err, path);
+    }
+
+    ret = installer_durability_fsync(fd, path, err);
+    close(fd);
+
+    return ret;
+}
+
+gboolean installer_durability_barrier(const gchar *path, GError **err) {
+    g_autofree gchar *dir = NULL;
+
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    // The file first, so its name never points at data that is not there
+    if (!fsync_path(path, O_NOFOLLOW, err)) {
+        return FALSE;
+    }
+
+    dir = g_path_get_dirname(path);
+    return fsync_path(dir, O_DIRECTORY, err);
+}
+
+void installer_durability_get_stats(InstallerDurabilityStats *out) {
+    g_return_if_fail(out != NULL);
+
+    g_mutex_lock(&stats_lock);
+    *out = stats;
+    g_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,127 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_DURABILITY_H
+#define INSTALLER_DURABILITY_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+/**
+ * InstallerDurability:
+ * @INSTALLER_DURABILITY_NONE: Leave writeback to the kernel
+ * @INSTALLER_DURABILITY_BATCHED: Start writeback of large files as they
+ *     are written, and sync the whole target filesystem once at the end
+ *     of each phase
+ * @INSTALLER_DURABILITY_STRICT: Also fsync every file and directory as
+ *     it is finished, for OEM lines that would rather be slow than risk
+ *     anything
+ *
+ * How hard a copy works to get what it wrote onto the disk. Syncing
+ * each file on its own, or calling sync() for the whole system, makes
+ * a spinning disk seek for every file; batching lets the kernel write
+ * everything in order.
+ */
+typedef enum {
+    INSTALLER_DURABILITY_NONE,
+    INSTALLER_DURABILITY_BATCHED,
+    INSTALLER_DURABILITY_STRICT,
+} InstallerDurability;
+
+/**
+ * InstallerDurabilityStats:
+ * @n_fsyncs: Files and directories synced on their own
+ * @n_syncfs: Whole filesystems synced
+ * @n_write_behinds: Ranges of files given to the kernel to start writing
+ *
+ * Counters of the syncing done by the whole process, for tracing.
+ */
+typedef struct _InstallerDurabilityStats {
+    guint64 n_fsyncs;
+    guint64 n_syncfs;
+    guint64 n_write_behinds;
+} InstallerDurabilityStats;
+
+/**
+ * installer_durability_fsync:
+ * @fd: An open file or directory
+ * @what: The path of @fd, for the error message
+ * @err: (out): Place to store an error (if any)
+ *
+ * Syncs a file or directory. On failure errno is left set too, for
+ * callers that report errors by it.
+ *
+ * Returns: %TRUE if the file was synced
+ */
+gboolean installer_durability_fsync(gint fd, const gchar *what, GError **err);
+
+/**
+ * installer_durability_syncfs:
+ * @fd: Any open file on the filesystem
+ * @what: The path of @fd, for the error message
+ * @err: (out): Place to store an error (if any)
+ *
+ * Syncs the whole filesystem @fd is on, and only that one.
+ *
+ * Returns: %TRUE if the filesystem was synced
+ */
+gboolean installer_durability_syncfs(gint fd, const gchar *what, GError **err);
+
+/**
+ * installer_durability_write_behind:
+ * @fd: A file being written
+ * @offset: The start of the range
+ * @len: The length of the range
+ * @wait: %TRUE to wait for the range to be written, %FALSE to only
+ *     start writing it
+ *
+ * Hands a range of a file to the kernel to write out with
+ * sync_file_range(). This only bounds how much is left dirty in the
+ * page cache, so it is no substitute for a sync, and failures are left
+ * for the sync to report.
+ */
+void installer_durability_write_behind(gint fd, off_t offset, off_t len, gboolean wait);
+
+/**
+ * installer_durability_barrier:
+ * @path: A file that was just written, e.g. /etc/fstab or a bootloader
+ *     config
+ * @err: (out): Place to store an error (if any)
+ *
+ * Makes sure a file and its name are on the disk before going on, by
+ * syncing the file and then its directory. Meant for the few files an
+ * install must not lose even if the power goes right after, whatever
+ * the durability of the copy.
+ *
+ * Returns: %TRUE if the file and its directory were synced
+ */
+gboolean installer_durability_barrier(const gchar *path, GError **err);
+
+/**
+ * installer_durability_get_stats:
+ * @stats: (out): Place to store the counters
+ *
+ * Gets how much syncing has been done so far. This may be called from
+ * any thread.
+ */
+void installer_durability_get_stats(InstallerDurabilityStats *stats);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,583 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "executor.h"
+
+/* Enough to keep a few devices busy without thrashing any of them */
+#define IO_DEFAULT_THREADS 4
+
+typedef struct _Job {
+    InstallerExecutorFunc func;
+    gpointer data;
+    GDestroyNotify destroy;
+    GCancellable *cancellable;
+    InstallerExecutorPriority priority;
+} Job;
+
+typedef struct _Worker {
+    InstallerExecutor *executor;
+    guint index;
+    GThread *thread;
+
+    /* The owner pushes and pops at the head, thieves take from the tail */
+    GMutex lock;
+    GQueue deque[INSTALLER_EXECUTOR_N_PRIORITIES];
+} Worker;
+
+typedef struct _DeviceQueue {
+    gchar *name;
+    GQueue jobs[INSTALLER_EXECUTOR_N_PRIORITIES];
+    guint queued;
+    gboolean running;
+    gboolean ready;
+} DeviceQueue;
+
+struct _InstallerExecutor {
+    GObject parent_instance;
+
+    gboolean shutting_down;
+
+    /* CPU pool */
+    Worker *workers;
+    guint n_workers;
+    GMutex cpu_lock;
+    GCond cpu_cond;
+    GQueue injected[INSTALLER_EXECUTOR_N_PRIORITIES];
+    gint cpu_pending;
+
+    /* I/O pool */
+    GThread **io_threads;
+    guint n_io_threads;
+    GMutex io_lock;
+    GCond io_cond;
+    GHashTable *devices;
+    GQueue ready;
+    guint io_queued;
+
+    /* Everything in here except queued and n_devices */
+    GMutex stats_lock;
+    InstallerExecutorStats stats;
+};
+
+G_DEFINE_TYPE(InstallerExecutor, installer_executor, G_TYPE_OBJECT);
+
+/* The CPU worker running on the current thread, if any */
+static GPrivate current_worker;
+
+static void installer_executor_dispose(GObject *obj);
+static void installer_executor_finalize(GObject *obj);
+
+static void installer_executor_class_init(InstallerExecutorClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->dispose = installer_executor_dispose;
+    class->finalize = installer_executor_finalize;
+}
+
+static Job *job_new(InstallerExecutorPriority priority, InstallerExecutorFunc func,
+                    gpointer data, GDestroyNotify destroy,
+                    GCancellable *cancellable) {
+    Job *job = g_new0(Job, 1);
+
+    job->func = func;
+    job->data = data;
+    job->destroy = destroy;
+    job->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+    job->priority = priority;
+
+    return job;
+}
+
+static void job_free(Job *job) {
+    if (job->destroy) {
+        job->destroy(job->data);
+    }
+    g_clear_object(&job->cancellable);
+    g_free(job);
+}
+
+static void run_job(InstallerExecutor *self, InstallerExecutorPoolStats *stats,
+                    Job *job) {
+    gint64 start = 0;
+
+    if (g_cancellable_is_cancelled(job->cancellable)) {
+        g_mutex_lock(&self->stats_lock);
+        stats->cancelled++;
+        g_mutex_unlock(&self->stats_lock);
+
+        job_free(job);
+        return;
+    }
+
+    g_mutex_lock(&self->stats_lock);
+    stats->running++;
+    g_mutex_unlock(&self->stats_lock);
+
+    start = g_get_monotonic_time();
+    job->func(job->data, job->cancellable);
+
+    g_mutex_lock(&self->stats_lock);
+    stats->running--;
+    stats->completed++;
+    stats->busy_us += g_get_monotonic_time() - start;
+    g_mutex_unlock(&self->stats_lock);
+
+    job_free(job);
+}
+
+/* CPU pool */
+
+static Job *pop_locked(GMutex *lock, GQueue *queue, gboolean tail) {
+    Job *job = NULL;
+
+    g_mutex_lock(lock);
+    job = tail ? g_queue_pop_tail(queue) : g_queue_pop_head(queue);
+    g_mutex_unlock(lock);
+
+    return job;
+}
+
+/**
+ * find_cpu_job:
+ * @worker: The worker looking for a job
+ *
+ * Looks for the job of the highest priority: first in the worker's own
+ * queue, then in the jobs submitted from outside the pool, then at the
+ * far end of every other worker's queue.
+ *
+ * Returns: (transfer full) (nullable): A job, or %NULL
+ */
+static Job *find_cpu_job(Worker *worker) {
+    InstallerExecutor *self = worker->executor;
+
+    for (guint prio = 0; prio < INSTALLER_EXECUTOR_N_PRIORITIES; prio++) {
+        Job *job = pop_locked(&worker->lock, &worker->deque[prio], FALSE);
+        if (job) {
+            return job;
+        }
+
+        job = pop_locked(&self->cpu_lock, &self->injected[prio], FALSE);
+        if (job) {
+            return job;
+        }
+
+        for (guint i = 1; i < self->n_workers; i++) {
+            Worker *victim = &self->workers[(worker->index + i) % self->n_workers];
+
+            job = pop_locked(&victim->lock, &victim->deque[prio], TRUE);
+            if (job) {
+                g_mutex_lock(&self->stats_lock);
+                self->stats.cpu.stolen++;
+                g_mutex_unlock(&self->stats_lock);
+                return job;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static gpointer cpu_worker_thread(gpointer data) {
+    Worker *worker = data;
+    InstallerExecutor *self = worker->executor;
+
+    g_private_set(&current_worker, worker);
+
+    while (TRUE) {
+        Job *job = find_cpu_job(worker);
+
+        if (job) {
+            g_atomic_int_add(&self->cpu_pending, -1);
+            run_job(self, &self->stats.cpu, job);
+            continue;
+        }
+
+        g_mutex_lock(&self->cpu_lock);
+
+        // A job may be counted just before it is pushed, so only sleep
+        // when there is really nothing left
+        if (g_atomic_int_get(&self->cpu_pending) > 0 && !self->shutting_down) {
+            g_mutex_unlock(&self->cpu_lock);
+            g_thread_yield();
+            continue;
+        }
+
+        while (!self->shutting_down && g_atomic_int_get(&self->cpu_pending) == 0) {
+            g_cond_wait(&self->cpu_cond, &self->cpu_lock);
+        }
+
+        if (self->shutting_down) {
+            g_mutex_unlock(&self->cpu_lock);
+            break;
+        }
+
+        g_mutex_unlock(&self->cpu_lock);
+    }
+
+    return NULL;
+}
+
+void installer_executor_submit_cpu(InstallerExecutor *self,
+                                   InstallerExecutorPriority priority,
+                                   InstallerExecutorFunc func, gpointer data,
+                                   GDestroyNotify destroy, GCancellable *cancellable) {
+    Worker *worker = NULL;
+    Job *job = NULL;
+
+    g_return_if_fail(INSTALLER_IS_EXECUTOR(self));
+    g_return_if_fail(priority < INSTALLER_EXECUTOR_N_PRIORITIES);
+    g_return_if_fail(func != NULL);
+
+    job = job_new(priority, func, data, destroy, cancellable);
+
+    // Counted first, so a worker never takes a job it has not seen counted
+    g_atomic_int_inc(&self->cpu_pending);
+
+    worker = g_private_get(&current_worker);
+    if (worker && worker->executor == self) {
+        g_mutex_lock(&worker->lock);
+        g_queue_push_head(&worker->deque[priority], job);
+        g_mutex_unlock(&worker->lock);
+
+        g_mutex_lock(&self->cpu_lock);
+    } else {
+        g_mutex_lock(&self->cpu_lock);
+        g_queue_push_tail(&self->injected[priority], job);
+    }
+
+    g_cond_signal(&self->cpu_cond);
+    g_mutex_unlock(&self->cpu_lock);
+}
+
+/* I/O pool */
+
+static void device_queue_free(DeviceQueue *queue) {
+    for (guint prio = 0; prio < INSTALLER_EXECUTOR_N_PRIORITIES; prio++) {
+        g_queue_clear_full(&queue->jobs[prio], (GDestroyNotify) job_free);
+    }
+    g_free(queue->name);
+    g_free(queue);
+}
+
+static guint device_queue_top_priority(DeviceQueue *queue) {
+    for (guint prio = 0; prio < INSTALLER_EXECUTOR_N_PRIORITIES; prio++) {
+        if (!g_queue_is_empty(&queue->jobs[prio])) {
+            return prio;
+        }
+    }
+
+    return INSTALLER_EXECUTOR_N_PRIORITIES;
+}
+
+/**
+ * take_io_job:
+ * @self: The executor
+ * @device: (out): The device the job belongs to
+ *
+ * Takes the next job from the ready device with the most urgent one.
+ * Devices go to the back of the line once served, so equal priorities
+ * are shared round-robin. Must be called with io_lock held.
+ *
+ * Returns: (transfer full) (nullable): A job, or %NULL
+ */
+static Job *take_io_job(InstallerExecutor *self, DeviceQueue **device) {
+    GList *best = NULL;
+    guint best_prio = INSTALLER_EXECUTOR_N_PRIORITIES;
+    DeviceQueue *queue = NULL;
+
+    for (GList *link = self->ready.head; link != NULL; link = link->next) {
+        guint prio = device_queue_top_priority(link->data);
+        if (prio < best_prio) {
+            best = link;
+            best_prio = prio;
+        }
+    }
+
+    if (!best) {
+        return NULL;
+    }
+
+    queue = best->data;
+    g_queue_delete_link(&self->ready, best);
+    queue->ready = FALSE;
+    queue->running = TRUE;
+    queue->queued--;
+    self->io_queued--;
+
+    *device = queue;
+    return g_queue_pop_head(&queue->jobs[best_prio]);
+}
+
+static gpointer io_worker_thread(gpointer data) {
+    InstallerExecutor *self = data;
+
+    g_mutex_lock(&self->io_lock);
+
+    while (TRUE) {
+        DeviceQueue *queue = NULL;
+        Job *job = NULL;
+
+        while (!self->shutting_down && g_queue_is_empty(&self->ready)) {
+            g_cond_wait(&self->io_cond, &self->io_lock);
+        }
+
+        if (self->shutting_down) {
+            break;
+        }
+
+        job = take_io_job(self, &queue);
+
+        g_mutex_unlock(&self->io_lock);
+        run_job(self, &self->stats.io, job);
+        g_mutex_lock(&self->io_lock);
+
+        queue->running = FALSE;
+        if (queue->queued > 0) {
+            queue->ready = TRUE;
+            g_queue_push_tail(&self->ready, queue);
+        } else {
+            g_hash_table_remove(self->devices, queue->name);
+        }
+    }
+
+    g_mutex_unlock(&self->io_lock);
+
+    return NULL;
+}
+
+void installer_executor_submit_io(InstallerExecutor *self, const gchar *device,
+                                  InstallerExecutorPriority priority,
+                                  InstallerExecutorFunc func, gpointer data,
+                                  GDestroyNotify destroy, GCancellable *cancellable) {
+    DeviceQueue *queue = NULL;
+
+    g_return_if_fail(INSTALLER_IS_EXECUTOR(self));
+    g_return_if_fail(priority < INSTALLER_EXECUTOR_N_PRIORITIES);
+    g_return_if_fail(func != NULL);
+
+    if (!device) {
+        device = "";
+    }
+
+    g_mutex_lock(&self->io_lock);
+
+    queue = g_hash_table_lookup(self->devices, device);
+    if (!queue) {
+        queue = g_new0(DeviceQueue, 1);
+        queue->name = g_strdup(device);
+        g_hash_table_insert(self->devices, queue->name, queue);
+    }
+
+    g_queue_push_tail(&queue->jobs[priority],
+                      job_new(priority, func, data, destroy, cancellable));
+    queue->queued++;
+    self->io_queued++;
+
+    if (!queue->running && !queue->ready) {
+        queue->ready = TRUE;
+        g_queue_push_tail(&self->ready, queue);
+        g_cond_signal(&self->io_cond);
+    }
+
+    g_mutex_unlock(&self->io_lock);
+}
+
+/* Tasks */
+
+typedef struct _TaskJob {
+    GTask *task;
+    GTaskThreadFunc func;
+    gboolean ran;
+} TaskJob;
+
+static void run_task_job(TaskJob *job, GCancellable *cancellable) {
+    job->ran = TRUE;
+    job->func(job->task, g_task_get_source_object(job->task),
+              g_task_get_task_data(job->task), cancellable);
+}
+
+static void task_job_free(TaskJob *job) {
+    // A task must always return, even if it never got to run
+    if (!job->ran) {
+        g_task_return_new_error(job->task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                "The operation was cancelled");
+    }
+
+    g_object_unref(job->task);
+    g_free(job);
+}
+
+void installer_executor_run_task(InstallerExecutor *self, GTask *task,
+                                 const gchar *device,
+                                 InstallerExecutorPriority priority,
+                                 GTaskThreadFunc func) {
+    TaskJob *job = NULL;
+
+    g_return_if_fail(INSTALLER_IS_EXECUTOR(self));
+    g_return_if_fail(G_IS_TASK(task));
+    g_return_if_fail(func != NULL);
+
+    job = g_new0(TaskJob, 1);
+    job->task = g_object_ref(task);
+    job->func = func;
+
+    if (device) {
+        installer_executor_submit_io(self, device, priority,
+                                     (InstallerExecutorFunc) run_task_job, job,
+                                     (GDestroyNotify) task_job_free,
+                                     g_task_get_cancellable(task));
+    } else {
+        installer_executor_submit_cpu(self, priority,
+                                      (InstallerExecutorFunc) run_task_job, job,
+                                      (GDestroyNotify) task_job_free,
+                                      g_task_get_cancellable(task));
+    }
+}
+
+/* Lifecycle */
+
+static void installer_executor_init(InstallerExecutor *self) {
+    g_mutex_init(&self->cpu_lock);
+    g_cond_init(&self->cpu_cond);
+    g_mutex_init(&self->io_lock);
+    g_cond_init(&self->io_cond);
+    g_mutex_init(&self->stats_lock);
+
+    self->devices = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) device_queue_free);
+}
+
+InstallerExecutor *installer_executor_new(guint n_cpu_threads, guint n_io_threads) {
+    InstallerExecutor *self = g_object_new(INSTALLER_TYPE_EXECUTOR, NULL);
+
+    self->n_workers = n_cpu_threads ? n_cpu_threads : g_get_num_processors();
+    self->n_io_threads = n_io_threads ? n_io_threads : IO_DEFAULT_THREADS;
+    self->stats.cpu.n_threads = self->n_workers;
+    self->stats.io.n_threads = self->n_io_threads;
+
+    // Every worker must exist before any of them can try to steal
+    self->workers = g_new0(Worker, self->n_workers);
+    for (guint i = 0; i < self->n_workers; i++) {
+        self->workers[i].executor = self;
+        self->workers[i].index = i;
+        g_mutex_init(&self->workers[i].lock);
+    }
+
+    for (guint i = 0; i < self->n_workers; i++) {
+        g_autofree gchar *name = g_strdup_printf("cpu-worker-%u", i);
+        self->workers[i].thread = g_thread_new(name, cpu_worker_thread,
+                                               &self->workers[i]);
+    }
+
+    self->io_threads = g_new0(GThread *, self->n_io_threads);
+    for (guint i = 0; i < self->n_io_threads; i++) {
+        g_autofree gchar *name = g_strdup_printf("io-worker-%u", i);
+        self->io_threads[i] = g_thread_new(name, io_worker_thread, self);
+    }
+
+    return self;
+}
+
+InstallerExecutor *installer_executor_get_default(void) {
+    static gsize executor = 0;
+
+    if (g_once_init_enter(&executor)) {
+        g_once_init_leave(&executor, (gsize) installer_executor_new(0, 0));
+    }
+
+    return (InstallerExecutor *) executor;
+}
+
+/**
+ * installer_executor_dispose:
+ *
+ * Stops every thread. Jobs that have not started are dropped, which
+ * returns %G_IO_ERROR_CANCELLED for tasks. This must not run on one of
+ * the executor's own threads.
+ */
+static void installer_executor_dispose(GObject *obj) {
+    InstallerExecutor *self = INSTALLER_EXECUTOR(obj);
+
+    g_mutex_lock(&self->cpu_lock);
+    g_mutex_lock(&self->io_lock);
+    self->shutting_down = TRUE;
+    g_cond_broadcast(&self->cpu_cond);
+    g_cond_broadcast(&self->io_cond);
+    g_mutex_unlock(&self->io_lock);
+    g_mutex_unlock(&self->cpu_lock);
+
+    for (guint i = 0; i < self->n_workers; i++) {
+        if (self->workers[i].thread) {
+            g_thread_join(self->workers[i].thread);
+            self->workers[i].thread = NULL;
+        }
+    }
+
+    for (guint i = 0; i < self->n_io_threads; i++) {
+        if (self->io_threads[i]) {
+            g_thread_join(self->io_threads[i]);
+            self->io_threads[i] = NULL;
+        }
+    }
+
+    G_OBJECT_CLASS(installer_executor_parent_class)->dispose(obj);
+}
+
+static void installer_executor_finalize(GObject *obj) {
+    InstallerExecutor *self = INSTALLER_EXECUTOR(obj);
+
+    for (guint i = 0; i < self->n_workers; i++) {
+        for (guint prio = 0; prio < INSTALLER_EXECUTOR_N_PRIORITIES; prio++) {
+            g_queue_clear_full(&self->workers[i].deque[prio], (GDestroyNotify) job_free);
+        }
+        g_mutex_clear(&self->workers[i].lock);
+    }
+    g_free(self->workers);
+
+    for (guint prio = 0; prio < INSTALLER_EXECUTOR_N_PRIORITIES; prio++) {
+        g_queue_clear_full(&self->injected[prio], (GDestroyNotify) job_free);
+    }
+
+    // The ready list only points into the device table
+    g_queue_clear(&self->ready);
+    g_hash_table_destroy(self->devices);
+    g_free(self->io_threads);
+
+    g_mutex_clear(&self->cpu_lock);
+    g_cond_clear(&self->cpu_cond);
+    g_mutex_clear(&self->io_lock);
+    g_cond_clear(&self->io_cond);
+    g_mutex_clear(&self->stats_lock);
+
+    G_OBJECT_CLASS(installer_executor_parent_class)->finalize(obj);
+}
+
+void installer_executor_get_stats(InstallerExecutor *self,
+                                  InstallerExecutorStats *stats) {
+    g_return_if_fail(INSTALLER_IS_EXECUTOR(self));
+    g_return_if_fail(stats != NULL);
+
+    g_mutex_lock(&self->stats_lock);
+    *stats = self->stats;
+    g_mutex_unlock(&self->stats_lock);
+
+    stats->cpu.queued = MAX(g_atomic_int_get(&self->cpu_pending), 0);
+
+    g_mutex_lock(&self->io_lock);
+    stats->io.queued = self->io_queued;
+    stats->io.n_devices = g_hash_table_size(self->devices);
+    g_mutex_unlock(&self->io_lock);
+}
@@ -0,0 +1,183 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_EXECUTOR_H
+#define INSTALLER_EXECUTOR_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_EXECUTOR (installer_executor_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerExecutor, installer_executor, INSTALLER, EXECUTOR,
+                     GObject)
+
+/**
+ * InstallerExecutorPriority:
+ * @INSTALLER_EXECUTOR_PRIORITY_HIGH: Work the user is waiting on
+ * @INSTALLER_EXECUTOR_PRIORITY_DEFAULT: Everything else
+ * @INSTALLER_EXECUTOR_PRIORITY_LOW: Background work, e.g. prefetching
+ *
+ * Queued jobs of a higher priority always start before those of a lower
+ * one. Running jobs are never preempted.
+ */
+typedef enum {
+    INSTALLER_EXECUTOR_PRIORITY_HIGH,
+    INSTALLER_EXECUTOR_PRIORITY_DEFAULT,
+    INSTALLER_EXECUTOR_PRIORITY_LOW,
+    INSTALLER_EXECUTOR_N_PRIORITIES
+} InstallerExecutorPriority;
+
+/**
+ * InstallerExecutorPoolStats:
+ * @n_threads: Worker threads in the pool
+ * @queued: Jobs waiting to start
+ * @running: Jobs running right now
+ * @completed: Jobs that have run
+ * @cancelled: Jobs dropped because their #GCancellable was cancelled
+ *     before they started
+ * @stolen: Jobs a CPU worker took from another worker's queue
+ * @busy_us: Total time spent running jobs, in microseconds
+ * @n_devices: Devices with queued or running I/O jobs
+ *
+ * Counters for one pool of an executor. @stolen only applies to the CPU
+ * pool and @n_devices only to the I/O pool.
+ */
+typedef struct _InstallerExecutorPoolStats {
+    guint n_threads;
+    guint queued;
+    guint running;
+    guint64 completed;
+    guint64 cancelled;
+    guint64 stolen;
+    gint64 busy_us;
+    guint n_devices;
+} InstallerExecutorPoolStats;
+
+/**
+ * InstallerExecutorStats:
+ * @cpu: Counters of the CPU pool
+ * @io: Counters of the I/O pool
+ *
+ * A snapshot of an executor's counters.
+ */
+typedef struct _InstallerExecutorStats {
+    InstallerExecutorPoolStats cpu;
+    InstallerExecutorPoolStats io;
+} InstallerExecutorStats;
+
+/**
+ * InstallerExecutorFunc:
+ * @data: The data the job was submitted with
+ * @cancellable: (nullable): The job's cancellable
+ *
+ * A job run by an executor. Long jobs should check @cancellable now and
+ * then; jobs cancelled before they start are never run.
+ */
+typedef void (*InstallerExecutorFunc)(gpointer data, GCancellable *cancellable);
+
+/**
+ * installer_executor_new:
+ * @n_cpu_threads: The size of the CPU pool, or 0 for one per core
+ * @n_io_threads: The size of the I/O pool, or 0 for the default
+ *
+ * Returns: (transfer full): A new executor with its threads started
+ */
+InstallerExecutor *installer_executor_new(guint n_cpu_threads, guint n_io_threads);
+
+/**
+ * installer_executor_get_default:
+ *
+ * Gets the executor shared by the whole library. Use it instead of
+ * starting threads of your own.
+ *
+ * Returns: (transfer none): The default executor
+ */
+InstallerExecutor *installer_executor_get_default(void);
+
+/**
+ * installer_executor_submit_cpu:
+ * @self: The executor
+ * @priority: The priority of the job
+ * @func: The job
+ * @data: Data to pass to @func
+ * @destroy: (nullable): Frees @data once the job has run or been dropped
+ * @cancellable: (nullable): Cancels the job
+ *
+ * Queues a CPU-bound job, such as hashing or decompressing. Jobs
+ * submitted from a CPU worker go to that worker's own queue and run
+ * there first; idle workers steal from the other end.
+ */
+void installer_executor_submit_cpu(InstallerExecutor *self,
+                                   InstallerExecutorPriority priority,
+                                   InstallerExecutorFunc func, gpointer data,
+                                   GDestroyNotify destroy, GCancellable *cancellable);
+
+/**
+ * installer_executor_submit_io:
+ * @self: The executor
+ * @device: (nullable): The block device the job reads or writes, or
+ *          %NULL if it does not matter
+ * @priority: The priority of the job
+ * @func: The job
+ * @data: Data to pass to @func
+ * @destroy: (nullable): Frees @data once the job has run or been dropped
+ * @cancellable: (nullable): Cancels the job
+ *
+ * Queues a job that blocks on I/O. Jobs for the same device run one at
+ * a time, in order of priority and then submission, so one device is
+ * never made to seek between competing jobs. Different devices are
+ * served in turn.
+ */
+void installer_executor_submit_io(InstallerExecutor *self, const gchar *device,
+                                  InstallerExecutorPriority priority,
+                                  InstallerExecutorFunc func, gpointer data,
+                                  GDestroyNotify destroy, GCancellable *cancellable);
+
+/**
+ * installer_executor_run_task:
+ * @self: The executor
+ * @task: The task to run
+ * @device: (nullable): For I/O-bound tasks, the device they use, or ""
+ *          if it is not known; %NULL for CPU-bound tasks
+ * @priority: The priority of the task
+ * @func: The function to run
+ *
+ * Like g_task_run_in_thread(), but on one of the executor's pools.
+ * @func is called with the task's cancellable. If the task is cancelled
+ * before it starts, it returns %G_IO_ERROR_CANCELLED without running.
+ */
+void installer_executor_run_task(InstallerExecutor *self, GTask *task,
+                                 const gchar *device,
+                                 InstallerExecutorPriority priority,
+                                 GTaskThreadFunc func);
+
+/**
+ * installer_executor_get_stats:
+ * @self: The executor
+ * @stats: (out): Place to store the counters
+ *
+ * Gets the current counters of an executor.
+ */
+void installer_executor_get_stats(InstallerExecutor *self,
+                                  InstallerExecutorStats *stats);
+
+G_END_DECLS
+
+#endif
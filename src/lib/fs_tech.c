@@ -0,0 +1,134 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "fs_tech.h"
+
+#include <string.h>
+
+typedef struct _FsTechType {
+    const gchar *fstype;
+    BDFSTech tech;
+} FsTechType;
+
+/* The filesystems the installer creates, resizes or checks */
+static const FsTechType fs_tech_types[] = {
+    {"ext2", BD_FS_TECH_EXT2},
+    {"ext3", BD_FS_TECH_EXT3},
+    {"ext4", BD_FS_TECH_EXT4},
+    {"xfs", BD_FS_TECH_XFS},
+    {"vfat", BD_FS_TECH_VFAT},
+    {"ntfs", BD_FS_TECH_NTFS},
+    {"f2fs", BD_FS_TECH_F2FS},
+};
+
+typedef struct _FsTechCheck {
+    gboolean available;
+    GError *error;
+} FsTechCheck;
+
+static GMutex checks_lock;
+static GHashTable *checks = NULL;
+
+static void fs_tech_check_free(FsTechCheck *check) {
+    g_clear_error(&check->error);
+    g_free(check);
+}
+
+gboolean installer_fs_tech_from_type(const gchar *fstype, BDFSTech *tech) {
+    g_return_val_if_fail(tech != NULL, FALSE);
+
+    if (!fstype) {
+        return FALSE;
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS(fs_tech_types); i++) {
+        if (strcmp(fs_tech_types[i].fstype, fstype) == 0) {
+            *tech = fs_tech_types[i].tech;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * check_mode:
+ * @tech: The filesystem technology
+ * @bit: The bit of a single #BDFSTechMode flag
+ *
+ * Looks up the result of checking one mode, running the check if it has
+ * not been done yet. Must be called with checks_lock held.
+ *
+ * Returns: (transfer none): The cached result
+ */
+static FsTechCheck *check_mode(BDFSTech tech, guint bit) {
+    gpointer key = GUINT_TO_POINTER(((guint) tech << 8) | bit);
+    guint64 mode = G_GUINT64_CONSTANT(1) << bit;
+    FsTechCheck *check = NULL;
+
+    if (!checks) {
+        checks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                       (GDestroyNotify) fs_tech_check_free);
+    }
+
+    check = g_hash_table_lookup(checks, key);
+    if (check) {
+        return check;
+    }
+
+    check = g_new0(FsTechCheck, 1);
+    check->available = bd_fs_is_tech_avail(tech, mode, &check->error);
+    if (!check->available && !check->error) {
+        check->error = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                   "Filesystem technology %d does not support "
+                                   "mode 0x%" G_GINT64_MODIFIER "x",
+                                   tech, mode);
+    }
+
+    g_debug("fs tech %d mode 0x%" G_GINT64_MODIFIER "x: %s", tech, mode,
+            check->available ? "available" : check->error->message);
+
+    g_hash_table_insert(checks, key, check);
+
+    return check;
+}
+
+gboolean installer_fs_tech_available(BDFSTech tech, guint64 mode, GError **err) {
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&checks_lock);
+
+    g_return_val_if_fail(mode != 0, FALSE);
+
+    // Check each mode on its own, so that e.g. a MKFS | RESIZE request
+    // reuses an earlier MKFS check
+    for (guint bit = 0; bit < 64; bit++) {
+        FsTechCheck *check = NULL;
+
+        if (!(mode & (G_GUINT64_CONSTANT(1) << bit))) {
+            continue;
+        }
+
+        check = check_mode(tech, bit);
+        if (!check->available) {
+            if (err) {
+                *err = g_error_copy(check->error);
+            }
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
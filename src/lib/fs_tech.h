@@ -0,0 +1,58 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_FS_TECH_H
+#define INSTALLER_FS_TECH_H
+
+#include <blockdev/fs.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * installer_fs_tech_from_type:
+ * @fstype: A filesystem type as reported by bd_fs_get_fstype(), e.g. "ext4"
+ * @tech: (out): Place to store the matching technology
+ *
+ * Maps a filesystem type to the libblockdev technology that handles it.
+ *
+ * Returns: %TRUE if @fstype is handled by a known technology
+ */
+gboolean installer_fs_tech_from_type(const gchar *fstype, BDFSTech *tech);
+
+/**
+ * installer_fs_tech_available:
+ * @tech: The filesystem technology
+ * @mode: One or more #BDFSTechMode flags that are needed
+ * @err: (out): Place to store the reason a mode is unavailable
+ *
+ * Checks that the tools needed for @mode on @tech are installed.
+ *
+ * Blockdev is initialized without its dependency checks, so that loading
+ * the plugins does not run a tool for every technology. Instead, call
+ * this right before an operation that needs a technology. Every mode is
+ * only checked once; later calls are answered from a cache. This may
+ * be called from any thread.
+ *
+ * Returns: %TRUE if every mode in @mode is available
+ */
+gboolean installer_fs_tech_available(BDFSTech tech, guint64 mode, GError **err);
+
+G_END_DECLS
+
+#endif
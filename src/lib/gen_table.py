@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+#
+# Copyright © 2022 Solus Project <copyright@getsol.us>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""Compile a key/value data file into a C header with a lookup table.
+
+Each line of the data file is a key followed by a value, separated by
+whitespace. Either may be quoted to hold spaces; unquoted words after the
+key are joined into the value. A line with only a key makes a set entry
+whose value is the key itself. Blank lines and lines starting with '#'
+are ignored.
+
+By default the header defines a perfect-hash table and two functions,
+`<name>_lookup()` and `<name>_lookup_n()`, that return the value for a
+key, or the default, without allocating. With --list, the entries are
+instead emitted in file order as `<name>_table` for callers that have to
+scan them, e.g. to search for each key inside a larger buffer.
+"""
+
+import argparse
+import os
+import shlex
+import sys
+
+FNV_PRIME = 16777619
+MAX_SEEDS = 1 << 16
+
+
+def fnv1a(seed, key, ignore_case):
+    h = seed
+    for byte in key:
+        if ignore_case and 0x41 <= byte <= 0x5a:
+            byte += 0x20
+        h ^= byte
+        h = (h * FNV_PRIME) & 0xffffffff
+    return h
+
+
+def read_entries(path):
+    entries = []
+    seen = set()
+    with open(path, encoding='utf-8') as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            try:
+                words = shlex.split(line)
+            except ValueError as e:
+                sys.exit(f'{path}:{lineno}: {e}')
+            key = words[0]
+            value = ' '.join(words[1:]) if len(words) > 1 else key
+            if key in seen:
+                sys.exit(f'{path}:{lineno}: duplicate key "{key}"')
+            seen.add(key)
+            entries.append((key, value))
+    if not entries:
+        sys.exit(f'{path}: no entries')
+    return entries
+
+
+def slot_of(seed, bits, key, ignore_case):
+    # The low bits of FNV-1a barely depend on the seed, so use the high ones
+    return fnv1a(seed, key, ignore_case) >> (32 - bits)
+
+
+def find_seed(keys, ignore_case):
+    bits = 1
+    while (1 << bits) < len(keys) * 2:
+        bits += 1
+    while True:
+        for seed in range(1, MAX_SEEDS):
+            slots = {slot_of(seed, bits, key, ignore_case) for key in keys}
+            if len(slots) == len(keys):
+                return seed, bits
+        bits += 1
+
+
+def c_bytes(data):
+    out = []
+    for byte in data:
+        if 0x20 <= byte < 0x7f and byte not in (0x22, 0x5c, 0x3f):
+            out.append(chr(byte))
+        else:
+            # Octal escapes stop after three digits, unlike hex ones
+            out.append(f'\\{byte:03o}')
+    return '"' + ''.join(out) + '"'
+
+
+def declare(c_type, name):
+    # Keep pointer stars next to the name, as the rest of the code does
+    return f'{c_type}{name}' if c_type.endswith('*') else f'{c_type} {name}'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--name', required=True,
+                        help='C identifier prefix for the table')
+    parser.add_argument('--value-type', default='const gchar *',
+                        help='C type of the values (default: a string)')
+    parser.add_argument('--raw-values', action='store_true',
+                        help='emit values as C expressions, not strings')
+    parser.add_argument('--default', default='NULL',
+                        help='value returned for unknown keys')
+    parser.add_argument('--include', action='append', default=[],
+                        help='extra header the values need')
+    parser.add_argument('--ignore-case', action='store_true',
+                        help='match ASCII keys case-insensitively')
+    parser.add_argument('--utf16le', action='store_true',
+                        help='store keys as UTF-16LE bytes')
+    parser.add_argument('--list', action='store_true',
+                        help='emit an ordered list instead of a hash table')
+    parser.add_argument('input', help='data file to read')
+    parser.add_argument('output', help='header file to write')
+    args = parser.parse_args()
+
+    encoding = 'utf-16-le' if args.utf16le else 'utf-8'
+    entries = [(key.encode(encoding), value)
+               for key, value in read_entries(args.input)]
+
+    def value_of(value):
+        return value if args.raw_values else c_bytes(value.encode('utf-8'))
+
+    name = args.name
+    upper = name.upper()
+    guard = f'INSTALLER_{upper}_TABLE_H'
+    lines = [
+        f'/* Generated by gen_table.py from {os.path.basename(args.input)}. Do not edit. */',
+        '',
+        f'#ifndef {guard}',
+        f'#define {guard}',
+        '',
+    ]
+    lines += [f'#include "{header}"' for header in args.include]
+    lines += [
+        '#include <glib.h>',
+        '#include <string.h>',
+        '',
+    ]
+
+    if args.list:
+        lines += [
+            f'#define {upper}_TABLE_LENGTH {len(entries)}',
+            '',
+            'static const struct {',
+            '    const gchar *key;',
+            '    gsize key_len;',
+            f'    {declare(args.value_type, "value")};',
+            f'}} {name}_table[{upper}_TABLE_LENGTH] = {{',
+        ]
+        for key, value in entries:
+            lines.append(f'    {{{c_bytes(key)}, {len(key)}, {value_of(value)}}},')
+        lines += ['};', '', '#endif', '']
+    else:
+        seed, bits = find_seed([key for key, _ in entries], args.ignore_case)
+        table = [None] * (1 << bits)
+        for key, value in entries:
+            table[slot_of(seed, bits, key, args.ignore_case)] = (key, value)
+
+        fold = 'g_ascii_tolower(*p)' if args.ignore_case else '*p'
+        compare = 'g_ascii_strncasecmp' if args.ignore_case else 'strncmp'
+
+        lines += [
+            f'#define {upper}_TABLE_SEED {seed}u',
+            f'#define {upper}_TABLE_SHIFT {32 - bits}u',
+            '',
+            'static const struct {',
+            '    const gchar *key;',
+            '    gsize key_len;',
+            f'    {declare(args.value_type, "value")};',
+            f'}} {name}_table[{1 << bits}] = {{',
+        ]
+        for slot, entry in enumerate(table):
+            if entry:
+                key, value = entry
+                lines.append(f'    [{slot}] = {{{c_bytes(key)}, {len(key)}, {value_of(value)}}},')
+        lines += [
+            '};',
+            '',
+            f'static inline {declare(args.value_type, name + "_lookup_n")}(const gchar *key, gsize len) {{',
+            f'    guint32 hash = {upper}_TABLE_SEED;',
+            '',
+            '    for (const guchar *p = (const guchar *) key; p < (const guchar *) key + len; p++) {',
+            f'        hash ^= (guchar) {fold};',
+            f'        hash *= {FNV_PRIME}u;',
+            '    }',
+            '',
+            f'    guint32 slot = hash >> {upper}_TABLE_SHIFT;',
+            f'    if ({name}_table[slot].key && {name}_table[slot].key_len == len &&',
+            f'        {compare}({name}_table[slot].key, key, len) == 0) {{',
+            f'        return {name}_table[slot].value;',
+            '    }',
+            '',
+            f'    return {args.default};',
+            '}',
+            '',
+            f'static inline {declare(args.value_type, name + "_lookup")}(const gchar *key) {{',
+            f'    return {name}_lookup_n(key, strlen(key));',
+            '}',
+            '',
+            '#endif',
+            '',
+        ]
+
+    with open(args.output, 'w', encoding='utf-8') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
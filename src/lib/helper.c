@@ -0,0 +1,319 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "helper.h"
+#include "helper_server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct _HelperOp {
+    InstallerHelperOp op;
+    GVariant *args;
+
+    gboolean answered;
+    GVariant *result;
+    GError *error;
+} HelperOp;
+
+struct _InstallerHelperBatch {
+    InstallerHelperBatchFlags flags;
+    GArray *ops;
+    gboolean ran;
+};
+
+struct _InstallerHelper {
+    GObject parent_instance;
+
+    gint fd;
+    pid_t pid;
+
+    /* Held for a whole round trip, so batches never interleave */
+    GMutex lock;
+    guint next_batch;
+    gboolean broken;
+};
+
+G_DEFINE_TYPE(InstallerHelper, installer_helper, G_TYPE_OBJECT);
+
+static void installer_helper_finalize(GObject *obj);
+
+static void installer_helper_class_init(InstallerHelperClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_helper_finalize;
+}
+
+static void installer_helper_init(InstallerHelper *self) {
+    self->fd = -1;
+    self->pid = -1;
+    g_mutex_init(&self->lock);
+}
+
+static void installer_helper_finalize(GObject *obj) {
+    InstallerHelper *self = INSTALLER_HELPER(obj);
+
+    // The helper exits once it reads the end of the socket
+    if (self->fd >= 0) {
+        close(self->fd);
+    }
+
+    if (self->pid > 0) {
+        while (waitpid(self->pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+
+    g_mutex_clear(&self->lock);
+
+    G_OBJECT_CLASS(installer_helper_parent_class)->finalize(obj);
+}
+
+InstallerHelper *installer_helper_spawn(GError **err) {
+    InstallerHelper *self = NULL;
+    pid_t parent = getpid();
+    pid_t pid = 0;
+    gint fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Error creating helper socket: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Error forking helper: %s", g_strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        // Never outlive the installer, even if it crashes
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) {
+            _exit(EXIT_FAILURE);
+        }
+
+        _exit(installer_helper_serve(fds[1]));
+    }
+
+    close(fds[1]);
+
+    self = g_object_new(INSTALLER_TYPE_HELPER, NULL);
+    self->fd = fds[0];
+    self->pid = pid;
+
+    return self;
+}
+
+static void helper_op_clear(HelperOp *op) {
+    g_clear_pointer(&op->args, g_variant_unref);
+    g_clear_pointer(&op->result, g_variant_unref);
+    g_clear_error(&op->error);
+}
+
+InstallerHelperBatch *installer_helper_batch_new(InstallerHelperBatchFlags flags) {
+    InstallerHelperBatch *self = g_new0(InstallerHelperBatch, 1);
+
+    self->flags = flags;
+    self->ops = g_array_new(FALSE, TRUE, sizeof(HelperOp));
+    g_array_set_clear_func(self->ops, (GDestroyNotify) helper_op_clear);
+
+    return self;
+}
+
+void installer_helper_batch_free(InstallerHelperBatch *self) {
+    g_return_if_fail(self != NULL);
+
+    g_array_unref(self->ops);
+    g_free(self);
+}
+
+guint installer_helper_batch_add(InstallerHelperBatch *self, InstallerHelperOp op,
+                                 GVariant *args) {
+    HelperOp entry = {0};
+
+    g_return_val_if_fail(self != NULL, 0);
+    g_return_val_if_fail(!self->ran, 0);
+    g_return_val_if_fail(op < INSTALLER_HELPER_N_OPS, 0);
+    g_return_val_if_fail(args != NULL, 0);
+
+    entry.op = op;
+    entry.args = g_variant_ref_sink(args);
+    g_array_append_val(self->ops, entry);
+
+    return self->ops->len - 1;
+}
+
+guint installer_helper_batch_get_length(InstallerHelperBatch *self) {
+    g_return_val_if_fail(self != NULL, 0);
+
+    return self->ops->len;
+}
+
+GVariant *installer_helper_batch_get_result(InstallerHelperBatch *self,
+                                            guint index, GError **err) {
+    HelperOp *op = NULL;
+
+    g_return_val_if_fail(self != NULL, NULL);
+    g_return_val_if_fail(index < self->ops->len, NULL);
+
+    op = &g_array_index(self->ops, HelperOp, index);
+    if (!op->answered) {
+        g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_PENDING,
+                            "Operation has not been run");
+        return NULL;
+    }
+
+    if (op->error) {
+        g_propagate_error(err, g_error_copy(op->error));
+        return NULL;
+    }
+
+    return op->result;
+}
+
+/**
+ * store_result:
+ * @op: The operation being answered
+ * @payload: A payload of %INSTALLER_HELPER_REPLY_RESULT
+ */
+static void store_result(HelperOp *op, GVariant *payload) {
+    gboolean success = FALSE;
+    const gchar *message = NULL;
+    g_autoptr(GVariant) value = NULL;
+
+    g_variant_get(payload, "(b&sv)", &success, &message, &value);
+
+    op->answered = TRUE;
+    if (success) {
+        op->result = g_steal_pointer(&value);
+    } else {
+        op->error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_FAILED, message);
+    }
+}
+
+static gboolean read_replies(InstallerHelper *self, InstallerHelperBatch *batch,
+                             guint id, InstallerHelperProgressFunc progress,
+                             gpointer user_data, GError **err) {
+    while (TRUE) {
+        g_autoptr(GVariant) reply = NULL;
+        g_autoptr(GVariant) payload = NULL;
+        guint kind = 0;
+        guint reply_id = 0;
+        guint index = 0;
+
+        reply = installer_helper_read_message(
+            self->fd, G_VARIANT_TYPE(INSTALLER_HELPER_REPLY_TYPE), err);
+        if (!reply) {
+            if (err && !*err) {
+                g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE,
+                                    "The helper has exited");
+            }
+            return FALSE;
+        }
+
+        g_variant_get(reply, "(uuuv)", &kind, &reply_id, &index, &payload);
+        if (reply_id != id) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "Reply for batch %u while running batch %u", reply_id, id);
+            return FALSE;
+        }
+
+        switch (kind) {
+            case INSTALLER_HELPER_REPLY_RESULT:
+                if (index >= batch->ops->len ||
+                    !g_variant_is_of_type(payload, G_VARIANT_TYPE("(bsv)"))) {
+                    g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                        "Malformed helper result");
+                    return FALSE;
+                }
+
+                store_result(&g_array_index(batch->ops, HelperOp, index), payload);
+                if (progress) {
+                    progress(batch, index, user_data);
+                }
+                break;
+
+            case INSTALLER_HELPER_REPLY_DONE:
+                return TRUE;
+
+            default:
+                g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Unknown helper reply kind %u", kind);
+                return FALSE;
+        }
+    }
+}
+
+gboolean installer_helper_run(InstallerHelper *self, InstallerHelperBatch *batch,
+                              InstallerHelperProgressFunc progress,
+                              gpointer user_data, GError **err) {
+    g_autoptr(GMutexLocker) locker = NULL;
+    g_autoptr(GVariant) request = NULL;
+    GVariantBuilder ops;
+    guint id = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_HELPER(self), FALSE);
+    g_return_val_if_fail(batch != NULL, FALSE);
+    g_return_val_if_fail(!batch->ran, FALSE);
+
+    locker = g_mutex_locker_new(&self->lock);
+
+    // After a failed round trip the stream may be mid-message
+    if (self->broken) {
+        g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE,
+                            "The connection to the helper has failed");
+        return FALSE;
+    }
+
+    g_variant_builder_init(&ops, G_VARIANT_TYPE("a(uv)"));
+    for (guint i = 0; i < batch->ops->len; i++) {
+        HelperOp *op = &g_array_index(batch->ops, HelperOp, i);
+        g_variant_builder_add(&ops, "(uv)", op->op, op->args);
+    }
+
+    batch->ran = TRUE;
+    id = ++self->next_batch;
+    request = g_variant_ref_sink(
+        g_variant_new(INSTALLER_HELPER_REQUEST_TYPE, id, batch->flags, &ops));
+
+    if (!installer_helper_write_message(self->fd, request, err) ||
+        !read_replies(self, batch, id, progress, user_data, err)) {
+        self->broken = TRUE;
+        return FALSE;
+    }
+
+    // Whatever was not answered was skipped after a failure
+    for (guint i = 0; i < batch->ops->len; i++) {
+        HelperOp *op = &g_array_index(batch->ops, HelperOp, i);
+        if (!op->answered) {
+            op->answered = TRUE;
+            op->error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                            "Skipped after an earlier failure");
+        }
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,145 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_HELPER_H
+#define INSTALLER_HELPER_H
+
+#include "helper_protocol.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_HELPER (installer_helper_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerHelper, installer_helper, INSTALLER, HELPER, GObject)
+
+/**
+ * InstallerHelperBatch:
+ *
+ * A list of operations to run in the root helper in one round trip,
+ * and once it has run, their results.
+ */
+typedef struct _InstallerHelperBatch InstallerHelperBatch;
+
+/**
+ * InstallerHelperProgressFunc:
+ * @batch: The batch being run
+ * @index: The index of the operation that finished
+ * @user_data: The data passed to installer_helper_run()
+ *
+ * Called as each operation of a batch finishes, on the thread running
+ * the batch. The result can be fetched with
+ * installer_helper_batch_get_result().
+ */
+typedef void (*InstallerHelperProgressFunc)(InstallerHelperBatch *batch,
+                                            guint index, gpointer user_data);
+
+/**
+ * installer_helper_spawn:
+ * @err: (out): Place to store an error (if any)
+ *
+ * Forks the root helper, connected to this process by a socketpair. The
+ * helper keeps the privileges of the calling process and exits once the
+ * returned object is finalized or this process goes away.
+ *
+ * Forking is only safe while a process has a single thread, so this
+ * must be called at the very start of main(), before anything starts a
+ * thread.
+ *
+ * Returns: (transfer full) (nullable): The helper, or %NULL on error
+ */
+InstallerHelper *installer_helper_spawn(GError **err);
+
+/**
+ * installer_helper_run:
+ * @self: The helper
+ * @batch: The batch to run
+ * @progress: (nullable) (scope call): Called as each operation finishes
+ * @user_data: Data to pass to @progress
+ * @err: (out): Place to store an error (if any)
+ *
+ * Sends a batch to the helper and blocks until every operation in it has
+ * been answered. Batches from different threads are run one after the
+ * other. A batch can only be run once.
+ *
+ * A failed operation does not fail the batch; check each result with
+ * installer_helper_batch_get_result().
+ *
+ * Returns: %FALSE if the batch could not be run at all
+ */
+gboolean installer_helper_run(InstallerHelper *self, InstallerHelperBatch *batch,
+                              InstallerHelperProgressFunc progress,
+                              gpointer user_data, GError **err);
+
+/**
+ * installer_helper_batch_new:
+ * @flags: Flags for running the batch
+ *
+ * Returns: (transfer full): A new, empty batch
+ */
+InstallerHelperBatch *installer_helper_batch_new(InstallerHelperBatchFlags flags);
+
+/**
+ * installer_helper_batch_free:
+ * @self: The batch
+ *
+ * Frees a batch and its results.
+ */
+void installer_helper_batch_free(InstallerHelperBatch *self);
+
+/**
+ * installer_helper_batch_add:
+ * @self: A batch that has not been run yet
+ * @op: The operation
+ * @args: (transfer floating): The arguments of @op, as described by
+ *        #InstallerHelperOp
+ *
+ * Returns: The index of the operation within the batch
+ */
+guint installer_helper_batch_add(InstallerHelperBatch *self, InstallerHelperOp op,
+                                 GVariant *args);
+
+/**
+ * installer_helper_batch_get_length:
+ * @self: The batch
+ *
+ * Returns: The number of operations in @self
+ */
+guint installer_helper_batch_get_length(InstallerHelperBatch *self);
+
+/**
+ * installer_helper_batch_get_result:
+ * @self: A batch that has been run
+ * @index: The index of the operation
+ * @err: (out): Place to store the error of the operation (if any)
+ *
+ * Gets what an operation returned. Operations that were skipped because
+ * an earlier one failed report %G_IO_ERROR_CANCELLED.
+ *
+ * Returns: (transfer none) (nullable): The return value, or %NULL if
+ *          the operation failed
+ */
+GVariant *installer_helper_batch_get_result(InstallerHelperBatch *self,
+                                            guint index, GError **err);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(InstallerHelperBatch, installer_helper_batch_free)
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,146 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "helper_protocol.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static gboolean write_full(gint fd, const guint8 *data, gsize size, GError **err) {
+    while (size > 0) {
+        // A helper that went away must not kill us with SIGPIPE
+        gssize written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Error writing to helper socket: %s", g_strerror(errno));
+            return FALSE;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return TRUE;
+}
+
+/**
+ * read_full:
+ *
+ * Returns: The number of bytes read, which is only less than @size if
+ *          the socket was closed, or -1 on error
+ */
+static gssize read_full(gint fd, guint8 *data, gsize size, GError **err) {
+    gsize total = 0;
+
+    while (total < size) {
+        gssize n = read(fd, data + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                        "Error reading from helper socket: %s", g_strerror(errno));
+            return -1;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        total += n;
+    }
+
+    return total;
+}
+
+gboolean installer_helper_write_message(gint fd, GVariant *message, GError **err) {
+    g_autoptr(GVariant) normal = NULL;
+    gsize size = 0;
+    guint32 header = 0;
+
+    g_return_val_if_fail(message != NULL, FALSE);
+
+    normal = g_variant_get_normal_form(message);
+    size = g_variant_get_size(normal);
+
+    if (size > INSTALLER_HELPER_MAX_FRAME_SIZE) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                    "Helper message of %" G_GSIZE_FORMAT " bytes is too large", size);
+        return FALSE;
+    }
+
+    // Both ends run on the same machine, but be explicit anyway
+    header = GUINT32_TO_LE((guint32) size);
+
+    return write_full(fd, (const guint8 *) &header, sizeof(header), err) &&
+           write_full(fd, g_variant_get_data(normal), size, err);
+}
+
+GVariant *installer_helper_read_message(gint fd, const GVariantType *type,
+                                        GError **err) {
+    g_autoptr(GBytes) bytes = NULL;
+    g_autoptr(GVariant) message = NULL;
+    guint32 header = 0;
+    gssize n = 0;
+    gsize size = 0;
+    guint8 *data = NULL;
+
+    n = read_full(fd, (guint8 *) &header, sizeof(header), err);
+    if (n <= 0) {
+        return NULL;
+    }
+
+    if (n != sizeof(header)) {
+        g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                            "Truncated helper message header");
+        return NULL;
+    }
+
+    size = GUINT32_FROM_LE(header);
+    if (size > INSTALLER_HELPER_MAX_FRAME_SIZE) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Helper message of %" G_GSIZE_FORMAT " bytes is too large", size);
+        return NULL;
+    }
+
+    data = g_malloc(size);
+    n = read_full(fd, data, size, err);
+    if (n < 0 || (gsize) n != size) {
+        if (n >= 0) {
+            g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                                "Truncated helper message");
+        }
+        g_free(data);
+        return NULL;
+    }
+
+    bytes = g_bytes_new_take(data, size);
+    message = g_variant_ref_sink(g_variant_new_from_bytes(type, bytes, FALSE));
+
+    // Never trust the other end to have sent the type it promised
+    if (!g_variant_is_normal_form(message)) {
+        g_set_error_literal(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Malformed helper message");
+        return NULL;
+    }
+
+    return g_steal_pointer(&message);
+}
@@ -0,0 +1,152 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_HELPER_PROTOCOL_H
+#define INSTALLER_HELPER_PROTOCOL_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * INSTALLER_HELPER_MAX_FRAME_SIZE:
+ *
+ * The largest message either side will accept. Anything bigger is
+ * treated as a protocol error rather than allocated.
+ */
+#define INSTALLER_HELPER_MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+/**
+ * INSTALLER_HELPER_REQUEST_TYPE:
+ *
+ * A batch of operations: its ID, #InstallerHelperBatchFlags, and an
+ * array of (#InstallerHelperOp, arguments) pairs.
+ */
+#define INSTALLER_HELPER_REQUEST_TYPE "(uua(uv))"
+
+/**
+ * INSTALLER_HELPER_REPLY_TYPE:
+ *
+ * A message from the helper: its #InstallerHelperReplyKind, the ID of
+ * the batch it belongs to, the index of the operation within the batch,
+ * and a payload that depends on the kind.
+ */
+#define INSTALLER_HELPER_REPLY_TYPE "(uuuv)"
+
+/**
+ * InstallerHelperOp:
+ * @INSTALLER_HELPER_OP_MOUNT: Mount a device on a new mount point of
+ *     the helper's, always nosuid, nodev and noexec. Arguments are
+ *     `(ssb)`: the device, the filesystem type or "" to detect it, and
+ *     whether to mount it read-write. Returns `(s)`: the mount point.
+ * @INSTALLER_HELPER_OP_UNMOUNT: Unmount a filesystem the helper mounted
+ *     and remove its mount point. Arguments are `(sb)`: the mount point
+ *     and whether to detach it lazily. Returns `()`.
+ * @INSTALLER_HELPER_OP_DETECT_OS: Mount a device read-only and look for
+ *     an operating system on it. Arguments are `(s)`: the device.
+ *     Returns `(usss)`: the #InstallerOSType, the name, the device and
+ *     the icon name, or `()` if nothing was found.
+ * @INSTALLER_HELPER_OP_WIPE: Wipe all signatures from a device.
+ *     Arguments are `(s)`: the device. Returns `()`.
+ * @INSTALLER_HELPER_OP_READ_DISK: Read the partition table of a disk.
+ *     Arguments are `(s)`: the disk. Returns the layout from
+ *     disk_manager_read_disk().
+ * @INSTALLER_HELPER_OP_READ_SIGNATURES: Read the LUKS, LVM2 and md
+ *     signatures of a device. Arguments are `(st)`: the device and its
+ *     size in bytes. Returns `(usas)`: the #InstallerTopologyMember, the
+ *     volume group or array name, and the logical volume names.
+ * @INSTALLER_HELPER_OP_INSTALL_IMAGE: Install a root filesystem by
+ *     writing a prebuilt image of it to a partition, as
+ *     #InstallerImageWriter does. Arguments are `(sss)`: the image, which
+ *     must be a world-readable regular file, the disk and the partition
+ *     on it. Returns `(s)`: the new UUID of the filesystem.
+ *
+ * The operations the root helper can run.
+ */
+typedef enum {
+    INSTALLER_HELPER_OP_MOUNT,
+    INSTALLER_HELPER_OP_UNMOUNT,
+    INSTALLER_HELPER_OP_DETECT_OS,
+    INSTALLER_HELPER_OP_WIPE,
+    INSTALLER_HELPER_OP_READ_DISK,
+    INSTALLER_HELPER_OP_READ_SIGNATURES,
+    INSTALLER_HELPER_OP_INSTALL_IMAGE,
+    INSTALLER_HELPER_N_OPS
+} InstallerHelperOp;
+
+/**
+ * InstallerHelperBatchFlags:
+ * @INSTALLER_HELPER_BATCH_NONE: Run every operation
+ * @INSTALLER_HELPER_BATCH_STOP_ON_ERROR: Skip the rest of the batch once
+ *     an operation fails
+ *
+ * Flags changing how a batch is run.
+ */
+typedef enum {
+    INSTALLER_HELPER_BATCH_NONE = 0,
+    INSTALLER_HELPER_BATCH_STOP_ON_ERROR = 1 << 0
+} InstallerHelperBatchFlags;
+
+/**
+ * InstallerHelperReplyKind:
+ * @INSTALLER_HELPER_REPLY_RESULT: An operation has finished. The payload
+ *     is `(bsv)`: whether it succeeded, the error message if not, and
+ *     its return value.
+ * @INSTALLER_HELPER_REPLY_DONE: Every operation of the batch has been
+ *     answered. The payload is `u`: the number of operations that ran.
+ *
+ * The kinds of message the helper sends back. Results are streamed as
+ * soon as each operation finishes, so they double as progress events.
+ */
+typedef enum {
+    INSTALLER_HELPER_REPLY_RESULT,
+    INSTALLER_HELPER_REPLY_DONE
+} InstallerHelperReplyKind;
+
+/**
+ * installer_helper_write_message:
+ * @fd: The socket to write to
+ * @message: The message to send
+ * @err: (out): Place to store an error (if any)
+ *
+ * Sends a message as a little-endian 32-bit length followed by the
+ * message serialized in GVariant normal form. Blocks until everything
+ * has been written.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean installer_helper_write_message(gint fd, GVariant *message, GError **err);
+
+/**
+ * installer_helper_read_message:
+ * @fd: The socket to read from
+ * @type: The type the message must have
+ * @err: (out): Place to store an error (if any)
+ *
+ * Reads one message written by installer_helper_write_message(). Blocks
+ * until it has been read. If the other end has closed the socket, %NULL
+ * is returned without setting @err.
+ *
+ * Returns: (transfer full) (nullable): The message, or %NULL
+ */
+GVariant *installer_helper_read_message(gint fd, const GVariantType *type,
+                                        GError **err);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,469 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "helper_server.h"
+#include "installer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Every mount is made with these, so nothing on it can gain privileges */
+#define HELPER_MOUNT_OPTIONS "nosuid,nodev,noexec"
+
+/**
+ * HelperSession:
+ * @manager: Used for probing
+ * @mounts: (element-type utf8): The mount points this helper made, and
+ *     so the only ones it will unmount
+ *
+ * What the helper keeps between batches.
+ */
+typedef struct _HelperSession {
+    DiskManager *manager;
+    GHashTable *mounts;
+} HelperSession;
+
+typedef GVariant *(*HelperOpFunc)(HelperSession *session, InstallerArena *arena,
+                                  GVariant *args, GError **err);
+
+/**
+ * check_device:
+ *
+ * The GUI is not trusted with anything but block devices. The path is
+ * resolved first, so neither symlinks under /dev nor files in /dev/shm
+ * get through, and the resolved path is what gets used.
+ *
+ * Returns: (transfer full) (nullable): The resolved path of the device
+ */
+static gchar *check_device(const gchar *device, GError **err) {
+    g_autofree gchar *resolved = realpath(device, NULL);
+    struct stat st;
+
+    if (!resolved || stat(resolved, &st) != 0 || !S_ISBLK(st.st_mode)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "'%s' is not a block device", device);
+        return NULL;
+    }
+
+    return g_steal_pointer(&resolved);
+}
+
+/**
+ * check_image:
+ *
+ * The helper reads an image with root's rights, so it only takes ones
+ * the GUI could read itself, and never e.g. /etc/shadow.
+ *
+ * Returns: (transfer full) (nullable): The resolved path of the image
+ */
+static gchar *check_image(const gchar *image, GError **err) {
+    g_autofree gchar *resolved = realpath(image, NULL);
+    struct stat st;
+
+    if (!resolved || stat(resolved, &st) != 0 || !S_ISREG(st.st_mode) ||
+        !(st.st_mode & S_IROTH)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "'%s' is not a readable image", image);
+        return NULL;
+    }
+
+    return g_steal_pointer(&resolved);
+}
+
+static gboolean check_fstype(const gchar *fstype, GError **err) {
+    for (const gchar *c = fstype; *c; c++) {
+        if (!g_ascii_isalnum(*c) && *c != '_' && *c != '.') {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                        "'%s' is not a filesystem type", fstype);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static GVariant *op_mount(HelperSession *session,
+                          __attribute((unused)) InstallerArena *arena,
+                          GVariant *args, GError **err) {
+    const gchar *device = NULL;
+    const gchar *fstype = NULL;
+    gboolean writable = FALSE;
+    g_autofree gchar *resolved = NULL;
+    g_autofree gchar *mount_point = NULL;
+    g_autofree gchar *options = NULL;
+
+    g_variant_get(args, "(&s&sb)", &device, &fstype, &writable);
+
+    resolved = check_device(device, err);
+    if (!resolved || !check_fstype(fstype, err)) {
+        return NULL;
+    }
+
+    // The mount point is always the helper's own, never one of the GUI's
+    mount_point = g_dir_make_tmp("us.getsol.Installer-XXXXXX", err);
+    if (!mount_point) {
+        return NULL;
+    }
+
+    options = g_strconcat(writable ? "rw," : "ro,", HELPER_MOUNT_OPTIONS, NULL);
+    if (!bd_fs_mount(resolved, mount_point, *fstype ? fstype : NULL, options, NULL,
+                     err)) {
+        rmdir(mount_point);
+        return NULL;
+    }
+
+    g_hash_table_add(session->mounts, g_strdup(mount_point));
+    return g_variant_new("(s)", mount_point);
+}
+
+static GVariant *op_unmount(HelperSession *session,
+                            __attribute((unused)) InstallerArena *arena,
+                            GVariant *args, GError **err) {
+    const gchar *mount_point = NULL;
+    gboolean lazy = FALSE;
+
+    g_variant_get(args, "(&sb)", &mount_point, &lazy);
+
+    if (!g_hash_table_contains(session->mounts, mount_point)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "'%s' was not mounted by the helper", mount_point);
+        return NULL;
+    }
+
+    if (!bd_fs_unmount(mount_point, lazy, FALSE, NULL, err)) {
+        return NULL;
+    }
+
+    rmdir(mount_point);
+    g_hash_table_remove(session->mounts, mount_point);
+
+    return g_variant_new("()");
+}
+
+/**
+ * unmount_all:
+ *
+ * Cleans up whatever the GUI left mounted when it went away.
+ */
+static void unmount_all(HelperSession *session) {
+    GHashTableIter iter;
+    gpointer mount_point = NULL;
+
+    g_hash_table_iter_init(&iter, session->mounts);
+    while (g_hash_table_iter_next(&iter, &mount_point, NULL)) {
+        if (bd_fs_unmount(mount_point, TRUE, FALSE, NULL, NULL)) {
+            rmdir(mount_point);
+        }
+        g_hash_table_iter_remove(&iter);
+    }
+}
+
+static GVariant *op_detect_os(HelperSession *session, InstallerArena *arena,
+                              GVariant *args, GError **err) {
+    const gchar *device = NULL;
+    g_autofree gchar *resolved = NULL;
+    const gchar *icon = NULL;
+    InstallerOS *os = NULL;
+    g_autoptr(GError) detect_err = NULL;
+
+    g_variant_get(args, "(&s)", &device);
+
+    resolved = check_device(device, err);
+    if (!resolved) {
+        return NULL;
+    }
+
+    // Reported under the name the GUI knows it by
+    os = disk_manager_detect_os_at_path(session->manager, arena, resolved, &detect_err);
+    if (!os) {
+        if (detect_err) {
+            g_propagate_error(err, g_steal_pointer(&detect_err));
+            return NULL;
+        }
+        return g_variant_new("()");
+    }
+
+    icon = installer_os_get_icon_name(os);
+
+    return g_variant_new("(usss)", installer_os_get_otype(os), os->name ? os->name : "",
+                         device, icon ? icon : "");
+}
+
+static GVariant *op_wipe(__attribute((unused)) HelperSession *session,
+                         __attribute((unused)) InstallerArena *arena,
+                         GVariant *args, GError **err) {
+    const gchar *device = NULL;
+    g_autofree gchar *resolved = NULL;
+
+    g_variant_get(args, "(&s)", &device);
+
+    resolved = check_device(device, err);
+    if (!resolved) {
+        return NULL;
+    }
+
+    if (!bd_fs_wipe(resolved, TRUE, err)) {
+        return NULL;
+    }
+
+    return g_variant_new("()");
+}
+
+static GVariant *op_read_disk(__attribute((unused)) HelperSession *session,
+                              __attribute((unused)) InstallerArena *arena,
+                              GVariant *args, GError **err) {
+    const gchar *disk = NULL;
+    g_autofree gchar *resolved = NULL;
+
+    g_variant_get(args, "(&s)", &disk);
+
+    resolved = check_device(disk, err);
+    if (!resolved) {
+        return NULL;
+    }
+
+    return disk_manager_read_disk(resolved, err);
+}
+
+static GVariant *op_read_signatures(__attribute((unused)) HelperSession *session,
+                                    __attribute((unused)) InstallerArena *arena,
+                                    GVariant *args, GError **err) {
+    const gchar *device = NULL;
+    guint64 size = 0;
+    g_autofree gchar *resolved = NULL;
+    InstallerTopologyNode node = {0};
+    GVariant *ret = NULL;
+
+    g_variant_get(args, "(&st)", &device, &size);
+
+    resolved = check_device(device, err);
+    if (!resolved) {
+        return NULL;
+    }
+
+    // Only the fields the readers fill in are needed
+    node.path = resolved;
+    node.member_children = g_ptr_array_new_with_free_func(g_free);
+
+    installer_topology_read_signatures(&node, size, NULL);
+
+    g_ptr_array_add(node.member_children, NULL);
+    ret = g_variant_new("(us^as)", node.member, node.member_of ? node.member_of : "",
+                        (gchar **) node.member_children->pdata);
+
+    g_free(node.member_of);
+    g_ptr_array_unref(node.member_children);
+    return ret;
+}
+
+static void on_image_written(__attribute((unused)) GObject *source, GAsyncResult *result,
+                             gpointer user_data) {
+    GAsyncResult **out = user_data;
+
+    *out = g_object_ref(result);
+}
+
+static GVariant *op_install_image(HelperSession *session,
+                                  __attribute((unused)) InstallerArena *arena,
+                                  GVariant *args, GError **err) {
+    const gchar *image = NULL;
+    const gchar *disk = NULL;
+    const gchar *partition = NULL;
+    g_autofree gchar *resolved_image = NULL;
+    g_autofree gchar *resolved_disk = NULL;
+    g_autofree gchar *resolved_partition = NULL;
+    g_autoptr(InstallerDrive) drive = NULL;
+    g_autoptr(InstallerImageWriter) writer = NULL;
+    g_autoptr(GMainContext) context = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+
+    g_variant_get(args, "(&s&s&s)", &image, &disk, &partition);
+
+    resolved_image = check_image(image, err);
+    if (!resolved_image) {
+        return NULL;
+    }
+
+    resolved_disk = check_device(disk, err);
+    if (!resolved_disk) {
+        return NULL;
+    }
+
+    resolved_partition = check_device(partition, err);
+    if (!resolved_partition) {
+        return NULL;
+    }
+
+    // Parsed here rather than taken from the GUI, which is not trusted
+    // to say where the EFI system partition is
+    drive = disk_manager_parse_system_disk(session->manager, resolved_disk, resolved_disk,
+                                           NULL, err);
+    if (!drive) {
+        return NULL;
+    }
+
+    writer = installer_image_writer_new(resolved_image, drive, resolved_partition, err);
+    if (!writer) {
+        return NULL;
+    }
+
+    // Operations are answered in order, so this one waits for the write
+    context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    installer_image_writer_write_async(writer, NULL, on_image_written, &result);
+    while (!result) {
+        g_main_context_iteration(context, TRUE);
+    }
+    g_main_context_pop_thread_default(context);
+
+    if (!installer_image_writer_write_finish(writer, result, err)) {
+        return NULL;
+    }
+
+    return g_variant_new("(s)", installer_image_writer_get_uuid(writer));
+}
+
+/* Indexed by InstallerHelperOp */
+static const struct {
+    const gchar *args_type;
+    HelperOpFunc func;
+} helper_ops[INSTALLER_HELPER_N_OPS] = {
+    [INSTALLER_HELPER_OP_MOUNT] = {"(ssb)", op_mount},
+    [INSTALLER_HELPER_OP_UNMOUNT] = {"(sb)", op_unmount},
+    [INSTALLER_HELPER_OP_DETECT_OS] = {"(s)", op_detect_os},
+    [INSTALLER_HELPER_OP_WIPE] = {"(s)", op_wipe},
+    [INSTALLER_HELPER_OP_READ_DISK] = {"(s)", op_read_disk},
+    [INSTALLER_HELPER_OP_READ_SIGNATURES] = {"(st)", op_read_signatures},
+    [INSTALLER_HELPER_OP_INSTALL_IMAGE] = {"(sss)", op_install_image},
+};
+
+static GVariant *run_op(HelperSession *session, InstallerArena *arena, guint op,
+                        GVariant *args, GError **err) {
+    if (op >= INSTALLER_HELPER_N_OPS) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Unknown helper operation %u", op);
+        return NULL;
+    }
+
+    if (!g_variant_is_of_type(args, G_VARIANT_TYPE(helper_ops[op].args_type))) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Expected arguments of type %s, got %s", helper_ops[op].args_type,
+                    g_variant_get_type_string(args));
+        return NULL;
+    }
+
+    return helper_ops[op].func(session, arena, args, err);
+}
+
+static gboolean send_reply(gint fd, InstallerHelperReplyKind kind, guint batch,
+                           guint index, GVariant *payload, GError **err) {
+    g_autoptr(GVariant) reply = g_variant_ref_sink(
+        g_variant_new(INSTALLER_HELPER_REPLY_TYPE, kind, batch, index, payload));
+
+    return installer_helper_write_message(fd, reply, err);
+}
+
+/**
+ * run_batch:
+ *
+ * Answers each operation as soon as it finishes, so the GUI can show
+ * progress while the rest of the batch is still running.
+ *
+ * Returns: %FALSE if the replies could not be sent
+ */
+static gboolean run_batch(gint fd, HelperSession *session, GVariant *request,
+                          GError **err) {
+    g_autoptr(InstallerArena) arena = installer_arena_new();
+    g_autoptr(GVariantIter) iter = NULL;
+    GVariant *args = NULL;
+    guint batch = 0;
+    guint flags = 0;
+    guint op = 0;
+    guint index = 0;
+
+    g_variant_get(request, "(uua(uv))", &batch, &flags, &iter);
+
+    while (g_variant_iter_next(iter, "(uv)", &op, &args)) {
+        g_autoptr(GVariant) owned_args = args;
+        g_autoptr(GError) op_err = NULL;
+        GVariant *payload = NULL;
+
+        // Results are floating, and sunk by the payload
+        GVariant *result = run_op(session, arena, op, args, &op_err);
+        if (result) {
+            payload = g_variant_new("(bsv)", TRUE, "", result);
+        } else {
+            payload = g_variant_new("(bsv)", FALSE, op_err->message, g_variant_new("()"));
+        }
+
+        if (!send_reply(fd, INSTALLER_HELPER_REPLY_RESULT, batch, index, payload, err)) {
+            return FALSE;
+        }
+
+        index++;
+        if (op_err && (flags & INSTALLER_HELPER_BATCH_STOP_ON_ERROR)) {
+            break;
+        }
+    }
+
+    return send_reply(fd, INSTALLER_HELPER_REPLY_DONE, batch, index,
+                      g_variant_new_uint32(index), err);
+}
+
+gint installer_helper_serve(gint fd) {
+    g_autoptr(GError) err = NULL;
+    g_autoptr(DiskManager) manager = NULL;
+    g_autoptr(GHashTable) mounts = NULL;
+    HelperSession session;
+
+    if (!installer_init_blockdev(&err)) {
+        g_critical("helper: error initializing blockdev library: %s", err->message);
+        return EXIT_FAILURE;
+    }
+
+    // Only used for probing; it never scans or monitors on its own
+    manager = disk_manager_new();
+    mounts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    session.manager = manager;
+    session.mounts = mounts;
+
+    while (TRUE) {
+        g_autoptr(GVariant) request = NULL;
+
+        request = installer_helper_read_message(
+            fd, G_VARIANT_TYPE(INSTALLER_HELPER_REQUEST_TYPE), &err);
+        if (!request) {
+            break;
+        }
+
+        if (!run_batch(fd, &session, request, &err)) {
+            break;
+        }
+    }
+
+    unmount_all(&session);
+
+    if (err) {
+        g_critical("helper: %s", err->message);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_HELPER_SERVER_H
+#define INSTALLER_HELPER_SERVER_H
+
+#include "helper_protocol.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * installer_helper_serve:
+ * @fd: The helper's end of the socketpair
+ *
+ * Runs the root helper: initializes blockdev, then answers batches read
+ * from @fd one at a time until the other end closes it. Only block
+ * devices are accepted, and only mount points the helper made itself
+ * can be unmounted; anything still mounted when the other end closes
+ * is unmounted.
+ *
+ * Returns: The exit status for the helper process
+ */
+gint installer_helper_serve(gint fd);
+
+G_END_DECLS
+
+#endif
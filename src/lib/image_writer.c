@@ -0,0 +1,624 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#define _GNU_SOURCE
+
+#include "image_writer.h"
+#include "btrfs.h"
+#include "executor.h"
+#include "fs_tech.h"
+
+#include <blockdev/fs.h>
+#include <blockdev/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Size of each write; big enough that the device sees long sequential runs */
+#define IMAGE_CHUNK_SIZE (8 * 1024 * 1024)
+
+/* RAID and other metadata that lives at the end of a partition */
+#define IMAGE_TAIL_SIZE (1024 * 1024)
+
+struct _InstallerImageWriter {
+    GObject parent_instance;
+
+    gchar *image;
+    gchar *fstype;
+    guint64 image_size;
+
+    gchar *device;
+    gchar *partition;
+    guint64 partition_size;
+    BDPartSpec *esp;
+
+    gchar *uuid;
+
+    GMutex progress_lock;
+    InstallerImageProgress progress;
+};
+
+G_DEFINE_TYPE(InstallerImageWriter, installer_image_writer, G_TYPE_OBJECT);
+
+static void installer_image_writer_finalize(GObject *obj);
+
+static void installer_image_writer_class_init(InstallerImageWriterClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_image_writer_finalize;
+}
+
+static void installer_image_writer_init(InstallerImageWriter *self) {
+    g_mutex_init(&self->progress_lock);
+}
+
+static void installer_image_writer_finalize(GObject *obj) {
+    InstallerImageWriter *self = INSTALLER_IMAGE_WRITER(obj);
+
+    g_free(self->image);
+    g_free(self->fstype);
+    g_free(self->device);
+    g_free(self->partition);
+    g_clear_pointer(&self->esp, bd_part_spec_free);
+    g_free(self->uuid);
+    g_mutex_clear(&self->progress_lock);
+
+    G_OBJECT_CLASS(installer_image_writer_parent_class)->finalize(obj);
+}
+
+static BDPartSpec *find_partition(GPtrArray *partitions, const gchar *path) {
+    for (guint i = 0; i < partitions->len; i++) {
+        BDPartSpec *spec = g_ptr_array_index(partitions, i);
+        if (g_strcmp0(spec->path, path) == 0) {
+            return spec;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * check_privileges:
+ *
+ * Every stage opens the partition for writing, and growing btrfs mounts
+ * it, so without root the install would fail part way, possibly after
+ * the image has been written. The unprivileged GUI has to leave image
+ * installs to the root helper.
+ */
+static gboolean check_privileges(GError **err) {
+    if (geteuid() != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "Installing an image needs root; it has to run in the root helper");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * check_tools:
+ *
+ * Checks for everything the later stages need before anything is
+ * written, so a missing tool cannot leave a half-installed partition.
+ */
+static gboolean check_tools(const gchar *fstype, GError **err) {
+    if (g_strcmp0(fstype, "ext4") == 0) {
+        return installer_fs_tech_available(BD_FS_TECH_EXT4,
+                                           BD_FS_TECH_MODE_REPAIR | BD_FS_TECH_MODE_RESIZE,
+                                           err) &&
+               bd_utils_check_util_version("tune2fs", NULL, NULL, NULL, err);
+    }
+
+    return bd_utils_check_util_version("btrfstune", NULL, NULL, NULL, err);
+}
+
+InstallerImageWriter *installer_image_writer_new(const gchar *image,
+                                                 InstallerDrive *drive,
+                                                 const gchar *partition,
+                                                 GError **err) {
+    g_autoptr(InstallerImageWriter) self = NULL;
+    g_autofree gchar *fstype = NULL;
+    BDPartSpec *spec = NULL;
+    struct stat st;
+
+    g_return_val_if_fail(image != NULL, NULL);
+    g_return_val_if_fail(INSTALLER_IS_DRIVE(drive), NULL);
+    g_return_val_if_fail(partition != NULL, NULL);
+
+    if (!check_privileges(err)) {
+        return NULL;
+    }
+
+    if (stat(image, &st) != 0) {
+        gint saved = errno;
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                    "Error reading image '%s': %s", image, g_strerror(saved));
+        return NULL;
+    }
+
+    fstype = bd_fs_get_fstype(image, err);
+    if (!fstype) {
+        g_prefix_error(err, "Error probing image '%s': ", image);
+        return NULL;
+    }
+
+    if (g_strcmp0(fstype, "ext4") != 0 && g_strcmp0(fstype, "btrfs") != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Image '%s' holds %s, not ext4 or btrfs", image, fstype);
+        return NULL;
+    }
+
+    spec = find_partition(drive->partitions, partition);
+    if (!spec) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                    "'%s' is not a partition on %s", partition, drive->device);
+        return NULL;
+    }
+
+    if (find_partition(drive->esps, partition)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "'%s' is the EFI system partition", partition);
+        return NULL;
+    }
+
+    if ((guint64) st.st_size + IMAGE_TAIL_SIZE > spec->size) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "'%s' is too small for image '%s'", partition, image);
+        return NULL;
+    }
+
+    if (drive->esps->len == 0 && g_file_test("/sys/firmware/efi", G_FILE_TEST_IS_DIR)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                    "%s has no EFI system partition to boot the image from",
+                    drive->device);
+        return NULL;
+    }
+
+    if (!check_tools(fstype, err)) {
+        return NULL;
+    }
+
+    self = g_object_new(INSTALLER_TYPE_IMAGE_WRITER, NULL);
+    self->image = g_strdup(image);
+    self->fstype = g_steal_pointer(&fstype);
+    self->image_size = st.st_size;
+    self->device = g_strdup(drive->device);
+    self->partition = g_strdup(partition);
+    self->partition_size = spec->size;
+    self->esp = drive->esps->len > 0 ? bd_part_spec_copy(g_ptr_array_index(drive->esps, 0))
+                                     : NULL;
+    self->uuid = g_uuid_string_random();
+    self->progress.bytes_total = st.st_size;
+
+    return g_steal_pointer(&self);
+}
+
+void installer_image_writer_get_progress(InstallerImageWriter *self,
+                                         InstallerImageProgress *progress) {
+    g_return_if_fail(INSTALLER_IS_IMAGE_WRITER(self));
+    g_return_if_fail(progress != NULL);
+
+    g_mutex_lock(&self->progress_lock);
+    *progress = self->progress;
+    g_mutex_unlock(&self->progress_lock);
+}
+
+const gchar *installer_image_writer_get_uuid(InstallerImageWriter *self) {
+    g_return_val_if_fail(INSTALLER_IS_IMAGE_WRITER(self), NULL);
+
+    return self->uuid;
+}
+
+BDPartSpec *installer_image_writer_get_esp(InstallerImageWriter *self) {
+    g_return_val_if_fail(INSTALLER_IS_IMAGE_WRITER(self), NULL);
+
+    return self->esp;
+}
+
+static void set_stage(InstallerImageWriter *self, InstallerImageStage stage) {
+    g_mutex_lock(&self->progress_lock);
+    self->progress.stage = stage;
+    g_mutex_unlock(&self->progress_lock);
+}
+
+static gboolean set_errno_error(GError **err, const gchar *what, const gchar *path) {
+    gint saved = errno;
+
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved), "Error %s '%s': %s",
+                what, path, g_strerror(saved));
+    return FALSE;
+}
+
+/* Writing */
+
+static gboolean read_full(gint fd, guint8 *buffer, gsize len, gsize *got) {
+    *got = 0;
+
+    while (*got < len) {
+        gssize n = read(fd, buffer + *got, len - *got);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        *got += n;
+    }
+
+    return TRUE;
+}
+
+static gboolean pwrite_full(gint fd, const guint8 *buffer, gsize len, guint64 offset) {
+    gsize written = 0;
+
+    while (written < len) {
+        gssize n = pwrite(fd, buffer + written, len - written, offset + written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+
+        written += n;
+    }
+
+    return TRUE;
+}
+
+/**
+ * write_tail:
+ *
+ * Zeroes the end of the partition, where old RAID superblocks would
+ * otherwise survive the install and be found again by udev.
+ */
+static gboolean write_tail(InstallerImageWriter *self, gint dev, guint8 *buffer,
+                           guint64 device_size, guint block_size, GError **err) {
+    guint64 offset = (device_size - IMAGE_TAIL_SIZE) / block_size * block_size;
+
+    memset(buffer, 0, device_size - offset);
+    if (!pwrite_full(dev, buffer, device_size - offset, offset)) {
+        return set_errno_error(err, "clearing the end of", self->partition);
+    }
+
+    return TRUE;
+}
+
+/**
+ * ImageChunk:
+ * @buffer: Where the chunk is read to
+ * @got: How much was read
+ * @errsv: The errno of a failed read, or 0
+ */
+typedef struct _ImageChunk {
+    guint8 *buffer;
+    gsize got;
+    gint errsv;
+} ImageChunk;
+
+/**
+ * ImageReader:
+ * @img: The image
+ * @size: The size of the image
+ * @chunks: The two buffers, passed back and forth with the writer
+ * @free: Chunks the reader may fill, or @stop
+ * @filled: Chunks ready to be written, in order
+ * @stop: Pushed to @free to stop the reader early
+ *
+ * Reads the image into one buffer while the other is written, so the
+ * source and the partition are busy at the same time.
+ */
+typedef struct _ImageReader {
+    gint img;
+    guint64 size;
+    ImageChunk chunks[2];
+    GAsyncQueue *free;
+    GAsyncQueue *filled;
+    ImageChunk stop;
+} ImageReader;
+
+static gpointer read_thread(gpointer data) {
+    ImageReader *reader = data;
+    guint64 done = 0;
+
+    while (done < reader->size) {
+        ImageChunk *chunk = g_async_queue_pop(reader->free);
+        gsize want = MIN(IMAGE_CHUNK_SIZE, reader->size - done);
+
+        if (chunk == &reader->stop) {
+            break;
+        }
+
+        chunk->errsv = read_full(reader->img, chunk->buffer, want, &chunk->got) ? 0 : errno;
+        g_async_queue_push(reader->filled, chunk);
+
+        // The writer stops at a failed or short read, so there is no more to do
+        if (chunk->errsv != 0 || chunk->got < want) {
+            break;
+        }
+        done += chunk->got;
+    }
+
+    return NULL;
+}
+
+static gboolean write_chunks(InstallerImageWriter *self, ImageReader *reader, gint dev,
+                             gint block_size, GCancellable *cancellable, GError **err) {
+    guint64 done = 0;
+
+    while (done < self->image_size) {
+        gsize want = MIN(IMAGE_CHUNK_SIZE, self->image_size - done);
+        ImageChunk *chunk = NULL;
+        gsize len = 0;
+
+        if (g_cancellable_set_error_if_cancelled(cancellable, err)) {
+            return FALSE;
+        }
+
+        chunk = g_async_queue_pop(reader->filled);
+        if (chunk->errsv != 0) {
+            errno = chunk->errsv;
+            return set_errno_error(err, "reading image", self->image);
+        }
+
+        if (chunk->got < want) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                        "Image '%s' changed while it was written", self->image);
+            return FALSE;
+        }
+
+        // Direct writes must be whole blocks, so the last is padded
+        len = (chunk->got + block_size - 1) / block_size * block_size;
+        memset(chunk->buffer + chunk->got, 0, len - chunk->got);
+
+        if (!pwrite_full(dev, chunk->buffer, len, done)) {
+            return set_errno_error(err, "writing to", self->partition);
+        }
+
+        done += chunk->got;
+        g_async_queue_push(reader->free, chunk);
+
+        g_mutex_lock(&self->progress_lock);
+        self->progress.bytes_done = done;
+        g_mutex_unlock(&self->progress_lock);
+    }
+
+    return TRUE;
+}
+
+static gboolean write_image(InstallerImageWriter *self, gint img, gint dev,
+                            guint8 *buffers, GCancellable *cancellable, GError **err) {
+    ImageReader reader = {0};
+    GThread *thread = NULL;
+    guint64 device_size = 0;
+    gint block_size = 0;
+    gboolean ret = FALSE;
+
+    if (ioctl(dev, BLKGETSIZE64, &device_size) != 0 ||
+        ioctl(dev, BLKSSZGET, &block_size) != 0) {
+        return set_errno_error(err, "reading the size of", self->partition);
+    }
+
+    if (self->image_size + IMAGE_TAIL_SIZE > device_size) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "'%s' is too small for image '%s'", self->partition, self->image);
+        return FALSE;
+    }
+
+    // Done before the reader starts, as it borrows the first buffer
+    if (!write_tail(self, dev, buffers, device_size, block_size, err)) {
+        return FALSE;
+    }
+
+    reader.img = img;
+    reader.size = self->image_size;
+    reader.free = g_async_queue_new();
+    reader.filled = g_async_queue_new();
+    for (guint i = 0; i < G_N_ELEMENTS(reader.chunks); i++) {
+        reader.chunks[i].buffer = buffers + i * IMAGE_CHUNK_SIZE;
+        g_async_queue_push(reader.free, &reader.chunks[i]);
+    }
+
+    thread = g_thread_new("image-reader", read_thread, &reader);
+    ret = write_chunks(self, &reader, dev, block_size, cancellable, err);
+
+    // Harmless if the reader has already read everything
+    g_async_queue_push(reader.free, &reader.stop);
+    g_thread_join(thread);
+    g_async_queue_unref(reader.free);
+    g_async_queue_unref(reader.filled);
+
+    if (ret && fdatasync(dev) != 0) {
+        return set_errno_error(err, "flushing", self->partition);
+    }
+
+    return ret;
+}
+
+static gboolean write_partition(InstallerImageWriter *self, GCancellable *cancellable,
+                                GError **err) {
+    guint8 *buffers = NULL;
+    gint img = -1;
+    gint dev = -1;
+    gboolean ret = FALSE;
+
+    img = open(self->image, O_RDONLY | O_CLOEXEC);
+    if (img < 0) {
+        return set_errno_error(err, "opening image", self->image);
+    }
+
+    // O_EXCL on a block device fails if it is mounted or in use
+    dev = open(self->partition, O_WRONLY | O_DIRECT | O_EXCL | O_CLOEXEC);
+    if (dev < 0) {
+        set_errno_error(err, "opening", self->partition);
+        close(img);
+        return FALSE;
+    }
+
+    // Mapped, since direct I/O needs page-aligned buffers
+    buffers = mmap(NULL, 2 * IMAGE_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        set_errno_error(err, "allocating a buffer for", self->partition);
+    } else {
+        posix_fadvise(img, 0, 0, POSIX_FADV_SEQUENTIAL);
+        ret = write_image(self, img, dev, buffers, cancellable, err);
+        munmap(buffers, 2 * IMAGE_CHUNK_SIZE);
+    }
+
+    close(img);
+    if (close(dev) != 0 && ret) {
+        ret = set_errno_error(err, "closing", self->partition);
+    }
+
+    return ret;
+}
+
+/* Finishing the filesystem */
+
+static gboolean run_tool(const gchar *tool, const gchar *arg, const gchar *value,
+                         const gchar *device, GError **err) {
+    const gchar *argv[] = {tool, arg, value, device, NULL};
+
+    return bd_utils_exec_and_report_error(argv, NULL, err);
+}
+
+static gboolean grow_btrfs(InstallerImageWriter *self, GError **err) {
+    g_autofree gchar *mount_point = NULL;
+    g_autoptr(GError) unmount_err = NULL;
+    gboolean ret = FALSE;
+    gint fd = -1;
+
+    mount_point = g_dir_make_tmp("installer-image-XXXXXX", err);
+    if (!mount_point) {
+        return FALSE;
+    }
+
+    // btrfs can only be grown while mounted
+    if (!bd_fs_mount(self->partition, mount_point, "btrfs", NULL, NULL, err)) {
+        g_rmdir(mount_point);
+        return FALSE;
+    }
+
+    fd = open(mount_point, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        set_errno_error(err, "opening", mount_point);
+    } else {
+        ret = installer_btrfs_resize_max(fd, err);
+        close(fd);
+    }
+
+    if (!bd_fs_unmount(mount_point, FALSE, FALSE, NULL, &unmount_err)) {
+        // Keep the error that caused the failure, if there was one
+        if (ret) {
+            g_propagate_error(err, g_steal_pointer(&unmount_err));
+        } else {
+            g_warning("Error unmounting %s: %s", mount_point, unmount_err->message);
+        }
+        return FALSE;
+    }
+
+    g_rmdir(mount_point);
+    return ret;
+}
+
+/**
+ * finish_filesystem:
+ *
+ * Every image install would otherwise share the UUID of the image, and
+ * the filesystem would stay the size of the image.
+ */
+static gboolean finish_filesystem(InstallerImageWriter *self, GError **err) {
+    if (g_strcmp0(self->fstype, "ext4") == 0) {
+        // resize2fs refuses a filesystem that has not just been checked
+        set_stage(self, INSTALLER_IMAGE_STAGE_CHECK);
+        if (!bd_fs_ext4_repair(self->partition, FALSE, NULL, err)) {
+            return FALSE;
+        }
+
+        set_stage(self, INSTALLER_IMAGE_STAGE_UUID);
+        if (!run_tool("tune2fs", "-U", self->uuid, self->partition, err)) {
+            return FALSE;
+        }
+
+        set_stage(self, INSTALLER_IMAGE_STAGE_GROW);
+        return bd_fs_ext4_resize(self->partition, 0, NULL, err);
+    }
+
+    // btrfstune needs -f to skip asking for confirmation
+    set_stage(self, INSTALLER_IMAGE_STAGE_UUID);
+    if (!run_tool("btrfstune", "-fU", self->uuid, self->partition, err)) {
+        return FALSE;
+    }
+
+    set_stage(self, INSTALLER_IMAGE_STAGE_GROW);
+    return grow_btrfs(self, err);
+}
+
+static void write_thread(GTask *task, gpointer source_object,
+                         __attribute((unused)) gpointer task_data,
+                         GCancellable *cancellable) {
+    InstallerImageWriter *self = INSTALLER_IMAGE_WRITER(source_object);
+    g_autoptr(GError) err = NULL;
+
+    // Root may have been dropped since the writer was made
+    if (!check_privileges(&err) || !write_partition(self, cancellable, &err) ||
+        !finish_filesystem(self, &err)) {
+        g_task_return_error(task, g_steal_pointer(&err));
+        return;
+    }
+
+    set_stage(self, INSTALLER_IMAGE_STAGE_DONE);
+    g_task_return_boolean(task, TRUE);
+}
+
+void installer_image_writer_write_async(InstallerImageWriter *self,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data) {
+    g_autoptr(GTask) task = NULL;
+
+    g_return_if_fail(INSTALLER_IS_IMAGE_WRITER(self));
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, installer_image_writer_write_async);
+
+    g_mutex_lock(&self->progress_lock);
+    self->progress.stage = INSTALLER_IMAGE_STAGE_WRITE;
+    self->progress.bytes_done = 0;
+    g_mutex_unlock(&self->progress_lock);
+
+    installer_executor_run_task(installer_executor_get_default(), task, self->device,
+                                INSTALLER_EXECUTOR_PRIORITY_DEFAULT, write_thread);
+}
+
+gboolean installer_image_writer_write_finish(InstallerImageWriter *self,
+                                             GAsyncResult *result, GError **err) {
+    g_return_val_if_fail(INSTALLER_IS_IMAGE_WRITER(self), FALSE);
+    g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), err);
+}
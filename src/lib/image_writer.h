@@ -0,0 +1,164 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_IMAGE_WRITER_H
+#define INSTALLER_IMAGE_WRITER_H
+
+#include "drive.h"
+
+#include <blockdev/part.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_IMAGE_WRITER (installer_image_writer_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerImageWriter, installer_image_writer, INSTALLER,
+                     IMAGE_WRITER, GObject)
+
+/**
+ * InstallerImageStage:
+ * @INSTALLER_IMAGE_STAGE_WRITE: Writing the image to the partition
+ * @INSTALLER_IMAGE_STAGE_CHECK: Checking the written filesystem
+ * @INSTALLER_IMAGE_STAGE_UUID: Giving the filesystem a new UUID
+ * @INSTALLER_IMAGE_STAGE_GROW: Growing the filesystem to fill the partition
+ * @INSTALLER_IMAGE_STAGE_DONE: Finished
+ *
+ * The stages of an image install, in order.
+ */
+typedef enum {
+    INSTALLER_IMAGE_STAGE_WRITE,
+    INSTALLER_IMAGE_STAGE_CHECK,
+    INSTALLER_IMAGE_STAGE_UUID,
+    INSTALLER_IMAGE_STAGE_GROW,
+    INSTALLER_IMAGE_STAGE_DONE,
+} InstallerImageStage;
+
+/**
+ * InstallerImageProgress:
+ * @stage: The current stage
+ * @bytes_total: The size of the image
+ * @bytes_done: Bytes of the image written so far
+ *
+ * How far an image install has got.
+ */
+typedef struct _InstallerImageProgress {
+    InstallerImageStage stage;
+    guint64 bytes_total;
+    guint64 bytes_done;
+} InstallerImageProgress;
+
+/**
+ * installer_image_writer_new:
+ * @image: The path to a prebuilt ext4 or btrfs root filesystem image
+ * @drive: The drive to install to
+ * @partition: The path of the partition on @drive to write the image to
+ * @err: (out): Place to store an error (if any)
+ *
+ * Prepares to install a root filesystem by writing an image of it,
+ * rather than copying it file by file.
+ *
+ * Fails if @partition is not one of the partitions of @drive, is its
+ * EFI system partition, or is too small for the image. On a system
+ * booted with UEFI, @drive must also have an EFI system partition,
+ * since the image carries no bootloader of its own.
+ *
+ * Every stage of the install needs root, including mounting btrfs to
+ * grow it, so this also fails unless the process is root. In the
+ * unprivileged GUI, image installs have to go through the root helper
+ * with disk_manager_install_image_async().
+ *
+ * Returns: (transfer full) (nullable): A new #InstallerImageWriter, or
+ *          %NULL in case of error (@err is set)
+ */
+InstallerImageWriter *installer_image_writer_new(const gchar *image,
+                                                 InstallerDrive *drive,
+                                                 const gchar *partition,
+                                                 GError **err);
+
+/**
+ * installer_image_writer_write_async:
+ * @self: The image writer
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Called once the install is done
+ * @user_data: Data to pass to @callback
+ *
+ * Writes the image to the partition sequentially with `O_DIRECT`, so
+ * the data does not pass through the page cache. Two buffers take
+ * turns, so the next chunk of the image is read on a thread of its own
+ * while the last one is written. The filesystem is
+ * then checked, given a new UUID so that every install is distinct,
+ * and grown to fill the partition.
+ *
+ * This runs on the default executor's I/O pool, and needs root; the
+ * install fails before anything is written if root has been dropped. The
+ * partition must not be mounted or in use, and only one write may run
+ * at a time.
+ */
+void installer_image_writer_write_async(InstallerImageWriter *self,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data);
+
+/**
+ * installer_image_writer_write_finish:
+ * @self: The image writer
+ * @result: The #GAsyncResult passed to the callback
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: %TRUE if the image was installed
+ */
+gboolean installer_image_writer_write_finish(InstallerImageWriter *self,
+                                             GAsyncResult *result, GError **err);
+
+/**
+ * installer_image_writer_get_progress:
+ * @self: The image writer
+ * @progress: (out): Place to store the progress
+ *
+ * Gets the progress of the install. This may be called from any thread.
+ */
+void installer_image_writer_get_progress(InstallerImageWriter *self,
+                                         InstallerImageProgress *progress);
+
+/**
+ * installer_image_writer_get_uuid:
+ * @self: The image writer
+ *
+ * Gets the UUID the filesystem is given, e.g. for writing an fstab or
+ * a kernel command line. It is chosen when @self is created.
+ *
+ * Returns: (transfer none): The new UUID of the filesystem
+ */
+const gchar *installer_image_writer_get_uuid(InstallerImageWriter *self);
+
+/**
+ * installer_image_writer_get_esp:
+ * @self: The image writer
+ *
+ * Gets the EFI system partition of the drive, for installing the
+ * bootloader once the image is written.
+ *
+ * Returns: (transfer none) (nullable): The EFI system partition, or %NULL
+ *          if the drive has none
+ */
+BDPartSpec *installer_image_writer_get_esp(InstallerImageWriter *self);
+
+G_END_DECLS
+
+#endif
@@ -21,11 +21,50 @@ gboolean installer_init_blockdev(GError **err) {
     BDPluginSpec part_plugin = {BD_PLUGIN_PART, NULL};
     BDPluginSpec *plugins[] = {&fs_plugin, &part_plugin, NULL};
 
+    // Checking every technology runs a tool for each filesystem, most of
+    // which we never touch. Checks are done on use by fs_tech.c instead.
+    if (!bd_switch_init_checks(FALSE, err)) {
+        return FALSE;
+    }
+
     gboolean success = bd_ensure_init(plugins, NULL, err);
 
     return success;
 }
 
+static void init_blockdev_thread(GTask *task,
+                                 __attribute((unused)) gpointer source,
+                                 __attribute((unused)) gpointer task_data,
+                                 __attribute((unused)) GCancellable *cancellable) {
+    GError *err = NULL;
+
+    if (!installer_init_blockdev(&err)) {
+        if (!err) {
+            err = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_FAILED, "unknown error");
+        }
+        g_task_return_error(task, err);
+        return;
+    }
+
+    g_task_return_boolean(task, TRUE);
+}
+
+void installer_init_blockdev_async(GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data) {
+    g_autoptr(GTask) task = g_task_new(NULL, cancellable, callback, user_data);
+
+    g_task_set_source_tag(task, installer_init_blockdev_async);
+    installer_executor_run_task(installer_executor_get_default(), task, "",
+                                INSTALLER_EXECUTOR_PRIORITY_HIGH, init_blockdev_thread);
+}
+
+gboolean installer_init_blockdev_finish(GAsyncResult *result, GError **err) {
+    g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(result), err);
+}
+
 gchar *installer_errno_to_message(GIOErrorEnum errnum) {
     gchar *message = NULL;
 
@@ -19,22 +19,65 @@
 
 #include <blockdev/blockdev.h>
 
+#include "arena.h"
+#include "btrfs.h"
+#include "copy_engine.h"
+#include "copy_ring.h"
+#include "device_model.h"
 #include "disk_manager.h"
 #include "drive.h"
+#include "durability.h"
+#include "executor.h"
+#include "fs_tech.h"
+#include "helper.h"
+#include "helper_protocol.h"
+#include "helper_server.h"
+#include "image_writer.h"
 #include "install_info.h"
+#include "journal.h"
+#include "manifest.h"
 #include "os.h"
+#include "part_class.h"
+#include "part_item.h"
 #include "partition.h"
 #include "permissions.h"
+#include "scan_snapshot.h"
+#include "squashfs.h"
+#include "topology.h"
 #include "user.h"
+#include "zero.h"
 
 /**
  * Attempt to initialize the blockdev library with our required plugins.
  *
+ * The plugins' dependency checks are skipped. Use
+ * `installer_fs_tech_available()` before an operation that needs one.
+ *
  * Returns `TRUE` if initialization was successful. If there was an error,
  * `FALSE` is returned and `err` is set.
  */
 gboolean installer_init_blockdev(GError **err);
 
+/**
+ * Initialize the blockdev library on a worker thread, calling `callback`
+ * on the current thread once it is done.
+ *
+ * Loading the plugins can take a noticeable amount of time, so a UI
+ * should use this and show itself in the meantime. Nothing else may use
+ * libblockdev until `callback` has been called.
+ */
+void installer_init_blockdev_async(GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data);
+
+/**
+ * Finish initializing the blockdev library.
+ *
+ * Returns `TRUE` if initialization was successful. If there was an error,
+ * `FALSE` is returned and `err` is set.
+ */
+gboolean installer_init_blockdev_finish(GAsyncResult *result, GError **err);
+
 /**
  * Generates a message from an I/O error.
  */
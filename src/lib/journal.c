@@ -0,0 +1,455 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "journal.h"
+#include "durability.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "SOLJOURN"
+#define JOURNAL_VERSION 1
+
+/* A hex SHA-256 checksum */
+#define JOURNAL_CHECKSUM_SIZE 64
+
+typedef enum {
+    JOURNAL_RECORD_PHASE = 1,
+    JOURNAL_RECORD_FILES = 2,
+} JournalRecordType;
+
+/*
+ * The file is a header, then fixed-size records appended as the install
+ * goes. Everything is little endian. Each record carries a check of its
+ * own, so one torn by a power cut is found and dropped.
+ */
+typedef struct _JournalHeader {
+    gchar magic[8];
+    guint32 version;
+    guint32 reserved;
+    gchar manifest[JOURNAL_CHECKSUM_SIZE];
+} JournalHeader;
+
+typedef struct _JournalRecord {
+    guint32 type;
+    guint32 check;
+    union {
+        struct {
+            guint64 start;
+            guint64 end;
+        } files;
+        gchar phase[INSTALLER_JOURNAL_PHASE_MAX + 1];
+    };
+} JournalRecord;
+
+G_STATIC_ASSERT(sizeof(JournalHeader) == 80);
+G_STATIC_ASSERT(sizeof(JournalRecord) == 32);
+
+struct _InstallerJournal {
+    GObject parent_instance;
+
+    gchar *path;
+    gint fd;
+    gboolean resumed;
+
+    /* Everything below is guarded by lock */
+    GMutex lock;
+    GHashTable *phases;
+    guint8 *done;
+    gsize n_entries;
+};
+
+G_DEFINE_TYPE(InstallerJournal, installer_journal, G_TYPE_OBJECT);
+
+static void installer_journal_finalize(GObject *obj);
+
+static void installer_journal_class_init(InstallerJournalClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_journal_finalize;
+}
+
+static void installer_journal_init(InstallerJournal *self) {
+    self->fd = -1;
+    self->phases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_init(&self->lock);
+}
+
+static void installer_journal_finalize(GObject *obj) {
+    InstallerJournal *self = INSTALLER_JOURNAL(obj);
+
+    if (self->fd >= 0) {
+        close(self->fd);
+    }
+    g_free(self->path);
+    g_hash_table_destroy(self->phases);
+    g_free(self->done);
+    g_mutex_clear(&self->lock);
+
+    G_OBJECT_CLASS(installer_journal_parent_class)->finalize(obj);
+}
+
+/**
+ * record_check:
+ *
+ * FNV-1a over a record, with its check taken as zero.
+ */
+static guint32 record_check(const JournalRecord *record) {
+    JournalRecord copy = *record;
+    const guint8 *p = (const guint8 *) &copy;
+    guint32 hash = 2166136261U;
+
+    copy.check = 0;
+    for (gsize i = 0; i < sizeof(copy); i++) {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+static void record_seal(JournalRecord *record) {
+    record->check = GUINT32_TO_LE(record_check(record));
+}
+
+static gboolean header_ok(const JournalHeader *header) {
+    return memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) == 0 &&
+           GUINT32_FROM_LE(header->version) == JOURNAL_VERSION;
+}
+
+static gboolean set_journal_error(GError **err, const gchar *what, const gchar *path) {
+    gint errsv = errno;
+
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errsv), "Error %s '%s': %s", what,
+                path, g_strerror(errsv));
+    return FALSE;
+}
+
+/* Replaying */
+
+static void mark_files(InstallerJournal *self, guint64 start, guint64 end) {
+    for (guint64 i = start; i < MIN(end, self->n_entries); i++) {
+        self->done[i / 8] |= 1 << (i % 8);
+    }
+}
+
+/**
+ * apply_record:
+ *
+ * Returns: %FALSE if the record is torn or not one this knows
+ */
+static gboolean apply_record(InstallerJournal *self, const JournalRecord *record) {
+    if (GUINT32_FROM_LE(record->check) != record_check(record)) {
+        return FALSE;
+    }
+
+    switch (GUINT32_FROM_LE(record->type)) {
+        case JOURNAL_RECORD_PHASE:
+            if (!memchr(record->phase, '\0', sizeof(record->phase))) {
+                return FALSE;
+            }
+            g_hash_table_add(self->phases, g_strdup(record->phase));
+            return TRUE;
+        case JOURNAL_RECORD_FILES:
+            mark_files(self, GUINT64_FROM_LE(record->files.start),
+                       GUINT64_FROM_LE(record->files.end));
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/**
+ * journal_replay:
+ *
+ * Applies the records of an existing journal. The first one that does
+ * not check out, and everything after it, was being written when the
+ * install was cut off, so the file is truncated there.
+ */
+static gboolean journal_replay(InstallerJournal *self, const gchar *contents, gsize len,
+                               const gchar *checksum, GError **err) {
+    const JournalHeader *header = (const JournalHeader *) contents;
+    gsize offset = sizeof(JournalHeader);
+
+    if (len < sizeof(JournalHeader) || !header_ok(header)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "'%s' is not an install journal", self->path);
+        return FALSE;
+    }
+
+    if (strncmp(header->manifest, checksum, JOURNAL_CHECKSUM_SIZE) != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "The unfinished install was started from different install media");
+        return FALSE;
+    }
+
+    for (; offset + sizeof(JournalRecord) <= len; offset += sizeof(JournalRecord)) {
+        JournalRecord record;
+
+        memcpy(&record, contents + offset, sizeof(record));
+        if (!apply_record(self, &record)) {
+            break;
+        }
+    }
+
+    if (offset < len) {
+        g_debug("Dropping %" G_GSIZE_FORMAT " bytes of torn records from '%s'",
+                len - offset, self->path);
+        if (ftruncate(self->fd, offset) != 0) {
+            return set_journal_error(err, "truncating", self->path);
+        }
+    }
+
+    return TRUE;
+}
+
+/* Writing */
+
+static gboolean journal_append(InstallerJournal *self, const JournalRecord *records,
+                               gsize n_records, GError **err) {
+    const guint8 *data = (const guint8 *) records;
+    gsize len = n_records * sizeof(JournalRecord);
+
+    if (self->fd < 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_CLOSED, "The install journal was removed");
+        return FALSE;
+    }
+
+    for (gsize written = 0; written < len;) {
+        gssize w = write(self->fd, data + written, len - written);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return set_journal_error(err, "writing", self->path);
+        }
+        written += w;
+    }
+
+    return installer_durability_fsync(self->fd, self->path, err);
+}
+
+static gboolean journal_create(InstallerJournal *self, const gchar *checksum,
+                               GError **err) {
+    JournalHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = GUINT32_TO_LE(JOURNAL_VERSION);
+    memcpy(header.manifest, checksum, MIN(strlen(checksum), JOURNAL_CHECKSUM_SIZE));
+
+    if (write(self->fd, &header, sizeof(header)) != sizeof(header)) {
+        return set_journal_error(err, "writing", self->path);
+    }
+
+    // The journal itself has to survive before anything relies on it
+    return installer_durability_barrier(self->path, err);
+}
+
+InstallerJournal *installer_journal_open(const gchar *root, InstallerManifest *manifest,
+                                         GError **err) {
+    g_autoptr(InstallerJournal) self = NULL;
+    g_autofree gchar *checksum = NULL;
+    g_autofree gchar *contents = NULL;
+    g_autoptr(GError) read_err = NULL;
+    gsize len = 0;
+
+    g_return_val_if_fail(root != NULL, NULL);
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(manifest), NULL);
+
+    self = g_object_new(INSTALLER_TYPE_JOURNAL, NULL);
+    self->path = g_build_filename(root, INSTALLER_JOURNAL_NAME, NULL);
+    self->n_entries = installer_manifest_get_n_entries(manifest);
+    self->done = g_malloc0(self->n_entries / 8 + 1);
+    checksum = installer_manifest_get_checksum(manifest);
+
+    if (!g_file_get_contents(self->path, &contents, &len, &read_err) &&
+        !g_error_matches(read_err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_error(err, g_steal_pointer(&read_err));
+        return NULL;
+    }
+
+    self->fd = open(self->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (self->fd < 0) {
+        set_journal_error(err, "opening", self->path);
+        return NULL;
+    }
+
+    // A journal without a whole header was cut off while it was being
+    // created, before anything relied on it, so it starts over
+    if (len > 0 && len < sizeof(JournalHeader)) {
+        g_debug("Dropping torn header of '%s'", self->path);
+        if (ftruncate(self->fd, 0) != 0) {
+            set_journal_error(err, "truncating", self->path);
+            return NULL;
+        }
+        len = 0;
+    }
+
+    if (len > 0) {
+        if (!journal_replay(self, contents, len, checksum, err)) {
+            return NULL;
+        }
+        self->resumed = TRUE;
+    } else if (!journal_create(self, checksum, err)) {
+        return NULL;
+    }
+
+    return g_steal_pointer(&self);
+}
+
+gboolean installer_journal_probe(const gchar *root) {
+    g_autofree gchar *path = NULL;
+    JournalHeader header;
+    gboolean ret = FALSE;
+    gint fd = -1;
+
+    g_return_val_if_fail(root != NULL, FALSE);
+
+    path = g_build_filename(root, INSTALLER_JOURNAL_NAME, NULL);
+    fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    ret = read(fd, &header, sizeof(header)) == sizeof(header) && header_ok(&header);
+    close(fd);
+
+    return ret;
+}
+
+gboolean installer_journal_is_resumed(InstallerJournal *self) {
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+
+    return self->resumed;
+}
+
+gboolean installer_journal_is_phase_done(InstallerJournal *self, const gchar *phase) {
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+    g_return_val_if_fail(phase != NULL, FALSE);
+
+    g_mutex_lock(&self->lock);
+    ret = g_hash_table_contains(self->phases, phase);
+    g_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
+gboolean installer_journal_complete_phase(InstallerJournal *self, const gchar *phase,
+                                          GError **err) {
+    JournalRecord record;
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+    g_return_val_if_fail(phase != NULL, FALSE);
+    g_return_val_if_fail(strlen(phase) <= INSTALLER_JOURNAL_PHASE_MAX, FALSE);
+
+    memset(&record, 0, sizeof(record));
+    record.type = GUINT32_TO_LE(JOURNAL_RECORD_PHASE);
+    strncpy(record.phase, phase, INSTALLER_JOURNAL_PHASE_MAX);
+    record_seal(&record);
+
+    g_mutex_lock(&self->lock);
+    ret = journal_append(self, &record, 1, err);
+    if (ret) {
+        g_hash_table_add(self->phases, g_strdup(phase));
+    }
+    g_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
+gboolean installer_journal_is_file_done(InstallerJournal *self, gsize index) {
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+
+    if (index >= self->n_entries) {
+        return FALSE;
+    }
+
+    g_mutex_lock(&self->lock);
+    ret = (self->done[index / 8] & (1 << (index % 8))) != 0;
+    g_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
+gboolean installer_journal_add_files(InstallerJournal *self,
+                                     const InstallerJournalRange *ranges, gsize n_ranges,
+                                     GError **err) {
+    g_autofree JournalRecord *records = NULL;
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+    g_return_val_if_fail(ranges != NULL || n_ranges == 0, FALSE);
+
+    if (n_ranges == 0) {
+        return TRUE;
+    }
+
+    records = g_new0(JournalRecord, n_ranges);
+    for (gsize i = 0; i < n_ranges; i++) {
+        records[i].type = GUINT32_TO_LE(JOURNAL_RECORD_FILES);
+        records[i].files.start = GUINT64_TO_LE(ranges[i].start);
+        records[i].files.end = GUINT64_TO_LE(ranges[i].end);
+        record_seal(&records[i]);
+    }
+
+    g_mutex_lock(&self->lock);
+    ret = journal_append(self, records, n_ranges, err);
+    if (ret) {
+        for (gsize i = 0; i < n_ranges; i++) {
+            mark_files(self, ranges[i].start, ranges[i].end);
+        }
+    }
+    g_mutex_unlock(&self->lock);
+
+    return ret;
+}
+
+gboolean installer_journal_remove(InstallerJournal *self, GError **err) {
+    g_autofree gchar *dir = NULL;
+    gboolean ret = FALSE;
+    gint fd = -1;
+
+    g_return_val_if_fail(INSTALLER_IS_JOURNAL(self), FALSE);
+
+    g_mutex_lock(&self->lock);
+    if (self->fd >= 0) {
+        close(self->fd);
+        self->fd = -1;
+    }
+    g_mutex_unlock(&self->lock);
+
+    if (unlink(self->path) != 0 && errno != ENOENT) {
+        return set_journal_error(err, "removing", self->path);
+    }
+
+    // Until the directory is synced, the journal may come back after a crash
+    dir = g_path_get_dirname(self->path);
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return set_journal_error(err, "opening", dir);
+    }
+
+    ret = installer_durability_fsync(fd, dir, err);
+    close(fd);
+
+    return ret;
+}
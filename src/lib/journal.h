@@ -0,0 +1,151 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_JOURNAL_H
+#define INSTALLER_JOURNAL_H
+
+#include "manifest.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Where the journal lives, relative to the root of the target */
+#define INSTALLER_JOURNAL_NAME ".solus-installer-journal"
+
+/* Longest name of a phase */
+#define INSTALLER_JOURNAL_PHASE_MAX 23
+
+#define INSTALLER_TYPE_JOURNAL (installer_journal_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerJournal, installer_journal, INSTALLER, JOURNAL, GObject)
+
+/**
+ * InstallerJournalRange:
+ * @start: The index of the first manifest entry in the range
+ * @end: The index after the last manifest entry in the range
+ *
+ * A run of manifest entries whose files are on the disk.
+ */
+typedef struct _InstallerJournalRange {
+    guint64 start;
+    guint64 end;
+} InstallerJournalRange;
+
+/**
+ * installer_journal_open:
+ * @root: The root of the target
+ * @manifest: The manifest of the tree being installed
+ * @err: (out): Place to store an error (if any)
+ *
+ * Opens the journal of an install into @root, creating it if there is
+ * none. An existing journal is replayed, so what an interrupted install
+ * finished can be skipped. A record cut short by a power cut is dropped.
+ * A journal of an install from other media fails with
+ * %G_IO_ERROR_INVALID_DATA, in which case the install has to start over.
+ *
+ * The journal is append-only: every record is synced before it counts,
+ * so anything it says is done is on the disk.
+ *
+ * Returns: (transfer full) (nullable): The journal, or %NULL on error
+ */
+InstallerJournal *installer_journal_open(const gchar *root, InstallerManifest *manifest,
+                                         GError **err);
+
+/**
+ * installer_journal_probe:
+ * @root: The root of a mounted filesystem
+ *
+ * Checks for the journal of an unfinished install, without replaying it.
+ *
+ * Returns: %TRUE if @root holds an install that can be resumed
+ */
+gboolean installer_journal_probe(const gchar *root);
+
+/**
+ * installer_journal_is_resumed:
+ * @self: The journal
+ *
+ * Returns: %TRUE if the journal was already there when it was opened
+ */
+gboolean installer_journal_is_resumed(InstallerJournal *self);
+
+/**
+ * installer_journal_is_phase_done:
+ * @self: The journal
+ * @phase: The name of a phase, e.g. "copy"
+ *
+ * Returns: %TRUE if @phase was completed
+ */
+gboolean installer_journal_is_phase_done(InstallerJournal *self, const gchar *phase);
+
+/**
+ * installer_journal_complete_phase:
+ * @self: The journal
+ * @phase: The name of a phase, no longer than %INSTALLER_JOURNAL_PHASE_MAX
+ * @err: (out): Place to store an error (if any)
+ *
+ * Records that a phase of the install is done. Whatever the phase wrote
+ * must already be on the disk.
+ *
+ * Returns: %TRUE if the record was written
+ */
+gboolean installer_journal_complete_phase(InstallerJournal *self, const gchar *phase,
+                                          GError **err);
+
+/**
+ * installer_journal_is_file_done:
+ * @self: The journal
+ * @index: The index of a manifest entry
+ *
+ * Returns: %TRUE if the file was copied, and verified if the copy was
+ *          verified
+ */
+gboolean installer_journal_is_file_done(InstallerJournal *self, gsize index);
+
+/**
+ * installer_journal_add_files:
+ * @self: The journal
+ * @ranges: (array length=n_ranges): The ranges of files that are done
+ * @n_ranges: The number of ranges
+ * @err: (out): Place to store an error (if any)
+ *
+ * Records that files are done, with one write and one sync however many
+ * ranges there are. The files must already be on the disk. This may be
+ * called from any thread.
+ *
+ * Returns: %TRUE if the records were written
+ */
+gboolean installer_journal_add_files(InstallerJournal *self,
+                                     const InstallerJournalRange *ranges, gsize n_ranges,
+                                     GError **err);
+
+/**
+ * installer_journal_remove:
+ * @self: The journal
+ * @err: (out): Place to store an error (if any)
+ *
+ * Deletes the journal once the install is complete, so the installed
+ * system does not look unfinished. Nothing may be recorded after.
+ *
+ * Returns: %TRUE if the journal is gone
+ */
+gboolean installer_journal_remove(InstallerJournal *self, GError **err);
+
+G_END_DECLS
+
+#endif
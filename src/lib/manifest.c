@@ -0,0 +1,1052 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define _GNU_SOURCE
+
+#include "manifest.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#define MANIFEST_MAGIC "SOLMNFST"
+#define MANIFEST_VERSION 1
+
+/* A string offset or xattr index that is not there */
+#define MANIFEST_NONE G_MAXUINT32
+
+#define MANIFEST_READ_SIZE (1024 * 1024)
+#define MANIFEST_XATTR_LIST_MAX 65536
+
+/* Symlinks with shorter targets are stored in the inode on ext4 */
+#define MANIFEST_FAST_SYMLINK_MAX 60
+
+/* Assumed for the target when checking free space */
+#define MANIFEST_BLOCK_SIZE 4096
+
+/*
+ * The file is a header, then the entries sorted by path, then the string
+ * table, then the xattr table. Everything is little endian, and every
+ * table starts 8-byte aligned so the entries can be read in place.
+ */
+typedef struct _ManifestHeader {
+    gchar magic[8];
+    guint32 version;
+    guint32 hash_type;
+    guint64 n_entries;
+    guint64 n_files;
+    guint64 n_dirs;
+    guint64 bytes;
+    guint64 entries_offset;
+    guint64 strings_offset;
+    guint64 strings_size;
+    guint64 xattrs_offset;
+    guint64 xattrs_size;
+} ManifestHeader;
+
+/* Strings are offsets into the string table */
+typedef struct _ManifestRecord {
+    guint32 path;
+    guint32 link_target;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint32 hardlink;
+    guint64 size;
+    guint64 mtime;
+    guint64 rdev;
+    guint32 xattrs;
+    guint32 n_xattrs;
+    guint8 hash[INSTALLER_MANIFEST_HASH_SIZE];
+} ManifestRecord;
+
+G_STATIC_ASSERT(sizeof(ManifestHeader) == 88);
+G_STATIC_ASSERT(sizeof(ManifestRecord) == 88);
+
+/* An xattr is a name offset and a value length, followed by the value */
+#define XATTR_RECORD_SIZE (2 * sizeof(guint32))
+
+struct _InstallerManifest {
+    GObject parent_instance;
+
+    GBytes *data;
+    const ManifestHeader *header;
+    const ManifestRecord *records;
+    const gchar *strings;
+    gsize strings_size;
+    const guint8 *xattrs;
+    gsize xattrs_size;
+    gsize n_entries;
+};
+
+G_DEFINE_TYPE(InstallerManifest, installer_manifest, G_TYPE_OBJECT);
+
+static void installer_manifest_finalize(GObject *obj);
+
+static void installer_manifest_class_init(InstallerManifestClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_manifest_finalize;
+}
+
+static void installer_manifest_init(__attribute((unused)) InstallerManifest *self) {}
+
+static void installer_manifest_finalize(GObject *obj) {
+    InstallerManifest *self = INSTALLER_MANIFEST(obj);
+
+    g_clear_pointer(&self->data, g_bytes_unref);
+
+    G_OBJECT_CLASS(installer_manifest_parent_class)->finalize(obj);
+}
+
+static guint32 get_u32(const guint8 *p) {
+    guint32 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+/* Loading */
+
+static gboolean set_corrupt_error(GError **err, const gchar *what) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "The manifest has a bad %s",
+                what);
+    return FALSE;
+}
+
+static gboolean range_ok(guint64 offset, guint64 size, gsize len) {
+    return offset <= len && size <= len - offset && offset % sizeof(guint64) == 0;
+}
+
+static gboolean string_ok(InstallerManifest *self, guint32 offset) {
+    return offset < self->strings_size;
+}
+
+/**
+ * check_xattrs:
+ *
+ * Walks the xattrs of a record, so they can be read later without any
+ * bounds checks.
+ */
+static gboolean check_xattrs(InstallerManifest *self, const ManifestRecord *record) {
+    guint32 n_xattrs = GUINT32_FROM_LE(record->n_xattrs);
+    gsize pos = GUINT32_FROM_LE(record->xattrs);
+
+    if (n_xattrs == 0) {
+        return TRUE;
+    }
+
+    for (guint32 i = 0; i < n_xattrs; i++) {
+        guint32 len = 0;
+
+        if (pos > self->xattrs_size || self->xattrs_size - pos < XATTR_RECORD_SIZE) {
+            return FALSE;
+        }
+
+        len = get_u32(self->xattrs + pos + sizeof(guint32));
+        if (!string_ok(self, get_u32(self->xattrs + pos)) ||
+            len > self->xattrs_size - pos - XATTR_RECORD_SIZE) {
+            return FALSE;
+        }
+
+        pos += XATTR_RECORD_SIZE + len;
+    }
+
+    return TRUE;
+}
+
+/**
+ * manifest_parse:
+ *
+ * Checks every offset in the manifest once, so nothing read from it
+ * later can point outside of it, and that the entries are sorted so
+ * lookups can search them.
+ */
+static gboolean manifest_parse(InstallerManifest *self, GError **err) {
+    gsize len = 0;
+    const guint8 *data = g_bytes_get_data(self->data, &len);
+    const ManifestHeader *header = (const ManifestHeader *) data;
+    guint64 n_entries = 0;
+    const gchar *prev = NULL;
+
+    if (len < sizeof(ManifestHeader) || memcmp(header->magic, MANIFEST_MAGIC, 8) != 0) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not a manifest");
+        return FALSE;
+    }
+
+    if (GUINT32_FROM_LE(header->version) != MANIFEST_VERSION) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Unsupported manifest version %u", GUINT32_FROM_LE(header->version));
+        return FALSE;
+    }
+
+    if (GUINT32_FROM_LE(header->hash_type) != INSTALLER_MANIFEST_HASH_SHA256 &&
+        GUINT32_FROM_LE(header->hash_type) != INSTALLER_MANIFEST_HASH_XXH3_128) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Unsupported manifest hash type %u",
+                    GUINT32_FROM_LE(header->hash_type));
+        return FALSE;
+    }
+
+    n_entries = GUINT64_FROM_LE(header->n_entries);
+    if (n_entries > len / sizeof(ManifestRecord) ||
+        !range_ok(GUINT64_FROM_LE(header->entries_offset),
+                  n_entries * sizeof(ManifestRecord), len)) {
+        return set_corrupt_error(err, "entry table");
+    }
+
+    self->strings_size = GUINT64_FROM_LE(header->strings_size);
+    if (!range_ok(GUINT64_FROM_LE(header->strings_offset), self->strings_size, len) ||
+        self->strings_size == 0 || self->strings_size > G_MAXUINT32) {
+        return set_corrupt_error(err, "string table");
+    }
+
+    self->xattrs_size = GUINT64_FROM_LE(header->xattrs_size);
+    if (!range_ok(GUINT64_FROM_LE(header->xattrs_offset), self->xattrs_size, len)) {
+        return set_corrupt_error(err, "xattr table");
+    }
+
+    self->header = header;
+    self->records = (const ManifestRecord *) (data +
+                                              GUINT64_FROM_LE(header->entries_offset));
+    self->strings = (const gchar *) data + GUINT64_FROM_LE(header->strings_offset);
+    self->xattrs = data + GUINT64_FROM_LE(header->xattrs_offset);
+    self->n_entries = n_entries;
+
+    // Every string ends within the table if the table itself ends in one
+    if (self->strings[self->strings_size - 1] != '\0') {
+        return set_corrupt_error(err, "string table");
+    }
+
+    for (gsize i = 0; i < self->n_entries; i++) {
+        const ManifestRecord *record = &self->records[i];
+        guint32 link_target = GUINT32_FROM_LE(record->link_target);
+        const gchar *path = NULL;
+
+        if (!string_ok(self, GUINT32_FROM_LE(record->path)) ||
+            (link_target != MANIFEST_NONE && !string_ok(self, link_target))) {
+            return set_corrupt_error(err, "entry");
+        }
+
+        if (!check_xattrs(self, record)) {
+            return set_corrupt_error(err, "xattr");
+        }
+
+        path = self->strings + GUINT32_FROM_LE(record->path);
+        if (prev && strcmp(prev, path) >= 0) {
+            return set_corrupt_error(err, "entry order");
+        }
+        prev = path;
+    }
+
+    return TRUE;
+}
+
+static InstallerManifest *manifest_new_from_bytes(GBytes *data, GError **err) {
+    g_autoptr(InstallerManifest) self = g_object_new(INSTALLER_TYPE_MANIFEST, NULL);
+
+    self->data = g_bytes_ref(data);
+    if (!manifest_parse(self, err)) {
+        return NULL;
+    }
+
+    return g_steal_pointer(&self);
+}
+
+InstallerManifest *installer_manifest_load(const gchar *path, GError **err) {
+    g_autoptr(GMappedFile) file = NULL;
+    g_autoptr(GBytes) data = NULL;
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    file = g_mapped_file_new(path, FALSE, err);
+    if (!file) {
+        return NULL;
+    }
+
+    data = g_mapped_file_get_bytes(file);
+    return manifest_new_from_bytes(data, err);
+}
+
+/* Hashing */
+
+typedef struct _Hasher {
+    InstallerManifestHash type;
+    GChecksum *checksum;
+#ifdef HAVE_XXHASH
+    XXH3_state_t *xxh3;
+#endif
+} Hasher;
+
+static gboolean hasher_init(Hasher *hasher, InstallerManifestHash type, GError **err) {
+    memset(hasher, 0, sizeof(*hasher));
+    hasher->type = type;
+
+    switch (type) {
+        case INSTALLER_MANIFEST_HASH_SHA256:
+            hasher->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+            return TRUE;
+
+#ifdef HAVE_XXHASH
+        case INSTALLER_MANIFEST_HASH_XXH3_128:
+            hasher->xxh3 = XXH3_createState();
+            if (!hasher->xxh3 || XXH3_128bits_reset(hasher->xxh3) != XXH_OK) {
+                g_set_error(err, G_IO_ERROR, G_IO_ERROR_FAILED, "Error starting a hash");
+                return FALSE;
+            }
+            return TRUE;
+#endif
+
+        default:
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "The installer was built without support for hash type %u",
+                        type);
+            return FALSE;
+    }
+}
+
+static void hasher_update(Hasher *hasher, const guint8 *data, gsize len) {
+#ifdef HAVE_XXHASH
+    if (hasher->xxh3) {
+        XXH3_128bits_update(hasher->xxh3, data, len);
+        return;
+    }
+#endif
+
+    g_checksum_update(hasher->checksum, data, len);
+}
+
+static void hasher_finish(Hasher *hasher, guint8 *hash) {
+    gsize len = INSTALLER_MANIFEST_HASH_SIZE;
+
+    memset(hash, 0, INSTALLER_MANIFEST_HASH_SIZE);
+
+#ifdef HAVE_XXHASH
+    if (hasher->xxh3) {
+        XXH128_canonical_t canonical;
+
+        G_STATIC_ASSERT(sizeof(canonical) <= INSTALLER_MANIFEST_HASH_SIZE);
+
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(hasher->xxh3));
+        memcpy(hash, &canonical, sizeof(canonical));
+        return;
+    }
+#endif
+
+    g_checksum_get_digest(hasher->checksum, hash, &len);
+}
+
+static void hasher_clear(Hasher *hasher) {
+    g_clear_pointer(&hasher->checksum, g_checksum_free);
+#ifdef HAVE_XXHASH
+    g_clear_pointer(&hasher->xxh3, XXH3_freeState);
+#endif
+}
+
+gboolean installer_manifest_hash_fd(InstallerManifestHash type, gint fd, guint8 *buffer,
+                                    gsize buffer_size, guint8 *hash,
+                                    GCancellable *cancellable, GError **err) {
+    Hasher hasher;
+
+    g_return_val_if_fail(fd >= 0, FALSE);
+    g_return_val_if_fail(buffer != NULL && buffer_size > 0, FALSE);
+    g_return_val_if_fail(hash != NULL, FALSE);
+
+    if (!hasher_init(&hasher, type, err)) {
+        hasher_clear(&hasher);
+        return FALSE;
+    }
+
+    while (TRUE) {
+        gssize n = read(fd, buffer, buffer_size);
+        if (n < 0) {
+            gint saved = errno;
+            if (saved == EINTR) {
+                continue;
+            }
+            hasher_clear(&hasher);
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved), "%s",
+                        g_strerror(saved));
+            return FALSE;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        if (g_cancellable_set_error_if_cancelled(cancellable, err)) {
+            hasher_clear(&hasher);
+            return FALSE;
+        }
+
+        hasher_update(&hasher, buffer, n);
+    }
+
+    hasher_finish(&hasher, hash);
+    hasher_clear(&hasher);
+    return TRUE;
+}
+
+/* Building */
+
+typedef struct _BuildXattr {
+    gchar *name;
+    GBytes *value;
+} BuildXattr;
+
+typedef struct _BuildEntry {
+    gchar *path;
+    gchar *link_target;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint32 hardlink;
+    guint64 size;
+    guint64 mtime;
+    guint64 rdev;
+    guint8 hash[INSTALLER_MANIFEST_HASH_SIZE];
+    GPtrArray *xattrs;
+} BuildEntry;
+
+typedef struct _Builder {
+    const gchar *root;
+    gint root_fd;
+    dev_t dev;
+    GCancellable *cancellable;
+    InstallerManifestHash hash_type;
+    guint8 *buffer;
+
+    GPtrArray *entries;
+    GHashTable *hardlinks;
+    guint32 n_hardlinks;
+    InstallerManifestTotals totals;
+} Builder;
+
+static void build_xattr_free(BuildXattr *xattr) {
+    g_free(xattr->name);
+    g_bytes_unref(xattr->value);
+    g_free(xattr);
+}
+
+static void build_entry_free(BuildEntry *entry) {
+    g_free(entry->path);
+    g_free(entry->link_target);
+    g_clear_pointer(&entry->xattrs, g_ptr_array_unref);
+    g_free(entry);
+}
+
+static gboolean set_build_error(GError **err, gint errsv, const gchar *what,
+                                const gchar *path) {
+    g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errsv), "Error %s '/%s': %s", what,
+                path, g_strerror(errsv));
+    return FALSE;
+}
+
+static gchar *child_path(const gchar *dir, const gchar *name) {
+    return *dir ? g_strconcat(dir, "/", name, NULL) : g_strdup(name);
+}
+
+static gboolean hash_file(Builder *builder, BuildEntry *entry, GError **err) {
+    gint fd = openat(builder->root_fd, entry->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    gboolean ret = FALSE;
+
+    if (fd < 0) {
+        return set_build_error(err, errno, "opening", entry->path);
+    }
+
+    ret = installer_manifest_hash_fd(builder->hash_type, fd, builder->buffer,
+                                     MANIFEST_READ_SIZE, entry->hash, builder->cancellable,
+                                     err);
+    close(fd);
+
+    if (!ret) {
+        g_prefix_error(err, "Error hashing '/%s': ", entry->path);
+    }
+
+    return ret;
+}
+
+/**
+ * read_xattrs:
+ *
+ * Reads by path, since symlinks have xattrs too and cannot be opened.
+ */
+static gboolean read_xattrs(Builder *builder, BuildEntry *entry, GError **err) {
+    g_autofree gchar *full = g_build_filename(builder->root, entry->path, NULL);
+    g_autofree gchar *names = g_malloc(MANIFEST_XATTR_LIST_MAX);
+    gssize len = llistxattr(full, names, MANIFEST_XATTR_LIST_MAX);
+
+    if (len < 0) {
+        if (errno == ENOTSUP) {
+            return TRUE;
+        }
+        return set_build_error(err, errno, "listing xattrs of", entry->path);
+    }
+
+    for (gchar *name = names; name < names + len; name += strlen(name) + 1) {
+        BuildXattr *xattr = NULL;
+        gssize size = lgetxattr(full, name, NULL, 0);
+        guint8 *value = NULL;
+
+        if (size < 0) {
+            return set_build_error(err, errno, "reading xattrs of", entry->path);
+        }
+
+        value = g_malloc(MAX(size, 1));
+        size = lgetxattr(full, name, value, size);
+        if (size < 0) {
+            g_free(value);
+            return set_build_error(err, errno, "reading xattrs of", entry->path);
+        }
+
+        if (!entry->xattrs) {
+            entry->xattrs = g_ptr_array_new_with_free_func((GDestroyNotify) build_xattr_free);
+        }
+
+        xattr = g_new0(BuildXattr, 1);
+        xattr->name = g_strdup(name);
+        xattr->value = g_bytes_new_take(value, size);
+        g_ptr_array_add(entry->xattrs, xattr);
+    }
+
+    return TRUE;
+}
+
+/**
+ * build_entry:
+ * @dirs: Directories still to be listed
+ *
+ * Adds one directory entry to the manifest.
+ */
+static gboolean build_entry(Builder *builder, gint dir_fd, const gchar *path,
+                            const gchar *name, GQueue *dirs, GError **err) {
+    BuildEntry *entry = NULL;
+    struct statx stx;
+
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_BASIC_STATS,
+              &stx) != 0) {
+        return set_build_error(err, errno, "reading", path);
+    }
+
+    if (S_ISSOCK(stx.stx_mode)) {
+        return TRUE;
+    }
+
+    entry = g_new0(BuildEntry, 1);
+    entry->path = g_strdup(path);
+    entry->mode = stx.stx_mode;
+    entry->uid = stx.stx_uid;
+    entry->gid = stx.stx_gid;
+    entry->mtime = stx.stx_mtime.tv_sec;
+    entry->rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    g_ptr_array_add(builder->entries, entry);
+
+    if (!read_xattrs(builder, entry, err)) {
+        return FALSE;
+    }
+
+    builder->totals.n_entries++;
+
+    if (S_ISDIR(stx.stx_mode)) {
+        builder->totals.n_dirs++;
+
+        // Like the copy engine, mount points are listed but not descended into
+        if (makedev(stx.stx_dev_major, stx.stx_dev_minor) == builder->dev) {
+            g_queue_push_tail(dirs, g_strdup(path));
+        }
+        return TRUE;
+    }
+
+    if (S_ISLNK(stx.stx_mode)) {
+        gchar target[PATH_MAX + 1];
+        gssize len = readlinkat(dir_fd, name, target, PATH_MAX);
+
+        if (len < 0) {
+            return set_build_error(err, errno, "reading", path);
+        }
+        target[len] = '\0';
+        entry->link_target = g_strdup(target);
+        return TRUE;
+    }
+
+    if (!S_ISREG(stx.stx_mode)) {
+        return TRUE;
+    }
+
+    entry->size = stx.stx_size;
+
+    if (stx.stx_nlink > 1) {
+        g_autofree gchar *key = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64) stx.stx_ino);
+        gpointer group = g_hash_table_lookup(builder->hardlinks, key);
+
+        // Later names of a file share the hash of the first
+        if (group) {
+            BuildEntry *first = g_ptr_array_index(builder->entries,
+                                                  GPOINTER_TO_UINT(group) - 1);
+            entry->hardlink = first->hardlink;
+            memcpy(entry->hash, first->hash, sizeof(entry->hash));
+            return TRUE;
+        }
+
+        entry->hardlink = ++builder->n_hardlinks;
+        g_hash_table_insert(builder->hardlinks, g_steal_pointer(&key),
+                            GUINT_TO_POINTER(builder->entries->len));
+    }
+
+    builder->totals.n_files++;
+    builder->totals.bytes += entry->size;
+
+    return hash_file(builder, entry, err);
+}
+
+static gboolean build_directory(Builder *builder, const gchar *path, GQueue *dirs,
+                                GError **err) {
+    gint dir_fd = openat(builder->root_fd, *path ? path : ".",
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct dirent *dent = NULL;
+    gboolean ret = TRUE;
+    DIR *dir = NULL;
+
+    if (dir_fd < 0) {
+        return set_build_error(err, errno, "opening", path);
+    }
+
+    // The DIR owns a duplicate, so dir_fd stays usable for statx
+    dir = fdopendir(dup(dir_fd));
+    if (!dir) {
+        close(dir_fd);
+        return set_build_error(err, errno, "opening", path);
+    }
+
+    while (ret && (dent = readdir(dir))) {
+        g_autofree gchar *child = NULL;
+
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+            continue;
+        }
+
+        if (g_cancellable_set_error_if_cancelled(builder->cancellable, err)) {
+            ret = FALSE;
+            break;
+        }
+
+        child = child_path(path, dent->d_name);
+        ret = build_entry(builder, dir_fd, child, dent->d_name, dirs, err);
+    }
+
+    closedir(dir);
+    close(dir_fd);
+    return ret;
+}
+
+static gint compare_build_entries(gconstpointer a, gconstpointer b) {
+    const BuildEntry *entry_a = *(BuildEntry *const *) a;
+    const BuildEntry *entry_b = *(BuildEntry *const *) b;
+
+    return strcmp(entry_a->path, entry_b->path);
+}
+
+/**
+ * add_string:
+ *
+ * Interns a string into the string table, since xattr names and symlink
+ * targets repeat a lot.
+ */
+static guint32 add_string(GByteArray *strings, GHashTable *offsets, const gchar *str) {
+    gpointer offset = NULL;
+
+    if (g_hash_table_lookup_extended(offsets, str, NULL, &offset)) {
+        return GPOINTER_TO_UINT(offset);
+    }
+
+    offset = GUINT_TO_POINTER(strings->len);
+    g_byte_array_append(strings, (const guint8 *) str, strlen(str) + 1);
+    g_hash_table_insert(offsets, (gpointer) str, offset);
+
+    return GPOINTER_TO_UINT(offset);
+}
+
+static gsize align_u64(gsize len) {
+    return (len + sizeof(guint64) - 1) & ~(sizeof(guint64) - 1);
+}
+
+static void pad_to_u64(GByteArray *data) {
+    static const guint8 zeroes[sizeof(guint64)] = {0};
+
+    g_byte_array_append(data, zeroes, align_u64(data->len) - data->len);
+}
+
+/**
+ * build_serialize:
+ *
+ * Lays the sorted entries out in the file format.
+ */
+static GBytes *build_serialize(Builder *builder) {
+    g_autoptr(GByteArray) strings = g_byte_array_new();
+    g_autoptr(GByteArray) xattrs = g_byte_array_new();
+    g_autoptr(GHashTable) offsets = g_hash_table_new(g_str_hash, g_str_equal);
+    g_autofree ManifestRecord *records = g_new0(ManifestRecord, builder->entries->len);
+    GByteArray *data = g_byte_array_new();
+    ManifestHeader header;
+    gsize records_size = builder->entries->len * sizeof(ManifestRecord);
+
+    for (guint i = 0; i < builder->entries->len; i++) {
+        BuildEntry *entry = g_ptr_array_index(builder->entries, i);
+        ManifestRecord *record = &records[i];
+        guint32 link_target = MANIFEST_NONE;
+
+        if (entry->link_target) {
+            link_target = add_string(strings, offsets, entry->link_target);
+        }
+
+        record->path = GUINT32_TO_LE(add_string(strings, offsets, entry->path));
+        record->link_target = GUINT32_TO_LE(link_target);
+        record->mode = GUINT32_TO_LE(entry->mode);
+        record->uid = GUINT32_TO_LE(entry->uid);
+        record->gid = GUINT32_TO_LE(entry->gid);
+        record->hardlink = GUINT32_TO_LE(entry->hardlink);
+        record->size = GUINT64_TO_LE(entry->size);
+        record->mtime = GUINT64_TO_LE(entry->mtime);
+        record->rdev = GUINT64_TO_LE(entry->rdev);
+        record->xattrs = GUINT32_TO_LE(xattrs->len);
+        record->n_xattrs = GUINT32_TO_LE(entry->xattrs ? entry->xattrs->len : 0);
+        memcpy(record->hash, entry->hash, sizeof(record->hash));
+
+        for (guint j = 0; entry->xattrs && j < entry->xattrs->len; j++) {
+            BuildXattr *xattr = g_ptr_array_index(entry->xattrs, j);
+            gsize len = 0;
+            gconstpointer value = g_bytes_get_data(xattr->value, &len);
+            guint32 fields[2] = {
+                GUINT32_TO_LE(add_string(strings, offsets, xattr->name)),
+                GUINT32_TO_LE((guint32) len),
+            };
+
+            g_byte_array_append(xattrs, (const guint8 *) fields, sizeof(fields));
+            g_byte_array_append(xattrs, value, len);
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = GUINT32_TO_LE(MANIFEST_VERSION);
+    header.hash_type = GUINT32_TO_LE(builder->hash_type);
+    header.n_entries = GUINT64_TO_LE(builder->totals.n_entries);
+    header.n_files = GUINT64_TO_LE(builder->totals.n_files);
+    header.n_dirs = GUINT64_TO_LE(builder->totals.n_dirs);
+    header.bytes = GUINT64_TO_LE(builder->totals.bytes);
+    header.entries_offset = GUINT64_TO_LE(sizeof(header));
+    header.strings_offset = GUINT64_TO_LE(sizeof(header) + records_size);
+    header.strings_size = GUINT64_TO_LE(strings->len);
+    header.xattrs_offset = GUINT64_TO_LE(sizeof(header) + records_size +
+                                         align_u64(strings->len));
+    header.xattrs_size = GUINT64_TO_LE(xattrs->len);
+
+    g_byte_array_append(data, (const guint8 *) &header, sizeof(header));
+    g_byte_array_append(data, (const guint8 *) records, records_size);
+    g_byte_array_append(data, strings->data, strings->len);
+    pad_to_u64(data);
+    g_byte_array_append(data, xattrs->data, xattrs->len);
+
+    return g_byte_array_free_to_bytes(data);
+}
+
+InstallerManifest *installer_manifest_build(const gchar *root, GCancellable *cancellable,
+                                            GError **err) {
+    g_autoptr(GPtrArray) entries = NULL;
+    g_autoptr(GHashTable) hardlinks = NULL;
+    g_autoptr(GBytes) data = NULL;
+    g_autofree guint8 *buffer = NULL;
+    GQueue dirs = G_QUEUE_INIT;
+    Builder builder = {0};
+    struct statx stx;
+    gboolean ret = TRUE;
+    gchar *path = NULL;
+
+    g_return_val_if_fail(root != NULL, NULL);
+
+    entries = g_ptr_array_new_with_free_func((GDestroyNotify) build_entry_free);
+    hardlinks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    buffer = g_malloc(MANIFEST_READ_SIZE);
+
+    builder.root = root;
+    builder.cancellable = cancellable;
+#ifdef HAVE_XXHASH
+    builder.hash_type = INSTALLER_MANIFEST_HASH_XXH3_128;
+#else
+    builder.hash_type = INSTALLER_MANIFEST_HASH_SHA256;
+#endif
+    builder.buffer = buffer;
+    builder.entries = entries;
+    builder.hardlinks = hardlinks;
+    builder.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (builder.root_fd < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno), "Error opening '%s': %s",
+                    root, g_strerror(errno));
+        return NULL;
+    }
+
+    if (statx(builder.root_fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &stx) != 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno), "Error reading '%s': %s",
+                    root, g_strerror(errno));
+        close(builder.root_fd);
+        return NULL;
+    }
+    builder.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+
+    // The root is listed as "", so it sorts first, and queues itself
+    ret = build_entry(&builder, builder.root_fd, "", ".", &dirs, err);
+
+    while (ret && (path = g_queue_pop_head(&dirs))) {
+        ret = build_directory(&builder, path, &dirs, err);
+        g_free(path);
+    }
+
+    g_queue_clear_full(&dirs, g_free);
+    close(builder.root_fd);
+
+    if (!ret) {
+        return NULL;
+    }
+
+    g_ptr_array_sort(entries, compare_build_entries);
+    data = build_serialize(&builder);
+
+    return manifest_new_from_bytes(data, err);
+}
+
+gboolean installer_manifest_save(InstallerManifest *self, const gchar *path,
+                                 GError **err) {
+    gsize len = 0;
+    const gchar *data = NULL;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    data = g_bytes_get_data(self->data, &len);
+    return g_file_set_contents(path, data, len, err);
+}
+
+/* Reading */
+
+InstallerManifestHash installer_manifest_get_hash_type(InstallerManifest *self) {
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), 0);
+
+    return GUINT32_FROM_LE(self->header->hash_type);
+}
+
+gboolean installer_manifest_check_hash_type(InstallerManifest *self, GError **err) {
+    Hasher hasher;
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), FALSE);
+
+    ret = hasher_init(&hasher, installer_manifest_get_hash_type(self), err);
+    hasher_clear(&hasher);
+
+    return ret;
+}
+
+gchar *installer_manifest_get_checksum(InstallerManifest *self) {
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), NULL);
+
+    return g_compute_checksum_for_bytes(G_CHECKSUM_SHA256, self->data);
+}
+
+void installer_manifest_get_totals(InstallerManifest *self,
+                                   InstallerManifestTotals *totals) {
+    g_return_if_fail(INSTALLER_IS_MANIFEST(self));
+    g_return_if_fail(totals != NULL);
+
+    totals->n_entries = self->n_entries;
+    totals->n_files = GUINT64_FROM_LE(self->header->n_files);
+    totals->n_dirs = GUINT64_FROM_LE(self->header->n_dirs);
+    totals->bytes = GUINT64_FROM_LE(self->header->bytes);
+}
+
+gsize installer_manifest_get_n_entries(InstallerManifest *self) {
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), 0);
+
+    return self->n_entries;
+}
+
+static const gchar *record_path(InstallerManifest *self, const ManifestRecord *record) {
+    return self->strings + GUINT32_FROM_LE(record->path);
+}
+
+static void read_record(InstallerManifest *self, const ManifestRecord *record,
+                        InstallerManifestEntry *entry) {
+    guint32 link_target = GUINT32_FROM_LE(record->link_target);
+
+    entry->path = record_path(self, record);
+    entry->link_target = link_target != MANIFEST_NONE ? self->strings + link_target : NULL;
+    entry->mode = GUINT32_FROM_LE(record->mode);
+    entry->uid = GUINT32_FROM_LE(record->uid);
+    entry->gid = GUINT32_FROM_LE(record->gid);
+    entry->hardlink = GUINT32_FROM_LE(record->hardlink);
+    entry->size = GUINT64_FROM_LE(record->size);
+    entry->mtime = GUINT64_FROM_LE(record->mtime);
+    entry->rdev = GUINT64_FROM_LE(record->rdev);
+    entry->hash = record->hash;
+    entry->xattrs = GUINT32_FROM_LE(record->xattrs);
+    entry->n_xattrs = GUINT32_FROM_LE(record->n_xattrs);
+}
+
+void installer_manifest_get_entry(InstallerManifest *self, gsize index,
+                                  InstallerManifestEntry *entry) {
+    g_return_if_fail(INSTALLER_IS_MANIFEST(self));
+    g_return_if_fail(index < self->n_entries);
+    g_return_if_fail(entry != NULL);
+
+    read_record(self, &self->records[index], entry);
+}
+
+gboolean installer_manifest_find(InstallerManifest *self, const gchar *path,
+                                 gsize *index) {
+    gsize low = 0;
+    gsize high = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), FALSE);
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    high = self->n_entries;
+    while (low < high) {
+        gsize mid = low + (high - low) / 2;
+        gint cmp = strcmp(path, record_path(self, &self->records[mid]));
+
+        if (cmp == 0) {
+            if (index) {
+                *index = mid;
+            }
+            return TRUE;
+        }
+
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return FALSE;
+}
+
+gboolean installer_manifest_lookup(InstallerManifest *self, const gchar *path,
+                                   InstallerManifestEntry *entry) {
+    gsize index = 0;
+
+    if (!installer_manifest_find(self, path, &index)) {
+        return FALSE;
+    }
+
+    if (entry) {
+        read_record(self, &self->records[index], entry);
+    }
+    return TRUE;
+}
+
+GArray *installer_manifest_get_xattrs(InstallerManifest *self,
+                                      const InstallerManifestEntry *entry) {
+    GArray *xattrs = NULL;
+    gsize pos = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), NULL);
+    g_return_val_if_fail(entry != NULL, NULL);
+
+    xattrs = g_array_sized_new(FALSE, FALSE, sizeof(InstallerManifestXattr),
+                               entry->n_xattrs);
+
+    // Checked when the manifest was loaded
+    pos = entry->xattrs;
+    for (guint32 i = 0; i < entry->n_xattrs; i++) {
+        InstallerManifestXattr xattr;
+
+        xattr.name = self->strings + get_u32(self->xattrs + pos);
+        xattr.len = get_u32(self->xattrs + pos + sizeof(guint32));
+        xattr.value = self->xattrs + pos + XATTR_RECORD_SIZE;
+        g_array_append_val(xattrs, xattr);
+
+        pos += XATTR_RECORD_SIZE + xattr.len;
+    }
+
+    return xattrs;
+}
+
+guint64 installer_manifest_get_required_space(InstallerManifest *self,
+                                              guint32 block_size) {
+    g_autoptr(GHashTable) seen = NULL;
+    guint64 total = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), 0);
+    g_return_val_if_fail(block_size > 0, 0);
+
+    seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    for (gsize i = 0; i < self->n_entries; i++) {
+        InstallerManifestEntry entry;
+
+        read_record(self, &self->records[i], &entry);
+
+        if (S_ISREG(entry.mode)) {
+            // The data of a hardlinked file is only stored once
+            if (entry.hardlink != 0) {
+                if (g_hash_table_contains(seen, GUINT_TO_POINTER(entry.hardlink))) {
+                    continue;
+                }
+                g_hash_table_add(seen, GUINT_TO_POINTER(entry.hardlink));
+            }
+            total += (entry.size + block_size - 1) / block_size * block_size;
+        } else if (S_ISDIR(entry.mode) ||
+                   (S_ISLNK(entry.mode) && entry.link_target &&
+                    strlen(entry.link_target) >= MANIFEST_FAST_SYMLINK_MAX)) {
+            total += block_size;
+        }
+    }
+
+    return total;
+}
+
+gboolean installer_manifest_check_space(InstallerManifest *self,
+                                        InstallerPartition *target, GError **err) {
+    guint64 required = 0;
+    guint64 available = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_MANIFEST(self), FALSE);
+    g_return_val_if_fail(INSTALLER_IS_PARTITION(target), FALSE);
+
+    required = installer_manifest_get_required_space(self, MANIFEST_BLOCK_SIZE);
+    available = installer_partition_get_freespace(target);
+
+    if (required > available) {
+        g_autofree gchar *required_str = g_format_size(required);
+        g_autofree gchar *free_str = g_format_size(available);
+
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "Installing needs %s, but only %s is free on %s", required_str,
+                    free_str, installer_partition_get_path(target));
+        return FALSE;
+    }
+
+    return TRUE;
+}
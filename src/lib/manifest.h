@@ -0,0 +1,302 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_MANIFEST_H
+#define INSTALLER_MANIFEST_H
+
+#include "partition.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_MANIFEST (installer_manifest_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerManifest, installer_manifest, INSTALLER, MANIFEST, GObject)
+
+/* Room for the content hash of every file; shorter hashes are padded */
+#define INSTALLER_MANIFEST_HASH_SIZE 32
+
+/**
+ * InstallerManifestHash:
+ * @INSTALLER_MANIFEST_HASH_SHA256: SHA-256
+ * @INSTALLER_MANIFEST_HASH_XXH3_128: The 128-bit XXH3, which is many
+ *     times faster; used when the installer is built with libxxhash
+ *
+ * How the content hashes of a manifest were made.
+ */
+typedef enum {
+    INSTALLER_MANIFEST_HASH_SHA256 = 1,
+    INSTALLER_MANIFEST_HASH_XXH3_128 = 2,
+} InstallerManifestHash;
+
+/**
+ * InstallerManifestEntry:
+ * @path: The path relative to the root, "" for the root itself
+ * @link_target: (nullable): The target of a symlink
+ * @mode: The type and permissions, as in struct stat
+ * @uid: The owner
+ * @gid: The group
+ * @hardlink: Shared by every name of a file with more than one, or 0
+ * @size: The size of a file
+ * @mtime: The modification time, in seconds
+ * @rdev: The device number of a device node
+ * @hash: The content hash of a regular file, all zeroes for anything else
+ *
+ * A file, directory, symlink or device node listed in a manifest. The
+ * strings and hash point into the manifest, and live as long as it does.
+ */
+typedef struct _InstallerManifestEntry {
+    const gchar *path;
+    const gchar *link_target;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint32 hardlink;
+    guint64 size;
+    guint64 mtime;
+    guint64 rdev;
+    const guint8 *hash;
+
+    /*< private >*/
+    guint32 xattrs;
+    guint32 n_xattrs;
+} InstallerManifestEntry;
+
+/**
+ * InstallerManifestXattr:
+ * @name: The full name of the attribute, e.g. "security.capability"
+ * @value: The value of the attribute
+ * @len: The length of @value
+ *
+ * An extended attribute of an entry, pointing into the manifest.
+ */
+typedef struct _InstallerManifestXattr {
+    const gchar *name;
+    const guint8 *value;
+    gsize len;
+} InstallerManifestXattr;
+
+/**
+ * InstallerManifestTotals:
+ * @n_entries: Everything listed
+ * @n_files: Regular files, counting each hardlinked file once
+ * @n_dirs: Directories, including the root
+ * @bytes: The size of the regular files, counting each hardlinked file once
+ *
+ * How big the tree a manifest lists is.
+ */
+typedef struct _InstallerManifestTotals {
+    guint64 n_entries;
+    guint64 n_files;
+    guint64 n_dirs;
+    guint64 bytes;
+} InstallerManifestTotals;
+
+/**
+ * installer_manifest_load:
+ * @path: The path to a manifest file
+ * @err: (out): Place to store an error (if any)
+ *
+ * Maps a manifest into memory. The whole file is checked once here, so
+ * reading entries afterwards cannot fail and costs no more than reading
+ * a struct.
+ *
+ * Returns: (transfer full) (nullable): The manifest, or %NULL in case
+ *          of error (@err is set)
+ */
+InstallerManifest *installer_manifest_load(const gchar *path, GError **err);
+
+/**
+ * installer_manifest_build:
+ * @root: The root of the tree to list, e.g. the mounted live filesystem
+ * @cancellable: (nullable): A #GCancellable
+ * @err: (out): Place to store an error (if any)
+ *
+ * Lists a tree and hashes every file in it, with XXH3 if the installer
+ * was built with libxxhash and SHA-256 otherwise. This reads everything, so
+ * it is meant to be run when the ISO is built, with the result saved
+ * next to the live image; see installer_manifest_save(). Like the copy
+ * engine, it does not cross mount points and leaves out sockets.
+ *
+ * Returns: (transfer full) (nullable): The manifest, or %NULL in case
+ *          of error (@err is set)
+ */
+InstallerManifest *installer_manifest_build(const gchar *root, GCancellable *cancellable,
+                                            GError **err);
+
+/**
+ * installer_manifest_save:
+ * @self: The manifest
+ * @path: Where to write it
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: %TRUE if the manifest was written
+ */
+gboolean installer_manifest_save(InstallerManifest *self, const gchar *path,
+                                 GError **err);
+
+/**
+ * installer_manifest_get_hash_type:
+ * @self: The manifest
+ *
+ * Returns: How the content hashes of @self were made
+ */
+InstallerManifestHash installer_manifest_get_hash_type(InstallerManifest *self);
+
+/**
+ * installer_manifest_check_hash_type:
+ * @self: The manifest
+ * @err: (out): Place to store an error (if any)
+ *
+ * Checks that this build of the installer can make the content hashes
+ * of @self. A manifest made with XXH3 cannot be verified by an installer
+ * built without libxxhash.
+ *
+ * Returns: %TRUE if files can be hashed to compare with @self
+ */
+gboolean installer_manifest_check_hash_type(InstallerManifest *self, GError **err);
+
+/**
+ * installer_manifest_get_checksum:
+ * @self: The manifest
+ *
+ * Gets a SHA-256 checksum of the whole manifest, which identifies the
+ * tree it lists, e.g. to tell whether a target was copied from it.
+ *
+ * Returns: (transfer full): The checksum as a hex string
+ */
+gchar *installer_manifest_get_checksum(InstallerManifest *self);
+
+/**
+ * installer_manifest_hash_fd:
+ * @type: The hash to use
+ * @fd: A file to read to its end
+ * @buffer: A buffer to read into, which may need to be aligned for
+ *     O_DIRECT
+ * @buffer_size: The size of @buffer
+ * @hash: (out caller-allocates): Place to store the hash, padded with
+ *     zeroes to %INSTALLER_MANIFEST_HASH_SIZE
+ * @cancellable: (nullable): A #GCancellable
+ * @err: (out): Place to store an error (if any)
+ *
+ * Hashes the rest of a file the way a manifest hashes its content, so
+ * it can be compared with the hash of an entry.
+ *
+ * Returns: %TRUE if the file was hashed
+ */
+gboolean installer_manifest_hash_fd(InstallerManifestHash type, gint fd, guint8 *buffer,
+                                    gsize buffer_size, guint8 *hash,
+                                    GCancellable *cancellable, GError **err);
+
+/**
+ * installer_manifest_get_totals:
+ * @self: The manifest
+ * @totals: (out): Place to store the totals
+ *
+ * Gets the size of the tree, which is stored in the manifest rather
+ * than counted.
+ */
+void installer_manifest_get_totals(InstallerManifest *self,
+                                   InstallerManifestTotals *totals);
+
+/**
+ * installer_manifest_get_n_entries:
+ * @self: The manifest
+ *
+ * Returns: The number of entries, which are sorted by path
+ */
+gsize installer_manifest_get_n_entries(InstallerManifest *self);
+
+/**
+ * installer_manifest_get_entry:
+ * @self: The manifest
+ * @index: The index of the entry
+ * @entry: (out): Place to store the entry
+ */
+void installer_manifest_get_entry(InstallerManifest *self, gsize index,
+                                  InstallerManifestEntry *entry);
+
+/**
+ * installer_manifest_find:
+ * @self: The manifest
+ * @path: A path relative to the root
+ * @index: (out) (optional): Place to store the index of the entry
+ *
+ * Finds where an entry is in the manifest, with a binary search.
+ *
+ * Returns: %TRUE if @path is listed
+ */
+gboolean installer_manifest_find(InstallerManifest *self, const gchar *path,
+                                 gsize *index);
+
+/**
+ * installer_manifest_lookup:
+ * @self: The manifest
+ * @path: A path relative to the root
+ * @entry: (out) (optional): Place to store the entry
+ *
+ * Finds an entry by its path, with a binary search.
+ *
+ * Returns: %TRUE if @path is listed
+ */
+gboolean installer_manifest_lookup(InstallerManifest *self, const gchar *path,
+                                   InstallerManifestEntry *entry);
+
+/**
+ * installer_manifest_get_xattrs:
+ * @self: The manifest
+ * @entry: An entry of @self
+ *
+ * Returns: (transfer container) (element-type InstallerManifestXattr):
+ *          The extended attributes of @entry
+ */
+GArray *installer_manifest_get_xattrs(InstallerManifest *self,
+                                      const InstallerManifestEntry *entry);
+
+/**
+ * installer_manifest_get_required_space:
+ * @self: The manifest
+ * @block_size: The block size of the target filesystem
+ *
+ * Estimates the space the tree takes on a filesystem, with every file
+ * and directory rounded up to whole blocks. Filesystem overhead such as
+ * inode tables and the journal is not included; it is not counted as
+ * free space either.
+ *
+ * Returns: The space needed, in bytes
+ */
+guint64 installer_manifest_get_required_space(InstallerManifest *self,
+                                              guint32 block_size);
+
+/**
+ * installer_manifest_check_space:
+ * @self: The manifest
+ * @target: The partition the tree is to be installed to
+ * @err: (out): Place to store an error (if any)
+ *
+ * Checks that the tree fits in the free space of a partition, so an
+ * install that cannot succeed fails before anything is written.
+ *
+ * Returns: %TRUE if the tree fits
+ */
+gboolean installer_manifest_check_space(InstallerManifest *self,
+                                        InstallerPartition *target, GError **err);
+
+G_END_DECLS
+
+#endif
@@ -16,212 +16,74 @@
 
 #include "os.h"
 
-enum {
-    PROP_EXP_0,
-    PROP_OTYPE,
-    PROP_NAME,
-    PROP_DEVICE_PATH,
-    PROP_ICON_NAME,
-    N_EXP_PROPERTIES
+#define DEFAULT_ICON_NAME "system-software-install"
+
+static const gchar *os_type_names[] = {
+    [INSTALLER_OS_TYPE_UNKNOWN] = "unknown",
+    [INSTALLER_OS_TYPE_WINDOWS] = "windows",
+    [INSTALLER_OS_TYPE_WINDOWS_BOOT] = "windows-boot",
+    [INSTALLER_OS_TYPE_LINUX] = "linux",
+    [INSTALLER_OS_TYPE_PARTIAL_INSTALL] = "partial-install",
 };
 
-static GParamSpec *props[N_EXP_PROPERTIES] = {NULL};
+InstallerOS *installer_os_new(InstallerArena *arena, InstallerOSType otype,
+                              const gchar *name, const gchar *device_path) {
+    g_return_val_if_fail(arena != NULL, NULL);
 
-struct _InstallerOS {
-    GObject parent_instance;
+    InstallerOS *self = installer_arena_new0(arena, InstallerOS);
 
-    const gchar *otype;
-    const gchar *name;
-    const gchar *device_path;
-    const gchar *icon_name;
-};
-
-G_DEFINE_TYPE(InstallerOS, installer_os, G_TYPE_OBJECT);
-
-static void installer_os_finalize(GObject *obj);
-static void installer_os_get_property(GObject *obj, guint prop_id, GValue *val,
-                                      GParamSpec *spec);
-static void installer_os_set_property(GObject *obj, guint prop_id,
-                                      const GValue *val, GParamSpec *spec);
-
-static void installer_os_class_init(InstallerOSClass *klass) {
-    GObjectClass *class = G_OBJECT_CLASS(klass);
-    class->finalize = installer_os_finalize;
-    class->get_property = installer_os_get_property;
-    class->set_property = installer_os_set_property;
-
-    props[PROP_OTYPE] = g_param_spec_string(
-        "otype", "OS Type", "The type of OS, e.g. Windows or Linux", "",
-        G_PARAM_CONSTRUCT_ONLY | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_READWRITE);
-
-    props[PROP_NAME] = g_param_spec_string(
-        "name", "Name", "The full name of the OS", "",
-        G_PARAM_CONSTRUCT_ONLY | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_READWRITE);
-
-    props[PROP_DEVICE_PATH] = g_param_spec_string(
-        "device-path", "Device Path",
-        "The path of the device the OS is installed on", "",
-        G_PARAM_CONSTRUCT_ONLY | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_READWRITE);
+    self->otype = otype;
+    self->name = installer_arena_strdup(arena, name ? name : "");
+    self->device_path = installer_arena_strdup(arena, device_path ? device_path : "");
+    self->icon = g_quark_from_static_string(DEFAULT_ICON_NAME);
 
-    props[PROP_ICON_NAME] = g_param_spec_string(
-        "icon-name", "Icon Name", "The icon name for the OS",
-        "system-software-install",
-        G_PARAM_CONSTRUCT_ONLY | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_READWRITE);
-
-    g_object_class_install_properties(class, N_EXP_PROPERTIES, props);
-}
-
-static void installer_os_init(InstallerOS *self) {
-    (void) self;
+    return self;
 }
 
-static void installer_os_finalize(GObject *obj) {
-    InstallerOS *self = INSTALLER_OS(obj);
+InstallerOSType installer_os_get_otype(const InstallerOS *self) {
+    g_return_val_if_fail(self != NULL, INSTALLER_OS_TYPE_UNKNOWN);
 
-    g_free((gchar *) self->otype);
-    g_free((gchar *) self->name);
-    g_free((gchar *) self->device_path);
-    g_free((gchar *) self->icon_name);
-
-    G_OBJECT_CLASS(installer_os_parent_class)->finalize(obj);
+    return self->otype;
 }
 
-static void installer_os_get_property(GObject *obj, guint prop_id, GValue *val,
-                                      GParamSpec *spec) {
-    InstallerOS *self = INSTALLER_OS(obj);
-
-    switch (prop_id) {
-        case PROP_OTYPE:
-            g_value_set_string(val, g_strdup(self->otype));
-            break;
-
-        case PROP_NAME:
-            g_value_set_string(val, g_strdup(self->name));
-            break;
-
-        case PROP_DEVICE_PATH:
-            g_value_set_string(val, g_strdup(self->device_path));
-            break;
-
-        case PROP_ICON_NAME:
-            g_value_set_string(val, g_strdup(self->icon_name));
-            break;
-
-        default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, spec);
-            break;
+const gchar *installer_os_type_to_string(InstallerOSType otype) {
+    if ((guint) otype >= G_N_ELEMENTS(os_type_names)) {
+        otype = INSTALLER_OS_TYPE_UNKNOWN;
     }
-}
-
-static void installer_os_set_property(GObject *obj, guint prop_id,
-                                      const GValue *val, GParamSpec *spec) {
-    InstallerOS *self = INSTALLER_OS(obj);
-
-    switch (prop_id) {
-        case PROP_OTYPE:
-            installer_os_set_otype(self, g_value_dup_string(val));
-            break;
-
-        case PROP_NAME:
-            installer_os_set_name(self, g_value_dup_string(val));
-            break;
 
-        case PROP_DEVICE_PATH:
-            installer_os_set_device_path(self, g_value_dup_string(val));
-            break;
-
-        case PROP_ICON_NAME:
-            installer_os_set_icon_name(self, g_value_dup_string(val));
-            break;
-
-        default:
-            G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, spec);
-            break;
-    }
+    return os_type_names[otype];
 }
 
-InstallerOS *installer_os_new(gchar *otype, gchar *name,
-                              const gchar *device_path) {
-    return g_object_new(INSTALLER_TYPE_OS, "otype", otype, "name", name,
-                        "device-path", device_path, NULL);
-}
+const gchar *installer_os_get_name(const InstallerOS *self) {
+    g_return_val_if_fail(self != NULL, NULL);
 
-gchar *installer_os_get_otype(InstallerOS *self) {
-    return g_strdup(self->otype);
+    return self->name;
 }
 
-gchar *installer_os_get_name(InstallerOS *self) {
-    return g_strdup(self->name);
-}
+const gchar *installer_os_get_device_path(const InstallerOS *self) {
+    g_return_val_if_fail(self != NULL, NULL);
 
-const gchar *installer_os_get_device_path(InstallerOS *self) {
-    return g_strdup(self->device_path);
+    return self->device_path;
 }
 
-gchar *installer_os_get_icon_name(InstallerOS *self) {
-    return g_strdup(self->icon_name);
-}
+GQuark installer_os_get_icon(const InstallerOS *self) {
+    g_return_val_if_fail(self != NULL, 0);
 
-void installer_os_set_otype(InstallerOS *self, const gchar *value) {
-    g_return_if_fail(INSTALLER_IS_OS(self));
-
-    if (!value) {
-        return;
-    }
-
-    if (self->otype) {
-        g_free((gchar *) self->otype);
-    }
-
-    self->otype = value;
-
-    g_object_notify_by_pspec(G_OBJECT(self), props[PROP_OTYPE]);
+    return self->icon;
 }
 
-void installer_os_set_name(InstallerOS *self, const gchar *value) {
-    g_return_if_fail(INSTALLER_IS_OS(self));
-
-    if (!value) {
-        return;
-    }
-
-    if (self->name) {
-        g_free((gchar *) self->name);
-    }
-
-    self->name = value;
+const gchar *installer_os_get_icon_name(const InstallerOS *self) {
+    g_return_val_if_fail(self != NULL, NULL);
 
-    g_object_notify_by_pspec(G_OBJECT(self), props[PROP_NAME]);
+    return g_quark_to_string(self->icon);
 }
 
-void installer_os_set_device_path(InstallerOS *self, const gchar *value) {
-    g_return_if_fail(INSTALLER_IS_OS(self));
+void installer_os_set_icon(InstallerOS *self, GQuark icon) {
+    g_return_if_fail(self != NULL);
 
-    if (!value) {
+    if (!icon) {
         return;
     }
 
-    if (self->device_path) {
-        g_free((gchar *) self->device_path);
-    }
-
-    self->device_path = value;
-
-    g_object_notify_by_pspec(G_OBJECT(self), props[PROP_DEVICE_PATH]);
-}
-
-void installer_os_set_icon_name(InstallerOS *self, const gchar *value) {
-    g_return_if_fail(INSTALLER_IS_OS(self));
-
-    if (!value) {
-        return;
-    }
-
-    if (self->icon_name) {
-        g_free((gchar *) self->icon_name);
-    }
-
-    self->icon_name = value;
-
-    g_object_notify_by_pspec(G_OBJECT(self), props[PROP_ICON_NAME]);
+    self->icon = icon;
 }
@@ -17,68 +17,97 @@
 #ifndef INSTALLER_OS_H
 #define INSTALLER_OS_H
 
-#include <gio/gio.h>
+#include "arena.h"
+
 #include <glib.h>
 
 G_BEGIN_DECLS
 
-#define INSTALLER_TYPE_OS (installer_os_get_type())
-
-G_DECLARE_FINAL_TYPE(InstallerOS, installer_os, INSTALLER, OS, GObject)
-
 /**
- * Create a new object for information about an operating system.
+ * InstallerOSType:
+ * @INSTALLER_OS_TYPE_UNKNOWN: Not a known kind of OS
+ * @INSTALLER_OS_TYPE_WINDOWS: A Windows installation
+ * @INSTALLER_OS_TYPE_WINDOWS_BOOT: A partition holding the Windows bootloader
+ * @INSTALLER_OS_TYPE_LINUX: A Linux distribution
+ * @INSTALLER_OS_TYPE_PARTIAL_INSTALL: An install that was interrupted,
+ *     and can be resumed
+ *
+ * The kinds of operating system a scan can find.
  */
-InstallerOS *installer_os_new(gchar *otype, gchar *name,
-                              const gchar *device_path);
+typedef enum {
+    INSTALLER_OS_TYPE_UNKNOWN,
+    INSTALLER_OS_TYPE_WINDOWS,
+    INSTALLER_OS_TYPE_WINDOWS_BOOT,
+    INSTALLER_OS_TYPE_LINUX,
+    INSTALLER_OS_TYPE_PARTIAL_INSTALL,
+} InstallerOSType;
 
 /**
- * Get the type of this OS.
+ * InstallerOS:
+ * @otype: The type of OS, e.g. Windows or Linux
+ * @name: The full name of the OS
+ * @device_path: The path of the device the OS is installed on
+ * @icon: The interned icon name for the OS
  *
- * The caller is responsible for freeing this string.
+ * Information about an operating system found during a scan. Records
+ * and their strings are owned by the #InstallerArena of the scan, and
+ * live exactly as long as it does.
  */
-gchar *installer_os_get_otype(InstallerOS *self);
+typedef struct _InstallerOS {
+    InstallerOSType otype;
+    const gchar *name;
+    const gchar *device_path;
+    GQuark icon;
+} InstallerOS;
 
 /**
- * Get the name of this OS.
+ * Create a new record for information about an operating system.
  *
- * The caller is responsible for freeing this string.
+ * The record and copies of the strings are allocated from `arena`.
  */
-gchar *installer_os_get_name(InstallerOS *self);
+InstallerOS *installer_os_new(InstallerArena *arena, InstallerOSType otype,
+                              const gchar *name, const gchar *device_path);
 
 /**
- * Get the path to the device this OS is installed on.
- *
- * The caller is responsible for freeing this string.
+ * Get the type of this OS.
  */
-const gchar *installer_os_get_device_path(InstallerOS *self);
+InstallerOSType installer_os_get_otype(const InstallerOS *self);
 
 /**
- * Get the icon name for this OS.
+ * Get a short, stable name for an OS type, e.g. "windows-boot".
+ */
+const gchar *installer_os_type_to_string(InstallerOSType otype);
+
+/**
+ * Get the name of this OS.
  *
- * The caller is responsible for freeing this string.
+ * The returned string is owned by the scan arena.
  */
-gchar *installer_os_get_icon_name(InstallerOS *self);
+const gchar *installer_os_get_name(const InstallerOS *self);
 
 /**
- * Set the type of this OS.
+ * Get the path to the device this OS is installed on.
+ *
+ * The returned string is owned by the scan arena.
  */
-void installer_os_set_otype(InstallerOS *self, const gchar *value);
+const gchar *installer_os_get_device_path(const InstallerOS *self);
 
 /**
- * Set the name of this OS.
+ * Get the interned icon name for this OS.
  */
-void installer_os_set_name(InstallerOS *self, const gchar *value);
+GQuark installer_os_get_icon(const InstallerOS *self);
 
 /**
- * Set the path to the device this OS is installed on.
+ * Get the icon name for this OS.
+ *
+ * The returned string is interned and never freed.
  */
-void installer_os_set_device_path(InstallerOS *self, const gchar *value);
+const gchar *installer_os_get_icon_name(const InstallerOS *self);
 
 /**
- * Set the icon name for this OS.
+ * Set the icon for this OS.
  */
-void installer_os_set_icon_name(InstallerOS *self, const gchar *value);
+void installer_os_set_icon(InstallerOS *self, GQuark icon);
 
 G_END_DECLS
 
@@ -0,0 +1,294 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "part_class.h"
+#include "part_type_guid_table.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MBR_SIZE 512
+#define MBR_TABLE_OFFSET 446
+#define MBR_ENTRY_SIZE 16
+#define MBR_PRIMARY_ENTRIES 4
+#define MBR_FIRST_LOGICAL 5
+/* Guard against looping EBR chains */
+#define MBR_MAX_LOGICAL 128
+
+typedef struct _FlagClass {
+    guint64 flag;
+    InstallerPartClass klass;
+} FlagClass;
+
+/* Indexed by MBR type byte; unlisted types are INSTALLER_PART_CLASS_UNKNOWN */
+static const InstallerPartClass mbr_classes[256] = {
+    [0x00] = INSTALLER_PART_CLASS_CONTAINER,
+    [0x05] = INSTALLER_PART_CLASS_CONTAINER,
+    [0x0f] = INSTALLER_PART_CLASS_CONTAINER,
+    [0x85] = INSTALLER_PART_CLASS_CONTAINER,
+    [0xee] = INSTALLER_PART_CLASS_CONTAINER,
+
+    [0x01] = INSTALLER_PART_CLASS_DATA,
+    [0x04] = INSTALLER_PART_CLASS_DATA,
+    [0x06] = INSTALLER_PART_CLASS_DATA,
+    [0x07] = INSTALLER_PART_CLASS_DATA,
+    [0x0b] = INSTALLER_PART_CLASS_DATA,
+    [0x0c] = INSTALLER_PART_CLASS_DATA,
+    [0x0e] = INSTALLER_PART_CLASS_DATA,
+    [0x83] = INSTALLER_PART_CLASS_DATA,
+
+    [0xef] = INSTALLER_PART_CLASS_ESP,
+    [0x82] = INSTALLER_PART_CLASS_SWAP,
+
+    /* Hidden copies of Windows and vendor restore images */
+    [0x12] = INSTALLER_PART_CLASS_RECOVERY,
+    [0x17] = INSTALLER_PART_CLASS_RECOVERY,
+    [0x1b] = INSTALLER_PART_CLASS_RECOVERY,
+    [0x1c] = INSTALLER_PART_CLASS_RECOVERY,
+    [0x27] = INSTALLER_PART_CLASS_RECOVERY,
+    [0xde] = INSTALLER_PART_CLASS_RECOVERY,
+
+    /* Hibernation areas */
+    [0x84] = INSTALLER_PART_CLASS_RESERVED,
+    [0xa0] = INSTALLER_PART_CLASS_RESERVED,
+
+    [0x42] = INSTALLER_PART_CLASS_STACK_MEMBER,
+    [0x8e] = INSTALLER_PART_CLASS_STACK_MEMBER,
+    [0xfd] = INSTALLER_PART_CLASS_STACK_MEMBER,
+    [0xe8] = INSTALLER_PART_CLASS_STACK_MEMBER,
+};
+
+/* Used when neither the GUID nor the type byte is known */
+static const FlagClass flag_classes[] = {
+    {BD_PART_FLAG_SWAP, INSTALLER_PART_CLASS_SWAP},
+    {BD_PART_FLAG_MSFT_RESERVED, INSTALLER_PART_CLASS_RESERVED},
+    {BD_PART_FLAG_BIOS_GRUB, INSTALLER_PART_CLASS_BIOS_BOOT},
+    {BD_PART_FLAG_LVM, INSTALLER_PART_CLASS_STACK_MEMBER},
+    {BD_PART_FLAG_RAID, INSTALLER_PART_CLASS_STACK_MEMBER},
+    {BD_PART_FLAG_DIAG, INSTALLER_PART_CLASS_RECOVERY},
+    {BD_PART_FLAG_HPSERVICE, INSTALLER_PART_CLASS_RECOVERY},
+    {BD_PART_FLAG_APPLE_TV_RECOVERY, INSTALLER_PART_CLASS_RECOVERY},
+    {BD_PART_FLAG_IRST, INSTALLER_PART_CLASS_RESERVED},
+    {BD_PART_FLAG_ESP, INSTALLER_PART_CLASS_ESP},
+};
+
+static const gchar *class_names[] = {
+    [INSTALLER_PART_CLASS_UNKNOWN] = "unknown",
+    [INSTALLER_PART_CLASS_DATA] = "data",
+    [INSTALLER_PART_CLASS_ESP] = "esp",
+    [INSTALLER_PART_CLASS_BIOS_BOOT] = "bios-boot",
+    [INSTALLER_PART_CLASS_SWAP] = "swap",
+    [INSTALLER_PART_CLASS_RESERVED] = "reserved",
+    [INSTALLER_PART_CLASS_RECOVERY] = "recovery",
+    [INSTALLER_PART_CLASS_STACK_MEMBER] = "stack-member",
+    [INSTALLER_PART_CLASS_CONTAINER] = "container",
+    [INSTALLER_PART_CLASS_TOO_SMALL] = "too-small",
+};
+
+static gboolean read_sector(gint fd, guint64 lba, guint64 sector_size,
+                            guint8 *buf, GError **err) {
+    gssize n = pread(fd, buf, MBR_SIZE, (off_t) (lba * sector_size));
+
+    if (n != MBR_SIZE) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(n < 0 ? errno : EIO),
+                    "Unable to read sector %" G_GUINT64_FORMAT ": %s", lba,
+                    g_strerror(n < 0 ? errno : EIO));
+        return FALSE;
+    }
+
+    if (buf[510] != 0x55 || buf[511] != 0xaa) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Sector %" G_GUINT64_FORMAT " has no boot signature", lba);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static guint32 entry_start(const guint8 *entry) {
+    guint32 v;
+    memcpy(&v, entry + 8, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+static void set_type(GByteArray *types, guint number, guint8 type) {
+    if (types->len <= number) {
+        g_byte_array_set_size(types, number + 1);
+    }
+    types->data[number] = type;
+}
+
+static gboolean is_extended(guint8 type) {
+    return type == 0x05 || type == 0x0f || type == 0x85;
+}
+
+GByteArray *installer_part_class_read_mbr_types(const gchar *disk,
+                                                guint64 sector_size,
+                                                GError **err) {
+    g_autoptr(GByteArray) types = NULL;
+    guint8 sector[MBR_SIZE];
+    guint64 ext_start = 0;
+    gint fd;
+
+    g_return_val_if_fail(disk != NULL, NULL);
+
+    if (sector_size == 0) {
+        sector_size = 512;
+    }
+
+    fd = open(disk, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "Unable to open '%s': %s", disk, g_strerror(errno));
+        return NULL;
+    }
+
+    if (!read_sector(fd, 0, sector_size, sector, err)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Zero-filled so that gaps read as "empty"
+    types = g_byte_array_new();
+    g_byte_array_set_size(types, MBR_FIRST_LOGICAL);
+    memset(types->data, 0, types->len);
+
+    for (guint i = 0; i < MBR_PRIMARY_ENTRIES; i++) {
+        const guint8 *entry = sector + MBR_TABLE_OFFSET + i * MBR_ENTRY_SIZE;
+        guint8 type = entry[4];
+
+        set_type(types, i + 1, type);
+        if (is_extended(type) && ext_start == 0) {
+            ext_start = entry_start(entry);
+        }
+    }
+
+    // Each EBR describes one logical partition relative to itself, and
+    // links to the next EBR relative to the start of the extended one.
+    guint64 ebr = ext_start;
+    for (guint n = MBR_FIRST_LOGICAL; ebr != 0 && n < MBR_FIRST_LOGICAL + MBR_MAX_LOGICAL; n++) {
+        g_autoptr(GError) ebr_err = NULL;
+        const guint8 *entry = sector + MBR_TABLE_OFFSET;
+
+        if (!read_sector(fd, ebr, sector_size, sector, &ebr_err)) {
+            g_debug("stopping EBR walk on '%s': %s", disk, ebr_err->message);
+            break;
+        }
+
+        set_type(types, n, entry[4]);
+
+        guint8 next_type = entry[MBR_ENTRY_SIZE + 4];
+        guint32 next = entry_start(entry + MBR_ENTRY_SIZE);
+        ebr = (is_extended(next_type) && next != 0) ? ext_start + next : 0;
+    }
+
+    close(fd);
+    return g_steal_pointer(&types);
+}
+
+/**
+ * get_part_number:
+ * @path: The path to a partition
+ *
+ * Returns: The number at the end of the partition path, e.g. 5 for
+ *          `/dev/sda5` or `/dev/nvme0n1p5`, or 0 if there is none
+ */
+static guint get_part_number(const gchar *path) {
+    const gchar *end = path + strlen(path);
+    const gchar *p = end;
+
+    while (p > path && g_ascii_isdigit(*(p - 1))) {
+        p--;
+    }
+
+    if (p == end) {
+        return 0;
+    }
+
+    return (guint) g_ascii_strtoull(p, NULL, 10);
+}
+
+static InstallerPartClass classify_table(BDPartSpec *part,
+                                         GByteArray *mbr_types) {
+    InstallerPartClass klass;
+
+    if (part->type & (BD_PART_TYPE_EXTENDED | BD_PART_TYPE_FREESPACE |
+                      BD_PART_TYPE_METADATA | BD_PART_TYPE_PROTECTED)) {
+        return INSTALLER_PART_CLASS_CONTAINER;
+    }
+
+    if (part->type_guid) {
+        klass = part_type_guid_lookup(part->type_guid);
+        if (klass != INSTALLER_PART_CLASS_UNKNOWN) {
+            return klass;
+        }
+    }
+
+    if (mbr_types && part->path) {
+        guint number = get_part_number(part->path);
+        if (number > 0 && number < mbr_types->len) {
+            klass = mbr_classes[mbr_types->data[number]];
+            if (klass != INSTALLER_PART_CLASS_UNKNOWN) {
+                return klass;
+            }
+        }
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS(flag_classes); i++) {
+        if (part->flags & flag_classes[i].flag) {
+            return flag_classes[i].klass;
+        }
+    }
+
+    return INSTALLER_PART_CLASS_UNKNOWN;
+}
+
+InstallerPartClass installer_part_classify(BDPartSpec *part,
+                                           GByteArray *mbr_types) {
+    InstallerPartClass klass;
+
+    g_return_val_if_fail(part != NULL, INSTALLER_PART_CLASS_UNKNOWN);
+
+    klass = classify_table(part, mbr_types);
+
+    if (installer_part_class_should_probe(klass) && klass != INSTALLER_PART_CLASS_ESP &&
+        part->size < INSTALLER_PART_CLASS_MIN_PROBE_SIZE) {
+        return INSTALLER_PART_CLASS_TOO_SMALL;
+    }
+
+    return klass;
+}
+
+gboolean installer_part_class_should_probe(InstallerPartClass klass) {
+    switch (klass) {
+        case INSTALLER_PART_CLASS_UNKNOWN:
+        case INSTALLER_PART_CLASS_DATA:
+        case INSTALLER_PART_CLASS_ESP:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+const gchar *installer_part_class_to_string(InstallerPartClass klass) {
+    if ((gsize) klass >= G_N_ELEMENTS(class_names)) {
+        return "invalid";
+    }
+
+    return class_names[klass];
+}
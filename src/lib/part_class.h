@@ -0,0 +1,128 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_PART_CLASS_H
+#define INSTALLER_PART_CLASS_H
+
+#include <blockdev/part.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * INSTALLER_PART_CLASS_MIN_PROBE_SIZE:
+ *
+ * Partitions smaller than this cannot hold an operating system, and
+ * are not worth mounting.
+ */
+#define INSTALLER_PART_CLASS_MIN_PROBE_SIZE (8 * 1024 * 1024)
+
+/**
+ * InstallerPartClass:
+ * @INSTALLER_PART_CLASS_UNKNOWN: The type is not in any table. Probed,
+ *     since it may hold anything.
+ * @INSTALLER_PART_CLASS_DATA: A general purpose or OS root partition.
+ *     Probed.
+ * @INSTALLER_PART_CLASS_ESP: An EFI system partition. Probed, since it
+ *     is where Windows bootloaders live, and checked for a valid
+ *     filesystem to be offered as an ESP.
+ * @INSTALLER_PART_CLASS_BIOS_BOOT: A BIOS boot partition holding raw
+ *     bootloader code without a filesystem. Never probed.
+ * @INSTALLER_PART_CLASS_SWAP: Swap space. Never probed.
+ * @INSTALLER_PART_CLASS_RESERVED: Space reserved by another OS or
+ *     firmware, e.g. the Microsoft reserved partition or hibernation
+ *     areas. Never probed.
+ * @INSTALLER_PART_CLASS_RECOVERY: A Windows or vendor recovery partition.
+ *     Never probed; they carry a bootable copy of an OS that must not be
+ *     offered as an installed one.
+ * @INSTALLER_PART_CLASS_STACK_MEMBER: A physical member of an LVM2,
+ *     RAID, LUKS or Windows dynamic disk stack. Never probed directly;
+ *     the top of the stack is probed instead.
+ * @INSTALLER_PART_CLASS_CONTAINER: An MBR extended partition or other
+ *     partition table metadata. Never probed.
+ * @INSTALLER_PART_CLASS_TOO_SMALL: A probeable type that is smaller than
+ *     %INSTALLER_PART_CLASS_MIN_PROBE_SIZE. Never probed.
+ *
+ * The probe class of a partition, assigned purely from the partition
+ * table before anything on the partition itself is read.
+ */
+typedef enum {
+    INSTALLER_PART_CLASS_UNKNOWN,
+    INSTALLER_PART_CLASS_DATA,
+    INSTALLER_PART_CLASS_ESP,
+    INSTALLER_PART_CLASS_BIOS_BOOT,
+    INSTALLER_PART_CLASS_SWAP,
+    INSTALLER_PART_CLASS_RESERVED,
+    INSTALLER_PART_CLASS_RECOVERY,
+    INSTALLER_PART_CLASS_STACK_MEMBER,
+    INSTALLER_PART_CLASS_CONTAINER,
+    INSTALLER_PART_CLASS_TOO_SMALL
+} InstallerPartClass;
+
+/**
+ * installer_part_class_read_mbr_types:
+ * @disk: The path to a disk with an MBR partition table
+ * @sector_size: The logical sector size of @disk
+ * @err: (out): Place to store an error (if any)
+ *
+ * Reads the MBR and the chain of extended boot records of @disk to get
+ * the type byte of every partition, since libblockdev does not expose
+ * them.
+ *
+ * Returns: (transfer full): An array of type bytes indexed by partition
+ *          number, where unused entries are zero, or %NULL in case of
+ *          error (@err is set)
+ */
+GByteArray *installer_part_class_read_mbr_types(const gchar *disk,
+                                                guint64 sector_size,
+                                                GError **err);
+
+/**
+ * installer_part_classify:
+ * @part: The partition to classify
+ * @mbr_types: (nullable): MBR type bytes from
+ *     installer_part_class_read_mbr_types(), if the disk uses MBR
+ *
+ * Assigns a probe class to a partition from its GPT type GUID, its MBR
+ * type byte, its libblockdev flags and its size, in that order. No I/O
+ * is done.
+ *
+ * Returns: The class of @part
+ */
+InstallerPartClass installer_part_classify(BDPartSpec *part,
+                                           GByteArray *mbr_types);
+
+/**
+ * installer_part_class_should_probe:
+ * @klass: The class to check
+ *
+ * Returns: %TRUE if partitions of this class should be mounted and
+ *          searched for an operating system
+ */
+gboolean installer_part_class_should_probe(InstallerPartClass klass);
+
+/**
+ * installer_part_class_to_string:
+ * @klass: The class to describe
+ *
+ * Returns: (transfer none): A short name for @klass, for logging
+ */
+const gchar *installer_part_class_to_string(InstallerPartClass klass);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,95 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "part_item.h"
+
+struct _InstallerPartItem {
+    GObject parent_instance;
+
+    gchar *disk;
+    BDPartSpec *spec;
+    InstallerPartClass klass;
+};
+
+G_DEFINE_TYPE(InstallerPartItem, installer_part_item, G_TYPE_OBJECT);
+
+static void installer_part_item_finalize(GObject *obj);
+
+static void installer_part_item_class_init(InstallerPartItemClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_part_item_finalize;
+}
+
+static void installer_part_item_init(__attribute((unused)) InstallerPartItem *self) {}
+
+static void installer_part_item_finalize(GObject *obj) {
+    InstallerPartItem *self = INSTALLER_PART_ITEM(obj);
+
+    g_free(self->disk);
+    bd_part_spec_free(self->spec);
+
+    G_OBJECT_CLASS(installer_part_item_parent_class)->finalize(obj);
+}
+
+InstallerPartItem *installer_part_item_new(const gchar *disk, const BDPartSpec *spec) {
+    g_return_val_if_fail(spec != NULL, NULL);
+
+    InstallerPartItem *self = g_object_new(INSTALLER_TYPE_PART_ITEM, NULL);
+
+    self->disk = g_strdup(disk);
+    self->spec = bd_part_spec_copy((BDPartSpec *) spec);
+    self->klass = installer_part_classify(self->spec, NULL);
+
+    return self;
+}
+
+const gchar *installer_part_item_get_disk(InstallerPartItem *self) {
+    g_return_val_if_fail(INSTALLER_IS_PART_ITEM(self), NULL);
+
+    return self->disk;
+}
+
+const gchar *installer_part_item_get_path(InstallerPartItem *self) {
+    g_return_val_if_fail(INSTALLER_IS_PART_ITEM(self), NULL);
+
+    return self->spec->path;
+}
+
+const BDPartSpec *installer_part_item_get_spec(InstallerPartItem *self) {
+    g_return_val_if_fail(INSTALLER_IS_PART_ITEM(self), NULL);
+
+    return self->spec;
+}
+
+InstallerPartClass installer_part_item_get_class(InstallerPartItem *self) {
+    g_return_val_if_fail(INSTALLER_IS_PART_ITEM(self), INSTALLER_PART_CLASS_UNKNOWN);
+
+    return self->klass;
+}
+
+gboolean installer_part_item_equal(gconstpointer a, gconstpointer b) {
+    const InstallerPartItem *item_a = a;
+    const InstallerPartItem *item_b = b;
+    const BDPartSpec *spec_a = item_a->spec;
+    const BDPartSpec *spec_b = item_b->spec;
+
+    return g_strcmp0(item_a->disk, item_b->disk) == 0 &&
+           g_strcmp0(spec_a->path, spec_b->path) == 0 &&
+           g_strcmp0(spec_a->name, spec_b->name) == 0 &&
+           g_strcmp0(spec_a->type_guid, spec_b->type_guid) == 0 &&
+           spec_a->type == spec_b->type && spec_a->start == spec_b->start &&
+           spec_a->size == spec_b->size && spec_a->flags == spec_b->flags;
+}
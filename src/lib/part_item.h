@@ -0,0 +1,90 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_PART_ITEM_H
+#define INSTALLER_PART_ITEM_H
+
+#include "part_class.h"
+
+#include <blockdev/part.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_PART_ITEM (installer_part_item_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerPartItem, installer_part_item, INSTALLER, PART_ITEM, GObject)
+
+/**
+ * installer_part_item_new:
+ * @disk: The path of the disk the partition is on
+ * @spec: The partition; it is copied
+ *
+ * Creates a lightweight, immutable partition object for use in a
+ * #GListModel. Unlike #InstallerPartition, nothing is mounted or read
+ * to make one.
+ *
+ * Returns: (transfer full): The new #InstallerPartItem
+ */
+InstallerPartItem *installer_part_item_new(const gchar *disk, const BDPartSpec *spec);
+
+/**
+ * installer_part_item_get_disk:
+ * @self: The partition item
+ *
+ * Returns: (transfer none): The path of the disk the partition is on
+ */
+const gchar *installer_part_item_get_disk(InstallerPartItem *self);
+
+/**
+ * installer_part_item_get_path:
+ * @self: The partition item
+ *
+ * Returns: (transfer none): The path of the partition
+ */
+const gchar *installer_part_item_get_path(InstallerPartItem *self);
+
+/**
+ * installer_part_item_get_spec:
+ * @self: The partition item
+ *
+ * Returns: (transfer none): The partition as libblockdev reported it
+ */
+const BDPartSpec *installer_part_item_get_spec(InstallerPartItem *self);
+
+/**
+ * installer_part_item_get_class:
+ * @self: The partition item
+ *
+ * Returns: The class of the partition, going by its table entry
+ */
+InstallerPartClass installer_part_item_get_class(InstallerPartItem *self);
+
+/**
+ * installer_part_item_equal:
+ * @a: A partition item
+ * @b: Another partition item
+ *
+ * Checks if two items describe the same partition with the same layout,
+ * so a UI row showing @a does not need to change to show @b.
+ *
+ * Returns: %TRUE if the items are interchangeable
+ */
+gboolean installer_part_item_equal(gconstpointer a, gconstpointer b);
+
+G_END_DECLS
+
+#endif
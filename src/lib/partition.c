@@ -15,6 +15,7 @@
 //
 
 #include "partition.h"
+#include "fs_tech.h"
 
 enum { PROP_EXP_0,
        PROP_DISK,
@@ -149,12 +150,11 @@ InstallerPartition *installer_partition_new(const gchar *disk,
         return NULL;
     }
 
-    self->resizeable = bd_fs_can_resize(type, NULL, NULL, err);
-    if (*err) {
-        bd_part_spec_free(part_spec);
-        g_object_unref(self);
-        return NULL;
-    }
+    // Only the resize tools for this filesystem are checked, and only once
+    BDFSTech tech;
+    self->resizeable =
+        installer_fs_tech_from_type(type, &tech) &&
+        installer_fs_tech_available(tech, BD_FS_TECH_MODE_RESIZE, NULL);
 
     // TODO: In the Python version, we just called out to the
     // resize tools directly to get the min_size of the resized
@@ -185,19 +185,19 @@ InstallerPartition *installer_partition_new(const gchar *disk,
 const gchar *installer_partition_get_disk(InstallerPartition *self) {
     g_return_val_if_fail(INSTALLER_IS_PARTITION(self), NULL);
 
-    return g_strdup(self->disk);
+    return self->disk;
 }
 
 const gchar *installer_partition_get_partition(InstallerPartition *self) {
     g_return_val_if_fail(INSTALLER_IS_PARTITION(self), NULL);
 
-    return g_strdup(self->partition);
+    return self->partition;
 }
 
 const gchar *installer_partition_get_path(InstallerPartition *self) {
     g_return_val_if_fail(INSTALLER_IS_PARTITION(self), NULL);
 
-    return g_strdup(self->path);
+    return self->path;
 }
 
 gboolean installer_partition_is_resizable(InstallerPartition *self) {
@@ -44,21 +44,21 @@ InstallerPartition *installer_partition_new(const gchar *disk,
 /**
  * Get the disk this partition is on.
  *
- * The caller is responsible for freeing this string.
+ * The returned string is owned by the partition.
  */
 const gchar *installer_partition_get_disk(InstallerPartition *self);
 
 /**
  * Get the name of this partition.
  *
- * The caller is responsible for freeing this string.
+ * The returned string is owned by the partition.
  */
 const gchar *installer_partition_get_partition(InstallerPartition *self);
 
 /**
  * Get the path to this partition.
  *
- * The caller is responsible for freeing this string.
+ * The returned string is owned by the partition.
  */
 const gchar *installer_partition_get_path(InstallerPartition *self);
 
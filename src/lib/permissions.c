@@ -18,11 +18,16 @@
 
 #include "permissions.h"
 
+#include <errno.h>
+#include <grp.h>
+#include <unistd.h>
+
 struct _InstallerPermissions {
     GObject parent_instance;
 
     guint down_uid;
     guint down_gid;
+    gchar *user_name;
     const gchar *home_dir;
 };
 
@@ -35,50 +40,64 @@ static void installer_permissions_class_init(InstallerPermissionsClass *klass) {
     class->finalize = installer_permissions_finalize;
 }
 
-static void installer_permissions_init(InstallerPermissions *self) {
-    const gchar *pkexec_uid = g_getenv("PKEXEC_UID");
-    guint64 uid = 0;
-    if (pkexec_uid) {
+/**
+ * read_caller_uid:
+ * @uid: (out): The UID of the user
+ *
+ * Finds the user that started the installer through pkexec or sudo.
+ *
+ * Returns: %TRUE if a user other than root was found
+ */
+static gboolean read_caller_uid(guint64 *uid) {
+    const gchar *vars[] = {"PKEXEC_UID", "SUDO_UID"};
+
+    for (guint i = 0; i < G_N_ELEMENTS(vars); i++) {
+        const gchar *value = g_getenv(vars[i]);
         g_autoptr(GError) err = NULL;
-        // Convert string to guint64
-        g_ascii_string_to_unsigned(pkexec_uid, 10, 0, 60000, &uid, &err);
 
-        if (err) {
-            g_warning("Defaulting on fallback UID: %s", err->message);
+        if (!value) {
+            continue;
         }
 
-        self->down_uid = uid;
-        self->down_gid = uid;
-    } else {
-        const gchar *sudo_uid = g_getenv("SUDO_UID");
-        if (sudo_uid) {
-            g_autoptr(GError) err = NULL;
-            // Convert string to guint64
-            g_ascii_string_to_unsigned(sudo_uid, 10, 0, 60000, &uid, &err);
-
-            if (err) {
-                g_warning("Defaulting on fallback UID: %s", err->message);
-            }
-
-            self->down_uid = uid;
-            self->down_gid = uid;
+        if (!g_ascii_string_to_unsigned(value, 10, 1, 60000, uid, &err)) {
+            g_warning("Unable to use %s: %s", vars[i], err->message);
+            return FALSE;
         }
+
+        return TRUE;
     }
 
-    struct passwd *pw = getpwuid(self->down_uid);
+    g_warning("Neither PKEXEC_UID nor SUDO_UID is set");
+    return FALSE;
+}
+
+static void installer_permissions_init(InstallerPermissions *self) {
+    struct passwd *pw = NULL;
+    guint64 uid = 0;
+
+    // Without a user the IDs stay at root, which is never dropped to
+    if (read_caller_uid(&uid)) {
+        pw = getpwuid(uid);
+        if (!pw) {
+            g_warning("No user with UID %" G_GUINT64_FORMAT, uid);
+        }
+    }
 
     if (!pw) {
-        self->home_dir = "/home/live";
+        self->home_dir = g_strdup("/home/live");
         return;
     }
 
+    self->down_uid = pw->pw_uid;
+    self->down_gid = pw->pw_gid;
+    self->user_name = g_strdup(pw->pw_name);
     self->home_dir = g_strdup(pw->pw_dir);
-    return;
 }
 
 static void installer_permissions_finalize(GObject *obj) {
     InstallerPermissions *self = INSTALLER_PERMISSIONS(obj);
 
+    g_free(self->user_name);
     g_free((gchar *) self->home_dir);
 
     G_OBJECT_CLASS(installer_permissions_parent_class)->finalize(obj);
@@ -88,46 +107,37 @@ InstallerPermissions *installer_permissions_new() {
     return g_object_new(INSTALLER_TYPE_PERMISSIONS, NULL);
 }
 
-gboolean installer_permissions_drop(InstallerPermissions *self) {
+gboolean installer_permissions_drop_permanently(InstallerPermissions *self) {
     g_return_val_if_fail(INSTALLER_IS_PERMISSIONS(self), FALSE);
 
-    int result = setresgid(self->down_gid, self->down_gid, 0);
-    if (result != 0) {
-        g_warning("Failed to restore GID");
+    if (self->down_uid == 0) {
+        g_warning("Refusing to drop privileges: the user that started the installer is unknown");
         return FALSE;
     }
 
-    result = setresuid(self->down_uid, self->down_uid, 0);
-    if (result != 0) {
-        g_warning("Failed to restore GID");
+    // Only the user's own groups. Anything like the disk group would give
+    // raw access to every drive, which is as good as root.
+    if (initgroups(self->user_name, self->down_gid) != 0) {
+        g_warning("Failed to set supplementary groups: %s", g_strerror(errno));
         return FALSE;
     }
 
-    gboolean success = g_setenv("HOME", self->home_dir, TRUE);
-    if (!success) {
-        g_warning("Failed to reset HOME environment variable");
-    }
-    return success;
-}
-
-gboolean installer_permissions_elevate(InstallerPermissions *self) {
-    g_return_val_if_fail(INSTALLER_IS_PERMISSIONS(self), FALSE);
-
-    int result = setresgid(0, 0, 0);
+    // Groups first, since changing them needs root
+    int result = setresgid(self->down_gid, self->down_gid, self->down_gid);
     if (result != 0) {
-        g_warning("Failed to elevate GID");
+        g_warning("Failed to drop GID: %s", g_strerror(errno));
         return FALSE;
     }
 
-    result = setresuid(0, 0, 0);
+    result = setresuid(self->down_uid, self->down_uid, self->down_uid);
     if (result != 0) {
-        g_warning("Failed to elevate UID");
+        g_warning("Failed to drop UID: %s", g_strerror(errno));
         return FALSE;
     }
 
-    gboolean success = g_setenv("HOME", "/root", TRUE);
+    gboolean success = g_setenv("HOME", self->home_dir, TRUE);
     if (!success) {
-        g_warning("Failed to set HOME environment variable");
+        g_warning("Failed to reset HOME environment variable");
     }
     return success;
 }
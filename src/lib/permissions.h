@@ -34,14 +34,18 @@ G_DECLARE_FINAL_TYPE(InstallerPermissions, installer_permissions, INSTALLER,
 InstallerPermissions *installer_permissions_new();
 
 /**
- * Drop our current permissions.
+ * Drop root for good, becoming the user that started the installer.
+ *
+ * The user, group and saved IDs are all changed, the supplementary
+ * groups become the user's own, and HOME is set to the user's home
+ * directory. This cannot be undone; anything needing root afterwards,
+ * including reading partition tables, goes through the helper from
+ * `installer_helper_spawn()`, which must be spawned before this.
+ *
+ * Fails without changing anything if the user is unknown, i.e. neither
+ * PKEXEC_UID nor SUDO_UID names one.
  */
-gboolean installer_permissions_drop(InstallerPermissions *self);
-
-/**
- * Elevate our current permissions.
- */
-gboolean installer_permissions_elevate(InstallerPermissions *self);
+gboolean installer_permissions_drop_permanently(InstallerPermissions *self);
 
 G_END_DECLS
 
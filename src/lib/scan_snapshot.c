@@ -0,0 +1,91 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "scan_snapshot.h"
+
+DiskScanSnapshot *disk_scan_snapshot_new(guint64 generation,
+                                         InstallerTopology *topology) {
+    DiskScanSnapshot *self = g_atomic_rc_box_new0(DiskScanSnapshot);
+
+    self->generation = generation;
+    self->topology = topology ? g_object_ref(topology) : NULL;
+    self->drives = g_ptr_array_new_with_free_func(g_object_unref);
+    self->partitions = g_ptr_array_new_with_free_func((GDestroyNotify) bd_part_spec_free);
+    self->operating_systems = g_ptr_array_new();
+    self->esps = g_ptr_array_new_with_free_func((GDestroyNotify) bd_part_spec_free);
+
+    return self;
+}
+
+DiskScanSnapshot *disk_scan_snapshot_ref(DiskScanSnapshot *self) {
+    g_return_val_if_fail(self != NULL, NULL);
+
+    return g_atomic_rc_box_acquire(self);
+}
+
+static void disk_scan_snapshot_clear(DiskScanSnapshot *self) {
+    g_clear_object(&self->topology);
+    g_ptr_array_unref(self->drives);
+    g_ptr_array_unref(self->partitions);
+    g_ptr_array_unref(self->operating_systems);
+    g_ptr_array_unref(self->esps);
+}
+
+void disk_scan_snapshot_unref(DiskScanSnapshot *self) {
+    g_return_if_fail(self != NULL);
+
+    g_atomic_rc_box_release_full(self, (GDestroyNotify) disk_scan_snapshot_clear);
+}
+
+void disk_scan_snapshot_add_drive(DiskScanSnapshot *self,
+                                  InstallerDrive *drive) {
+    GHashTableIter iter;
+    gpointer os = NULL;
+
+    g_return_if_fail(self != NULL);
+    g_return_if_fail(INSTALLER_IS_DRIVE(drive));
+
+    g_ptr_array_add(self->drives, g_object_ref(drive));
+
+    for (guint i = 0; i < drive->partitions->len; i++) {
+        g_ptr_array_add(self->partitions,
+                        bd_part_spec_copy(g_ptr_array_index(drive->partitions, i)));
+    }
+
+    g_hash_table_iter_init(&iter, drive->operating_systems);
+    while (g_hash_table_iter_next(&iter, NULL, &os)) {
+        g_ptr_array_add(self->operating_systems, os);
+    }
+
+    for (guint i = 0; i < drive->esps->len; i++) {
+        g_ptr_array_add(self->esps, bd_part_spec_copy(g_ptr_array_index(drive->esps, i)));
+    }
+}
+
+InstallerDrive *disk_scan_snapshot_lookup_drive(DiskScanSnapshot *self,
+                                                const gchar *device) {
+    g_return_val_if_fail(self != NULL, NULL);
+    g_return_val_if_fail(device != NULL, NULL);
+
+    for (guint i = 0; i < self->drives->len; i++) {
+        InstallerDrive *drive = g_ptr_array_index(self->drives, i);
+        if (g_strcmp0(drive->device, device) == 0) {
+            return drive;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,115 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_SCAN_SNAPSHOT_H
+#define INSTALLER_SCAN_SNAPSHOT_H
+
+#include "arena.h"
+#include "drive.h"
+#include "topology.h"
+
+#include <blockdev/part.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * DiskScanSnapshot:
+ * @generation: Increases by one for every published snapshot
+ * @topology: (nullable): The block device topology at scan time
+ * @drives: (element-type InstallerDrive): Every parsed drive
+ * @partitions: (element-type BDPartSpec): Every partition on every drive
+ * @operating_systems: (element-type InstallerOS): Every detected OS, owned
+ *                     by the arena of the drive it was found on
+ * @esps: (element-type BDPartSpec): Every EFI system partition
+ * @arena_stats: How the arena of this scan was used; drives carried over
+ *               from an earlier scan are not counted
+ *
+ * The result of one disk scan. A snapshot is never modified once it has
+ * been published by a #DiskManager, so it can be read from any thread
+ * for as long as a reference is held.
+ */
+typedef struct _DiskScanSnapshot {
+    guint64 generation;
+    InstallerTopology *topology;
+
+    GPtrArray *drives;
+    GPtrArray *partitions;
+    GPtrArray *operating_systems;
+    GPtrArray *esps;
+
+    InstallerArenaStats arena_stats;
+} DiskScanSnapshot;
+
+/**
+ * disk_scan_snapshot_new:
+ * @generation: The generation of the new snapshot
+ * @topology: (nullable): The topology the scan was made against
+ *
+ * Creates a new, empty snapshot to be filled in by a scan.
+ *
+ * Returns: (transfer full): The new #DiskScanSnapshot
+ */
+DiskScanSnapshot *disk_scan_snapshot_new(guint64 generation,
+                                         InstallerTopology *topology);
+
+/**
+ * disk_scan_snapshot_ref:
+ * @self: The snapshot
+ *
+ * Atomically takes a reference on a snapshot.
+ *
+ * Returns: (transfer full): @self
+ */
+DiskScanSnapshot *disk_scan_snapshot_ref(DiskScanSnapshot *self);
+
+/**
+ * disk_scan_snapshot_unref:
+ * @self: The snapshot
+ *
+ * Atomically drops a reference on a snapshot, freeing it when the last
+ * one is gone.
+ */
+void disk_scan_snapshot_unref(DiskScanSnapshot *self);
+
+/**
+ * disk_scan_snapshot_add_drive:
+ * @self: A snapshot that has not been published yet
+ * @drive: The drive to add
+ *
+ * Adds a drive and its partitions, operating systems and ESPs to a
+ * snapshot. A reference is taken on @drive, and the partitions are
+ * copied.
+ */
+void disk_scan_snapshot_add_drive(DiskScanSnapshot *self,
+                                  InstallerDrive *drive);
+
+/**
+ * disk_scan_snapshot_lookup_drive:
+ * @self: The snapshot to search
+ * @device: The path of the drive's device
+ *
+ * Returns: (transfer none) (nullable): The drive for @device, or %NULL
+ */
+InstallerDrive *disk_scan_snapshot_lookup_drive(DiskScanSnapshot *self,
+                                                const gchar *device);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(DiskScanSnapshot, disk_scan_snapshot_unref)
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1316 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "squashfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define SQUASHFS_MAGIC 0x73717368
+#define SQUASHFS_SUPERBLOCK_SIZE 96
+#define SQUASHFS_METADATA_SIZE 8192
+#define SQUASHFS_METADATA_UNCOMPRESSED 0x8000
+#define SQUASHFS_BLOCK_UNCOMPRESSED (1 << 24)
+#define SQUASHFS_INVALID_FRAGMENT G_MAXUINT32
+#define SQUASHFS_INVALID_TABLE G_MAXUINT64
+#define SQUASHFS_MAX_BLOCK_SIZE (1024 * 1024)
+#define SQUASHFS_XATTR_OUT_OF_LINE 0x100
+
+/* Decompressed fragment blocks kept for the small files that share them */
+#define FRAGMENT_CACHE_SIZE 64
+
+typedef enum {
+    SQUASHFS_COMP_GZIP = 1,
+    SQUASHFS_COMP_LZMA,
+    SQUASHFS_COMP_LZO,
+    SQUASHFS_COMP_XZ,
+    SQUASHFS_COMP_LZ4,
+    SQUASHFS_COMP_ZSTD,
+} SquashfsCompressor;
+
+typedef enum {
+    SQUASHFS_DIR = 1,
+    SQUASHFS_FILE,
+    SQUASHFS_SYMLINK,
+    SQUASHFS_BLKDEV,
+    SQUASHFS_CHRDEV,
+    SQUASHFS_FIFO,
+    SQUASHFS_SOCKET,
+    SQUASHFS_LDIR,
+    SQUASHFS_LFILE,
+    SQUASHFS_LSYMLINK,
+    SQUASHFS_LBLKDEV,
+    SQUASHFS_LCHRDEV,
+    SQUASHFS_LFIFO,
+    SQUASHFS_LSOCKET,
+} SquashfsInodeType;
+
+/**
+ * MetaTable:
+ * @data: Every metadata block of the table, decompressed back to back
+ * @len: The length of @data
+ * @blocks: Maps the on-disk offset of each block, from the start of the
+ *     table, to the offset of its data in @data
+ *
+ * A table made of metadata blocks, which references point into by
+ * block and offset.
+ */
+typedef struct _MetaTable {
+    guint8 *data;
+    gsize len;
+    GHashTable *blocks;
+} MetaTable;
+
+struct _InstallerSquashfs {
+    GObject parent_instance;
+
+    gchar *path;
+    gint fd;
+
+    SquashfsCompressor compressor;
+    guint32 block_size;
+    guint32 n_fragments;
+    guint64 root;
+
+    MetaTable inodes;
+    MetaTable dirs;
+    MetaTable xattrs;
+
+    guint8 *ids;
+    gsize n_ids;
+    guint8 *fragments;
+    guint8 *xattr_ids;
+    gsize n_xattr_ids;
+
+    GMutex fragment_lock;
+    GHashTable *fragment_cache;
+    GQueue fragment_order;
+};
+
+G_DEFINE_TYPE(InstallerSquashfs, installer_squashfs, G_TYPE_OBJECT);
+
+static void installer_squashfs_finalize(GObject *obj);
+
+static void installer_squashfs_class_init(InstallerSquashfsClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_squashfs_finalize;
+}
+
+static void meta_table_init(MetaTable *table) {
+    table->blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+static void meta_table_clear(MetaTable *table) {
+    g_free(table->data);
+    g_hash_table_destroy(table->blocks);
+}
+
+static void installer_squashfs_init(InstallerSquashfs *self) {
+    self->fd = -1;
+    meta_table_init(&self->inodes);
+    meta_table_init(&self->dirs);
+    meta_table_init(&self->xattrs);
+    g_mutex_init(&self->fragment_lock);
+    self->fragment_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                 (GDestroyNotify) g_bytes_unref);
+    g_queue_init(&self->fragment_order);
+}
+
+static void installer_squashfs_finalize(GObject *obj) {
+    InstallerSquashfs *self = INSTALLER_SQUASHFS(obj);
+
+    if (self->fd >= 0) {
+        close(self->fd);
+    }
+
+    g_free(self->path);
+    meta_table_clear(&self->inodes);
+    meta_table_clear(&self->dirs);
+    meta_table_clear(&self->xattrs);
+    g_free(self->ids);
+    g_free(self->fragments);
+    g_free(self->xattr_ids);
+    g_mutex_clear(&self->fragment_lock);
+    g_hash_table_destroy(self->fragment_cache);
+    g_queue_clear(&self->fragment_order);
+
+    G_OBJECT_CLASS(installer_squashfs_parent_class)->finalize(obj);
+}
+
+void installer_squashfs_dirent_free(InstallerSquashfsDirent *self) {
+    if (!self) {
+        return;
+    }
+
+    g_free(self->name);
+    g_free(self);
+}
+
+void installer_squashfs_xattr_free(InstallerSquashfsXattr *self) {
+    if (!self) {
+        return;
+    }
+
+    g_free(self->name);
+    g_bytes_unref(self->value);
+    g_free(self);
+}
+
+/* Little-endian fields */
+
+static guint16 get_u16(const guint8 *p) {
+    guint16 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT16_FROM_LE(v);
+}
+
+static guint32 get_u32(const guint8 *p) {
+    guint32 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+static guint64 get_u64(const guint8 *p) {
+    guint64 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT64_FROM_LE(v);
+}
+
+static gboolean set_corrupt_error(InstallerSquashfs *self, GError **err, const gchar *what) {
+    g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "Squashfs image '%s' is corrupt: bad %s", self->path, what);
+    return FALSE;
+}
+
+/* Reading and decompressing */
+
+static gboolean pread_full(InstallerSquashfs *self, guint8 *buffer, gsize len,
+                           guint64 offset, GError **err) {
+    gsize done = 0;
+
+    while (done < len) {
+        gssize n = pread(self->fd, buffer + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            gint saved = errno;
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                        "Error reading '%s': %s", self->path, g_strerror(saved));
+            return FALSE;
+        }
+
+        if (n == 0) {
+            return set_corrupt_error(self, err, "length");
+        }
+
+        done += n;
+    }
+
+    return TRUE;
+}
+
+static gboolean compressor_supported(SquashfsCompressor compressor) {
+    switch (compressor) {
+#ifdef HAVE_ZLIB
+        case SQUASHFS_COMP_GZIP:
+            return TRUE;
+#endif
+#ifdef HAVE_LZMA
+        case SQUASHFS_COMP_XZ:
+            return TRUE;
+#endif
+#ifdef HAVE_LZ4
+        case SQUASHFS_COMP_LZ4:
+            return TRUE;
+#endif
+#ifdef HAVE_ZSTD
+        case SQUASHFS_COMP_ZSTD:
+            return TRUE;
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+#ifdef HAVE_ZSTD
+static void free_dctx(gpointer dctx) {
+    ZSTD_freeDCtx(dctx);
+}
+
+/* Decompression contexts are reused per thread, saving an allocation per block */
+static GPrivate zstd_dctx = G_PRIVATE_INIT(free_dctx);
+#endif
+
+/**
+ * decompress:
+ *
+ * Every block is compressed on its own, so any thread can decompress
+ * any block without state from the ones before it.
+ */
+static gboolean decompress(InstallerSquashfs *self, __attribute((unused)) const guint8 *in,
+                           __attribute((unused)) gsize in_len,
+                           __attribute((unused)) guint8 *out,
+                           __attribute((unused)) gsize out_size,
+                           __attribute((unused)) gsize *out_len, GError **err) {
+    gboolean ok = FALSE;
+
+    switch (self->compressor) {
+#ifdef HAVE_ZLIB
+        case SQUASHFS_COMP_GZIP: {
+            uLongf len = out_size;
+            ok = uncompress(out, &len, in, in_len) == Z_OK;
+            *out_len = len;
+            break;
+        }
+#endif
+#ifdef HAVE_LZMA
+        case SQUASHFS_COMP_XZ: {
+            uint64_t memlimit = UINT64_MAX;
+            size_t in_pos = 0;
+            size_t out_pos = 0;
+            ok = lzma_stream_buffer_decode(&memlimit, 0, NULL, in, &in_pos, in_len, out,
+                                           &out_pos, out_size) == LZMA_OK;
+            *out_len = out_pos;
+            break;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case SQUASHFS_COMP_LZ4: {
+            gint len = LZ4_decompress_safe((const gchar *) in, (gchar *) out, in_len,
+                                           out_size);
+            ok = len >= 0;
+            *out_len = MAX(len, 0);
+            break;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case SQUASHFS_COMP_ZSTD: {
+            ZSTD_DCtx *dctx = g_private_get(&zstd_dctx);
+            gsize len = 0;
+
+            if (!dctx) {
+                dctx = ZSTD_createDCtx();
+                g_private_set(&zstd_dctx, dctx);
+            }
+
+            len = ZSTD_decompressDCtx(dctx, out, out_size, in, in_len);
+            ok = !ZSTD_isError(len);
+            *out_len = ok ? len : 0;
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+
+    if (!ok) {
+        return set_corrupt_error(self, err, "compressed block");
+    }
+
+    return TRUE;
+}
+
+/**
+ * read_block:
+ * @size_field: The on-disk size of the block, with its uncompressed flag
+ * @scratch: A buffer of the block size, for the compressed data
+ * @out: A buffer of the block size
+ *
+ * Reads a data or fragment block into @out.
+ */
+static gboolean read_block(InstallerSquashfs *self, guint64 offset, guint32 size_field,
+                           guint8 *scratch, guint8 *out, gsize *out_len, GError **err) {
+    gsize size = size_field & ~SQUASHFS_BLOCK_UNCOMPRESSED;
+
+    if (size > self->block_size) {
+        return set_corrupt_error(self, err, "block size");
+    }
+
+    if (size_field & SQUASHFS_BLOCK_UNCOMPRESSED) {
+        *out_len = size;
+        return pread_full(self, out, size, offset, err);
+    }
+
+    return pread_full(self, scratch, size, offset, err) &&
+           decompress(self, scratch, size, out, self->block_size, out_len, err);
+}
+
+/**
+ * read_metadata_block:
+ * @offset: The offset of the block's header in the image
+ * @out: (out caller-allocates): A buffer of %SQUASHFS_METADATA_SIZE
+ * @next: (out): The offset of the next block
+ *
+ * Reads one metadata block, which has a 16-bit header with its size
+ * rather than a size stored elsewhere.
+ */
+static gboolean read_metadata_block(InstallerSquashfs *self, guint64 offset, guint8 *out,
+                                    gsize *out_len, guint64 *next, GError **err) {
+    guint8 header[2];
+    guint8 scratch[SQUASHFS_METADATA_SIZE];
+    gsize size = 0;
+
+    if (!pread_full(self, header, sizeof(header), offset, err)) {
+        return FALSE;
+    }
+
+    size = get_u16(header) & ~SQUASHFS_METADATA_UNCOMPRESSED;
+    if (size == 0 || size > SQUASHFS_METADATA_SIZE) {
+        return set_corrupt_error(self, err, "metadata block");
+    }
+
+    *next = offset + sizeof(header) + size;
+
+    if (get_u16(header) & SQUASHFS_METADATA_UNCOMPRESSED) {
+        *out_len = size;
+        return pread_full(self, out, size, offset + sizeof(header), err);
+    }
+
+    return pread_full(self, scratch, size, offset + sizeof(header), err) &&
+           decompress(self, scratch, size, out, SQUASHFS_METADATA_SIZE, out_len, err);
+}
+
+/**
+ * read_meta_table:
+ * @start: The offset of the table's first block
+ * @end: The offset just past the table's last block
+ *
+ * Decompresses a whole table of metadata blocks, for the tables that
+ * are looked up by reference: inodes, directories and xattrs.
+ */
+static gboolean read_meta_table(InstallerSquashfs *self, MetaTable *table,
+                                guint64 start, guint64 end, GError **err) {
+    gsize capacity = MAX((end - start) * 2, SQUASHFS_METADATA_SIZE);
+    guint64 offset = start;
+
+    table->data = g_malloc(capacity);
+
+    while (offset < end) {
+        gsize len = 0;
+        guint64 next = 0;
+
+        if (table->len + SQUASHFS_METADATA_SIZE > capacity) {
+            capacity *= 2;
+            table->data = g_realloc(table->data, capacity);
+        }
+
+        g_hash_table_insert(table->blocks, GSIZE_TO_POINTER(offset - start),
+                            GSIZE_TO_POINTER(table->len));
+
+        if (!read_metadata_block(self, offset, table->data + table->len, &len, &next,
+                                 err)) {
+            return FALSE;
+        }
+
+        table->len += len;
+        offset = next;
+    }
+
+    return TRUE;
+}
+
+/**
+ * read_indexed_table:
+ * @index: The offset of an array of pointers to metadata blocks
+ * @size: The length of the table
+ *
+ * Reads a table of fixed-size entries, for the tables that are looked
+ * up by index: ids, fragments and xattr ids.
+ *
+ * Returns: (transfer full): The table, or %NULL in case of error
+ */
+static guint8 *read_indexed_table(InstallerSquashfs *self, guint64 index, gsize size,
+                                  GError **err) {
+    gsize n_blocks = (size + SQUASHFS_METADATA_SIZE - 1) / SQUASHFS_METADATA_SIZE;
+    g_autofree guint8 *pointers = g_malloc(MAX(n_blocks, 1) * sizeof(guint64));
+    g_autofree guint8 *table = g_malloc(MAX(n_blocks, 1) * SQUASHFS_METADATA_SIZE);
+    gsize len = 0;
+
+    if (!pread_full(self, pointers, n_blocks * sizeof(guint64), index, err)) {
+        return NULL;
+    }
+
+    for (gsize i = 0; i < n_blocks; i++) {
+        gsize block_len = 0;
+        guint64 next = 0;
+
+        if (!read_metadata_block(self, get_u64(pointers + i * sizeof(guint64)),
+                                 table + len, &block_len, &next, err)) {
+            return NULL;
+        }
+
+        len += block_len;
+    }
+
+    if (len < size) {
+        set_corrupt_error(self, err, "table");
+        return NULL;
+    }
+
+    return g_steal_pointer(&table);
+}
+
+/**
+ * first_block:
+ *
+ * Gets where the first block of an indexed table is, which is also
+ * where the table before it ends.
+ */
+static gboolean first_block(InstallerSquashfs *self, guint64 index, guint64 *offset,
+                            GError **err) {
+    guint8 pointer[sizeof(guint64)];
+
+    if (!pread_full(self, pointer, sizeof(pointer), index, err)) {
+        return FALSE;
+    }
+
+    *offset = get_u64(pointer);
+    return TRUE;
+}
+
+/**
+ * meta_locate:
+ * @block: The on-disk offset of a metadata block, from the table start
+ * @offset: The offset into the decompressed block
+ * @len: The number of bytes that must be readable
+ * @pos: (out): The position in the table's data
+ */
+static gboolean meta_locate(InstallerSquashfs *self, MetaTable *table, guint64 block,
+                            gsize offset, gsize len, gsize *pos, GError **err) {
+    gpointer start = NULL;
+
+    if (!g_hash_table_lookup_extended(table->blocks, GSIZE_TO_POINTER(block), NULL,
+                                      &start)) {
+        return set_corrupt_error(self, err, "reference");
+    }
+
+    *pos = GPOINTER_TO_SIZE(start) + offset;
+    if (*pos > table->len || len > table->len - *pos) {
+        return set_corrupt_error(self, err, "reference");
+    }
+
+    return TRUE;
+}
+
+static gboolean meta_check(InstallerSquashfs *self, MetaTable *table, gsize pos,
+                           gsize len, GError **err) {
+    if (pos > table->len || len > table->len - pos) {
+        return set_corrupt_error(self, err, "table entry");
+    }
+
+    return TRUE;
+}
+
+/* Opening */
+
+static gboolean read_tables(InstallerSquashfs *self, const guint8 *sb, GError **err) {
+    guint64 id_table = get_u64(sb + 48);
+    guint64 xattr_table = get_u64(sb + 56);
+    guint64 inode_table = get_u64(sb + 64);
+    guint64 dir_table = get_u64(sb + 72);
+    guint64 fragment_table = get_u64(sb + 80);
+    guint64 export_table = get_u64(sb + 88);
+    guint64 dir_end = 0;
+    guint64 xattr_start = 0;
+    guint64 next = 0;
+
+    // Every table after the directory table is found through an index,
+    // so the directory table ends where the first of them starts
+    if (!first_block(self, id_table, &dir_end, err)) {
+        return FALSE;
+    }
+
+    if (self->n_fragments > 0) {
+        if (!first_block(self, fragment_table, &next, err)) {
+            return FALSE;
+        }
+        dir_end = MIN(dir_end, next);
+    }
+
+    if (export_table != SQUASHFS_INVALID_TABLE) {
+        if (!first_block(self, export_table, &next, err)) {
+            return FALSE;
+        }
+        dir_end = MIN(dir_end, next);
+    }
+
+    if (xattr_table != SQUASHFS_INVALID_TABLE) {
+        guint8 header[16];
+
+        if (!pread_full(self, header, sizeof(header), xattr_table, err)) {
+            return FALSE;
+        }
+
+        xattr_start = get_u64(header);
+        self->n_xattr_ids = get_u32(header + 8);
+        dir_end = MIN(dir_end, xattr_start);
+    }
+
+    if (inode_table >= dir_table || dir_table > dir_end) {
+        return set_corrupt_error(self, err, "table offsets");
+    }
+
+    if (!read_meta_table(self, &self->inodes, inode_table, dir_table, err) ||
+        !read_meta_table(self, &self->dirs, dir_table, dir_end, err)) {
+        return FALSE;
+    }
+
+    self->ids = read_indexed_table(self, id_table, self->n_ids * sizeof(guint32), err);
+    if (!self->ids) {
+        return FALSE;
+    }
+
+    if (self->n_fragments > 0) {
+        self->fragments = read_indexed_table(self, fragment_table,
+                                             (gsize) self->n_fragments * 16, err);
+        if (!self->fragments) {
+            return FALSE;
+        }
+    }
+
+    if (xattr_table != SQUASHFS_INVALID_TABLE && self->n_xattr_ids > 0) {
+        guint64 xattr_end = 0;
+
+        self->xattr_ids = read_indexed_table(self, xattr_table + 16,
+                                             self->n_xattr_ids * 16, err);
+        if (!self->xattr_ids || !first_block(self, xattr_table + 16, &xattr_end, err) ||
+            !read_meta_table(self, &self->xattrs, xattr_start, xattr_end, err)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+InstallerSquashfs *installer_squashfs_open(const gchar *path, GError **err) {
+    g_autoptr(InstallerSquashfs) self = NULL;
+    guint8 sb[SQUASHFS_SUPERBLOCK_SIZE];
+
+    g_return_val_if_fail(path != NULL, NULL);
+
+    self = g_object_new(INSTALLER_TYPE_SQUASHFS, NULL);
+    self->path = g_strdup(path);
+
+    self->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (self->fd < 0) {
+        gint saved = errno;
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                    "Error opening '%s': %s", path, g_strerror(saved));
+        return NULL;
+    }
+
+    if (!pread_full(self, sb, sizeof(sb), 0, err)) {
+        return NULL;
+    }
+
+    if (get_u32(sb) != SQUASHFS_MAGIC || get_u16(sb + 28) != 4) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "'%s' is not a version 4 squashfs image", path);
+        return NULL;
+    }
+
+    self->block_size = get_u32(sb + 12);
+    self->n_fragments = get_u32(sb + 16);
+    self->compressor = get_u16(sb + 20);
+    self->n_ids = get_u16(sb + 26);
+    self->root = get_u64(sb + 32);
+
+    if (self->block_size < 4096 || self->block_size > SQUASHFS_MAX_BLOCK_SIZE ||
+        self->block_size != 1u << get_u16(sb + 22)) {
+        set_corrupt_error(self, err, "block size");
+        return NULL;
+    }
+
+    if (!compressor_supported(self->compressor)) {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Squashfs image '%s' uses compressor %u, which this build cannot read",
+                    path, self->compressor);
+        return NULL;
+    }
+
+    if (!read_tables(self, sb, err)) {
+        return NULL;
+    }
+
+    // The image is read front to back as the files in it are copied
+    posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    return g_steal_pointer(&self);
+}
+
+guint64 installer_squashfs_get_root(InstallerSquashfs *self) {
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), 0);
+
+    return self->root;
+}
+
+/* Inodes */
+
+static gboolean lookup_id(InstallerSquashfs *self, guint16 index, guint32 *id,
+                          GError **err) {
+    if (index >= self->n_ids) {
+        return set_corrupt_error(self, err, "id index");
+    }
+
+    *id = get_u32(self->ids + index * sizeof(guint32));
+    return TRUE;
+}
+
+/* The kernel's new_decode_dev() */
+static dev_t decode_dev(guint32 dev) {
+    return makedev((dev & 0xfff00) >> 8, (dev & 0xff) | ((dev >> 12) & 0xfff00));
+}
+
+static mode_t type_to_mode(SquashfsInodeType type) {
+    switch (type) {
+        case SQUASHFS_DIR:
+        case SQUASHFS_LDIR:
+            return S_IFDIR;
+        case SQUASHFS_FILE:
+        case SQUASHFS_LFILE:
+            return S_IFREG;
+        case SQUASHFS_SYMLINK:
+        case SQUASHFS_LSYMLINK:
+            return S_IFLNK;
+        case SQUASHFS_BLKDEV:
+        case SQUASHFS_LBLKDEV:
+            return S_IFBLK;
+        case SQUASHFS_CHRDEV:
+        case SQUASHFS_LCHRDEV:
+            return S_IFCHR;
+        case SQUASHFS_FIFO:
+        case SQUASHFS_LFIFO:
+            return S_IFIFO;
+        case SQUASHFS_SOCKET:
+        case SQUASHFS_LSOCKET:
+            return S_IFSOCK;
+        default:
+            return 0;
+    }
+}
+
+/* Lengths of each type's fields after the common header */
+static gsize type_body_size(SquashfsInodeType type) {
+    switch (type) {
+        case SQUASHFS_DIR:
+            return 16;
+        case SQUASHFS_LDIR:
+            return 24;
+        case SQUASHFS_FILE:
+            return 16;
+        case SQUASHFS_LFILE:
+            return 40;
+        case SQUASHFS_SYMLINK:
+        case SQUASHFS_LSYMLINK:
+            return 8;
+        case SQUASHFS_BLKDEV:
+        case SQUASHFS_CHRDEV:
+            return 8;
+        case SQUASHFS_LBLKDEV:
+        case SQUASHFS_LCHRDEV:
+            return 12;
+        case SQUASHFS_FIFO:
+        case SQUASHFS_SOCKET:
+            return 4;
+        case SQUASHFS_LFIFO:
+        case SQUASHFS_LSOCKET:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+gboolean installer_squashfs_read_inode(InstallerSquashfs *self, guint64 ref,
+                                       InstallerSquashfsInode *inode, GError **err) {
+    SquashfsInodeType type = 0;
+    const guint8 *p = NULL;
+    gsize pos = 0;
+    guint16 uid_index = 0;
+    guint16 gid_index = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), FALSE);
+    g_return_val_if_fail(inode != NULL, FALSE);
+
+    if (!meta_locate(self, &self->inodes, ref >> 16, ref & 0xffff, 16, &pos, err)) {
+        return FALSE;
+    }
+
+    p = self->inodes.data + pos;
+    type = get_u16(p);
+    if (type_to_mode(type) == 0) {
+        return set_corrupt_error(self, err, "inode type");
+    }
+
+    if (!meta_check(self, &self->inodes, pos + 16, type_body_size(type), err)) {
+        return FALSE;
+    }
+
+    memset(inode, 0, sizeof(*inode));
+    inode->ref = ref;
+    inode->mode = type_to_mode(type) | (get_u16(p + 2) & 07777);
+    uid_index = get_u16(p + 4);
+    gid_index = get_u16(p + 6);
+    inode->mtime = get_u32(p + 8);
+    inode->number = get_u32(p + 12);
+    inode->nlink = 1;
+    inode->xattr = INSTALLER_SQUASHFS_NO_XATTRS;
+    inode->fragment = SQUASHFS_INVALID_FRAGMENT;
+
+    if (!lookup_id(self, uid_index, &inode->uid, err) ||
+        !lookup_id(self, gid_index, &inode->gid, err)) {
+        return FALSE;
+    }
+
+    p += 16;
+    switch (type) {
+        case SQUASHFS_DIR:
+            inode->dir_block = get_u32(p);
+            inode->nlink = get_u32(p + 4);
+            inode->size = get_u16(p + 8);
+            inode->dir_offset = get_u16(p + 10);
+            break;
+        case SQUASHFS_LDIR:
+            inode->nlink = get_u32(p);
+            inode->size = get_u32(p + 4);
+            inode->dir_block = get_u32(p + 8);
+            inode->dir_offset = get_u16(p + 18);
+            inode->xattr = get_u32(p + 20);
+            break;
+        case SQUASHFS_FILE:
+            inode->blocks_start = get_u32(p);
+            inode->fragment = get_u32(p + 4);
+            inode->fragment_offset = get_u32(p + 8);
+            inode->size = get_u32(p + 12);
+            inode->block_list = pos + 32;
+            break;
+        case SQUASHFS_LFILE:
+            inode->blocks_start = get_u64(p);
+            inode->size = get_u64(p + 8);
+            inode->nlink = get_u32(p + 24);
+            inode->fragment = get_u32(p + 28);
+            inode->fragment_offset = get_u32(p + 32);
+            inode->xattr = get_u32(p + 36);
+            inode->block_list = pos + 56;
+            break;
+        case SQUASHFS_SYMLINK:
+        case SQUASHFS_LSYMLINK:
+            inode->nlink = get_u32(p);
+            inode->size = get_u32(p + 4);
+            inode->link_target = pos + 24;
+            if (!meta_check(self, &self->inodes, inode->link_target,
+                            inode->size + (type == SQUASHFS_LSYMLINK ? 4 : 0), err)) {
+                return FALSE;
+            }
+            if (type == SQUASHFS_LSYMLINK) {
+                inode->xattr = get_u32(self->inodes.data + inode->link_target + inode->size);
+            }
+            break;
+        case SQUASHFS_LBLKDEV:
+        case SQUASHFS_LCHRDEV:
+            inode->xattr = get_u32(p + 8);
+            G_GNUC_FALLTHROUGH;
+        case SQUASHFS_BLKDEV:
+        case SQUASHFS_CHRDEV:
+            inode->nlink = get_u32(p);
+            inode->rdev = decode_dev(get_u32(p + 4));
+            break;
+        case SQUASHFS_LFIFO:
+        case SQUASHFS_LSOCKET:
+            inode->xattr = get_u32(p + 4);
+            G_GNUC_FALLTHROUGH;
+        case SQUASHFS_FIFO:
+        case SQUASHFS_SOCKET:
+            inode->nlink = get_u32(p);
+            break;
+    }
+
+    return TRUE;
+}
+
+/* Directories */
+
+/**
+ * valid_name:
+ *
+ * Names are used as paths in the target, so nothing may climb out of
+ * its directory.
+ */
+static gboolean valid_name(const gchar *name) {
+    return *name && strchr(name, '/') == NULL && strcmp(name, ".") != 0 &&
+           strcmp(name, "..") != 0;
+}
+
+GPtrArray *installer_squashfs_read_dir(InstallerSquashfs *self,
+                                       const InstallerSquashfsInode *dir,
+                                       GError **err) {
+    g_autoptr(GPtrArray) entries = NULL;
+    gsize pos = 0;
+    gsize end = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), NULL);
+    g_return_val_if_fail(dir != NULL && S_ISDIR(dir->mode), NULL);
+
+    entries = g_ptr_array_new_with_free_func((GDestroyNotify) installer_squashfs_dirent_free);
+
+    // The size counts the "." and ".." entries that are not stored
+    if (dir->size <= 3) {
+        return g_steal_pointer(&entries);
+    }
+
+    if (!meta_locate(self, &self->dirs, dir->dir_block, dir->dir_offset, dir->size - 3,
+                     &pos, err)) {
+        return NULL;
+    }
+    end = pos + dir->size - 3;
+
+    while (pos < end) {
+        const guint8 *header = self->dirs.data + pos;
+        guint32 count = 0;
+        guint32 start = 0;
+
+        if (!meta_check(self, &self->dirs, pos, 12, err)) {
+            return NULL;
+        }
+
+        count = get_u32(header) + 1;
+        start = get_u32(header + 4);
+        pos += 12;
+
+        for (guint32 i = 0; i < count; i++) {
+            const guint8 *p = self->dirs.data + pos;
+            InstallerSquashfsDirent *entry = NULL;
+            gsize name_len = 0;
+
+            if (!meta_check(self, &self->dirs, pos, 8, err)) {
+                return NULL;
+            }
+
+            name_len = get_u16(p + 6) + 1;
+            if (!meta_check(self, &self->dirs, pos + 8, name_len, err)) {
+                return NULL;
+            }
+
+            entry = g_new0(InstallerSquashfsDirent, 1);
+            entry->name = g_strndup((const gchar *) p + 8, name_len);
+            entry->ref = ((guint64) start << 16) | get_u16(p);
+            g_ptr_array_add(entries, entry);
+
+            if (strlen(entry->name) != name_len || !valid_name(entry->name)) {
+                set_corrupt_error(self, err, "file name");
+                return NULL;
+            }
+
+            pos += 8 + name_len;
+        }
+    }
+
+    return g_steal_pointer(&entries);
+}
+
+gchar *installer_squashfs_read_link(InstallerSquashfs *self,
+                                    const InstallerSquashfsInode *link, GError **err) {
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), NULL);
+    g_return_val_if_fail(link != NULL && S_ISLNK(link->mode), NULL);
+
+    if (!meta_check(self, &self->inodes, link->link_target, link->size, err)) {
+        return NULL;
+    }
+
+    return g_strndup((const gchar *) self->inodes.data + link->link_target, link->size);
+}
+
+/* Extended attributes */
+
+static const gchar *xattr_prefix(guint16 type) {
+    switch (type & 0xff) {
+        case 0:
+            return "user.";
+        case 1:
+            return "trusted.";
+        case 2:
+            return "security.";
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * read_xattr_value:
+ *
+ * Reads a value, following it if it is stored out of line. Values
+ * shared by many inodes, like SELinux labels, are stored once and
+ * referenced.
+ */
+static GBytes *read_xattr_value(InstallerSquashfs *self, gsize *pos, gboolean out_of_line,
+                                GError **err) {
+    gsize value_pos = 0;
+    guint32 len = 0;
+
+    if (!meta_check(self, &self->xattrs, *pos, 4, err)) {
+        return NULL;
+    }
+
+    len = get_u32(self->xattrs.data + *pos);
+    value_pos = *pos + 4;
+
+    if (out_of_line) {
+        guint64 ref = 0;
+
+        if (len != sizeof(guint64) || !meta_check(self, &self->xattrs, value_pos, len, err)) {
+            set_corrupt_error(self, err, "xattr");
+            return NULL;
+        }
+
+        ref = get_u64(self->xattrs.data + value_pos);
+        *pos = value_pos + len;
+
+        if (!meta_locate(self, &self->xattrs, ref >> 16, ref & 0xffff, 4, &value_pos,
+                         err)) {
+            return NULL;
+        }
+
+        len = get_u32(self->xattrs.data + value_pos);
+        value_pos += 4;
+    } else {
+        *pos = value_pos + len;
+    }
+
+    if (!meta_check(self, &self->xattrs, value_pos, len, err)) {
+        return NULL;
+    }
+
+    return g_bytes_new(self->xattrs.data + value_pos, len);
+}
+
+GPtrArray *installer_squashfs_read_xattrs(InstallerSquashfs *self, guint32 xattr,
+                                          GError **err) {
+    g_autoptr(GPtrArray) xattrs = NULL;
+    const guint8 *id = NULL;
+    guint64 ref = 0;
+    guint32 count = 0;
+    gsize pos = 0;
+
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), NULL);
+
+    xattrs = g_ptr_array_new_with_free_func((GDestroyNotify) installer_squashfs_xattr_free);
+    if (xattr == INSTALLER_SQUASHFS_NO_XATTRS) {
+        return g_steal_pointer(&xattrs);
+    }
+
+    if (xattr >= self->n_xattr_ids) {
+        set_corrupt_error(self, err, "xattr index");
+        return NULL;
+    }
+
+    id = self->xattr_ids + (gsize) xattr * 16;
+    ref = get_u64(id);
+    count = get_u32(id + 8);
+
+    if (!meta_locate(self, &self->xattrs, ref >> 16, ref & 0xffff, 0, &pos, err)) {
+        return NULL;
+    }
+
+    for (guint32 i = 0; i < count; i++) {
+        InstallerSquashfsXattr *entry = NULL;
+        const gchar *prefix = NULL;
+        guint16 type = 0;
+        guint16 name_len = 0;
+
+        if (!meta_check(self, &self->xattrs, pos, 4, err)) {
+            return NULL;
+        }
+
+        type = get_u16(self->xattrs.data + pos);
+        name_len = get_u16(self->xattrs.data + pos + 2);
+        prefix = xattr_prefix(type);
+
+        if (!prefix || !meta_check(self, &self->xattrs, pos + 4, name_len, err)) {
+            set_corrupt_error(self, err, "xattr");
+            return NULL;
+        }
+
+        entry = g_new0(InstallerSquashfsXattr, 1);
+        entry->name = g_strdup_printf("%s%.*s", prefix, name_len,
+                                      self->xattrs.data + pos + 4);
+        g_ptr_array_add(xattrs, entry);
+        pos += 4 + name_len;
+
+        entry->value = read_xattr_value(self, &pos, type & SQUASHFS_XATTR_OUT_OF_LINE, err);
+        if (!entry->value) {
+            return NULL;
+        }
+    }
+
+    return g_steal_pointer(&xattrs);
+}
+
+/* File data */
+
+static void fragment_cache_add(InstallerSquashfs *self, guint32 index, GBytes *data) {
+    g_mutex_lock(&self->fragment_lock);
+
+    // Another thread may have read it at the same time
+    if (!g_hash_table_contains(self->fragment_cache, GUINT_TO_POINTER(index))) {
+        g_hash_table_insert(self->fragment_cache, GUINT_TO_POINTER(index),
+                            g_bytes_ref(data));
+        g_queue_push_tail(&self->fragment_order, GUINT_TO_POINTER(index));
+    }
+
+    if (g_queue_get_length(&self->fragment_order) > FRAGMENT_CACHE_SIZE) {
+        g_hash_table_remove(self->fragment_cache, g_queue_pop_head(&self->fragment_order));
+    }
+
+    g_mutex_unlock(&self->fragment_lock);
+}
+
+/**
+ * get_fragment:
+ *
+ * Fragment blocks hold the tails of many small files, usually from the
+ * same directory, which are copied one after another. Recent ones are
+ * kept so each is only decompressed once.
+ *
+ * Returns: (transfer full): The decompressed fragment block
+ */
+static GBytes *get_fragment(InstallerSquashfs *self, guint32 index, GError **err) {
+    g_autofree guint8 *scratch = NULL;
+    g_autofree guint8 *data = NULL;
+    GBytes *bytes = NULL;
+    const guint8 *entry = NULL;
+    gsize len = 0;
+
+    if (index >= self->n_fragments) {
+        set_corrupt_error(self, err, "fragment index");
+        return NULL;
+    }
+
+    g_mutex_lock(&self->fragment_lock);
+    bytes = g_hash_table_lookup(self->fragment_cache, GUINT_TO_POINTER(index));
+    if (bytes) {
+        g_bytes_ref(bytes);
+    }
+    g_mutex_unlock(&self->fragment_lock);
+
+    if (bytes) {
+        return bytes;
+    }
+
+    entry = self->fragments + (gsize) index * 16;
+    scratch = g_malloc(self->block_size);
+    data = g_malloc(self->block_size);
+
+    if (!read_block(self, get_u64(entry), get_u32(entry + 8), scratch, data, &len, err)) {
+        return NULL;
+    }
+
+    bytes = g_bytes_new_take(g_steal_pointer(&data), len);
+    fragment_cache_add(self, index, bytes);
+
+    return bytes;
+}
+
+static gboolean pwrite_full(gint fd, const guint8 *buffer, gsize len, guint64 offset,
+                            GError **err) {
+    gsize done = 0;
+
+    while (done < len) {
+        gssize n = pwrite(fd, buffer + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            gint saved = errno;
+            g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                        "Error writing file data: %s", g_strerror(saved));
+            return FALSE;
+        }
+
+        done += n;
+    }
+
+    return TRUE;
+}
+
+static gboolean write_fragment(InstallerSquashfs *self, const InstallerSquashfsInode *file,
+                               gint fd, guint64 offset, GError **err) {
+    g_autoptr(GBytes) fragment = get_fragment(self, file->fragment, err);
+    gsize tail = file->size - offset;
+    gsize len = 0;
+    const guint8 *data = NULL;
+
+    if (!fragment) {
+        return FALSE;
+    }
+
+    data = g_bytes_get_data(fragment, &len);
+    if (file->fragment_offset > len || tail > len - file->fragment_offset) {
+        return set_corrupt_error(self, err, "fragment offset");
+    }
+
+    return pwrite_full(fd, data + file->fragment_offset, tail, offset, err);
+}
+
+/**
+ * count_blocks:
+ *
+ * Files without a fragment keep their tail in a short last block.
+ */
+static guint64 count_blocks(InstallerSquashfs *self, const InstallerSquashfsInode *file) {
+    guint64 n_blocks = file->size / self->block_size;
+
+    if (file->fragment == SQUASHFS_INVALID_FRAGMENT && file->size % self->block_size) {
+        n_blocks++;
+    }
+
+    return n_blocks;
+}
+
+void installer_squashfs_get_extent(InstallerSquashfs *self,
+                                   const InstallerSquashfsInode *file, guint64 *offset,
+                                   guint64 *length) {
+    guint64 n_blocks = 0;
+
+    g_return_if_fail(INSTALLER_IS_SQUASHFS(self));
+    g_return_if_fail(file != NULL && S_ISREG(file->mode));
+
+    *offset = 0;
+    *length = 0;
+
+    n_blocks = count_blocks(self, file);
+    if (n_blocks == 0) {
+        if (file->fragment < self->n_fragments) {
+            const guint8 *entry = self->fragments + (gsize) file->fragment * 16;
+            *offset = get_u64(entry);
+            *length = get_u32(entry + 8) & ~SQUASHFS_BLOCK_UNCOMPRESSED;
+        }
+        return;
+    }
+
+    // Only a hint, so a corrupt block list is left for reading to report
+    *offset = file->blocks_start;
+    if (n_blocks > (self->inodes.len - MIN(file->block_list, self->inodes.len)) /
+                       sizeof(guint32)) {
+        return;
+    }
+
+    for (guint64 i = 0; i < n_blocks; i++) {
+        *length += get_u32(self->inodes.data + file->block_list + i * sizeof(guint32)) &
+                   ~SQUASHFS_BLOCK_UNCOMPRESSED;
+    }
+}
+
+void installer_squashfs_readahead(InstallerSquashfs *self, guint64 offset,
+                                  guint64 length) {
+    g_return_if_fail(INSTALLER_IS_SQUASHFS(self));
+
+    if (length > 0) {
+        posix_fadvise(self->fd, (off_t) offset, (off_t) length, POSIX_FADV_WILLNEED);
+    }
+}
+
+gboolean installer_squashfs_read_file(InstallerSquashfs *self,
+                                      const InstallerSquashfsInode *file, gint fd,
+                                      InstallerSquashfsWriteFunc func, gpointer user_data,
+                                      GError **err) {
+    g_autofree guint8 *scratch = NULL;
+    g_autofree guint8 *data = NULL;
+    guint64 n_blocks = 0;
+    guint64 offset = file->blocks_start;
+
+    g_return_val_if_fail(INSTALLER_IS_SQUASHFS(self), FALSE);
+    g_return_val_if_fail(file != NULL && S_ISREG(file->mode), FALSE);
+    g_return_val_if_fail(fd >= 0, FALSE);
+
+    n_blocks = count_blocks(self, file);
+
+    if (n_blocks > G_MAXSIZE / sizeof(guint32) ||
+        !meta_check(self, &self->inodes, file->block_list, n_blocks * sizeof(guint32),
+                    err)) {
+        return FALSE;
+    }
+
+    if (n_blocks > 0) {
+        scratch = g_malloc(self->block_size);
+        data = g_malloc(self->block_size);
+    }
+
+    for (guint64 i = 0; i < n_blocks; i++) {
+        guint32 size_field = get_u32(self->inodes.data + file->block_list +
+                                     i * sizeof(guint32));
+        guint64 file_offset = i * self->block_size;
+        gsize want = MIN(self->block_size, file->size - file_offset);
+        gsize len = 0;
+
+        // Blocks of zeroes are not stored at all, and stay holes
+        if ((size_field & ~SQUASHFS_BLOCK_UNCOMPRESSED) == 0) {
+            continue;
+        }
+
+        if (!read_block(self, offset, size_field, scratch, data, &len, err)) {
+            return FALSE;
+        }
+
+        if (len != want) {
+            return set_corrupt_error(self, err, "data block");
+        }
+
+        if (!pwrite_full(fd, data, len, file_offset, err)) {
+            return FALSE;
+        }
+
+        if (func) {
+            func(file_offset + len, user_data);
+        }
+
+        offset += size_field & ~SQUASHFS_BLOCK_UNCOMPRESSED;
+    }
+
+    if (file->fragment != SQUASHFS_INVALID_FRAGMENT &&
+        !write_fragment(self, file, fd, n_blocks * self->block_size, err)) {
+        return FALSE;
+    }
+
+    // Trailing holes are not written, so set the size explicitly
+    if (ftruncate(fd, file->size) != 0) {
+        gint saved = errno;
+        g_set_error(err, G_IO_ERROR, g_io_error_from_errno(saved),
+                    "Error writing file data: %s", g_strerror(saved));
+        return FALSE;
+    }
+
+    return TRUE;
+}
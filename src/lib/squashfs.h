@@ -0,0 +1,261 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_SQUASHFS_H
+#define INSTALLER_SQUASHFS_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+#define INSTALLER_TYPE_SQUASHFS (installer_squashfs_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerSquashfs, installer_squashfs, INSTALLER, SQUASHFS, GObject)
+
+/* The xattr index of an inode without extended attributes */
+#define INSTALLER_SQUASHFS_NO_XATTRS G_MAXUINT32
+
+/**
+ * InstallerSquashfsInode:
+ * @ref: The reference the inode was read from
+ * @number: The inode number, shared by every hardlink to it
+ * @mode: The type and permissions, as in struct stat
+ * @uid: The owner
+ * @gid: The group
+ * @mtime: The modification time, in seconds
+ * @nlink: The number of links
+ * @size: The size of a file or the length of a symlink's target
+ * @rdev: The device number of a device node
+ * @xattr: The index of the extended attributes, or
+ *     %INSTALLER_SQUASHFS_NO_XATTRS
+ *
+ * An inode, as read from the inode table. The remaining fields are
+ * for the reader's own use.
+ */
+typedef struct _InstallerSquashfsInode {
+    guint64 ref;
+    guint32 number;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    guint32 mtime;
+    guint32 nlink;
+    guint64 size;
+    dev_t rdev;
+    guint32 xattr;
+
+    /*< private >*/
+    guint64 blocks_start;
+    guint32 fragment;
+    guint32 fragment_offset;
+    gsize block_list;
+    guint32 dir_block;
+    guint32 dir_offset;
+    gsize link_target;
+} InstallerSquashfsInode;
+
+/**
+ * InstallerSquashfsDirent:
+ * @name: The name of the entry
+ * @ref: The reference of the entry's inode
+ *
+ * An entry of a directory.
+ */
+typedef struct _InstallerSquashfsDirent {
+    gchar *name;
+    guint64 ref;
+} InstallerSquashfsDirent;
+
+/**
+ * InstallerSquashfsXattr:
+ * @name: The full name of the attribute, e.g. "security.capability"
+ * @value: The value of the attribute
+ *
+ * An extended attribute of an inode.
+ */
+typedef struct _InstallerSquashfsXattr {
+    gchar *name;
+    GBytes *value;
+} InstallerSquashfsXattr;
+
+/**
+ * installer_squashfs_open:
+ * @path: The path to a squashfs image, e.g. the live filesystem
+ * @err: (out): Place to store an error (if any)
+ *
+ * Opens a squashfs image to read it without mounting it.
+ *
+ * The inode, directory, fragment, id and xattr tables are read and
+ * decompressed once, here, so looking up inodes and listing directories
+ * never touches the disk again. Only file data is read later, one block
+ * at a time, so every thread reading a file decompresses on its own
+ * core rather than queueing behind the kernel's squashfs driver.
+ *
+ * Images compressed with gzip, xz, lz4 and zstd are supported, as far
+ * as the installer was built with the matching library.
+ *
+ * Returns: (transfer full) (nullable): The image, or %NULL in case of
+ *          error (@err is set)
+ */
+InstallerSquashfs *installer_squashfs_open(const gchar *path, GError **err);
+
+/**
+ * installer_squashfs_get_root:
+ * @self: The image
+ *
+ * Returns: The reference of the root directory's inode
+ */
+guint64 installer_squashfs_get_root(InstallerSquashfs *self);
+
+/**
+ * installer_squashfs_read_inode:
+ * @self: The image
+ * @ref: The reference of the inode
+ * @inode: (out): Place to store the inode
+ * @err: (out): Place to store an error (if any)
+ *
+ * Reads an inode from the inode table. This may be called from any
+ * thread.
+ *
+ * Returns: %TRUE if the inode was read
+ */
+gboolean installer_squashfs_read_inode(InstallerSquashfs *self, guint64 ref,
+                                       InstallerSquashfsInode *inode, GError **err);
+
+/**
+ * installer_squashfs_read_dir:
+ * @self: The image
+ * @dir: A directory inode
+ * @err: (out): Place to store an error (if any)
+ *
+ * Lists a directory. The listing has no "." or ".." entries. This may be
+ * called from any thread.
+ *
+ * Returns: (transfer full) (element-type InstallerSquashfsDirent): The
+ *          entries of @dir, or %NULL in case of error (@err is set)
+ */
+GPtrArray *installer_squashfs_read_dir(InstallerSquashfs *self,
+                                       const InstallerSquashfsInode *dir,
+                                       GError **err);
+
+/**
+ * installer_squashfs_read_link:
+ * @self: The image
+ * @link: A symlink inode
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: (transfer full): The target of @link, or %NULL in case of
+ *          error (@err is set)
+ */
+gchar *installer_squashfs_read_link(InstallerSquashfs *self,
+                                    const InstallerSquashfsInode *link, GError **err);
+
+/**
+ * installer_squashfs_read_xattrs:
+ * @self: The image
+ * @xattr: The xattr index of an inode
+ * @err: (out): Place to store an error (if any)
+ *
+ * Returns: (transfer full) (element-type InstallerSquashfsXattr): The
+ *          extended attributes at @xattr, empty for
+ *          %INSTALLER_SQUASHFS_NO_XATTRS, or %NULL in case of error
+ *          (@err is set)
+ */
+GPtrArray *installer_squashfs_read_xattrs(InstallerSquashfs *self, guint32 xattr,
+                                          GError **err);
+
+/**
+ * InstallerSquashfsWriteFunc:
+ * @written: How far into the file data has been written
+ * @user_data: The data passed to installer_squashfs_read_file()
+ *
+ * Called as each block of a file is written, e.g. to start writeback
+ * of the file while the rest is still being decompressed.
+ */
+typedef void (*InstallerSquashfsWriteFunc)(guint64 written, gpointer user_data);
+
+/**
+ * installer_squashfs_read_file:
+ * @self: The image
+ * @file: A regular file inode
+ * @fd: A file descriptor to write the data to, from offset 0
+ * @func: (nullable) (scope call): Called after each block is written
+ * @user_data: Data to pass to @func
+ * @err: (out): Place to store an error (if any)
+ *
+ * Decompresses the data of a file into @fd. Sparse blocks are left as
+ * holes. This may be called from any thread, and is where the
+ * decompression work happens.
+ *
+ * Returns: %TRUE if all of the data was written
+ */
+gboolean installer_squashfs_read_file(InstallerSquashfs *self,
+                                      const InstallerSquashfsInode *file, gint fd,
+                                      InstallerSquashfsWriteFunc func, gpointer user_data,
+                                      GError **err);
+
+/**
+ * installer_squashfs_get_extent:
+ * @self: The image
+ * @file: A regular file inode
+ * @offset: (out): Place to store where the data starts in the image
+ * @length: (out): Place to store the length of the data in the image
+ *
+ * Gets where the compressed data of a file is stored. A file whose data
+ * is all in a fragment is placed at the fragment's block, which it may
+ * share with other small files. A file without data is at offset 0.
+ *
+ * Copying files in the order of their offsets reads the image nearly
+ * sequentially.
+ */
+void installer_squashfs_get_extent(InstallerSquashfs *self,
+                                   const InstallerSquashfsInode *file, guint64 *offset,
+                                   guint64 *length);
+
+/**
+ * installer_squashfs_readahead:
+ * @self: The image
+ * @offset: Where to start reading
+ * @length: How much to read
+ *
+ * Asks the kernel to start reading part of the image into the page
+ * cache, so it is there by the time it is decompressed.
+ */
+void installer_squashfs_readahead(InstallerSquashfs *self, guint64 offset,
+                                  guint64 length);
+
+/**
+ * installer_squashfs_dirent_free:
+ * @self: (nullable): The entry to free
+ *
+ * Frees a directory entry.
+ */
+void installer_squashfs_dirent_free(InstallerSquashfsDirent *self);
+
+/**
+ * installer_squashfs_xattr_free:
+ * @self: (nullable): The attribute to free
+ *
+ * Frees an extended attribute.
+ */
+void installer_squashfs_xattr_free(InstallerSquashfsXattr *self);
+
+G_END_DECLS
+
+#endif
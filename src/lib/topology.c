@@ -0,0 +1,720 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "topology.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYSFS_BLOCK_DIR "/sys/block"
+
+/* LVM2 on-disk format, see lib/format_text/layout.h in lvm2 */
+#define LVM_SECTOR_SIZE 512
+#define LVM_LABEL_SCAN_SECTORS 4
+#define LVM_LABEL_ID "LABELONE"
+#define LVM_LABEL_TYPE "LVM2 001"
+#define LVM_MDA_HEADER_SIZE 512
+#define LVM_MDA_MAGIC " LVM2 x[5A%r0N*>"
+#define LVM_METADATA_MAX_SIZE (1024 * 1024)
+
+/* md superblock format, see include/uapi/linux/raid/md_p.h */
+#define MD_SB_MAGIC 0xa92b4efc
+#define MD_V1_NAME_OFFSET 32
+#define MD_V1_NAME_SIZE 32
+
+/* LUKS1 and LUKS2 share the magic and UUID location */
+#define LUKS_MAGIC "LUKS\xba\xbe"
+#define LUKS_MAGIC_SIZE 6
+#define LUKS_UUID_OFFSET 168
+#define LUKS_UUID_SIZE 40
+
+struct _InstallerTopology {
+    GObject parent_instance;
+
+    GHashTable *nodes;
+    GHashTable *sysfs_dirs;
+    GHashTable *partitioned;
+};
+
+G_DEFINE_TYPE(InstallerTopology, installer_topology, G_TYPE_OBJECT);
+
+static void installer_topology_finalize(GObject *obj);
+
+static void installer_topology_class_init(InstallerTopologyClass *klass) {
+    GObjectClass *class = G_OBJECT_CLASS(klass);
+    class->finalize = installer_topology_finalize;
+}
+
+static void topology_node_free(InstallerTopologyNode *node) {
+    if (!node) {
+        return;
+    }
+
+    g_free(node->name);
+    g_free(node->path);
+    g_ptr_array_unref(node->holders);
+    g_ptr_array_unref(node->slaves);
+    g_free(node->member_of);
+    g_ptr_array_unref(node->member_children);
+    g_free(node);
+}
+
+static void installer_topology_init(InstallerTopology *self) {
+    self->nodes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                        (GDestroyNotify) topology_node_free);
+    self->sysfs_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    self->partitioned = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void installer_topology_finalize(GObject *obj) {
+    InstallerTopology *self = INSTALLER_TOPOLOGY(obj);
+
+    // Keys of the other tables are owned by the nodes
+    g_hash_table_destroy(self->partitioned);
+    g_hash_table_destroy(self->sysfs_dirs);
+    g_hash_table_destroy(self->nodes);
+
+    G_OBJECT_CLASS(installer_topology_parent_class)->finalize(obj);
+}
+
+/**
+ * read_sysfs_attr:
+ * @dir: The sysfs directory of a device
+ * @attr: The attribute path relative to @dir
+ *
+ * Returns: (transfer full) (nullable): The stripped contents of the
+ *          attribute, or %NULL if it could not be read
+ */
+static gchar *read_sysfs_attr(const gchar *dir, const gchar *attr) {
+    g_autofree gchar *fpath = g_build_filename(dir, attr, NULL);
+    gchar *contents = NULL;
+
+    if (!g_file_get_contents(fpath, &contents, NULL, NULL)) {
+        return NULL;
+    }
+
+    return g_strstrip(contents);
+}
+
+static InstallerTopologyNode *add_node(InstallerTopology *self,
+                                       const gchar *name, const gchar *dir,
+                                       InstallerTopologyKind kind) {
+    InstallerTopologyNode *node = g_new0(InstallerTopologyNode, 1);
+
+    node->name = g_strdup(name);
+    node->kind = kind;
+    node->holders = g_ptr_array_new();
+    node->slaves = g_ptr_array_new();
+    node->member_children = g_ptr_array_new_with_free_func(g_free);
+
+    if (g_str_has_prefix(name, "dm-")) {
+        g_autofree gchar *uuid = read_sysfs_attr(dir, "dm/uuid");
+        g_autofree gchar *dm_name = read_sysfs_attr(dir, "dm/name");
+
+        if (g_str_has_prefix(uuid, "LVM-")) {
+            node->kind = INSTALLER_TOPOLOGY_KIND_LVM;
+        } else if (g_str_has_prefix(uuid, "CRYPT-")) {
+            node->kind = INSTALLER_TOPOLOGY_KIND_CRYPT;
+        }
+
+        if (dm_name && *dm_name != '\0') {
+            node->path = g_build_filename("/dev/mapper", dm_name, NULL);
+        }
+    }
+
+    if (!node->path) {
+        node->path = g_build_filename("/dev", name, NULL);
+    }
+
+    g_hash_table_insert(self->nodes, node->name, node);
+    g_hash_table_insert(self->sysfs_dirs, node->name, g_strdup(dir));
+
+    return node;
+}
+
+static void link_nodes(InstallerTopologyNode *lower,
+                       InstallerTopologyNode *upper) {
+    if (!g_ptr_array_find(lower->holders, upper, NULL)) {
+        g_ptr_array_add(lower->holders, upper);
+    }
+
+    if (!g_ptr_array_find(upper->slaves, lower, NULL)) {
+        g_ptr_array_add(upper->slaves, lower);
+    }
+}
+
+/**
+ * link_dir_entries:
+ * @self: The topology being built
+ * @node: The node whose links are being read
+ * @subdir: Either `holders` or `slaves`
+ *
+ * Reads one of the link directories of a device and records the edges
+ * in both directions, so a missing half on either side is tolerated.
+ */
+static void link_dir_entries(InstallerTopology *self,
+                             InstallerTopologyNode *node,
+                             const gchar *subdir) {
+    const gchar *dir = g_hash_table_lookup(self->sysfs_dirs, node->name);
+    g_autofree gchar *fpath = g_build_filename(dir, subdir, NULL);
+    g_autoptr(GDir) links = g_dir_open(fpath, 0, NULL);
+    const gchar *child = NULL;
+
+    if (!links) {
+        return;
+    }
+
+    while ((child = g_dir_read_name(links)) != NULL) {
+        InstallerTopologyNode *other = g_hash_table_lookup(self->nodes, child);
+        if (!other) {
+            continue;
+        }
+
+        if (g_strcmp0(subdir, "holders") == 0) {
+            link_nodes(node, other);
+        } else {
+            link_nodes(other, node);
+        }
+    }
+}
+
+static gboolean read_at(gint fd, guint64 offset, gpointer buf, gsize len) {
+    return pread(fd, buf, len, (off_t) offset) == (gssize) len;
+}
+
+static guint32 get_le32(const guint8 *p) {
+    guint32 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+static guint64 get_le64(const guint8 *p) {
+    guint64 v;
+    memcpy(&v, p, sizeof(v));
+    return GUINT64_FROM_LE(v);
+}
+
+static gboolean is_lvm_name_char(gchar c) {
+    return g_ascii_isalnum(c) || c == '+' || c == '_' || c == '.' || c == '-';
+}
+
+/**
+ * parse_lvm_metadata:
+ * @node: The node to store the results in
+ * @text: The LVM2 metadata text
+ * @len: The length of @text
+ *
+ * Pulls the volume group name and the logical volume names out of the
+ * metadata text area. The text is a nested `name { ... }` format, so
+ * only braces and the token before them need to be tracked.
+ */
+static void parse_lvm_metadata(InstallerTopologyNode *node, const gchar *text,
+                               gsize len) {
+    g_autoptr(GString) token = g_string_new(NULL);
+    gboolean in_token = FALSE;
+    gboolean in_lvs = FALSE;
+    guint depth = 0;
+
+    for (gsize i = 0; i < len && text[i] != '\0'; i++) {
+        gchar c = text[i];
+
+        if (c == '#') {
+            while (i < len && text[i] != '\n') i++;
+            continue;
+        }
+
+        if (c == '"') {
+            // Skip strings entirely, they may contain braces
+            for (i++; i < len && text[i] != '"'; i++) {
+                if (text[i] == '\\') i++;
+            }
+            g_string_truncate(token, 0);
+            in_token = FALSE;
+            continue;
+        }
+
+        if (is_lvm_name_char(c)) {
+            if (!in_token) {
+                g_string_truncate(token, 0);
+                in_token = TRUE;
+            }
+            g_string_append_c(token, c);
+            continue;
+        }
+
+        in_token = FALSE;
+
+        if (c == '{') {
+            if (depth == 0 && !node->member_of && token->len > 0) {
+                node->member_of = g_strdup(token->str);
+            } else if (depth == 1 && g_strcmp0(token->str, "logical_volumes") == 0) {
+                in_lvs = TRUE;
+            } else if (depth == 2 && in_lvs && token->len > 0) {
+                g_ptr_array_add(node->member_children, g_strdup(token->str));
+            }
+
+            depth++;
+            g_string_truncate(token, 0);
+        } else if (c == '}') {
+            if (depth > 0) {
+                depth--;
+            }
+
+            if (depth < 2) {
+                in_lvs = FALSE;
+            }
+
+            g_string_truncate(token, 0);
+        } else if (!g_ascii_isspace(c)) {
+            g_string_truncate(token, 0);
+        }
+    }
+}
+
+/**
+ * read_lvm_label:
+ * @node: The node being probed
+ * @fd: An open fd for the device
+ *
+ * Looks for an LVM2 label in the first sectors of the device and, if
+ * one is found, reads the most recent metadata text from the first
+ * metadata area. This does not need the volume group to be active.
+ *
+ * Returns: %TRUE if the device is an LVM2 physical volume
+ */
+static gboolean read_lvm_label(InstallerTopologyNode *node, gint fd) {
+    guint8 sectors[LVM_SECTOR_SIZE * LVM_LABEL_SCAN_SECTORS];
+    guint8 mda_header[LVM_MDA_HEADER_SIZE];
+    const guint8 *label = NULL;
+    const guint8 *areas = NULL;
+    guint64 mda_offset = 0;
+    guint64 mda_size = 0;
+
+    if (!read_at(fd, 0, sectors, sizeof(sectors))) {
+        return FALSE;
+    }
+
+    for (gint i = 0; i < LVM_LABEL_SCAN_SECTORS; i++) {
+        const guint8 *sector = sectors + i * LVM_SECTOR_SIZE;
+        if (memcmp(sector, LVM_LABEL_ID, 8) == 0 &&
+            memcmp(sector + 24, LVM_LABEL_TYPE, 8) == 0) {
+            label = sector;
+            break;
+        }
+    }
+
+    if (!label) {
+        return FALSE;
+    }
+
+    node->member = INSTALLER_TOPOLOGY_MEMBER_LVM_PV;
+
+    // The pv_header follows the label; skip the PV UUID and size, then
+    // the zero-terminated list of data areas to reach the metadata areas.
+    guint32 header_offset = get_le32(label + 20);
+    gsize pos = (gsize) (label - sectors) + header_offset + 32 + 8;
+
+    while (pos + 16 <= sizeof(sectors) && get_le64(sectors + pos) != 0) {
+        pos += 16;
+    }
+    pos += 16;
+
+    if (pos + 16 > sizeof(sectors)) {
+        return TRUE;
+    }
+
+    areas = sectors + pos;
+    mda_offset = get_le64(areas);
+    mda_size = get_le64(areas + 8);
+    if (mda_offset == 0 || mda_size <= LVM_MDA_HEADER_SIZE) {
+        // PVs created with --metadatacopies 0 carry no metadata
+        return TRUE;
+    }
+
+    if (!read_at(fd, mda_offset, mda_header, sizeof(mda_header)) ||
+        memcmp(mda_header + 4, LVM_MDA_MAGIC, 16) != 0) {
+        return TRUE;
+    }
+
+    // The first raw location points at the committed metadata, relative
+    // to the start of the area. The area is a ring buffer, so the text
+    // may wrap around to just after the header.
+    guint64 text_offset = get_le64(mda_header + 40);
+    guint64 text_size = get_le64(mda_header + 48);
+    if (text_offset == 0 || text_size == 0 || text_size > LVM_METADATA_MAX_SIZE ||
+        text_offset >= mda_size) {
+        return TRUE;
+    }
+
+    g_autofree gchar *text = g_malloc0(text_size + 1);
+    guint64 first = MIN(text_size, mda_size - text_offset);
+
+    if (!read_at(fd, mda_offset + text_offset, text, first)) {
+        return TRUE;
+    }
+
+    if (first < text_size &&
+        !read_at(fd, mda_offset + LVM_MDA_HEADER_SIZE, text + first, text_size - first)) {
+        return TRUE;
+    }
+
+    parse_lvm_metadata(node, text, text_size);
+
+    return TRUE;
+}
+
+/**
+ * read_md_superblock:
+ * @node: The node being probed
+ * @fd: An open fd for the device
+ * @size: The size of the device in bytes
+ *
+ * Checks every location an md superblock can live at: the start of
+ * the device (1.1), 4 KiB in (1.2), and near the end (1.0 and 0.90).
+ *
+ * Returns: %TRUE if the device is a software RAID member
+ */
+static gboolean read_md_superblock(InstallerTopologyNode *node, gint fd,
+                                   guint64 size) {
+    guint64 sectors = size / 512;
+    guint8 sb[MD_V1_NAME_OFFSET + MD_V1_NAME_SIZE];
+    guint64 v1_offsets[3] = {0, 4096, 0};
+    gint n_offsets = 2;
+
+    if (sectors > 16) {
+        v1_offsets[n_offsets++] = ((sectors - 16) & ~G_GUINT64_CONSTANT(7)) * 512;
+    }
+
+    for (gint i = 0; i < n_offsets; i++) {
+        if (!read_at(fd, v1_offsets[i], sb, sizeof(sb)) ||
+            get_le32(sb) != MD_SB_MAGIC || get_le32(sb + 4) != 1) {
+            continue;
+        }
+
+        node->member = INSTALLER_TOPOLOGY_MEMBER_MD;
+        node->member_of = g_strndup((const gchar *) sb + MD_V1_NAME_OFFSET,
+                                    MD_V1_NAME_SIZE);
+        return TRUE;
+    }
+
+    if (sectors > 128) {
+        guint64 offset = ((sectors & ~G_GUINT64_CONSTANT(127)) - 128) * 512;
+        if (read_at(fd, offset, sb, sizeof(guint32)) && get_le32(sb) == MD_SB_MAGIC) {
+            node->member = INSTALLER_TOPOLOGY_MEMBER_MD;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean read_luks_header(InstallerTopologyNode *node, gint fd) {
+    guint8 header[LUKS_UUID_OFFSET + LUKS_UUID_SIZE];
+
+    if (!read_at(fd, 0, header, sizeof(header)) ||
+        memcmp(header, LUKS_MAGIC, LUKS_MAGIC_SIZE) != 0) {
+        return FALSE;
+    }
+
+    node->member = INSTALLER_TOPOLOGY_MEMBER_LUKS;
+    node->member_of = g_strndup((const gchar *) header + LUKS_UUID_OFFSET,
+                                LUKS_UUID_SIZE);
+    return TRUE;
+}
+
+void installer_topology_read_signatures(InstallerTopologyNode *node, guint64 size,
+                                        __attribute((unused)) gpointer user_data) {
+    gint fd;
+
+    if (size == 0) {
+        return;
+    }
+
+    fd = open(node->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_debug("unable to open '%s' to read signatures: %s", node->path,
+                g_strerror(errno));
+        return;
+    }
+
+    if (!read_luks_header(node, fd) && !read_lvm_label(node, fd)) {
+        read_md_superblock(node, fd, size);
+    }
+
+    close(fd);
+}
+
+static void read_each(GPtrArray *nodes, GArray *sizes,
+                      __attribute((unused)) gpointer user_data) {
+    for (guint i = 0; i < nodes->len; i++) {
+        installer_topology_read_signatures(g_ptr_array_index(nodes, i),
+                                           g_array_index(sizes, guint64, i), NULL);
+    }
+}
+
+static guint64 get_size(InstallerTopology *self, InstallerTopologyNode *node) {
+    const gchar *dir = g_hash_table_lookup(self->sysfs_dirs, node->name);
+    g_autofree gchar *size_str = read_sysfs_attr(dir, "size");
+
+    return size_str ? g_ascii_strtoull(size_str, NULL, 10) * 512 : 0;
+}
+
+static InstallerTopologyKind kind_for_name(const gchar *name) {
+    if (g_str_has_prefix(name, "dm-")) {
+        return INSTALLER_TOPOLOGY_KIND_DM;
+    } else if (g_str_has_prefix(name, "md")) {
+        return INSTALLER_TOPOLOGY_KIND_MD;
+    }
+
+    return INSTALLER_TOPOLOGY_KIND_DISK;
+}
+
+/**
+ * add_partitions:
+ * @self: The topology
+ * @disk: The node of the disk
+ * @disk_dir: The sysfs directory of @disk
+ *
+ * Adds a node for every partition of @disk, and remembers that @disk
+ * has a partition table if it has any.
+ */
+static void add_partitions(InstallerTopology *self, InstallerTopologyNode *disk,
+                           const gchar *disk_dir) {
+    g_autoptr(GDir) dir = g_dir_open(disk_dir, 0, NULL);
+    const gchar *child = NULL;
+
+    if (!dir) {
+        return;
+    }
+
+    while ((child = g_dir_read_name(dir)) != NULL) {
+        g_autofree gchar *part_dir = g_build_filename(disk_dir, child, NULL);
+        g_autofree gchar *part_file = g_build_filename(part_dir, "partition", NULL);
+
+        if (g_file_test(part_file, G_FILE_TEST_EXISTS)) {
+            add_node(self, child, part_dir, INSTALLER_TOPOLOGY_KIND_PARTITION);
+            g_hash_table_add(self->partitioned, disk->name);
+        }
+    }
+}
+
+InstallerTopology *installer_topology_new(GError **err) {
+    return installer_topology_new_full(read_each, NULL, err);
+}
+
+InstallerTopology *installer_topology_new_full(InstallerTopologySignatureFunc func,
+                                               gpointer user_data, GError **err) {
+    g_autoptr(InstallerTopology) self = g_object_new(INSTALLER_TYPE_TOPOLOGY, NULL);
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GPtrArray) leaves = g_ptr_array_new();
+    g_autoptr(GArray) sizes = g_array_new(FALSE, FALSE, sizeof(guint64));
+    const gchar *child = NULL;
+    GHashTableIter iter;
+    InstallerTopologyNode *node = NULL;
+
+    dir = g_dir_open(SYSFS_BLOCK_DIR, 0, err);
+    if (!dir) {
+        return NULL;
+    }
+
+    while ((child = g_dir_read_name(dir)) != NULL) {
+        g_autofree gchar *disk_dir = g_build_filename(SYSFS_BLOCK_DIR, child, NULL);
+        node = add_node(self, child, disk_dir, kind_for_name(child));
+        add_partitions(self, node, disk_dir);
+    }
+
+    // Wire up the edges once every node exists
+    g_hash_table_iter_init(&iter, self->nodes);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &node)) {
+        link_dir_entries(self, node, "holders");
+        link_dir_entries(self, node, "slaves");
+    }
+
+    // Only devices at the bottom of a stack can carry a member signature.
+    // Disks with a partition table are left alone.
+    g_hash_table_iter_init(&iter, self->nodes);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &node)) {
+        if (node->slaves->len > 0 || g_hash_table_contains(self->partitioned, node->name)) {
+            continue;
+        }
+
+        if (node->kind == INSTALLER_TOPOLOGY_KIND_PARTITION ||
+            (node->kind == INSTALLER_TOPOLOGY_KIND_DISK && !g_str_has_prefix(node->name, "loop") &&
+             !g_str_has_prefix(node->name, "sr") && !g_str_has_prefix(node->name, "zram"))) {
+            guint64 size = get_size(self, node);
+            if (size > 0) {
+                g_ptr_array_add(leaves, node);
+                g_array_append_val(sizes, size);
+            }
+        }
+    }
+
+    // Read all at once, so a reader going through the helper needs one
+    // round trip
+    func(leaves, sizes, user_data);
+
+    return g_steal_pointer(&self);
+}
+
+InstallerTopologyNode *installer_topology_lookup(InstallerTopology *self,
+                                                 const gchar *device) {
+    GHashTableIter iter;
+    InstallerTopologyNode *node = NULL;
+
+    g_return_val_if_fail(INSTALLER_IS_TOPOLOGY(self), NULL);
+    g_return_val_if_fail(device != NULL, NULL);
+
+    if (device[0] != G_DIR_SEPARATOR) {
+        return g_hash_table_lookup(self->nodes, device);
+    }
+
+    // Symlinks such as /dev/mapper/* and /dev/md/* point at the kernel name
+    g_autofree gchar *real = realpath(device, NULL);
+    if (real) {
+        g_autofree gchar *name = g_path_get_basename(real);
+        node = g_hash_table_lookup(self->nodes, name);
+        if (node) {
+            return node;
+        }
+    }
+
+    g_hash_table_iter_init(&iter, self->nodes);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &node)) {
+        if (g_strcmp0(node->path, device) == 0) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static void collect_tops(InstallerTopologyNode *node, GPtrArray *tops,
+                         GHashTable *visited) {
+    if (!g_hash_table_add(visited, node)) {
+        return;
+    }
+
+    if (node->holders->len == 0) {
+        g_ptr_array_add(tops, node);
+        return;
+    }
+
+    for (guint i = 0; i < node->holders->len; i++) {
+        collect_tops(g_ptr_array_index(node->holders, i), tops, visited);
+    }
+}
+
+GPtrArray *installer_topology_get_tops(InstallerTopology *self,
+                                       InstallerTopologyNode *node) {
+    g_autoptr(GHashTable) visited = NULL;
+    GPtrArray *tops = NULL;
+
+    g_return_val_if_fail(INSTALLER_IS_TOPOLOGY(self), NULL);
+    g_return_val_if_fail(node != NULL, NULL);
+
+    visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+    tops = g_ptr_array_new();
+    collect_tops(node, tops, visited);
+
+    return tops;
+}
+
+gboolean installer_topology_is_stack_member(InstallerTopologyNode *node) {
+    g_return_val_if_fail(node != NULL, FALSE);
+
+    return node->holders->len > 0 || node->member != INSTALLER_TOPOLOGY_MEMBER_NONE;
+}
+
+static gchar *join_names(GPtrArray *nodes) {
+    g_autoptr(GString) names = g_string_new(NULL);
+
+    for (guint i = 0; i < nodes->len; i++) {
+        InstallerTopologyNode *node = g_ptr_array_index(nodes, i);
+        g_autofree gchar *name = g_path_get_basename(node->path);
+
+        if (i > 0) {
+            g_string_append(names, ", ");
+        }
+        g_string_append(names, name);
+    }
+
+    return g_strdup(names->str);
+}
+
+gchar *installer_topology_describe(InstallerTopology *self,
+                                   InstallerTopologyNode *node) {
+    g_return_val_if_fail(INSTALLER_IS_TOPOLOGY(self), NULL);
+    g_return_val_if_fail(node != NULL, NULL);
+
+    if (node->holders->len > 0) {
+        g_autoptr(GPtrArray) tops = installer_topology_get_tops(self, node);
+        g_autofree gchar *names = join_names(tops);
+
+        switch (node->member) {
+            case INSTALLER_TOPOLOGY_MEMBER_LVM_PV:
+                if (node->member_of) {
+                    return g_strdup_printf("LVM2 physical volume of volume group '%s', holding %s",
+                                           node->member_of, names);
+                }
+                return g_strdup_printf("LVM2 physical volume holding %s", names);
+
+            case INSTALLER_TOPOLOGY_MEMBER_MD:
+                return g_strdup_printf("RAID member of %s", names);
+
+            case INSTALLER_TOPOLOGY_MEMBER_LUKS:
+                return g_strdup_printf("Unlocked LUKS container holding %s", names);
+
+            case INSTALLER_TOPOLOGY_MEMBER_NONE:
+            default:
+                return g_strdup_printf("In use by %s", names);
+        }
+    }
+
+    switch (node->member) {
+        case INSTALLER_TOPOLOGY_MEMBER_LVM_PV:
+            if (node->member_of && node->member_children->len > 0) {
+                g_autoptr(GString) lvs = g_string_new(NULL);
+                for (guint i = 0; i < node->member_children->len; i++) {
+                    if (i > 0) {
+                        g_string_append(lvs, ", ");
+                    }
+                    g_string_append(lvs, g_ptr_array_index(node->member_children, i));
+                }
+                return g_strdup_printf("LVM2 physical volume of inactive volume group '%s' (%s)",
+                                       node->member_of, lvs->str);
+            } else if (node->member_of) {
+                return g_strdup_printf("LVM2 physical volume of inactive volume group '%s'",
+                                       node->member_of);
+            }
+            return g_strdup("LVM2 physical volume");
+
+        case INSTALLER_TOPOLOGY_MEMBER_MD:
+            if (node->member_of && *node->member_of != '\0') {
+                return g_strdup_printf("Member of inactive RAID array '%s'", node->member_of);
+            }
+            return g_strdup("Member of inactive RAID array");
+
+        case INSTALLER_TOPOLOGY_MEMBER_LUKS:
+            return g_strdup("Locked LUKS container");
+
+        case INSTALLER_TOPOLOGY_MEMBER_NONE:
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,200 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_TOPOLOGY_H
+#define INSTALLER_TOPOLOGY_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * InstallerTopologyKind:
+ * @INSTALLER_TOPOLOGY_KIND_DISK: A whole disk
+ * @INSTALLER_TOPOLOGY_KIND_PARTITION: A partition on a disk
+ * @INSTALLER_TOPOLOGY_KIND_MD: A software RAID array
+ * @INSTALLER_TOPOLOGY_KIND_LVM: A device-mapper LVM2 logical volume
+ * @INSTALLER_TOPOLOGY_KIND_CRYPT: An opened device-mapper crypt (LUKS) device
+ * @INSTALLER_TOPOLOGY_KIND_DM: Any other device-mapper device
+ *
+ * The kind of block device a topology node represents.
+ */
+typedef enum {
+    INSTALLER_TOPOLOGY_KIND_DISK,
+    INSTALLER_TOPOLOGY_KIND_PARTITION,
+    INSTALLER_TOPOLOGY_KIND_MD,
+    INSTALLER_TOPOLOGY_KIND_LVM,
+    INSTALLER_TOPOLOGY_KIND_CRYPT,
+    INSTALLER_TOPOLOGY_KIND_DM
+} InstallerTopologyKind;
+
+/**
+ * InstallerTopologyMember:
+ * @INSTALLER_TOPOLOGY_MEMBER_NONE: No stacking signature was found
+ * @INSTALLER_TOPOLOGY_MEMBER_LVM_PV: The device is an LVM2 physical volume
+ * @INSTALLER_TOPOLOGY_MEMBER_MD: The device is a software RAID member
+ * @INSTALLER_TOPOLOGY_MEMBER_LUKS: The device is a LUKS container
+ *
+ * The on-disk signature of a device that is part of a stack, whether or
+ * not the stack is currently active.
+ */
+typedef enum {
+    INSTALLER_TOPOLOGY_MEMBER_NONE,
+    INSTALLER_TOPOLOGY_MEMBER_LVM_PV,
+    INSTALLER_TOPOLOGY_MEMBER_MD,
+    INSTALLER_TOPOLOGY_MEMBER_LUKS
+} InstallerTopologyMember;
+
+/**
+ * InstallerTopologyNode:
+ * @name: The kernel name of the device, e.g. `sda2` or `dm-0`
+ * @path: The path to the device node, e.g. `/dev/mapper/vg0-root`
+ * @kind: The kind of device this is
+ * @holders: (element-type InstallerTopologyNode): Devices built on top of this one
+ * @slaves: (element-type InstallerTopologyNode): Devices this one is built from
+ * @member: The stacking signature found on the device
+ * @member_of: The volume group or array name from the on-disk metadata, if any
+ * @member_children: (element-type utf8): Logical volume names from the
+ *                   on-disk LVM2 metadata, if any
+ *
+ * A single block device in the topology graph. Nodes are owned by
+ * their #InstallerTopology.
+ */
+typedef struct _InstallerTopologyNode {
+    gchar *name;
+    gchar *path;
+    InstallerTopologyKind kind;
+
+    GPtrArray *holders;
+    GPtrArray *slaves;
+
+    InstallerTopologyMember member;
+    gchar *member_of;
+    GPtrArray *member_children;
+} InstallerTopologyNode;
+
+/**
+ * InstallerTopologySignatureFunc:
+ * @nodes: (element-type InstallerTopologyNode): The devices at the
+ *     bottom of a stack, possibly none
+ * @sizes: (element-type guint64): The size of each of @nodes in bytes
+ * @user_data: The data passed to installer_topology_new_full()
+ *
+ * Reads the stacking signatures of @nodes and fills in their @member,
+ * @member_of and @member_children. It is called exactly once per
+ * topology, with every node, so the reads can be batched.
+ */
+typedef void (*InstallerTopologySignatureFunc)(GPtrArray *nodes, GArray *sizes,
+                                               gpointer user_data);
+
+#define INSTALLER_TYPE_TOPOLOGY (installer_topology_get_type())
+
+G_DECLARE_FINAL_TYPE(InstallerTopology, installer_topology, INSTALLER, TOPOLOGY, GObject)
+
+/**
+ * installer_topology_new:
+ * @err: (out): Place to store an error (if any)
+ *
+ * Builds a graph of every block device on the system from the
+ * `holders` and `slaves` links in sysfs. Leaf devices are additionally
+ * checked for LVM2, md and LUKS signatures, reading the LVM2 metadata
+ * text and md superblocks directly so that inactive stacks are
+ * understood without activating them.
+ *
+ * Returns: (transfer full): The new #InstallerTopology, or %NULL in
+ *          case of error (@err is set)
+ */
+InstallerTopology *installer_topology_new(GError **err);
+
+/**
+ * installer_topology_new_full:
+ * @func: (scope call): Reads the signatures of the leaf devices
+ * @user_data: Data to pass to @func
+ * @err: (out): Place to store an error (if any)
+ *
+ * Like installer_topology_new(), but leaves reading the devices
+ * themselves to @func. Opening a device takes privileges the sysfs walk
+ * does not, so an unprivileged process can have the root helper do it.
+ *
+ * Returns: (transfer full): The new #InstallerTopology, or %NULL in
+ *          case of error (@err is set)
+ */
+InstallerTopology *installer_topology_new_full(InstallerTopologySignatureFunc func,
+                                               gpointer user_data, GError **err);
+
+/**
+ * installer_topology_read_signatures:
+ * @node: The device to read
+ * @size: The size of @node in bytes
+ * @user_data: Unused
+ *
+ * Reads the LUKS, LVM2 and md signatures of @node directly, as
+ * installer_topology_new() does for every leaf device.
+ */
+void installer_topology_read_signatures(InstallerTopologyNode *node, guint64 size,
+                                        gpointer user_data);
+
+/**
+ * installer_topology_lookup:
+ * @self: The topology to search
+ * @device: A kernel device name or a path to a device node
+ *
+ * Returns: (transfer none) (nullable): The node for @device, or %NULL
+ */
+InstallerTopologyNode *installer_topology_lookup(InstallerTopology *self,
+                                                 const gchar *device);
+
+/**
+ * installer_topology_get_tops:
+ * @self: The topology to search
+ * @node: The node to start from
+ *
+ * Follows holders up from @node to the devices at the top of each
+ * stack, i.e. the ones that can actually hold a filesystem.
+ *
+ * Returns: (transfer container) (element-type InstallerTopologyNode): The
+ *          topmost devices above @node, or just @node if nothing holds it
+ */
+GPtrArray *installer_topology_get_tops(InstallerTopology *self,
+                                       InstallerTopologyNode *node);
+
+/**
+ * installer_topology_is_stack_member:
+ * @node: The node to check
+ *
+ * Returns: %TRUE if @node is held by another device or carries a
+ *          stacking signature, meaning it should not be mounted itself
+ */
+gboolean installer_topology_is_stack_member(InstallerTopologyNode *node);
+
+/**
+ * installer_topology_describe:
+ * @self: The topology @node belongs to
+ * @node: The node to describe
+ *
+ * Formats a description of what sits on top of @node, suitable for
+ * annotating a physical member in a UI.
+ *
+ * Returns: (transfer full) (nullable): The description, or %NULL if
+ *          @node is not part of a stack
+ */
+gchar *installer_topology_describe(InstallerTopology *self,
+                                   InstallerTopologyNode *node);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,113 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "zero.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef gboolean (*IsZeroFunc)(const guint8 *data, gsize len);
+
+static gboolean is_zero_generic(const guint8 *data, gsize len) {
+    gsize i = 0;
+
+    for (; i + sizeof(guint64) <= len; i += sizeof(guint64)) {
+        guint64 word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != 0) {
+            return FALSE;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (data[i] != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+#if defined(__x86_64__)
+
+/* SSE2 is part of x86-64, so this needs no check */
+static gboolean is_zero_sse2(const guint8 *data, gsize len) {
+    const __m128i zero = _mm_setzero_si128();
+    gsize i = 0;
+
+    // Data is usually not zero, so check often enough to bail out early
+    for (; i + 64 <= len; i += 64) {
+        __m128i v = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *) (data + i)),
+                         _mm_loadu_si128((const __m128i *) (data + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *) (data + i + 32)),
+                         _mm_loadu_si128((const __m128i *) (data + i + 48))));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff) {
+            return FALSE;
+        }
+    }
+
+    return is_zero_generic(data + i, len - i);
+}
+
+__attribute((target("avx2"))) static gboolean is_zero_avx2(const guint8 *data,
+                                                            gsize len) {
+    gsize i = 0;
+
+    for (; i + 128 <= len; i += 128) {
+        __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (data + i)),
+                            _mm256_loadu_si256((const __m256i *) (data + i + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (data + i + 64)),
+                            _mm256_loadu_si256((const __m256i *) (data + i + 96))));
+
+        if (!_mm256_testz_si256(v, v)) {
+            return FALSE;
+        }
+    }
+
+    return is_zero_sse2(data + i, len - i);
+}
+
+#endif
+
+static IsZeroFunc pick_is_zero(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return is_zero_avx2;
+    }
+    return is_zero_sse2;
+#else
+    return is_zero_generic;
+#endif
+}
+
+gboolean installer_is_zero(const guint8 *data, gsize len) {
+    static gsize impl = 0;
+
+    g_return_val_if_fail(data != NULL || len == 0, FALSE);
+
+    if (g_once_init_enter(&impl)) {
+        g_once_init_leave(&impl, (gsize) pick_is_zero());
+    }
+
+    return ((IsZeroFunc) impl)(data, len);
+}
@@ -0,0 +1,39 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_ZERO_H
+#define INSTALLER_ZERO_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * installer_is_zero:
+ * @data: The memory to check
+ * @len: The length of @data
+ *
+ * Checks whether a buffer holds nothing but zero bytes, e.g. to find
+ * blocks of a file that can be left as holes. On x86-64 this uses AVX2
+ * where the CPU has it, and SSE2 otherwise.
+ *
+ * Returns: %TRUE if every byte of @data is zero
+ */
+gboolean installer_is_zero(const guint8 *data, gsize len);
+
+G_END_DECLS
+
+#endif
@@ -15,39 +15,79 @@
 //
 
 #include "lib/installer.h"
+#include "startup.h"
+#include "watchdog.h"
 #include "window.h"
 
+#include <stdlib.h>
+#include <unistd.h>
+
 GtkWindow *main_window;
+InstallerHelper *helper;
 
 static void on_activate(GtkApplication *app) {
     g_assert(GTK_IS_APPLICATION(app));
 
-    g_autoptr(GError) err = NULL;
-    if (!installer_init_blockdev(&err)) {
-        if (err) {
-            g_critical("Error initializing blockdev library: %s", err->message);
-        } else {
-            g_critical("Error initializing blockdev library: unknown error");
-        }
+    installer_startup_mark("activate");
 
+    main_window = gtk_application_get_active_window(app);
+    if (main_window != NULL) {
+        gtk_widget_show_all(GTK_WIDGET(main_window));
         return;
     }
 
-    main_window = gtk_application_get_active_window(app);
-    if (main_window == NULL) {
-        main_window =
-            g_object_new(INSTALLER_TYPE_WINDOW, "application", app, "default-width",
-                         768, "default-height", 500, NULL);
-    }
+    main_window =
+        g_object_new(INSTALLER_TYPE_WINDOW, "application", app, "default-width",
+                     768, "default-height", 500, NULL);
+    installer_window_set_helper(INSTALLER_WINDOW(main_window), helper);
+    installer_startup_mark("window built");
 
     gtk_widget_show_all(GTK_WIDGET(main_window));
+    installer_startup_watch_first_frame(GTK_WIDGET(main_window));
+    installer_watchdog_watch_frames(GTK_WIDGET(main_window));
+
+    // Blockdev and the disk scan come up behind the visible window
+    installer_window_perform_inits(INSTALLER_WINDOW(main_window));
 }
 
 static void on_shutdown(GtkApplication *app) {
     (void) app;
+
+    installer_watchdog_stop();
+    g_clear_object(&helper);
+}
+
+/**
+ * Split off a root helper and drop root in this process for good, so the
+ * GUI never runs privileged. This forks, so it has to happen before
+ * anything starts a thread.
+ */
+static void separate_privileges(void) {
+    g_autoptr(GError) err = NULL;
+    g_autoptr(InstallerPermissions) perms = NULL;
+
+    if (geteuid() != 0) {
+        return;
+    }
+
+    helper = installer_helper_spawn(&err);
+    if (!helper) {
+        g_critical("Error starting the root helper: %s", err->message);
+        exit(EXIT_FAILURE);
+    }
+
+    perms = installer_permissions_new();
+    if (!installer_permissions_drop_permanently(perms)) {
+        g_critical("Unable to drop root privileges");
+        exit(EXIT_FAILURE);
+    }
 }
 
 int main(int argc, char *argv[]) {
+    installer_startup_begin();
+    separate_privileges();
+    installer_watchdog_start();
+
     GtkApplication *app =
         gtk_application_new("us.getsol.Installer", G_APPLICATION_FLAGS_NONE);
 
@@ -0,0 +1,50 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "lib/installer.h"
+
+#include <stdlib.h>
+
+/**
+ * Writes the manifest of a tree, e.g. the root filesystem of a live
+ * image while the ISO is built, for the installer to plan with:
+ *
+ *     solus-installer-manifest /path/to/rootfs /path/to/manifest
+ */
+int main(int argc, char *argv[]) {
+    g_autoptr(InstallerManifest) manifest = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *size = NULL;
+    InstallerManifestTotals totals;
+
+    if (argc != 3) {
+        g_printerr("Usage: %s ROOT OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    manifest = installer_manifest_build(argv[1], NULL, &err);
+    if (!manifest || !installer_manifest_save(manifest, argv[2], &err)) {
+        g_printerr("Error writing the manifest: %s\n", err->message);
+        return EXIT_FAILURE;
+    }
+
+    installer_manifest_get_totals(manifest, &totals);
+    size = g_format_size(totals.bytes);
+    g_print("%" G_GUINT64_FORMAT " entries, %" G_GUINT64_FORMAT " files, %s\n",
+            totals.n_entries, totals.n_files, size);
+
+    return EXIT_SUCCESS;
+}
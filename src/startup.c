@@ -0,0 +1,106 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "startup.h"
+
+#include <stdio.h>
+
+static gint64 startup_begin_time = 0;
+static gint64 first_frame_time = 0;
+static gint64 interactive_time = 0;
+static guint scan_allocations = 0;
+static guint scan_chunks = 0;
+
+static gdouble elapsed_ms(gint64 when) {
+    return (gdouble) (when - startup_begin_time) / 1000.0;
+}
+
+void installer_startup_begin(void) {
+    startup_begin_time = g_get_monotonic_time();
+}
+
+void installer_startup_mark(const gchar *phase) {
+    g_return_if_fail(phase != NULL);
+
+    g_debug("startup: %-24s %8.1f ms", phase, elapsed_ms(g_get_monotonic_time()));
+}
+
+/**
+ * check_complete:
+ *
+ * Reports the startup times once both milestones have been reached, in
+ * whichever order they came.
+ */
+static void check_complete(void) {
+    if (!first_frame_time || !interactive_time) {
+        return;
+    }
+
+    g_message("Time to first frame: %.1f ms, time to interactive: %.1f ms",
+              elapsed_ms(first_frame_time), elapsed_ms(interactive_time));
+
+    if (g_getenv(INSTALLER_STARTUP_BENCHMARK_ENV)) {
+        GApplication *app = g_application_get_default();
+
+        // Machine-readable, for comparing runs
+        printf("time_to_first_frame_ms %.3f\n", elapsed_ms(first_frame_time));
+        printf("time_to_interactive_ms %.3f\n", elapsed_ms(interactive_time));
+        printf("scan_allocations_without_arena %u\n", scan_allocations);
+        printf("scan_allocations_with_arena %u\n", scan_chunks);
+        fflush(stdout);
+
+        if (app) {
+            g_application_quit(app);
+        }
+    }
+}
+
+static void on_after_paint(GdkFrameClock *clock, GtkWidget *window) {
+    g_signal_handlers_disconnect_by_func(clock, on_after_paint, window);
+
+    first_frame_time = g_get_monotonic_time();
+    installer_startup_mark("first frame");
+    check_complete();
+}
+
+void installer_startup_watch_first_frame(GtkWidget *window) {
+    GdkFrameClock *clock = NULL;
+
+    g_return_if_fail(GTK_IS_WIDGET(window));
+
+    clock = gtk_widget_get_frame_clock(window);
+    if (!clock) {
+        g_warning("Window has no frame clock; is it shown?");
+        return;
+    }
+
+    g_signal_connect(clock, "after-paint", G_CALLBACK(on_after_paint), window);
+}
+
+void installer_startup_scan_allocations(guint n_allocations, guint n_chunks) {
+    scan_allocations = n_allocations;
+    scan_chunks = n_chunks;
+}
+
+void installer_startup_interactive(void) {
+    if (interactive_time) {
+        return;
+    }
+
+    interactive_time = g_get_monotonic_time();
+    installer_startup_mark("interactive");
+    check_complete();
+}
@@ -0,0 +1,64 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef INSTALLER_STARTUP_H
+#define INSTALLER_STARTUP_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Environment variable that makes the installer print its startup times
+ * and quit as soon as it is interactive. Used by `meson benchmark`.
+ */
+#define INSTALLER_STARTUP_BENCHMARK_ENV "INSTALLER_STARTUP_BENCHMARK"
+
+/**
+ * Start the startup timeline. Call this first thing in `main()`; every
+ * phase is timed from here.
+ */
+void installer_startup_begin(void);
+
+/**
+ * Log that a startup phase has finished.
+ */
+void installer_startup_mark(const gchar *phase);
+
+/**
+ * Record the first frame once `window` has been painted.
+ *
+ * The window must already be shown.
+ */
+void installer_startup_watch_first_frame(GtkWidget *window);
+
+/**
+ * Record how many allocations the first disk scan made from its arena,
+ * each of which would otherwise have been a separate heap allocation,
+ * and how many chunks it took from the heap to serve them. Call this
+ * before `installer_startup_interactive()`.
+ */
+void installer_startup_scan_allocations(guint n_allocations, guint n_chunks);
+
+/**
+ * Record that the installer is interactive, i.e. the disks have been
+ * scanned and the user can go on.
+ */
+void installer_startup_interactive(void);
+
+G_END_DECLS
+
+#endif
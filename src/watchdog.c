@@ -0,0 +1,382 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "watchdog.h"
+#include "lib/installer.h"
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#define WATCHDOG_DEFAULT_THRESHOLD_MS 16
+#define WATCHDOG_MAX_FRAMES 64
+
+/* Sent to the main thread to make it record its own stack */
+#define WATCHDOG_SIGNAL (SIGRTMIN + 4)
+
+/* Upper bounds of the histogram buckets, in ms; the last one is open */
+static const guint bucket_limits_ms[] = {4, 8, 16, 33, 50, 100, 250, 1000};
+#define N_BUCKETS (G_N_ELEMENTS(bucket_limits_ms) + 1)
+
+typedef struct _Histogram {
+    const gchar *name;
+    guint counts[N_BUCKETS];
+    guint n_samples;
+    gint64 max_us;
+    gint64 total_us;
+} Histogram;
+
+typedef struct _Watchdog {
+    GThread *thread;
+    pthread_t main_thread;
+    gchar *exe;
+    gchar *exe_name;
+    gint running;
+    gint64 threshold_us;
+
+    /* Main loop probe, see loop_probe_funcs */
+    GSource *probe;
+    gint64 dispatch_start;
+    gint busy;
+    guint iteration;
+    guint n_stalls;
+
+    /* Filled in by the signal handler on the main thread */
+    gpointer frames[WATCHDOG_MAX_FRAMES];
+    gint n_frames;
+    gint stack_ready;
+
+    GdkFrameClock *clock;
+    gint64 frame_start;
+
+    Histogram loop;
+    Histogram paint;
+} Watchdog;
+
+static Watchdog *watchdog = NULL;
+
+static void histogram_add(Histogram *histogram, gint64 duration_us) {
+    guint bucket = 0;
+
+    while (bucket < G_N_ELEMENTS(bucket_limits_ms) &&
+           duration_us > (gint64) bucket_limits_ms[bucket] * 1000) {
+        bucket++;
+    }
+
+    histogram->counts[bucket]++;
+    histogram->n_samples++;
+    histogram->total_us += duration_us;
+    histogram->max_us = MAX(histogram->max_us, duration_us);
+}
+
+static void histogram_log(Histogram *histogram) {
+    if (histogram->n_samples == 0) {
+        g_message("watchdog: %s: no samples", histogram->name);
+        return;
+    }
+
+    g_message("watchdog: %s: %u samples, mean %.2f ms, max %.1f ms", histogram->name,
+              histogram->n_samples,
+              (gdouble) histogram->total_us / histogram->n_samples / 1000.0,
+              (gdouble) histogram->max_us / 1000.0);
+
+    for (guint i = 0; i < N_BUCKETS; i++) {
+        if (i < G_N_ELEMENTS(bucket_limits_ms)) {
+            g_message("watchdog: %s: <= %4u ms %8u", histogram->name,
+                      bucket_limits_ms[i], histogram->counts[i]);
+        } else {
+            g_message("watchdog: %s:  > %4u ms %8u", histogram->name,
+                      bucket_limits_ms[i - 1], histogram->counts[i]);
+        }
+    }
+}
+
+static void log_pool_stats(const gchar *name, InstallerExecutorPoolStats *pool) {
+    g_message("watchdog: %s pool: %u threads, %u queued, %u running, "
+              "%" G_GUINT64_FORMAT " completed, %" G_GUINT64_FORMAT " cancelled, "
+              "%" G_GUINT64_FORMAT " stolen, %.1f ms busy",
+              name, pool->n_threads, pool->queued, pool->running, pool->completed,
+              pool->cancelled, pool->stolen, (gdouble) pool->busy_us / 1000.0);
+}
+
+static void log_executor_stats(void) {
+    InstallerExecutorStats stats;
+
+    installer_executor_get_stats(installer_executor_get_default(), &stats);
+    log_pool_stats("cpu", &stats.cpu);
+    log_pool_stats("io", &stats.io);
+}
+
+/*
+ * The probe never dispatches. GLib calls check() right after polling and
+ * prepare() at the start of the next iteration, so the time between the
+ * two is the time spent dispatching the sources that were ready. Its
+ * priority is the highest possible so that it is always prepared and
+ * checked, no matter what else is ready.
+ */
+
+static gboolean loop_probe_prepare(__attribute((unused)) GSource *source,
+                                   gint *timeout) {
+    *timeout = -1;
+
+    if (!g_atomic_int_get(&watchdog->busy)) {
+        return FALSE;
+    }
+
+    gint64 duration = g_get_monotonic_time() - watchdog->dispatch_start;
+    g_atomic_int_set(&watchdog->busy, FALSE);
+
+    histogram_add(&watchdog->loop, duration);
+    if (duration > watchdog->threshold_us) {
+        watchdog->n_stalls++;
+        g_debug("watchdog: main loop iteration took %.1f ms",
+                (gdouble) duration / 1000.0);
+    }
+
+    return FALSE;
+}
+
+static gboolean loop_probe_check(__attribute((unused)) GSource *source) {
+    watchdog->dispatch_start = g_get_monotonic_time();
+    g_atomic_int_inc(&watchdog->iteration);
+    g_atomic_int_set(&watchdog->busy, TRUE);
+
+    return FALSE;
+}
+
+static gboolean loop_probe_dispatch(__attribute((unused)) GSource *source,
+                                    __attribute((unused)) GSourceFunc callback,
+                                    __attribute((unused)) gpointer user_data) {
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs loop_probe_funcs = {
+    .prepare = loop_probe_prepare,
+    .check = loop_probe_check,
+    .dispatch = loop_probe_dispatch,
+};
+
+/**
+ * on_stack_signal:
+ *
+ * Runs on the main thread while it is stalled, so it does nothing but
+ * record the stack. backtrace() has been called once already so that its
+ * unwinder is loaded. GLib calls, even g_main_current_source(), are not
+ * async-signal-safe; the source that stalled is one of the frames.
+ */
+static void on_stack_signal(__attribute((unused)) int sig) {
+    watchdog->n_frames = backtrace(watchdog->frames, WATCHDOG_MAX_FRAMES);
+
+    g_atomic_int_set(&watchdog->stack_ready, TRUE);
+}
+
+/**
+ * append_offset:
+ * @offsets: The offsets found so far
+ * @symbol: A frame from backtrace_symbols()
+ *
+ * Static functions, which includes most callbacks, have no dynamic
+ * symbol even with `export_dynamic`, and show up as `binary(+0x1234)`.
+ * Collects the offsets of those in the installer itself, so the report
+ * can say how to symbolize them with addr2line.
+ */
+static void append_offset(GString *offsets, const gchar *symbol) {
+    const gchar *start = strstr(symbol, "(+0x");
+    g_autofree gchar *module = NULL;
+    g_autofree gchar *module_name = NULL;
+
+    if (!start) {
+        return;
+    }
+
+    module = g_strndup(symbol, start - symbol);
+    module_name = g_path_get_basename(module);
+    if (g_strcmp0(module_name, watchdog->exe_name) != 0) {
+        return;
+    }
+
+    g_string_append_c(offsets, ' ');
+    g_string_append_len(offsets, start + 2, strcspn(start + 2, ")"));
+}
+
+static void report_stall(gint64 stalled_us) {
+    g_auto(GStrv) symbols = NULL;
+    g_autoptr(GString) offsets = g_string_new(NULL);
+    gint64 deadline = g_get_monotonic_time() + 100 * G_TIME_SPAN_MILLISECOND;
+
+    g_atomic_int_set(&watchdog->stack_ready, FALSE);
+    pthread_kill(watchdog->main_thread, WATCHDOG_SIGNAL);
+
+    while (!g_atomic_int_get(&watchdog->stack_ready)) {
+        if (g_get_monotonic_time() > deadline) {
+            g_warning("watchdog: main loop stalled for over %.1f ms; no stack captured",
+                      (gdouble) stalled_us / 1000.0);
+            return;
+        }
+        g_usleep(G_TIME_SPAN_MILLISECOND);
+    }
+
+    g_warning("watchdog: main loop stalled for over %.1f ms in:",
+              (gdouble) stalled_us / 1000.0);
+
+    // Skip the signal handler's own frames
+    symbols = backtrace_symbols(watchdog->frames, watchdog->n_frames);
+    for (gint i = 2; symbols && i < watchdog->n_frames; i++) {
+        g_warning("watchdog:   #%-2d %s", i - 2, symbols[i]);
+        append_offset(offsets, symbols[i]);
+    }
+
+    if (offsets->len > 0 && watchdog->exe) {
+        g_warning("watchdog: symbolize with: addr2line -f -p -e %s%s", watchdog->exe,
+                  offsets->str);
+    }
+}
+
+static gpointer watchdog_thread(__attribute((unused)) gpointer data) {
+    guint last_iteration = 0;
+    gint64 busy_since = 0;
+    gboolean reported = FALSE;
+
+    // Sample a few times per threshold so stalls are caught close to it
+    gulong interval = MAX(watchdog->threshold_us / 4, G_TIME_SPAN_MILLISECOND);
+
+    while (g_atomic_int_get(&watchdog->running)) {
+        guint iteration = g_atomic_int_get(&watchdog->iteration);
+        gint64 now = g_get_monotonic_time();
+
+        if (!g_atomic_int_get(&watchdog->busy) || iteration != last_iteration) {
+            last_iteration = iteration;
+            busy_since = now;
+            reported = FALSE;
+        } else if (!reported && now - busy_since > watchdog->threshold_us) {
+            // Only one report per stall
+            report_stall(now - busy_since);
+            reported = TRUE;
+        }
+
+        g_usleep(interval);
+    }
+
+    return NULL;
+}
+
+void installer_watchdog_start(void) {
+    const gchar *value = g_getenv(INSTALLER_WATCHDOG_ENV);
+    struct sigaction action = {0};
+    gpointer warmup[1];
+    guint64 threshold_ms = 0;
+
+    if (!value || watchdog) {
+        return;
+    }
+
+    threshold_ms = g_ascii_strtoull(value, NULL, 10);
+    if (threshold_ms == 0) {
+        threshold_ms = WATCHDOG_DEFAULT_THRESHOLD_MS;
+    }
+
+    watchdog = g_new0(Watchdog, 1);
+    watchdog->threshold_us = threshold_ms * G_TIME_SPAN_MILLISECOND;
+    watchdog->main_thread = pthread_self();
+    watchdog->exe = g_file_read_link("/proc/self/exe", NULL);
+    watchdog->exe_name = g_path_get_basename(watchdog->exe ? watchdog->exe : "");
+    watchdog->loop.name = "main loop";
+    watchdog->paint.name = "frame";
+
+    // The first call may load libgcc, which is not safe in a signal handler
+    backtrace(warmup, G_N_ELEMENTS(warmup));
+
+    action.sa_handler = on_stack_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(WATCHDOG_SIGNAL, &action, NULL);
+
+    watchdog->probe = g_source_new(&loop_probe_funcs, sizeof(GSource));
+    g_source_set_name(watchdog->probe, "[installer] watchdog probe");
+    g_source_set_priority(watchdog->probe, G_MININT);
+    g_source_attach(watchdog->probe, NULL);
+
+    g_atomic_int_set(&watchdog->running, TRUE);
+    watchdog->thread = g_thread_new("watchdog", watchdog_thread, NULL);
+
+    g_message("watchdog: reporting main loop stalls over %" G_GUINT64_FORMAT " ms",
+              threshold_ms);
+}
+
+static void on_flush_events(__attribute((unused)) GdkFrameClock *clock,
+                            __attribute((unused)) gpointer data) {
+    watchdog->frame_start = g_get_monotonic_time();
+}
+
+static void on_after_paint(__attribute((unused)) GdkFrameClock *clock,
+                           __attribute((unused)) gpointer data) {
+    if (!watchdog->frame_start) {
+        return;
+    }
+
+    histogram_add(&watchdog->paint, g_get_monotonic_time() - watchdog->frame_start);
+    watchdog->frame_start = 0;
+}
+
+void installer_watchdog_watch_frames(GtkWidget *window) {
+    g_return_if_fail(GTK_IS_WIDGET(window));
+
+    if (!watchdog || watchdog->clock) {
+        return;
+    }
+
+    watchdog->clock = gtk_widget_get_frame_clock(window);
+    if (!watchdog->clock) {
+        g_warning("Window has no frame clock; is it shown?");
+        return;
+    }
+
+    g_object_ref(watchdog->clock);
+    g_signal_connect(watchdog->clock, "flush-events", G_CALLBACK(on_flush_events),
+                     NULL);
+    g_signal_connect(watchdog->clock, "after-paint", G_CALLBACK(on_after_paint),
+                     NULL);
+}
+
+void installer_watchdog_stop(void) {
+    if (!watchdog) {
+        return;
+    }
+
+    g_atomic_int_set(&watchdog->running, FALSE);
+    g_thread_join(watchdog->thread);
+
+    g_source_destroy(watchdog->probe);
+    g_source_unref(watchdog->probe);
+
+    if (watchdog->clock) {
+        g_signal_handlers_disconnect_by_func(watchdog->clock, on_flush_events, NULL);
+        g_signal_handlers_disconnect_by_func(watchdog->clock, on_after_paint, NULL);
+        g_object_unref(watchdog->clock);
+    }
+
+    g_message("watchdog: %u main loop stalls over %.0f ms", watchdog->n_stalls,
+              (gdouble) watchdog->threshold_us / 1000.0);
+    histogram_log(&watchdog->loop);
+    histogram_log(&watchdog->paint);
+    log_executor_stats();
+
+    g_free(watchdog->exe);
+    g_free(watchdog->exe_name);
+    g_clear_pointer(&watchdog, g_free);
+}
@@ -0,0 +1,62 @@
+//
+// Copyright © 2022 Solus Project <copyright@getsol.us>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef INSTALLER_WATCHDOG_H
+#define INSTALLER_WATCHDOG_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Environment variable that enables the main loop watchdog. Its value is
+ * the stall threshold in milliseconds; anything that is not a positive
+ * number uses the default of 16 ms, i.e. one frame at 60 Hz.
+ */
+#define INSTALLER_WATCHDOG_ENV "INSTALLER_WATCHDOG"
+
+/**
+ * Start the watchdog if it is enabled in the environment. Must be called
+ * from the thread that runs the main loop, before the loop is started.
+ *
+ * While running, every main loop iteration that takes longer than the
+ * threshold is logged with a stack trace of the main thread, in which
+ * the callback of the stalled source can be found. Exported functions
+ * are named; static ones are followed by an addr2line command line that
+ * names them, e.g.
+ *
+ *     addr2line -f -p -e /usr/bin/us.getsol.Installer 0x1a2b3 0x1a4c5
+ */
+void installer_watchdog_start(void);
+
+/**
+ * Add the frames of `window` to the frame time histogram. Does nothing
+ * if the watchdog is not running.
+ *
+ * The window must already be shown.
+ */
+void installer_watchdog_watch_frames(GtkWidget *window);
+
+/**
+ * Stop the watchdog and log the main loop and frame time histograms of
+ * this session, along with the counters of the library's executor.
+ */
+void installer_watchdog_stop(void);
+
+G_END_DECLS
+
+#endif
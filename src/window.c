@@ -17,6 +17,7 @@
 #include "window.h"
 #include "disk_manager.h"
 #include "install_info.h"
+#include "startup.h"
 
 struct _InstallerWindow {
     GtkApplicationWindow parent_instance;
@@ -37,10 +38,10 @@ struct _InstallerWindow {
     GtkWidget *next_button;
 
     InstallerInfo *info;
-    InstallerPermissions *perms;
+    InstallerHelper *helper;
     DiskManager *disk_manager;
 
-    GSList *pages;
+    GPtrArray *pages;
 
     gboolean final_step;
     gboolean skip_forward;
@@ -60,32 +61,60 @@ static void installer_window_class_init(InstallerWindowClass *klass) {
     class->finalize = installer_window_finalize;
 }
 
-static void parse_device(gchar *device, InstallerWindow *self) {
-    g_autoptr(GError) err = NULL;
-
-    g_autoptr(InstallerDrive) disk = NULL;
-    GList *mount_points = NULL;
+static void log_drive(InstallerDrive *disk) {
+    g_message("Device: %s | Model: %s | Vendor: %s | Path: %s", disk->device,
+              disk->model, disk->vendor, disk->disk->path);
+}
 
-    g_autoptr(GVolumeMonitor) volume_monitor = g_volume_monitor_get();
-    mount_points = g_volume_monitor_get_mounts(volume_monitor);
+static void on_drives_changed(GListModel *drives, guint position,
+                              __attribute((unused)) guint removed, guint added,
+                              __attribute((unused)) InstallerWindow *self) {
+    // Only the drives that were added or parsed again are logged
+    for (guint i = position; i < position + added; i++) {
+        g_autoptr(InstallerDrive) disk = g_list_model_get_item(drives, i);
+        log_drive(disk);
+    }
+}
 
-    disk = disk_manager_parse_system_disk(self->disk_manager, device, device,
-                                          mount_points, &err);
+static void on_rescan_done(GObject *source, GAsyncResult *result,
+                           __attribute((unused)) gpointer user_data) {
+    g_autoptr(GError) err = NULL;
+    g_autoptr(DiskScanSnapshot) snapshot = NULL;
 
-    g_list_free_full(mount_points, g_object_unref);
+    snapshot = disk_manager_rescan_finish(DISK_MANAGER(source), result, &err);
+    if (snapshot) {
+        installer_startup_scan_allocations(snapshot->arena_stats.n_allocations,
+                                           snapshot->arena_stats.n_chunks);
+    }
 
-    if (!disk) {
-        if (err) {
-            g_critical("Error parsing system disk: %s", err->message);
-        } else {
-            g_critical("Unknown problem parsing system disk");
-        }
+    // The user can go on either way; a failed scan just leaves no disks
+    installer_startup_interactive();
 
+    if (!snapshot) {
+        g_critical("Error scanning system disks: %s", err->message);
         return;
     }
 
-    g_message("Device: %s | Model: %s | Vendor: %s | Path: %s", disk->device,
-              disk->model, disk->vendor, disk->disk->path);
+    g_debug("scan %" G_GUINT64_FORMAT " found %u drives", snapshot->generation,
+            snapshot->drives->len);
+}
+
+static void on_device_added(__attribute((unused)) DiskManager *manager,
+                            const gchar *device,
+                            __attribute((unused)) InstallerWindow *self) {
+    g_message("Device added: %s", device);
+}
+
+static void on_device_removed(__attribute((unused)) DiskManager *manager,
+                              const gchar *device,
+                              __attribute((unused)) InstallerWindow *self) {
+    g_message("Device removed: %s", device);
+}
+
+static void on_device_changed(__attribute((unused)) DiskManager *manager,
+                              const gchar *device,
+                              __attribute((unused)) InstallerWindow *self) {
+    g_message("Device changed: %s", device);
 }
 
 static void installer_window_init(InstallerWindow *self) {
@@ -190,29 +219,21 @@ static void installer_window_init(InstallerWindow *self) {
     gtk_container_add(GTK_CONTAINER(self), self->installer_wrap);
 
     // TODO: Add the installer pages
+    self->pages = g_ptr_array_new();
 
     installer_window_buttons_update_sensitivity(self);
 
-    self->perms = installer_permissions_new();
-    self->disk_manager = disk_manager_new();
-    disk_manager_scan_parts(self->disk_manager);
-
     // TODO: Update current page
-
-    // TODO: Start our threads
-
-    GSList *devices = disk_manager_get_devices(self->disk_manager);
-    g_slist_foreach(devices, (GFunc) parse_device, self);
 }
 
 static void installer_window_finalize(GObject *obj) {
     InstallerWindow *self = INSTALLER_WINDOW(obj);
 
     g_object_unref(self->provider);
-    g_object_unref(self->disk_manager);
-    g_object_unref(self->perms);
+    g_clear_object(&self->disk_manager);
+    g_clear_object(&self->helper);
     g_object_unref(self->info);
-    g_slist_free(self->pages);
+    g_ptr_array_unref(self->pages);
 
     G_OBJECT_CLASS(installer_window_parent_class)->finalize(obj);
 }
@@ -231,7 +252,7 @@ void installer_window_setup_style(InstallerWindow *self) {
                                         "/us/getsol/installer/style.css");
 
     // Set our dark theme preference
-    g_autoptr(GtkSettings) settings = gtk_settings_get_default();
+    GtkSettings *settings = gtk_settings_get_default();
     g_object_set(settings, "gtk-application-prefer-dark-theme", FALSE, NULL);
 
     // Set our styles
@@ -289,6 +310,69 @@ void installer_window_set_vanity(InstallerWindow *self) {
     }
 }
 
+static void on_blockdev_ready(__attribute((unused)) GObject *source,
+                              GAsyncResult *result, gpointer user_data) {
+    g_autoptr(InstallerWindow) self = user_data;
+    g_autoptr(GError) err = NULL;
+
+    if (!installer_init_blockdev_finish(result, &err)) {
+        g_critical("Error initializing blockdev library: %s", err->message);
+        gtk_widget_destroy(GTK_WIDGET(self));
+        return;
+    }
+
+    installer_startup_mark("blockdev ready");
+    installer_window_start_threads(self);
+}
+
+void installer_window_set_helper(InstallerWindow *self, InstallerHelper *helper) {
+    g_return_if_fail(INSTALLER_IS_WINDOW(self));
+
+    g_set_object(&self->helper, helper);
+}
+
+void installer_window_perform_inits(InstallerWindow *self) {
+    g_return_if_fail(INSTALLER_IS_WINDOW(self));
+
+    // Loading the blockdev plugins is slow, so it happens off the UI thread
+    // while the window paints its first frame
+    installer_init_blockdev_async(NULL, on_blockdev_ready, g_object_ref(self));
+}
+
+gboolean installer_window_start_threads(InstallerWindow *self) {
+    g_return_val_if_fail(INSTALLER_IS_WINDOW(self), FALSE);
+
+    if (self->disk_manager) {
+        return FALSE;
+    }
+
+    self->disk_manager = disk_manager_new();
+    if (self->helper) {
+        disk_manager_set_helper(self->disk_manager, self->helper);
+    }
+    g_signal_connect(disk_manager_get_drives(self->disk_manager), "items-changed",
+                     G_CALLBACK(on_drives_changed), self);
+
+    // Listing disks, reading their signatures and probing them all touch
+    // devices, so none of it happens on the UI thread
+    disk_manager_rescan_async(self->disk_manager, NULL, on_rescan_done, self);
+
+    // Pick up disks plugged in while the installer is running
+    g_signal_connect(self->disk_manager, "device-added", G_CALLBACK(on_device_added),
+                     self);
+    g_signal_connect(self->disk_manager, "device-removed",
+                     G_CALLBACK(on_device_removed), self);
+    g_signal_connect(self->disk_manager, "device-changed",
+                     G_CALLBACK(on_device_changed), self);
+
+    g_autoptr(GError) monitor_err = NULL;
+    if (!disk_manager_start_monitor(self->disk_manager, &monitor_err)) {
+        g_warning("Unable to monitor devices: %s", monitor_err->message);
+    }
+
+    return TRUE;
+}
+
 void installer_window_buttons_update_sensitivity(InstallerWindow *self) {
     g_return_if_fail(INSTALLER_IS_WINDOW(self));
 
@@ -301,7 +385,7 @@ void installer_window_buttons_update_sensitivity(InstallerWindow *self) {
         prev_sensitive = TRUE;
     }
 
-    if (self->page_index < g_slist_length(self->pages)) {
+    if (self->page_index < self->pages->len) {
         next_sensitive = TRUE;
     } else {
         next_sensitive = FALSE;
@@ -316,6 +400,32 @@ gpointer installer_window_page_next_callback(InstallerWindow *self) {
     return NULL;
 }
 
+static void page_advance(InstallerWindow *self) {
+    self->skip_forward = TRUE;
+    guint index = self->page_index + 1;
+
+    if (index >= self->pages->len) {
+        return;
+    }
+
+    // TODO: Get the page at the new index
+
+    // TODO: Check if the new page is hidden, incrementing the index again if so
+
+    self->page_index = index;
+
+    // TODO: Update the current page
+}
+
+static void on_install_confirmed(GtkDialog *dialog, gint response,
+                                 InstallerWindow *self) {
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+
+    if (response == GTK_RESPONSE_OK) {
+        page_advance(self);
+    }
+}
+
 void installer_window_page_next(InstallerWindow *self) {
     g_return_if_fail(INSTALLER_IS_WINDOW(self));
 
@@ -328,28 +438,16 @@ void installer_window_page_next(InstallerWindow *self) {
             "result in data loss.\nDo you wish to install?";
         GtkWidget *dialog = gtk_message_dialog_new(
             GTK_WINDOW(self), GTK_DIALOG_MODAL, GTK_MESSAGE_WARNING,
-            GTK_BUTTONS_CANCEL, message);
+            GTK_BUTTONS_CANCEL, "%s", message);
+        gtk_dialog_add_button(GTK_DIALOG(dialog), "Install", GTK_RESPONSE_OK);
 
-        gint result = gtk_dialog_run(GTK_DIALOG(dialog));
-        if (result != GTK_RESPONSE_OK) {
-            return;
-        }
-    }
-
-    self->skip_forward = TRUE;
-    guint index = self->page_index + 1;
-
-    if (index >= g_slist_length(self->pages)) {
+        // Not gtk_dialog_run(), which would nest a main loop in this handler
+        g_signal_connect(dialog, "response", G_CALLBACK(on_install_confirmed), self);
+        gtk_widget_show(dialog);
         return;
     }
 
-    // TODO: Get the page at the new index
-
-    // TODO: Check if the new page is hidden, incrementing the index again if so
-
-    self->page_index = index;
-
-    // TODO: Update the current page
+    page_advance(self);
 }
 
 gpointer installer_window_page_prev_callback(InstallerWindow *self) {
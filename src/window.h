@@ -41,8 +41,26 @@ void installer_window_setup_style(InstallerWindow *self);
  */
 void installer_window_set_vanity(InstallerWindow *self);
 
+/**
+ * Set the root helper to do privileged disk operations through.
+ *
+ * Call this before `installer_window_perform_inits()`. Without a helper,
+ * the window expects its own process to be root.
+ */
+void installer_window_set_helper(InstallerWindow *self, InstallerHelper *helper);
+
+/**
+ * Create the disk manager and start scanning and monitoring the disks.
+ *
+ * Blockdev must have been initialized first. Returns FALSE if the threads
+ * were already started.
+ */
 gboolean installer_window_start_threads(InstallerWindow *self);
 
+/**
+ * Initialize everything the window needs that is too slow to do before it
+ * is first shown, then start the disk threads once blockdev is ready.
+ */
 void installer_window_perform_inits(InstallerWindow *self);
 
 /**